@@ -0,0 +1,109 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "coins.h"
+#include "memusage.h"
+#include "random.h"
+
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// Variant of the CCoinsCaching benchmark that exercises the map of coins held
+// by a CCoinsViewCache directly, comparing the flat map used by CCoinsMap with
+// the std::unordered_map it replaced.
+
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher>
+    CCoinsNodeMap;
+
+//! Memory budget the fill benchmarks fill the maps up to, like -dbcache does.
+static const size_t COINS_MAP_BUDGET = 64 << 20;
+//! Number of coins in the maps of the lookup benchmarks.
+static const size_t COINS_MAP_LOOKUP_SIZE = 200000;
+
+static Coin MakeCoin(FastRandomContext &rng) {
+    CTxOut txout;
+    txout.nValue = Amount(int64_t(rng.randrange(21000000)));
+    // Typical P2PKH script, which fits in the coin itself.
+    txout.scriptPubKey.assign(size_t(25), uint8_t(OP_DUP));
+    return Coin(std::move(txout), rng.randrange(500000), false);
+}
+
+template <typename Map>
+static size_t UsageOf(const Map &map, size_t nCoinsUsage) {
+    return memusage::DynamicUsage(map) + nCoinsUsage;
+}
+
+template <typename Map>
+static size_t FillCoinsMap(Map &map, FastRandomContext &rng, size_t nBudget,
+                           std::vector<COutPoint> *pOutpoints = nullptr) {
+    size_t nCoinsUsage = 0;
+    while (UsageOf(map, nCoinsUsage) < nBudget) {
+        COutPoint outpoint(rng.rand256(), rng.randrange(4));
+        Coin coin = MakeCoin(rng);
+        nCoinsUsage += coin.DynamicMemoryUsage();
+        CCoinsCacheEntry &entry = map[outpoint];
+        entry.coin = std::move(coin);
+        entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+        if (pOutpoints) {
+            pOutpoints->push_back(outpoint);
+        }
+    }
+    return map.size();
+}
+
+// Fill a map up to the memory budget, as a CCoinsViewCache does during IBD,
+// and report how many coins fit in a GiB.
+template <typename Map>
+static void CoinsMapFill(benchmark::State &state, const char *name) {
+    size_t nCoins = 0;
+    while (state.KeepRunning()) {
+        FastRandomContext rng(true);
+        Map map;
+        nCoins = FillCoinsMap(map, rng, COINS_MAP_BUDGET);
+    }
+    std::cout << "# " << name << ": "
+              << nCoins * ((1 << 30) / COINS_MAP_BUDGET) << " coins per GiB"
+              << std::endl;
+}
+
+// Look up coins that are in the map half of the time.
+template <typename Map> static void CoinsMapLookup(benchmark::State &state) {
+    FastRandomContext rng(true);
+    Map map;
+    std::vector<COutPoint> outpoints;
+    while (map.size() < COINS_MAP_LOOKUP_SIZE) {
+        FillCoinsMap(map, rng, UsageOf(map, 0) + (1 << 20), &outpoints);
+    }
+    for (size_t i = 0, n = outpoints.size(); i < n; i++) {
+        outpoints.emplace_back(rng.rand256(), 0);
+    }
+
+    size_t nFound = 0;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            nFound += map.count(outpoints[rng.randrange(outpoints.size())]);
+        }
+    }
+    assert(nFound > 0);
+}
+
+static void CoinsMapFillFlat(benchmark::State &state) {
+    CoinsMapFill<CCoinsMap>(state, "CoinsMapFillFlat");
+}
+static void CoinsMapFillNode(benchmark::State &state) {
+    CoinsMapFill<CCoinsNodeMap>(state, "CoinsMapFillNode");
+}
+static void CoinsMapLookupFlat(benchmark::State &state) {
+    CoinsMapLookup<CCoinsMap>(state);
+}
+static void CoinsMapLookupNode(benchmark::State &state) {
+    CoinsMapLookup<CCoinsNodeMap>(state);
+}
+
+BENCHMARK(CoinsMapFillFlat);
+BENCHMARK(CoinsMapFillNode);
+BENCHMARK(CoinsMapLookupFlat);
+BENCHMARK(CoinsMapLookupNode);
@@ -4,6 +4,7 @@
 
 #include "checkqueue.h"
 #include "bench.h"
+#include "crypto/sha256.h"
 #include "prevector.h"
 #include "random.h"
 #include "util.h"
@@ -92,3 +93,58 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State &state) {
 }
 BENCHMARK(CCheckQueueSpeed);
 BENCHMARK(CCheckQueueSpeedPrevectorJob);
+
+// This Benchmark measures how each queue engine scales with the number of
+// worker threads. Every check hashes a few bytes, so that there is enough work
+// to spread, but little enough that the cost of handing it out still matters.
+static const size_t SCALING_BATCHES = 1000;
+static void CCheckQueueScaling(benchmark::State &state, CheckQueueEngine engine,
+                               int nThreads) {
+    struct HashJob {
+        unsigned char data[64] = {};
+        bool operator()() {
+            unsigned char hash[CSHA256::OUTPUT_SIZE];
+            CSHA256().Write(data, sizeof(data)).Finalize(hash);
+            return true;
+        }
+        void swap(HashJob &x) { std::swap(data, x.data); };
+    };
+    std::unique_ptr<CCheckQueueBase<HashJob>> queue =
+        MakeCheckQueue<HashJob>(engine, QUEUE_BATCH_SIZE);
+    boost::thread_group tg;
+    // The master thread takes part in the verification as well.
+    for (auto x = 0; x < nThreads - 1; ++x) {
+        tg.create_thread([&] { queue->Thread(); });
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<HashJob> control(queue.get());
+        for (size_t i = 0; i < SCALING_BATCHES; i++) {
+            std::vector<HashJob> vChecks(BATCH_SIZE);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+#define CHECKQUEUE_SCALING_BENCH(engine, name, threads)                        \
+    static void CCheckQueueScaling##name##threads(benchmark::State &state) {  \
+        CCheckQueueScaling(state, CheckQueueEngine::engine, threads);          \
+    }                                                                          \
+    BENCHMARK(CCheckQueueScaling##name##threads);
+
+CHECKQUEUE_SCALING_BENCH(LEGACY, Legacy, 1)
+CHECKQUEUE_SCALING_BENCH(LEGACY, Legacy, 2)
+CHECKQUEUE_SCALING_BENCH(LEGACY, Legacy, 4)
+CHECKQUEUE_SCALING_BENCH(LEGACY, Legacy, 8)
+CHECKQUEUE_SCALING_BENCH(LEGACY, Legacy, 16)
+CHECKQUEUE_SCALING_BENCH(LEGACY, Legacy, 32)
+CHECKQUEUE_SCALING_BENCH(LEGACY, Legacy, 64)
+CHECKQUEUE_SCALING_BENCH(WORKSTEALING, WorkStealing, 1)
+CHECKQUEUE_SCALING_BENCH(WORKSTEALING, WorkStealing, 2)
+CHECKQUEUE_SCALING_BENCH(WORKSTEALING, WorkStealing, 4)
+CHECKQUEUE_SCALING_BENCH(WORKSTEALING, WorkStealing, 8)
+CHECKQUEUE_SCALING_BENCH(WORKSTEALING, WorkStealing, 16)
+CHECKQUEUE_SCALING_BENCH(WORKSTEALING, WorkStealing, 32)
+CHECKQUEUE_SCALING_BENCH(WORKSTEALING, WorkStealing, 64)
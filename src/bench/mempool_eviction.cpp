@@ -120,4 +120,54 @@ static void MempoolEviction(benchmark::State &state) {
     }
 }
 
+// Accepts transactions into a mempool of 300k entries, as chains of 10
+// transactions, spending the end of some of the chains. This stresses the
+// walks of the mempool graph done for every accepted transaction.
+static void MempoolAcceptLarge(benchmark::State &state) {
+    const int nChains = 30000;
+    const int nChainLength = 10;
+    CTxMemPool pool(CFeeRate(Amount(1000)));
+
+    std::vector<CTransaction> vChainTips;
+    vChainTips.reserve(nChains);
+    for (int i = 0; i < nChains; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1;
+        tx.vout[0].nValue = 10 * COIN;
+        for (int j = 0; j < nChainLength; j++) {
+            if (j > 0) {
+                tx.vin[0].prevout = COutPoint(tx.GetId(), 0);
+                tx.vin[0].scriptSig = CScript();
+            }
+            AddTx(CTransaction(tx), Amount(1000), pool);
+        }
+        vChainTips.emplace_back(tx);
+    }
+
+    std::vector<CTransaction> vSpends;
+    for (int i = 0; i < 1000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(2);
+        tx.vin[0].prevout = COutPoint(vChainTips[i * 29].GetId(), 0);
+        tx.vin[1].prevout = COutPoint(vChainTips[i * 29 + 1].GetId(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1;
+        tx.vout[0].nValue = 10 * COIN;
+        vSpends.emplace_back(tx);
+    }
+
+    while (state.KeepRunning()) {
+        for (const CTransaction &tx : vSpends) {
+            AddTx(tx, Amount(2000), pool);
+        }
+        for (const CTransaction &tx : vSpends) {
+            pool.removeRecursive(tx);
+        }
+    }
+}
+
 BENCHMARK(MempoolEviction);
+BENCHMARK(MempoolAcceptLarge);
@@ -0,0 +1,28 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "consensus/merkle.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <vector>
+
+// About the number of transactions in a 32MB block.
+static void MerkleRoot(benchmark::State &state) {
+    FastRandomContext rng(true);
+    std::vector<uint256> leaves;
+    leaves.resize(100000);
+    for (auto &item : leaves) {
+        item = rng.rand256();
+    }
+    while (state.KeepRunning()) {
+        bool mutation = false;
+        uint256 hash = ComputeMerkleRoot(leaves, &mutation);
+        leaves[mutation] = hash;
+    }
+}
+
+BENCHMARK(MerkleRoot);
@@ -0,0 +1,121 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "util.h"
+#include "validation.h"
+
+std::unique_ptr<CRawBlockCache> g_rawblockcache;
+std::unique_ptr<CBlockFilePool> g_blockfilepool;
+
+RawBlockRef CRawBlockCache::Get(const uint256 &hash) {
+    LOCK(cs);
+    auto it = index.find(hash);
+    if (it == index.end()) {
+        nMisses++;
+        return nullptr;
+    }
+    nHits++;
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->second;
+}
+
+void CRawBlockCache::Add(const uint256 &hash, RawBlockRef block) {
+    if (block->size() > nMaxBytes) {
+        return;
+    }
+
+    LOCK(cs);
+    if (index.count(hash)) {
+        return;
+    }
+    while (nBytes + block->size() > nMaxBytes) {
+        nBytes -= entries.back().second->size();
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+    nBytes += block->size();
+    entries.emplace_front(hash, std::move(block));
+    index.emplace(hash, entries.begin());
+}
+
+void CRawBlockCache::Clear() {
+    LOCK(cs);
+    entries.clear();
+    index.clear();
+    nBytes = 0;
+}
+
+size_t CRawBlockCache::Size() const {
+    LOCK(cs);
+    return entries.size();
+}
+
+size_t CRawBlockCache::Bytes() const {
+    LOCK(cs);
+    return nBytes;
+}
+
+uint64_t CRawBlockCache::Hits() const {
+    LOCK(cs);
+    return nHits;
+}
+
+uint64_t CRawBlockCache::Misses() const {
+    LOCK(cs);
+    return nMisses;
+}
+
+std::shared_ptr<FILE> CBlockFilePool::GetFile(int nFile) {
+    LOCK(cs);
+    for (auto it = files.begin(); it != files.end(); ++it) {
+        if (it->first == nFile) {
+            files.splice(files.begin(), files, it);
+            return it->second;
+        }
+    }
+
+    FILE *file = OpenBlockFile(CDiskBlockPos(nFile, 0), true);
+    if (!file) {
+        return nullptr;
+    }
+    FileAdviseSequential(file);
+    nOpened++;
+
+    // Readers still using an evicted file keep it open until they are done.
+    if (!files.empty() && files.size() >= nMaxFiles) {
+        files.pop_back();
+    }
+    files.emplace_front(nFile, std::shared_ptr<FILE>(file, fclose));
+    return files.front().second;
+}
+
+bool CBlockFilePool::Read(const CDiskBlockPos &pos, void *data,
+                          size_t length) {
+    std::shared_ptr<FILE> file = GetFile(pos.nFile);
+    if (!file || !FileReadAt(file.get(), data, length, pos.nPos)) {
+        return false;
+    }
+    FileReadAhead(file.get(), uint64_t(pos.nPos) + length,
+                  BLOCK_FILE_READAHEAD);
+    return true;
+}
+
+void CBlockFilePool::Close(int nFile) {
+    LOCK(cs);
+    files.remove_if([nFile](const List::value_type &entry) {
+        return entry.first == nFile;
+    });
+}
+
+size_t CBlockFilePool::Size() const {
+    LOCK(cs);
+    return files.size();
+}
+
+uint64_t CBlockFilePool::Opened() const {
+    LOCK(cs);
+    return nOpened;
+}
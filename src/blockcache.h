@@ -0,0 +1,110 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include "chain.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/** Default for -rawblockcache, in MiB */
+static const int64_t DEFAULT_RAW_BLOCK_CACHE_SIZE = 64;
+/** Number of block files CBlockFilePool keeps open */
+static const size_t MAX_OPEN_BLOCK_FILES = 8;
+/** How many bytes past each read the OS is asked to read ahead */
+static const uint64_t BLOCK_FILE_READAHEAD = 4 << 20;
+
+typedef std::shared_ptr<const std::vector<uint8_t>> RawBlockRef;
+
+/**
+ * A least recently used cache of serialized blocks, keyed by block hash, so
+ * that the blocks many peers ask for are read from disk once. A block is
+ * stored on disk as it is sent over the network, so the entries can be sent
+ * as they are.
+ */
+class CRawBlockCache {
+private:
+    typedef std::list<std::pair<uint256, RawBlockRef>> List;
+
+    mutable CCriticalSection cs;
+    //! Most recently used first.
+    List entries;
+    std::unordered_map<uint256, List::iterator, BlockHasher> index;
+    size_t nMaxBytes;
+    size_t nBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+public:
+    explicit CRawBlockCache(size_t nMaxBytesIn)
+        : nMaxBytes(nMaxBytesIn), nBytes(0), nHits(0), nMisses(0) {}
+
+    /** Get the block with this hash, or nullptr if it is not cached. */
+    RawBlockRef Get(const uint256 &hash);
+
+    /**
+     * Add a block, evicting the least recently used ones to make room. Blocks
+     * larger than the whole cache are not added.
+     */
+    void Add(const uint256 &hash, RawBlockRef block);
+
+    void Clear();
+
+    size_t Size() const;
+    size_t Bytes() const;
+    size_t MaxBytes() const { return nMaxBytes; }
+    uint64_t Hits() const;
+    uint64_t Misses() const;
+};
+
+/**
+ * A pool of block files opened for reading, so that reading a block does not
+ * open, seek and close a file. The files are read at an offset, so threads
+ * share them without locking, and the least recently used one is closed when
+ * another has to be opened.
+ *
+ * Peers syncing from us ask for blocks in the order they are in the files, so
+ * the OS is told the files are read sequentially and to read ahead past every
+ * read.
+ */
+class CBlockFilePool {
+private:
+    typedef std::list<std::pair<int, std::shared_ptr<FILE>>> List;
+
+    mutable CCriticalSection cs;
+    //! Most recently used first.
+    List files;
+    size_t nMaxFiles;
+    uint64_t nOpened;
+
+    std::shared_ptr<FILE> GetFile(int nFile);
+
+public:
+    explicit CBlockFilePool(size_t nMaxFilesIn)
+        : nMaxFiles(nMaxFilesIn), nOpened(0) {}
+
+    /** Read length bytes at pos of its block file into data. */
+    bool Read(const CDiskBlockPos &pos, void *data, size_t length);
+
+    /** Close a block file, which must be done before it is deleted. */
+    void Close(int nFile);
+
+    size_t Size() const;
+    uint64_t Opened() const;
+};
+
+/** The cache ReadRawBlockFromDisk and ReadBlockFromDisk go through, if set. */
+extern std::unique_ptr<CRawBlockCache> g_rawblockcache;
+/** The files blocks are read from, if set. */
+extern std::unique_ptr<CBlockFilePool> g_blockfilepool;
+
+#endif // BITCOIN_BLOCKCACHE_H
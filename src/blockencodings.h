@@ -232,6 +232,10 @@ public:
     InitData(const CBlockHeaderAndShortTxIDs &cmpctblock,
              const std::vector<std::pair<uint256, CTransactionRef>> &extra_txn);
     bool IsTxAvailable(size_t index) const;
+    //! The transactions of the block, null for the ones still missing.
+    const std::vector<CTransactionRef> &GetAvailableTransactions() const {
+        return txns_available;
+    }
     ReadStatus FillBlock(CBlock &block,
                          const std::vector<CTransactionRef> &vtx_missing);
 };
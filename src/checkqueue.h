@@ -6,6 +6,10 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -14,6 +18,35 @@
 
 template <typename T> class CCheckQueueControl;
 
+/** The available implementations of the verification queue. */
+enum class CheckQueueEngine {
+    //! Single shared stack protected by one mutex.
+    LEGACY,
+    //! Per-worker deques with work stealing.
+    WORKSTEALING,
+};
+
+/**
+ * Interface shared by the verification queue engines, so that callers (and
+ * CCheckQueueControl) do not need to know which one is in use.
+ */
+template <typename T> class CCheckQueueBase {
+public:
+    virtual ~CCheckQueueBase() {}
+
+    //! Worker thread
+    virtual void Thread() = 0;
+
+    //! Wait until execution finishes, and return whether all evaluations were
+    //! successful.
+    virtual bool Wait() = 0;
+
+    //! Add a batch of checks to the queue
+    virtual void Add(std::vector<T> &vChecks) = 0;
+
+    virtual bool IsIdle() = 0;
+};
+
 /**
  * Queue for verifications that have to be performed.
  * The verifications are represented by a type T, which must provide an
@@ -24,7 +57,7 @@ template <typename T> class CCheckQueueControl;
  * done adding work, it temporarily joins the worker pool as an N'th worker,
  * until all jobs are done.
  */
-template <typename T> class CCheckQueue {
+template <typename T> class CCheckQueue : public CCheckQueueBase<T> {
 private:
     //! Mutex to protect the inner state
     boost::mutex mutex;
@@ -134,15 +167,11 @@ public:
         : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false),
           nBatchSize(nBatchSizeIn) {}
 
-    //! Worker thread
-    void Thread() { Loop(); }
+    void Thread() override { Loop(); }
 
-    //! Wait until execution finishes, and return whether all evaluations were
-    //! successful.
-    bool Wait() { return Loop(true); }
+    bool Wait() override { return Loop(true); }
 
-    //! Add a batch of checks to the queue
-    void Add(std::vector<T> &vChecks) {
+    void Add(std::vector<T> &vChecks) override {
         boost::unique_lock<boost::mutex> lock(mutex);
         for (T &check : vChecks) {
             queue.push_back(std::move(check));
@@ -157,23 +186,285 @@ public:
 
     ~CCheckQueue() {}
 
-    bool IsIdle() {
+    bool IsIdle() override {
         boost::unique_lock<boost::mutex> lock(mutex);
         return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
     }
 };
 
+/**
+ * Work-stealing queue for verifications that have to be performed.
+ *
+ * Same contract as CCheckQueue, but instead of funneling every worker through
+ * a single mutex, each worker owns a deque of checks. The master spreads the
+ * checks it adds over the deques of the registered workers (and its own), and
+ * a worker that runs out of local work steals half of another worker's deque.
+ * Each deque has its own short-lived lock, which is only ever contended by its
+ * owner and a thief; the global mutex is only taken to sleep and to wake up.
+ *
+ * Batches taken from the local deque shrink as the deque drains and as more
+ * workers go idle, so that all workers finish approximately simultaneously.
+ */
+template <typename T>
+class CWorkStealingCheckQueue : public CCheckQueueBase<T> {
+private:
+    struct WorkerDeque {
+        boost::mutex mutex;
+        std::deque<T> checks;
+        //! Number of threads using this deque as their own.
+        int nUsers = 0;
+    };
+
+    //! Slot 0 belongs to the master, the others to the worker threads.
+    std::vector<std::unique_ptr<WorkerDeque>> vDeques;
+
+    //! Protects sleeping/waking up and worker registration.
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Master thread blocks on this when waiting for the workers to finish
+    boost::condition_variable condMaster;
+
+    //! Slots that have at least one registered user, guarded by mutex.
+    std::vector<size_t> vActiveSlots;
+
+    //! Number of checks sitting in the deques. This can transiently be
+    //! negative as it is only updated after the checks are pushed.
+    std::atomic<int> nQueued;
+
+    //! Number of checks that haven't completed yet, including the ones
+    //! currently being processed.
+    std::atomic<int> nTodo;
+
+    //! Number of worker threads waiting for work.
+    std::atomic<int> nIdle;
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
+
+    //! The maximum number of elements to be processed in one batch
+    const unsigned int nBatchSize;
+
+    //! Slot at which the next call to Add starts distributing checks.
+    size_t nNextSlot;
+
+    size_t RegisterWorker() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        // Pick the least used worker slot. Threads only share a deque when
+        // there are more threads than slots.
+        size_t nSlot = 1;
+        for (size_t i = 2; i < vDeques.size(); i++) {
+            if (vDeques[i]->nUsers < vDeques[nSlot]->nUsers) {
+                nSlot = i;
+            }
+        }
+        if (vDeques[nSlot]->nUsers++ == 0) {
+            vActiveSlots.push_back(nSlot);
+        }
+        return nSlot;
+    }
+
+    void UnregisterWorker(size_t nSlot) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (--vDeques[nSlot]->nUsers == 0) {
+            vActiveSlots.erase(
+                std::find(vActiveSlots.begin(), vActiveSlots.end(), nSlot));
+        }
+    }
+
+    /**
+     * Fill vChecks with work: first from our own deque, otherwise by stealing
+     * from somebody else's. Returns false if no work could be found.
+     */
+    bool TakeWork(size_t nSlot, std::vector<T> &vChecks) {
+        {
+            WorkerDeque &own = *vDeques[nSlot];
+            boost::unique_lock<boost::mutex> lock(own.mutex);
+            if (!own.checks.empty()) {
+                size_t nNow = std::max<size_t>(
+                    1, std::min<size_t>(nBatchSize, own.checks.size() /
+                                                        (nIdle.load() + 2)));
+                for (size_t i = 0; i < nNow; i++) {
+                    vChecks.push_back(std::move(own.checks.back()));
+                    own.checks.pop_back();
+                }
+            }
+        }
+
+        for (size_t i = 1; vChecks.empty() && i < vDeques.size(); i++) {
+            WorkerDeque &victim = *vDeques[(nSlot + i) % vDeques.size()];
+            boost::unique_lock<boost::mutex> lock(victim.mutex);
+            // Steal half of the victim's work, from the opposite end it is
+            // working on.
+            size_t nNow = std::min<size_t>(nBatchSize,
+                                           (victim.checks.size() + 1) / 2);
+            for (size_t j = 0; j < nNow; j++) {
+                vChecks.push_back(std::move(victim.checks.front()));
+                victim.checks.pop_front();
+            }
+        }
+
+        if (vChecks.empty()) {
+            return false;
+        }
+
+        nQueued -= vChecks.size();
+        return true;
+    }
+
+    /** Run a batch of checks and account for their completion. */
+    void RunChecks(std::vector<T> &vChecks) {
+        bool fOk = fAllOk;
+        for (T &check : vChecks) {
+            if (fOk) fOk = check();
+        }
+        if (!fOk) fAllOk = false;
+
+        const int nRemaining = nTodo -= vChecks.size();
+        vChecks.clear();
+        if (nRemaining == 0) {
+            // We processed the last element; inform the master it can exit
+            // and return the result
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
+
+public:
+    //! Create a new check queue, with room for nMaxWorkers worker threads.
+    CWorkStealingCheckQueue(unsigned int nBatchSizeIn,
+                            unsigned int nMaxWorkers = 64)
+        : nQueued(0), nTodo(0), nIdle(0), fAllOk(true),
+          nBatchSize(nBatchSizeIn), nNextSlot(0) {
+        for (unsigned int i = 0; i < nMaxWorkers + 1; i++) {
+            vDeques.emplace_back(new WorkerDeque());
+        }
+    }
+
+    void Thread() override {
+        const size_t nSlot = RegisterWorker();
+        // Threads are stopped by interruption, make sure we leave our slot.
+        struct Unregister {
+            CWorkStealingCheckQueue &queue;
+            size_t nSlot;
+            ~Unregister() { queue.UnregisterWorker(nSlot); }
+        } unregister{*this, nSlot};
+
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (true) {
+            if (TakeWork(nSlot, vChecks)) {
+                RunChecks(vChecks);
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (nQueued <= 0) {
+                nIdle++;
+                try {
+                    condWorker.wait(lock);
+                } catch (...) {
+                    nIdle--;
+                    throw;
+                }
+                nIdle--;
+            }
+        }
+    }
+
+    bool Wait() override {
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        while (true) {
+            if (TakeWork(0, vChecks)) {
+                RunChecks(vChecks);
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            // Nothing left to take, wait for the workers to finish what they
+            // are doing.
+            while (nQueued <= 0 && nTodo != 0) {
+                condMaster.wait(lock);
+            }
+            if (nTodo == 0) {
+                // reset the status for new work later
+                return fAllOk.exchange(true);
+            }
+        }
+    }
+
+    void Add(std::vector<T> &vChecks) override {
+        if (vChecks.empty()) {
+            return;
+        }
+
+        std::vector<size_t> vSlots(1, 0);
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            vSlots.insert(vSlots.end(), vActiveSlots.begin(),
+                          vActiveSlots.end());
+        }
+
+        // Spread the checks in contiguous chunks over the deques, starting at
+        // a different deque each time so single checks get distributed too.
+        nTodo += vChecks.size();
+        const size_t nChunks = std::min(vSlots.size(), vChecks.size());
+        size_t nPos = 0;
+        for (size_t i = 0; i < nChunks; i++) {
+            const size_t nEnd = vChecks.size() * (i + 1) / nChunks;
+            WorkerDeque &dest =
+                *vDeques[vSlots[(nNextSlot + i) % vSlots.size()]];
+            boost::unique_lock<boost::mutex> lock(dest.mutex);
+            for (; nPos < nEnd; nPos++) {
+                dest.checks.push_back(std::move(vChecks[nPos]));
+            }
+        }
+        nNextSlot = (nNextSlot + nChunks) % vSlots.size();
+        nQueued += vChecks.size();
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (vChecks.size() == 1) {
+            condWorker.notify_one();
+        } else {
+            condWorker.notify_all();
+        }
+    }
+
+    bool IsIdle() override {
+        return nTodo == 0 && nQueued == 0 && fAllOk;
+    }
+};
+
+/** Create a verification queue using the given engine. */
+template <typename T>
+std::unique_ptr<CCheckQueueBase<T>> MakeCheckQueue(CheckQueueEngine engine,
+                                                   unsigned int nBatchSize) {
+    switch (engine) {
+        case CheckQueueEngine::LEGACY:
+            return std::unique_ptr<CCheckQueueBase<T>>(
+                new CCheckQueue<T>(nBatchSize));
+        case CheckQueueEngine::WORKSTEALING:
+            return std::unique_ptr<CCheckQueueBase<T>>(
+                new CWorkStealingCheckQueue<T>(nBatchSize));
+    }
+    assert(false);
+    return nullptr;
+}
+
 /**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
 template <typename T> class CCheckQueueControl {
 private:
-    CCheckQueue<T> *pqueue;
+    CCheckQueueBase<T> *pqueue;
     bool fDone;
 
 public:
-    CCheckQueueControl(CCheckQueue<T> *pqueueIn)
+    CCheckQueueControl(CCheckQueueBase<T> *pqueueIn)
         : pqueue(pqueueIn), fDone(false) {
         // passed queue is supposed to be unused, or nullptr
         if (pqueue != nullptr) {
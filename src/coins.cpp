@@ -16,6 +16,15 @@ bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const {
 bool CCoinsView::HaveCoin(const COutPoint &outpoint) const {
     return false;
 }
+void CCoinsView::GetCoins(const std::vector<COutPoint> &vOutpoints,
+                          std::vector<Coin> &vCoins) const {
+    vCoins.assign(vOutpoints.size(), Coin());
+    for (size_t i = 0; i < vOutpoints.size(); i++) {
+        if (!GetCoin(vOutpoints[i], vCoins[i])) {
+            vCoins[i].Clear();
+        }
+    }
+}
 uint256 CCoinsView::GetBestBlock() const {
     return uint256();
 }
@@ -36,6 +45,10 @@ bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const {
 bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const {
     return base->HaveCoin(outpoint);
 }
+void CCoinsViewBacked::GetCoins(const std::vector<COutPoint> &vOutpoints,
+                                std::vector<Coin> &vCoins) const {
+    base->GetCoins(vOutpoints, vCoins);
+}
 uint256 CCoinsViewBacked::GetBestBlock() const {
     return base->GetBestBlock();
 }
@@ -49,6 +62,9 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
                                   const uint256 &hashBlock) {
     return base->BatchWrite(mapCoins, hashBlock);
 }
+bool CCoinsViewBacked::WaitForWrites() {
+    return base->WaitForWrites();
+}
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const {
     return base->Cursor();
 }
@@ -100,6 +116,55 @@ bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     return true;
 }
 
+void CCoinsViewCache::PrefetchCoins(
+    const std::vector<COutPoint> &vOutpoints) const {
+    std::vector<COutPoint> vMissing;
+    for (const COutPoint &outpoint : vOutpoints) {
+        if (cacheCoins.find(outpoint) == cacheCoins.end()) {
+            vMissing.push_back(outpoint);
+        }
+    }
+    if (vMissing.empty()) {
+        return;
+    }
+
+    std::vector<Coin> vCoins;
+    base->GetCoins(vMissing, vCoins);
+    AddFetchedCoins(vMissing, vCoins);
+}
+
+void CCoinsViewCache::AddFetchedCoins(const std::vector<COutPoint> &vOutpoints,
+                                      std::vector<Coin> &vCoins) const {
+    assert(vOutpoints.size() == vCoins.size());
+    for (size_t i = 0; i < vOutpoints.size(); i++) {
+        // Spent coins are not cached, a later FetchCoin will decide whether
+        // they need to be.
+        if (vCoins[i].IsSpent()) {
+            continue;
+        }
+        CCoinsMap::iterator it;
+        bool inserted;
+        std::tie(it, inserted) = cacheCoins.emplace(
+            std::piecewise_construct, std::forward_as_tuple(vOutpoints[i]),
+            std::forward_as_tuple(std::move(vCoins[i])));
+        if (inserted) {
+            cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+        }
+    }
+}
+
+void CCoinsViewCache::GetCoins(const std::vector<COutPoint> &vOutpoints,
+                               std::vector<Coin> &vCoins) const {
+    PrefetchCoins(vOutpoints);
+    vCoins.assign(vOutpoints.size(), Coin());
+    for (size_t i = 0; i < vOutpoints.size(); i++) {
+        CCoinsMap::const_iterator it = cacheCoins.find(vOutpoints[i]);
+        if (it != cacheCoins.end()) {
+            vCoins[i] = it->second.coin;
+        }
+    }
+}
+
 void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin coin,
                               bool possible_overwrite) {
     assert(!coin.IsSpent());
@@ -8,6 +8,7 @@
 
 #include "compressor.h"
 #include "core_memusage.h"
+#include "flathashmap.h"
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
@@ -72,7 +73,7 @@ public:
 class SaltedOutpointHasher {
 private:
     /** Salt */
-    const uint64_t k0, k1;
+    uint64_t k0, k1;
 
 public:
     SaltedOutpointHasher();
@@ -112,7 +113,12 @@ struct CCoinsCacheEntry {
         : coin(std::move(coinIn)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher>
+/**
+ * Map of the coins held by a CCoinsViewCache. The entries live in an arena
+ * next to a flat hash table, rather than in one heap node each, which makes
+ * them both smaller and faster to look up.
+ */
+typedef flathashmap<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher>
     CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
@@ -145,6 +151,12 @@ public:
     //! This may (but cannot always) return true for spent outputs.
     virtual bool HaveCoin(const COutPoint &outpoint) const;
 
+    //! Retrieve the Coins for several outpoints at once, in the same order.
+    //! Outpoints that are not found are returned as spent coins.
+    //! Implementations may resolve the lookups concurrently.
+    virtual void GetCoins(const std::vector<COutPoint> &vOutpoints,
+                          std::vector<Coin> &vCoins) const;
+
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
@@ -159,6 +171,11 @@ public:
     //! The passed mapCoins can be modified.
     virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
 
+    //! Wait until the modifications passed to BatchWrite are written, for
+    //! views that write them in the background. Returns false if writing them
+    //! failed.
+    virtual bool WaitForWrites() { return true; }
+
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
 
@@ -178,10 +195,13 @@ public:
     CCoinsViewBacked(CCoinsView *viewIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    void GetCoins(const std::vector<COutPoint> &vOutpoints,
+                  std::vector<Coin> &vCoins) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool WaitForWrites() override;
     CCoinsViewCursor *Cursor() const override;
     size_t EstimateSize() const override;
 };
@@ -207,6 +227,8 @@ public:
     // Standard CCoinsView methods
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    void GetCoins(const std::vector<COutPoint> &vOutpoints,
+                  std::vector<Coin> &vCoins) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
@@ -218,6 +240,21 @@ public:
      */
     bool HaveCoinInCache(const COutPoint &outpoint) const;
 
+    /**
+     * Load the given utxos into this cache. All the ones that are not cached
+     * yet are requested from the backing CCoinsView in a single GetCoins
+     * call, which gives it the opportunity to resolve them in parallel.
+     */
+    void PrefetchCoins(const std::vector<COutPoint> &vOutpoints) const;
+
+    /**
+     * Add coins read from the backing CCoinsView outside of this cache, for
+     * the outpoints that are not cached yet. The caller must make sure the
+     * backing view has not changed since they were read.
+     */
+    void AddFetchedCoins(const std::vector<COutPoint> &vOutpoints,
+                         std::vector<Coin> &vCoins) const;
+
     /**
      * Return a reference to a Coin in the cache, or a pruned one if not found.
      * This is more efficient than GetCoin. Modifications to other cache entries
@@ -0,0 +1,373 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinstats.h"
+
+#include "coins.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "txdb.h"
+#include "undo.h"
+#include "util.h"
+#include "validation.h"
+#include "version.h"
+
+#include <secp256k1.h>
+#include <secp256k1_multiset.h>
+
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+namespace {
+
+/** Context for the multiset operations, which need no precomputed tables. */
+class CMultiSetContext {
+public:
+    secp256k1_context *ctx;
+
+    CMultiSetContext()
+        : ctx(secp256k1_context_create(SECP256K1_CONTEXT_NONE)) {}
+    ~CMultiSetContext() { secp256k1_context_destroy(ctx); }
+};
+
+const secp256k1_context *GetMultiSetContext() {
+    static CMultiSetContext context;
+    return context.ctx;
+}
+
+uint64_t GetBogoSize(const CTxOut &txout) {
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ +
+           8 /* amount */ + 2 /* scriptPubKey len */ +
+           txout.scriptPubKey.size() /* scriptPubKey */;
+}
+
+} // namespace
+
+static_assert(sizeof(secp256k1_multiset) == 96,
+              "CCoinsSetHash::data must hold a secp256k1_multiset");
+
+CCoinsSetHash::CCoinsSetHash() {
+    secp256k1_multiset multiset;
+    secp256k1_multiset_init(GetMultiSetContext(), &multiset);
+    memcpy(data, multiset.d, sizeof(data));
+}
+
+void CCoinsSetHash::Update(const COutPoint &outpoint, const Coin &coin,
+                           bool fRemove) {
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << uint32_t(coin.GetHeight() * 2 + coin.IsCoinBase());
+    ss << coin.GetTxOut();
+
+    secp256k1_multiset multiset;
+    memcpy(multiset.d, data, sizeof(data));
+    const uint8_t *pch = reinterpret_cast<const uint8_t *>(ss.data());
+    if (fRemove) {
+        secp256k1_multiset_remove(GetMultiSetContext(), &multiset, pch,
+                                  ss.size());
+    } else {
+        secp256k1_multiset_add(GetMultiSetContext(), &multiset, pch,
+                               ss.size());
+    }
+    memcpy(data, multiset.d, sizeof(data));
+}
+
+void CCoinsSetHash::Combine(const CCoinsSetHash &other) {
+    secp256k1_multiset multiset, multisetOther;
+    memcpy(multiset.d, data, sizeof(data));
+    memcpy(multisetOther.d, other.data, sizeof(data));
+    secp256k1_multiset_combine(GetMultiSetContext(), &multiset,
+                               &multisetOther);
+    memcpy(data, multiset.d, sizeof(data));
+}
+
+uint256 CCoinsSetHash::GetHash() const {
+    secp256k1_multiset multiset;
+    memcpy(multiset.d, data, sizeof(data));
+    uint256 hash;
+    secp256k1_multiset_finalize(GetMultiSetContext(), hash.begin(),
+                                &multiset);
+    return hash;
+}
+
+namespace {
+
+/** What the coins of one range of txids contribute to the statistics. */
+struct CCoinsStatsRange {
+    CCoinsStats stats;
+    //! The part of the serialized hash input covering the range.
+    std::vector<uint8_t> vchSerialized;
+    bool fDone = false;
+    bool fOk = false;
+};
+
+template <typename Stream>
+void ApplyStats(CCoinsStats &stats, Stream &ss, const uint256 &hash,
+                const std::map<uint32_t, Coin> &outputs, bool fSetHash) {
+    assert(!outputs.empty());
+    ss << hash;
+    ss << VARINT(outputs.begin()->second.GetHeight() * 2 +
+                 outputs.begin()->second.IsCoinBase());
+    stats.nTransactions++;
+    for (const auto &output : outputs) {
+        ss << VARINT(output.first + 1);
+        ss << output.second.GetTxOut().scriptPubKey;
+        ss << VARINT(output.second.GetTxOut().nValue.GetSatoshis());
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += output.second.GetTxOut().nValue;
+        stats.nBogoSize += GetBogoSize(output.second.GetTxOut());
+        if (fSetHash) {
+            stats.setHash.Add(COutPoint(hash, output.first), output.second);
+        }
+    }
+    ss << VARINT(0);
+}
+
+bool ReadRange(CCoinsViewCursor &cursor, CCoinsStatsRange &range,
+               bool fSetHash) {
+    CVectorWriter ss(SER_GETHASH, PROTOCOL_VERSION, range.vchSerialized, 0);
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    while (cursor.Valid()) {
+        COutPoint key;
+        Coin coin;
+        if (cursor.GetKey(key) && cursor.GetValue(coin)) {
+            if (!outputs.empty() && key.hash != prevkey) {
+                ApplyStats(range.stats, ss, prevkey, outputs, fSetHash);
+                outputs.clear();
+            }
+            prevkey = key.hash;
+            outputs[key.n] = std::move(coin);
+        } else {
+            return error("%s: unable to read value", __func__);
+        }
+        cursor.Next();
+    }
+    if (!outputs.empty()) {
+        ApplyStats(range.stats, ss, prevkey, outputs, fSetHash);
+    }
+    return true;
+}
+
+//! First txid of range i out of UTXO_STATS_RANGES, null past the last one.
+uint256 GetRangeStart(int i) {
+    uint256 hash;
+    if (i < UTXO_STATS_RANGES) {
+        // Keys are ordered by the bytes of the txid, so the ranges are cut on
+        // its first two bytes.
+        const uint32_t nPrefix = uint32_t(i) * 65536 / UTXO_STATS_RANGES;
+        hash.begin()[0] = nPrefix >> 8;
+        hash.begin()[1] = nPrefix & 0xff;
+    }
+    return hash;
+}
+
+} // namespace
+
+bool GetUTXOStats(CCoinsViewDB *view, CCoinsStats &stats, int nThreads,
+                  bool fSetHash) {
+    nThreads = std::max(1, std::min(nThreads, MAX_UTXO_STATS_THREADS));
+    std::unique_ptr<CDBSnapshot> snapshot;
+    {
+        // Flushes are queued under cs_main, so none can start writing between
+        // waiting for the pending ones and taking the snapshot.
+        LOCK(cs_main);
+        snapshot = view->GetSnapshot();
+        // All the cursors read from the snapshot, so are at the same block.
+        std::unique_ptr<CCoinsViewCursor> pcursor(
+            view->Cursor(*snapshot, uint256(), uint256()));
+        stats.hashBlock = pcursor->GetBestBlock();
+        BlockMap::const_iterator it = mapBlockIndex.find(stats.hashBlock);
+        stats.nHeight = it == mapBlockIndex.end() ? 0 : it->second->nHeight;
+    }
+
+    // The ranges are read in parallel, but must be hashed in order: reading
+    // only runs a bounded number of ranges ahead of hashing, which bounds the
+    // memory used by the serialized data waiting to be hashed.
+    const size_t nWindow = 4 * nThreads;
+    std::vector<CCoinsStatsRange> vRanges(UTXO_STATS_RANGES);
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    size_t nNextRange = 0;
+    size_t nHashedRanges = 0;
+    bool fAbort = false;
+
+    auto readRanges = [&]() {
+        while (true) {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fAbort && nNextRange < vRanges.size() &&
+                       nNextRange >= nHashedRanges + nWindow) {
+                    cond.wait(lock);
+                }
+                if (fAbort || nNextRange == vRanges.size()) {
+                    return;
+                }
+                i = nNextRange++;
+            }
+
+            bool fOk = false;
+            try {
+                std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor(
+                    *snapshot, GetRangeStart(i), GetRangeStart(i + 1)));
+                fOk = ReadRange(*pcursor, vRanges[i], fSetHash);
+            } catch (const std::runtime_error &e) {
+                LogPrintf("%s: %s\n", __func__, e.what());
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                vRanges[i].fDone = true;
+                vRanges[i].fOk = fOk;
+            }
+            cond.notify_all();
+        }
+    };
+
+    boost::thread_group readThreads;
+    for (int i = 0; i < nThreads; i++) {
+        readThreads.create_thread([&readRanges] {
+            RenameThread("bitcoin-utxostats");
+            readRanges();
+        });
+    }
+    auto stopThreads = [&]() {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fAbort = true;
+        }
+        cond.notify_all();
+        readThreads.join_all();
+    };
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << stats.hashBlock;
+    try {
+        for (size_t i = 0; i < vRanges.size(); i++) {
+            CCoinsStatsRange &range = vRanges[i];
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!range.fDone) {
+                    cond.wait(lock);
+                }
+            }
+            if (!range.fOk) {
+                stopThreads();
+                return false;
+            }
+
+            ss.write(reinterpret_cast<const char *>(range.vchSerialized.data()),
+                     range.vchSerialized.size());
+            stats.nTransactions += range.stats.nTransactions;
+            stats.nTransactionOutputs += range.stats.nTransactionOutputs;
+            stats.nBogoSize += range.stats.nBogoSize;
+            stats.nTotalAmount += range.stats.nTotalAmount;
+            if (fSetHash) {
+                stats.setHash.Combine(range.stats.setHash);
+            }
+            std::vector<uint8_t>().swap(range.vchSerialized);
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                nHashedRanges = i + 1;
+            }
+            cond.notify_all();
+        }
+    } catch (const boost::thread_interrupted &) {
+        stopThreads();
+        throw;
+    }
+    stopThreads();
+
+    stats.hashSerialized = ss.GetHash();
+    stats.nDiskSize = view->EstimateSize();
+    return true;
+}
+
+CUTXOSummary::CUTXOSummary(const CCoinsStats &stats)
+    : hashBlock(stats.hashBlock), nHeight(stats.nHeight),
+      nTransactionOutputs(stats.nTransactionOutputs),
+      nBogoSize(stats.nBogoSize), nTotalAmount(stats.nTotalAmount),
+      setHash(stats.setHash) {}
+
+void CUTXOSummary::AddCoin(const COutPoint &outpoint, const Coin &coin) {
+    nTransactionOutputs++;
+    nBogoSize += GetBogoSize(coin.GetTxOut());
+    nTotalAmount += coin.GetTxOut().nValue;
+    setHash.Add(outpoint, coin);
+}
+
+void CUTXOSummary::RemoveCoin(const COutPoint &outpoint, const Coin &coin) {
+    nTransactionOutputs--;
+    nBogoSize -= GetBogoSize(coin.GetTxOut());
+    nTotalAmount -= coin.GetTxOut().nValue;
+    setHash.Remove(outpoint, coin);
+}
+
+bool CUTXOSummary::ConnectBlock(
+    const CBlock &block, const CBlockUndo &blockundo, int nHeightIn,
+    const std::vector<std::pair<COutPoint, Coin>> &vOverwritten) {
+    if (block.hashPrevBlock != hashBlock ||
+        blockundo.vtxundo.size() + 1 != block.vtx.size()) {
+        return false;
+    }
+
+    for (const std::pair<COutPoint, Coin> &overwritten : vOverwritten) {
+        RemoveCoin(overwritten.first, overwritten.second);
+    }
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction &tx = *block.vtx[i];
+        if (i > 0) {
+            const CTxUndo &txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                RemoveCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+            }
+        }
+        const uint256 txid = tx.GetId();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                AddCoin(COutPoint(txid, o),
+                        Coin(tx.vout[o], nHeightIn, i == 0));
+            }
+        }
+    }
+
+    hashBlock = block.GetHash();
+    nHeight = nHeightIn;
+    return true;
+}
+
+bool CUTXOSummary::DisconnectBlock(const CBlock &block,
+                                   const CBlockUndo &blockundo) {
+    if (block.GetHash() != hashBlock ||
+        blockundo.vtxundo.size() + 1 != block.vtx.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction &tx = *block.vtx[i];
+        const uint256 txid = tx.GetId();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                RemoveCoin(COutPoint(txid, o),
+                           Coin(tx.vout[o], nHeight, i == 0));
+            }
+        }
+        if (i > 0) {
+            const CTxUndo &txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                AddCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+            }
+        }
+    }
+
+    hashBlock = block.hashPrevBlock;
+    nHeight--;
+    return true;
+}
@@ -0,0 +1,141 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include "amount.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+class CCoinsViewDB;
+class COutPoint;
+class Coin;
+
+//! Maximum number of threads walking the UTXO set for statistics
+static const int MAX_UTXO_STATS_THREADS = 16;
+//! Number of ranges of txids the UTXO set is split into for statistics
+static const int UTXO_STATS_RANGES = 4096;
+//! -utxosummary default
+static const bool DEFAULT_UTXO_SUMMARY = false;
+
+/**
+ * Hash of a set of coins that can be updated as coins are added and removed,
+ * in any order. It is an elliptic curve multiset hash, so the hashes of
+ * disjoint sets can also be combined into the hash of their union.
+ */
+class CCoinsSetHash {
+private:
+    //! The multiset, as a secp256k1_multiset.
+    uint8_t data[96];
+
+    void Update(const COutPoint &outpoint, const Coin &coin, bool fRemove);
+
+public:
+    //! Hash of the empty set.
+    CCoinsSetHash();
+
+    void Add(const COutPoint &outpoint, const Coin &coin) {
+        Update(outpoint, coin, false);
+    }
+    void Remove(const COutPoint &outpoint, const Coin &coin) {
+        Update(outpoint, coin, true);
+    }
+    void Combine(const CCoinsSetHash &other);
+
+    uint256 GetHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(FLATDATA(data));
+    }
+};
+
+struct CCoinsStats {
+    int nHeight;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    uint256 hashSerialized;
+    uint64_t nDiskSize;
+    Amount nTotalAmount;
+    //! Only computed on request, see GetUTXOStats.
+    CCoinsSetHash setHash;
+
+    CCoinsStats()
+        : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0),
+          nDiskSize(0), nTotalAmount(0) {}
+};
+
+/**
+ * Calculate statistics about the unspent transaction output set. The coins are
+ * split into ranges of txids that are read by nThreads threads in parallel,
+ * while the calling thread hashes them in order. The set hash is only
+ * computed if fSetHash is set, as it costs more than everything else.
+ */
+bool GetUTXOStats(CCoinsViewDB *view, CCoinsStats &stats, int nThreads,
+                  bool fSetHash = false);
+
+/**
+ * Statistics of the UTXO set kept up to date as blocks are connected and
+ * disconnected (-utxosummary), so that they are known for the tip without
+ * walking the whole set.
+ */
+class CUTXOSummary {
+public:
+    //! Block the summary is up to date with, null for the empty set.
+    uint256 hashBlock;
+    int nHeight;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    Amount nTotalAmount;
+    CCoinsSetHash setHash;
+
+    CUTXOSummary()
+        : nHeight(0), nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+    explicit CUTXOSummary(const CCoinsStats &stats);
+
+    /**
+     * Account for the connection of block at nHeight, blockundo holding the
+     * coins it spent, and vOverwritten the unspent coins its coinbase replaced
+     * (only possible for the blocks exempted from BIP30). Returns false,
+     * leaving the summary untouched, if the block does not build on hashBlock.
+     */
+    bool ConnectBlock(
+        const CBlock &block, const CBlockUndo &blockundo, int nHeightIn,
+        const std::vector<std::pair<COutPoint, Coin>> &vOverwritten = {});
+    /**
+     * Account for the disconnection of block, blockundo holding the coins it
+     * spent. Returns false, leaving the summary untouched, if the block is not
+     * hashBlock.
+     */
+    bool DisconnectBlock(const CBlock &block, const CBlockUndo &blockundo);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBogoSize);
+        READWRITE(nTotalAmount);
+        READWRITE(setHash);
+    }
+
+private:
+    void AddCoin(const COutPoint &outpoint, const Coin &coin);
+    void RemoveCoin(const COutPoint &outpoint, const Coin &coin);
+};
+
+#endif // BITCOIN_COINSTATS_H
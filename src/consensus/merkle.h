@@ -12,7 +12,7 @@
 #include "primitives/transaction.h"
 #include "uint256.h"
 
-uint256 ComputeMerkleRoot(const std::vector<uint256> &leaves,
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes,
                           bool *mutated = nullptr);
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256> &leaves,
                                          uint32_t position);
@@ -18,6 +18,21 @@ void Transform(uint32_t *s, const unsigned char *chunk, size_t blocks);
 #endif
 #endif
 
+#if defined(ENABLE_SHANI)
+namespace sha256_shani {
+void Transform(uint32_t *s, const unsigned char *chunk, size_t blocks);
+}
+namespace sha256d64_shani {
+void Transform_2way(unsigned char *out, const unsigned char *in);
+}
+#endif
+
+#if defined(ENABLE_AVX2)
+namespace sha256d64_avx2 {
+void Transform_8way(unsigned char *out, const unsigned char *in);
+}
+#endif
+
 // Internal implementation code.
 namespace {
 /// Internal SHA-256 implementation.
@@ -216,6 +231,31 @@ namespace sha256 {
 } // namespace sha256
 
 typedef void (*TransformType)(uint32_t *, const unsigned char *, size_t);
+typedef void (*TransformD64Type)(unsigned char *, const unsigned char *);
+
+/** Double-SHA256 of a 64-byte input, using the single block transform tr. */
+template <TransformType tr>
+void TransformD64Wrapper(unsigned char *out, const unsigned char *in) {
+    // The padding of the 64-byte input is a block on its own, the hash of
+    // the first round and its padding is the second block.
+    unsigned char padding1[64] = {0x80};
+    padding1[62] = 2;
+    unsigned char buffer2[64] = {0};
+    buffer2[32] = 0x80;
+    buffer2[62] = 1;
+    uint32_t s[8];
+    sha256::Initialize(s);
+    tr(s, in, 1);
+    tr(s, padding1, 1);
+    for (int i = 0; i < 8; i++) {
+        WriteBE32(buffer2 + 4 * i, s[i]);
+    }
+    sha256::Initialize(s);
+    tr(s, buffer2, 1);
+    for (int i = 0; i < 8; i++) {
+        WriteBE32(out + 4 * i, s[i]);
+    }
+}
 
 bool SelfTest(TransformType tr) {
     static const unsigned char in1[65] = {0, 0x80};
@@ -253,21 +293,87 @@ bool SelfTest(TransformType tr) {
 }
 
 TransformType Transform = sha256::Transform;
+TransformD64Type TransformD64 = TransformD64Wrapper<sha256::Transform>;
+TransformD64Type TransformD64_2way = nullptr;
+TransformD64Type TransformD64_8way = nullptr;
+
+/** Check the double-SHA256 of 8 64-byte inputs against the single transform. */
+bool SelfTestD64() {
+    unsigned char in[8 * 64], expected[8 * 32], out[8 * 32];
+    for (int i = 0; i < 8 * 64; i++) {
+        in[i] = i * 7 + 1;
+    }
+    for (int i = 0; i < 8; i++) {
+        TransformD64Wrapper<sha256::Transform>(expected + 32 * i, in + 64 * i);
+    }
+    for (int i = 0; i < 8; i++) {
+        TransformD64(out + 32 * i, in + 64 * i);
+    }
+    if (memcmp(out, expected, sizeof(out))) return false;
+    if (TransformD64_2way) {
+        for (int i = 0; i < 8; i += 2) {
+            TransformD64_2way(out + 32 * i, in + 64 * i);
+        }
+        if (memcmp(out, expected, sizeof(out))) return false;
+    }
+    if (TransformD64_8way) {
+        TransformD64_8way(out, in);
+        if (memcmp(out, expected, sizeof(out))) return false;
+    }
+    return true;
+}
+
+#if defined(USE_ASM) &&                                                        \
+    (defined(__x86_64__) || defined(__amd64__)) && defined(ENABLE_AVX2)
+/** Whether the OS saves the AVX registers on context switches. */
+bool AVXEnabled() {
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
 
 } // namespace
 
 std::string SHA256AutoDetect() {
+    std::string ret = "standard";
 #if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
     uint32_t eax, ebx, ecx, edx;
     if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx >> 19) & 1) {
+        // The extended features, among which AVX2 and SHA-NI.
+        uint32_t eax7 = 0, ebx7 = 0, ecx7 = 0, edx7 = 0;
+        if (__get_cpuid_max(0, nullptr) >= 7) {
+            __cpuid_count(7, 0, eax7, ebx7, ecx7, edx7);
+        }
+
         Transform = sha256_sse4::Transform;
-        assert(SelfTest(Transform));
-        return "sse4";
+        TransformD64 = TransformD64Wrapper<sha256_sse4::Transform>;
+        ret = "sse4(1way)";
+#if defined(ENABLE_AVX2)
+        // The CPU must have AVX and OSXSAVE, and the OS save the AVX
+        // registers.
+        if ((ecx >> 27) & (ecx >> 28) & 1 && (ebx7 >> 5) & 1 &&
+            AVXEnabled()) {
+            TransformD64_8way = sha256d64_avx2::Transform_8way;
+            ret += ",avx2(8way)";
+        }
+#endif
+#if defined(ENABLE_SHANI)
+        // Two ways with SHA-NI are faster than eight ways with AVX2.
+        if ((ebx7 >> 29) & 1) {
+            Transform = sha256_shani::Transform;
+            TransformD64 = TransformD64Wrapper<sha256_shani::Transform>;
+            TransformD64_2way = sha256d64_shani::Transform_2way;
+            TransformD64_8way = nullptr;
+            ret = "shani(1way,2way)";
+        }
+#endif
     }
 #endif
 
     assert(SelfTest(Transform));
-    return "standard";
+    assert(SelfTestD64());
+    return ret;
 }
 
 ////// SHA-256
@@ -322,3 +428,28 @@ CSHA256 &CSHA256::Reset() {
     sha256::Initialize(s);
     return *this;
 }
+
+void SHA256D64(unsigned char *out, const unsigned char *in, size_t blocks) {
+    if (TransformD64_8way) {
+        while (blocks >= 8) {
+            TransformD64_8way(out, in);
+            out += 256;
+            in += 512;
+            blocks -= 8;
+        }
+    }
+    if (TransformD64_2way) {
+        while (blocks >= 2) {
+            TransformD64_2way(out, in);
+            out += 64;
+            in += 128;
+            blocks -= 2;
+        }
+    }
+    while (blocks) {
+        TransformD64(out, in);
+        out += 32;
+        in += 64;
+        --blocks;
+    }
+}
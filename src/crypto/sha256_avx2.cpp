@@ -0,0 +1,193 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_AVX2
+
+#include <cstdint>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+const uint32_t INIT[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul,
+                          0xa54ff53aul, 0x510e527ful, 0x9b05688cul,
+                          0x1f83d9abul, 0x5be0cd19ul};
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Each lane of a __m256i holds the same word for one of 8 independent
+// messages.
+ALWAYS_INLINE __m256i Set(uint32_t x) {
+    return _mm256_set1_epi32(x);
+}
+ALWAYS_INLINE __m256i Add(__m256i x, __m256i y) {
+    return _mm256_add_epi32(x, y);
+}
+ALWAYS_INLINE __m256i Add(__m256i x, __m256i y, __m256i z) {
+    return Add(Add(x, y), z);
+}
+ALWAYS_INLINE __m256i Add(__m256i x, __m256i y, __m256i z, __m256i w) {
+    return Add(Add(x, y), Add(z, w));
+}
+ALWAYS_INLINE __m256i Xor(__m256i x, __m256i y) {
+    return _mm256_xor_si256(x, y);
+}
+ALWAYS_INLINE __m256i Xor(__m256i x, __m256i y, __m256i z) {
+    return Xor(Xor(x, y), z);
+}
+ALWAYS_INLINE __m256i Or(__m256i x, __m256i y) {
+    return _mm256_or_si256(x, y);
+}
+ALWAYS_INLINE __m256i And(__m256i x, __m256i y) {
+    return _mm256_and_si256(x, y);
+}
+ALWAYS_INLINE __m256i ShR(__m256i x, int n) {
+    return _mm256_srli_epi32(x, n);
+}
+ALWAYS_INLINE __m256i ShL(__m256i x, int n) {
+    return _mm256_slli_epi32(x, n);
+}
+
+ALWAYS_INLINE __m256i Ch(__m256i x, __m256i y, __m256i z) {
+    return Xor(z, And(x, Xor(y, z)));
+}
+ALWAYS_INLINE __m256i Maj(__m256i x, __m256i y, __m256i z) {
+    return Or(And(x, y), And(z, Or(x, y)));
+}
+ALWAYS_INLINE __m256i Sigma0(__m256i x) {
+    return Xor(Or(ShR(x, 2), ShL(x, 30)), Or(ShR(x, 13), ShL(x, 19)),
+               Or(ShR(x, 22), ShL(x, 10)));
+}
+ALWAYS_INLINE __m256i Sigma1(__m256i x) {
+    return Xor(Or(ShR(x, 6), ShL(x, 26)), Or(ShR(x, 11), ShL(x, 21)),
+               Or(ShR(x, 25), ShL(x, 7)));
+}
+ALWAYS_INLINE __m256i sigma0(__m256i x) {
+    return Xor(Or(ShR(x, 7), ShL(x, 25)), Or(ShR(x, 18), ShL(x, 14)),
+               ShR(x, 3));
+}
+ALWAYS_INLINE __m256i sigma1(__m256i x) {
+    return Xor(Or(ShR(x, 17), ShL(x, 15)), Or(ShR(x, 19), ShL(x, 13)),
+               ShR(x, 10));
+}
+
+/** One round of SHA-256. */
+ALWAYS_INLINE void Round(__m256i a, __m256i b, __m256i c, __m256i &d,
+                         __m256i e, __m256i f, __m256i g, __m256i &h,
+                         uint32_t k, __m256i w) {
+    __m256i t1 = Add(Add(h, Sigma1(e)), Add(Ch(e, f, g), Set(k), w));
+    __m256i t2 = Add(Sigma0(a), Maj(a, b, c));
+    d = Add(d, t1);
+    h = Add(t1, t2);
+}
+
+/** Message word i, expanding the schedule kept in the 16 entries of w. */
+ALWAYS_INLINE __m256i Word(__m256i *w, int i) {
+    if (i >= 16) {
+        w[i & 15] = Add(w[i & 15], sigma1(w[(i - 2) & 15]), w[(i - 7) & 15],
+                        sigma0(w[(i - 15) & 15]));
+    }
+    return w[i & 15];
+}
+
+/** Process one 64-byte chunk of each message. The message words are lost. */
+ALWAYS_INLINE void Compress(__m256i *s, __m256i *w) {
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5],
+            g = s[6], h = s[7];
+    for (int i = 0; i < 64; i += 8) {
+        Round(a, b, c, d, e, f, g, h, K[i + 0], Word(w, i + 0));
+        Round(h, a, b, c, d, e, f, g, K[i + 1], Word(w, i + 1));
+        Round(g, h, a, b, c, d, e, f, K[i + 2], Word(w, i + 2));
+        Round(f, g, h, a, b, c, d, e, K[i + 3], Word(w, i + 3));
+        Round(e, f, g, h, a, b, c, d, K[i + 4], Word(w, i + 4));
+        Round(d, e, f, g, h, a, b, c, K[i + 5], Word(w, i + 5));
+        Round(c, d, e, f, g, h, a, b, K[i + 6], Word(w, i + 6));
+        Round(b, c, d, e, f, g, h, a, K[i + 7], Word(w, i + 7));
+    }
+    s[0] = Add(s[0], a);
+    s[1] = Add(s[1], b);
+    s[2] = Add(s[2], c);
+    s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e);
+    s[5] = Add(s[5], f);
+    s[6] = Add(s[6], g);
+    s[7] = Add(s[7], h);
+}
+
+ALWAYS_INLINE void Initialize(__m256i *s) {
+    for (int i = 0; i < 8; i++) {
+        s[i] = Set(INIT[i]);
+    }
+}
+
+/** Big endian word at offset of each of the 8 consecutive 64-byte inputs. */
+ALWAYS_INLINE __m256i Read8(const unsigned char *in, int offset) {
+    return _mm256_set_epi32(
+        ReadBE32(in + 448 + offset), ReadBE32(in + 384 + offset),
+        ReadBE32(in + 320 + offset), ReadBE32(in + 256 + offset),
+        ReadBE32(in + 192 + offset), ReadBE32(in + 128 + offset),
+        ReadBE32(in + 64 + offset), ReadBE32(in + 0 + offset));
+}
+
+/** Write the word of each lane at offset of 8 consecutive 32-byte outputs. */
+ALWAYS_INLINE void Write8(unsigned char *out, int offset, __m256i v) {
+    WriteBE32(out + 0 + offset, _mm256_extract_epi32(v, 0));
+    WriteBE32(out + 32 + offset, _mm256_extract_epi32(v, 1));
+    WriteBE32(out + 64 + offset, _mm256_extract_epi32(v, 2));
+    WriteBE32(out + 96 + offset, _mm256_extract_epi32(v, 3));
+    WriteBE32(out + 128 + offset, _mm256_extract_epi32(v, 4));
+    WriteBE32(out + 160 + offset, _mm256_extract_epi32(v, 5));
+    WriteBE32(out + 192 + offset, _mm256_extract_epi32(v, 6));
+    WriteBE32(out + 224 + offset, _mm256_extract_epi32(v, 7));
+}
+
+} // namespace
+
+namespace sha256d64_avx2 {
+void Transform_8way(unsigned char *out, const unsigned char *in) {
+    __m256i s[8], w[16];
+
+    // The 64-byte messages, then their padding.
+    Initialize(s);
+    for (int i = 0; i < 16; i++) {
+        w[i] = Read8(in, 4 * i);
+    }
+    Compress(s, w);
+    for (int i = 0; i < 16; i++) {
+        w[i] = Set(i == 0 ? 0x80000000 : i == 15 ? 0x200 : 0);
+    }
+    Compress(s, w);
+
+    // The 32-byte hashes, padded.
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+    }
+    for (int i = 8; i < 16; i++) {
+        w[i] = Set(i == 8 ? 0x80000000 : i == 15 ? 0x100 : 0);
+    }
+    Initialize(s);
+    Compress(s, w);
+
+    for (int i = 0; i < 8; i++) {
+        Write8(out, 4 * i, s[i]);
+    }
+}
+} // namespace sha256d64_avx2
+
+#endif
@@ -0,0 +1,266 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// Based on the SHA extensions sample code by Intel, and on
+// https://github.com/noloader/SHA-Intrinsics/blob/master/sha256-x86.c,
+// placed in the public domain by Jeffrey Walton.
+
+#ifdef ENABLE_SHANI
+
+#include <cstdint>
+#include <cstdlib>
+#include <immintrin.h>
+
+namespace {
+
+alignas(16) const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+alignas(16) const uint32_t INIT[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul,
+                                      0xa54ff53aul, 0x510e527ful, 0x9b05688cul,
+                                      0x1f83d9abul, 0x5be0cd19ul};
+
+/** Swaps the bytes of each 32 bits word. */
+alignas(16) const uint8_t MASK[16] = {0x03, 0x02, 0x01, 0x00, 0x07, 0x06,
+                                      0x05, 0x04, 0x0b, 0x0a, 0x09, 0x08,
+                                      0x0f, 0x0e, 0x0d, 0x0c};
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+/** Four rounds of SHA-256, using the message words m and the constants at i. */
+ALWAYS_INLINE void QuadRound(__m128i &s0, __m128i &s1, __m128i m, int i) {
+    const __m128i msg =
+        _mm_add_epi32(m, _mm_load_si128((const __m128i *)(K + i)));
+    s1 = _mm_sha256rnds2_epu32(s1, s0, msg);
+    s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(msg, 0x0e));
+}
+
+ALWAYS_INLINE void ShiftMessageA(__m128i &m0, __m128i m1) {
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+}
+
+ALWAYS_INLINE void ShiftMessageC(__m128i &m0, __m128i m1, __m128i &m2) {
+    m2 = _mm_sha256msg2_epu32(_mm_add_epi32(m2, _mm_alignr_epi8(m1, m0, 4)),
+                              m1);
+}
+
+ALWAYS_INLINE void ShiftMessageB(__m128i &m0, __m128i m1, __m128i &m2) {
+    ShiftMessageC(m0, m1, m2);
+    ShiftMessageA(m0, m1);
+}
+
+/** Converts the state words s[0..3], s[4..7] to the layout of the rounds. */
+ALWAYS_INLINE void Shuffle(__m128i &s0, __m128i &s1) {
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0xb1);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0x1b);
+    s0 = _mm_alignr_epi8(t1, t2, 0x08);
+    s1 = _mm_blend_epi16(t2, t1, 0xf0);
+}
+
+ALWAYS_INLINE void Unshuffle(__m128i &s0, __m128i &s1) {
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0x1b);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0xb1);
+    s0 = _mm_blend_epi16(t1, t2, 0xf0);
+    s1 = _mm_alignr_epi8(t2, t1, 0x08);
+}
+
+ALWAYS_INLINE __m128i Load(const unsigned char *in) {
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)in),
+                            _mm_load_si128((const __m128i *)MASK));
+}
+
+ALWAYS_INLINE void Save(unsigned char *out, __m128i s) {
+    _mm_storeu_si128((__m128i *)out,
+                     _mm_shuffle_epi8(s, _mm_load_si128((const __m128i *)MASK)));
+}
+
+ALWAYS_INLINE void Initialize(__m128i &s0, __m128i &s1) {
+    s0 = _mm_load_si128((const __m128i *)INIT);
+    s1 = _mm_load_si128((const __m128i *)(INIT + 4));
+    Shuffle(s0, s1);
+}
+
+/**
+ * Process one 64-byte chunk, whose big endian message words are in m0..m3.
+ * The message words are overwritten.
+ */
+ALWAYS_INLINE void Compress(__m128i &s0, __m128i &s1, __m128i m0, __m128i m1,
+                            __m128i m2, __m128i m3) {
+    const __m128i so0 = s0, so1 = s1;
+    QuadRound(s0, s1, m0, 0);
+    QuadRound(s0, s1, m1, 4);
+    ShiftMessageA(m0, m1);
+    QuadRound(s0, s1, m2, 8);
+    ShiftMessageA(m1, m2);
+    QuadRound(s0, s1, m3, 12);
+    ShiftMessageB(m2, m3, m0);
+    QuadRound(s0, s1, m0, 16);
+    ShiftMessageB(m3, m0, m1);
+    QuadRound(s0, s1, m1, 20);
+    ShiftMessageB(m0, m1, m2);
+    QuadRound(s0, s1, m2, 24);
+    ShiftMessageB(m1, m2, m3);
+    QuadRound(s0, s1, m3, 28);
+    ShiftMessageB(m2, m3, m0);
+    QuadRound(s0, s1, m0, 32);
+    ShiftMessageB(m3, m0, m1);
+    QuadRound(s0, s1, m1, 36);
+    ShiftMessageB(m0, m1, m2);
+    QuadRound(s0, s1, m2, 40);
+    ShiftMessageB(m1, m2, m3);
+    QuadRound(s0, s1, m3, 44);
+    ShiftMessageB(m2, m3, m0);
+    QuadRound(s0, s1, m0, 48);
+    ShiftMessageB(m3, m0, m1);
+    QuadRound(s0, s1, m1, 52);
+    ShiftMessageC(m0, m1, m2);
+    QuadRound(s0, s1, m2, 56);
+    ShiftMessageC(m1, m2, m3);
+    QuadRound(s0, s1, m3, 60);
+    s0 = _mm_add_epi32(s0, so0);
+    s1 = _mm_add_epi32(s1, so1);
+}
+
+/**
+ * Same as Compress, on two independent states. The rounds of both are
+ * interleaved so one hides the latency of the other.
+ */
+ALWAYS_INLINE void Compress2(__m128i &s0a, __m128i &s1a, __m128i m0a,
+                             __m128i m1a, __m128i m2a, __m128i m3a,
+                             __m128i &s0b, __m128i &s1b, __m128i m0b,
+                             __m128i m1b, __m128i m2b, __m128i m3b) {
+    const __m128i so0a = s0a, so1a = s1a, so0b = s0b, so1b = s1b;
+    QuadRound(s0a, s1a, m0a, 0);
+    QuadRound(s0b, s1b, m0b, 0);
+    QuadRound(s0a, s1a, m1a, 4);
+    QuadRound(s0b, s1b, m1b, 4);
+    ShiftMessageA(m0a, m1a);
+    ShiftMessageA(m0b, m1b);
+    QuadRound(s0a, s1a, m2a, 8);
+    QuadRound(s0b, s1b, m2b, 8);
+    ShiftMessageA(m1a, m2a);
+    ShiftMessageA(m1b, m2b);
+    QuadRound(s0a, s1a, m3a, 12);
+    QuadRound(s0b, s1b, m3b, 12);
+    ShiftMessageB(m2a, m3a, m0a);
+    ShiftMessageB(m2b, m3b, m0b);
+    QuadRound(s0a, s1a, m0a, 16);
+    QuadRound(s0b, s1b, m0b, 16);
+    ShiftMessageB(m3a, m0a, m1a);
+    ShiftMessageB(m3b, m0b, m1b);
+    QuadRound(s0a, s1a, m1a, 20);
+    QuadRound(s0b, s1b, m1b, 20);
+    ShiftMessageB(m0a, m1a, m2a);
+    ShiftMessageB(m0b, m1b, m2b);
+    QuadRound(s0a, s1a, m2a, 24);
+    QuadRound(s0b, s1b, m2b, 24);
+    ShiftMessageB(m1a, m2a, m3a);
+    ShiftMessageB(m1b, m2b, m3b);
+    QuadRound(s0a, s1a, m3a, 28);
+    QuadRound(s0b, s1b, m3b, 28);
+    ShiftMessageB(m2a, m3a, m0a);
+    ShiftMessageB(m2b, m3b, m0b);
+    QuadRound(s0a, s1a, m0a, 32);
+    QuadRound(s0b, s1b, m0b, 32);
+    ShiftMessageB(m3a, m0a, m1a);
+    ShiftMessageB(m3b, m0b, m1b);
+    QuadRound(s0a, s1a, m1a, 36);
+    QuadRound(s0b, s1b, m1b, 36);
+    ShiftMessageB(m0a, m1a, m2a);
+    ShiftMessageB(m0b, m1b, m2b);
+    QuadRound(s0a, s1a, m2a, 40);
+    QuadRound(s0b, s1b, m2b, 40);
+    ShiftMessageB(m1a, m2a, m3a);
+    ShiftMessageB(m1b, m2b, m3b);
+    QuadRound(s0a, s1a, m3a, 44);
+    QuadRound(s0b, s1b, m3b, 44);
+    ShiftMessageB(m2a, m3a, m0a);
+    ShiftMessageB(m2b, m3b, m0b);
+    QuadRound(s0a, s1a, m0a, 48);
+    QuadRound(s0b, s1b, m0b, 48);
+    ShiftMessageB(m3a, m0a, m1a);
+    ShiftMessageB(m3b, m0b, m1b);
+    QuadRound(s0a, s1a, m1a, 52);
+    QuadRound(s0b, s1b, m1b, 52);
+    ShiftMessageC(m0a, m1a, m2a);
+    ShiftMessageC(m0b, m1b, m2b);
+    QuadRound(s0a, s1a, m2a, 56);
+    QuadRound(s0b, s1b, m2b, 56);
+    ShiftMessageC(m1a, m2a, m3a);
+    ShiftMessageC(m1b, m2b, m3b);
+    QuadRound(s0a, s1a, m3a, 60);
+    QuadRound(s0b, s1b, m3b, 60);
+    s0a = _mm_add_epi32(s0a, so0a);
+    s1a = _mm_add_epi32(s1a, so1a);
+    s0b = _mm_add_epi32(s0b, so0b);
+    s1b = _mm_add_epi32(s1b, so1b);
+}
+
+} // namespace
+
+namespace sha256_shani {
+void Transform(uint32_t *s, const unsigned char *chunk, size_t blocks) {
+    __m128i s0 = _mm_loadu_si128((const __m128i *)s);
+    __m128i s1 = _mm_loadu_si128((const __m128i *)(s + 4));
+    Shuffle(s0, s1);
+    while (blocks--) {
+        Compress(s0, s1, Load(chunk), Load(chunk + 16), Load(chunk + 32),
+                 Load(chunk + 48));
+        chunk += 64;
+    }
+    Unshuffle(s0, s1);
+    _mm_storeu_si128((__m128i *)s, s0);
+    _mm_storeu_si128((__m128i *)(s + 4), s1);
+}
+} // namespace sha256_shani
+
+namespace sha256d64_shani {
+void Transform_2way(unsigned char *out, const unsigned char *in) {
+    // The padding of a 64 bytes message, and of a 32 bytes one. The words of
+    // the second message are the state after the first hash.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i pad64_0 = _mm_set_epi32(0, 0, 0, 0x80000000);
+    const __m128i pad64_3 = _mm_set_epi32(0x200, 0, 0, 0);
+    const __m128i pad32_2 = _mm_set_epi32(0, 0, 0, 0x80000000);
+    const __m128i pad32_3 = _mm_set_epi32(0x100, 0, 0, 0);
+
+    __m128i s0a, s1a, s0b, s1b;
+    Initialize(s0a, s1a);
+    s0b = s0a;
+    s1b = s1a;
+    Compress2(s0a, s1a, Load(in), Load(in + 16), Load(in + 32), Load(in + 48),
+              s0b, s1b, Load(in + 64), Load(in + 80), Load(in + 96),
+              Load(in + 112));
+    Compress2(s0a, s1a, pad64_0, zero, zero, pad64_3, s0b, s1b, pad64_0, zero,
+              zero, pad64_3);
+    Unshuffle(s0a, s1a);
+    Unshuffle(s0b, s1b);
+
+    __m128i t0a, t1a, t0b, t1b;
+    Initialize(t0a, t1a);
+    t0b = t0a;
+    t1b = t1a;
+    Compress2(t0a, t1a, s0a, s1a, pad32_2, pad32_3, t0b, t1b, s0b, s1b,
+              pad32_2, pad32_3);
+    Unshuffle(t0a, t1a);
+    Unshuffle(t0b, t1b);
+    Save(out, t0a);
+    Save(out + 16, t1a);
+    Save(out + 32, t0b);
+    Save(out + 48, t1b);
+}
+} // namespace sha256d64_shani
+
+#endif
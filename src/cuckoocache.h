@@ -118,6 +118,7 @@ public:
  *
  *  Read Operations:
  *      - contains(*, false)
+ *      - get_elements()
  *
  *  Read+Erase Operations:
  *      - contains(*, true)
@@ -455,6 +456,23 @@ public:
         }
         return false;
     }
+
+    /**
+     * get_elements appends every element which has not been garbage collected
+     * to out, those of the older epoch first.
+     *
+     * @param out the vector to append the elements to
+     */
+    void get_elements(std::vector<Element> &out) const {
+        for (bool recent : {false, true}) {
+            for (uint32_t i = 0; i < size; ++i) {
+                if (!collection_flags.bit_is_set(i) &&
+                    epoch_flags[i] == recent) {
+                    out.push_back(table[i]);
+                }
+            }
+        }
+    }
 };
 } // namespace CuckooCache
 
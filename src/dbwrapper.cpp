@@ -189,6 +189,21 @@ bool CDBWrapper::IsEmpty() {
     return !(it->Valid());
 }
 
+CDBSnapshot::CDBSnapshot(const CDBWrapper &parentIn)
+    : parent(parentIn), psnapshot(parentIn.pdb->GetSnapshot()),
+      readoptions(parentIn.readoptions), iteroptions(parentIn.iteroptions) {
+    readoptions.snapshot = psnapshot;
+    iteroptions.snapshot = psnapshot;
+}
+
+CDBSnapshot::~CDBSnapshot() {
+    parent.pdb->ReleaseSnapshot(psnapshot);
+}
+
+CDBIterator *CDBSnapshot::NewIterator() const {
+    return new CDBIterator(parent, parent.pdb->NewIterator(iteroptions));
+}
+
 CDBIterator::~CDBIterator() {
     delete piter;
 }
@@ -173,6 +173,7 @@ public:
 class CDBWrapper {
     friend const std::vector<uint8_t> &
     dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
+    friend class CDBSnapshot;
 
 private:
     //! custom environment this database is using (may be nullptr in case of
@@ -208,29 +209,16 @@ private:
 
     std::vector<uint8_t> CreateObfuscateKey() const;
 
-public:
-    /**
-     * @param[in] path        Location in the filesystem where leveldb data will
-     * be stored.
-     * @param[in] nCacheSize  Configures various leveldb cache settings.
-     * @param[in] fMemory     If true, use leveldb's memory environment.
-     * @param[in] fWipe       If true, remove all existing data.
-     * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If
-     * false, XOR
-     *                        with a zero'd byte array.
-     */
-    CDBWrapper(const fs::path &path, size_t nCacheSize, bool fMemory = false,
-               bool fWipe = false, bool obfuscate = false);
-    ~CDBWrapper();
-
-    template <typename K, typename V> bool Read(const K &key, V &value) const {
+    template <typename K, typename V>
+    bool ReadWithOptions(const leveldb::ReadOptions &options, const K &key,
+                         V &value) const {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
         ssKey << key;
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(options, slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound()) return false;
             LogPrintf("LevelDB read failure: %s\n", status.ToString());
@@ -248,6 +236,25 @@ public:
         return true;
     }
 
+public:
+    /**
+     * @param[in] path        Location in the filesystem where leveldb data will
+     * be stored.
+     * @param[in] nCacheSize  Configures various leveldb cache settings.
+     * @param[in] fMemory     If true, use leveldb's memory environment.
+     * @param[in] fWipe       If true, remove all existing data.
+     * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If
+     * false, XOR
+     *                        with a zero'd byte array.
+     */
+    CDBWrapper(const fs::path &path, size_t nCacheSize, bool fMemory = false,
+               bool fWipe = false, bool obfuscate = false);
+    ~CDBWrapper();
+
+    template <typename K, typename V> bool Read(const K &key, V &value) const {
+        return ReadWithOptions(readoptions, key, value);
+    }
+
     template <typename K, typename V>
     bool Write(const K &key, const V &value, bool fSync = false) {
         CDBBatch batch(*this);
@@ -329,4 +336,30 @@ public:
     }
 };
 
+/**
+ * Point in time view of a CDBWrapper. Reads through it are not affected by
+ * writes made after it was taken, so a set of reads can be spread over several
+ * threads and still return a consistent result.
+ */
+class CDBSnapshot {
+private:
+    const CDBWrapper &parent;
+    const leveldb::Snapshot *psnapshot;
+    leveldb::ReadOptions readoptions;
+    leveldb::ReadOptions iteroptions;
+
+public:
+    explicit CDBSnapshot(const CDBWrapper &parentIn);
+    ~CDBSnapshot();
+
+    CDBSnapshot(const CDBSnapshot &) = delete;
+    CDBSnapshot &operator=(const CDBSnapshot &) = delete;
+
+    template <typename K, typename V> bool Read(const K &key, V &value) const {
+        return parent.ReadWithOptions(readoptions, key, value);
+    }
+
+    CDBIterator *NewIterator() const;
+};
+
 #endif // BITCOIN_DBWRAPPER_H
@@ -0,0 +1,426 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATHASHMAP_H
+#define BITCOIN_FLATHASHMAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Hash map with open addressing, meant as a drop-in replacement for the subset
+ * of std::unordered_map used by the coins cache, except that erasing an entry
+ * by iterator does not return the next one.
+ *
+ * The hash table itself is a flat array of 8-byte slots, each holding 32 bits
+ * of the hash of the key and the index of the entry. Lookups probe the slots
+ * linearly and only touch an entry when its hash matches, and growing the
+ * table never needs to look at the entries. Removal uses backward shifting,
+ * so that there are no tombstones.
+ *
+ * The entries are allocated in chunks of CHUNK_ENTRIES from an arena that is
+ * only released by clear() and the destructor, with freed entries being reused
+ * first. This avoids one heap allocation per entry, and the allocator overhead
+ * that comes with it. Entries never move, so that iterators, pointers and
+ * references to them stay valid until the entry is erased, like with
+ * std::unordered_map. Iteration goes over the arena, in no particular order.
+ */
+template <typename K, typename T, typename Hash = std::hash<K>>
+class flathashmap {
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+    typedef Hash hasher;
+
+    //! Number of entries allocated at once.
+    static const size_t CHUNK_ENTRIES = 256;
+
+    struct Slot {
+        uint32_t nHash;
+        uint32_t nIndex;
+    };
+
+private:
+    static const uint32_t NO_INDEX = std::numeric_limits<uint32_t>::max();
+
+    typedef typename std::aligned_storage<sizeof(value_type),
+                                          alignof(value_type)>::type Storage;
+
+    struct Chunk {
+        //! Bitmap of the entries that hold a value.
+        uint64_t vUsed[CHUNK_ENTRIES / 64];
+        Storage entries[CHUNK_ENTRIES];
+    };
+
+public:
+    //! Bytes allocated for each chunk of entries.
+    static const size_t CHUNK_SIZE = sizeof(Chunk);
+
+private:
+    //! Hash table, whose size is zero or a power of two.
+    std::vector<Slot> vSlots;
+    std::vector<std::unique_ptr<Chunk>> vChunks;
+    //! Number of entries ever handed out from the chunks.
+    uint32_t nTop;
+    //! First entry of the free list, linked through the entries' storage.
+    uint32_t nFree;
+    size_t nSize;
+    Hash hash;
+
+    Storage &GetStorage(uint32_t nIndex) const {
+        return vChunks[nIndex / CHUNK_ENTRIES]->entries[nIndex % CHUNK_ENTRIES];
+    }
+
+    value_type &GetEntry(uint32_t nIndex) const {
+        return *reinterpret_cast<value_type *>(&GetStorage(nIndex));
+    }
+
+    bool IsUsed(uint32_t nIndex) const {
+        const Chunk &chunk = *vChunks[nIndex / CHUNK_ENTRIES];
+        size_t nBit = nIndex % CHUNK_ENTRIES;
+        return (chunk.vUsed[nBit / 64] >> (nBit % 64)) & 1;
+    }
+
+    void SetUsed(uint32_t nIndex, bool fUsed) {
+        Chunk &chunk = *vChunks[nIndex / CHUNK_ENTRIES];
+        size_t nBit = nIndex % CHUNK_ENTRIES;
+        if (fUsed) {
+            chunk.vUsed[nBit / 64] |= uint64_t(1) << (nBit % 64);
+        } else {
+            chunk.vUsed[nBit / 64] &= ~(uint64_t(1) << (nBit % 64));
+        }
+    }
+
+    //! First entry holding a value from nIndex onwards, or nTop.
+    uint32_t NextUsed(uint32_t nIndex) const {
+        while (nIndex < nTop && !IsUsed(nIndex)) {
+            nIndex++;
+        }
+        return nIndex;
+    }
+
+    //! Get room for one entry, without constructing it.
+    uint32_t AllocateEntry() {
+        if (nFree != NO_INDEX) {
+            uint32_t nIndex = nFree;
+            std::memcpy(&nFree, &GetStorage(nIndex), sizeof(nFree));
+            return nIndex;
+        }
+        if (nTop == vChunks.size() * CHUNK_ENTRIES) {
+            std::unique_ptr<Chunk> chunk(new Chunk());
+            vChunks.push_back(std::move(chunk));
+        }
+        return nTop++;
+    }
+
+    //! Give back the room of an entry that is not constructed.
+    void ReleaseEntry(uint32_t nIndex) {
+        std::memcpy(&GetStorage(nIndex), &nFree, sizeof(nFree));
+        nFree = nIndex;
+    }
+
+    uint32_t HashKey(const K &key) const { return uint32_t(hash(key)); }
+
+    size_t Mask() const { return vSlots.size() - 1; }
+
+    //! Position of the slot of key in the table, or vSlots.size().
+    size_t FindSlot(const K &key, uint32_t nHash) const {
+        if (vSlots.empty()) {
+            return 0;
+        }
+        for (size_t nPos = nHash & Mask();; nPos = (nPos + 1) & Mask()) {
+            const Slot &slot = vSlots[nPos];
+            if (slot.nIndex == NO_INDEX) {
+                return vSlots.size();
+            }
+            if (slot.nHash == nHash && GetEntry(slot.nIndex).first == key) {
+                return nPos;
+            }
+        }
+    }
+
+    static void InsertSlot(std::vector<Slot> &vTable, const Slot &slot) {
+        size_t nMask = vTable.size() - 1;
+        size_t nPos = slot.nHash & nMask;
+        while (vTable[nPos].nIndex != NO_INDEX) {
+            nPos = (nPos + 1) & nMask;
+        }
+        vTable[nPos] = slot;
+    }
+
+    //! Resize the table, without looking at the entries.
+    void Rehash(size_t nSlots) {
+        std::vector<Slot> vNewSlots(nSlots, Slot{0, NO_INDEX});
+        for (const Slot &slot : vSlots) {
+            if (slot.nIndex != NO_INDEX) {
+                InsertSlot(vNewSlots, slot);
+            }
+        }
+        vSlots.swap(vNewSlots);
+    }
+
+    //! Empty the slot at nPos, shifting back the slots that follow it.
+    void RemoveSlot(size_t nPos) {
+        size_t nHole = nPos;
+        for (size_t i = (nPos + 1) & Mask(); vSlots[i].nIndex != NO_INDEX;
+             i = (i + 1) & Mask()) {
+            // Move the slot to the hole if that does not put it before its
+            // ideal position.
+            size_t nIdeal = vSlots[i].nHash & Mask();
+            if (((i - nIdeal) & Mask()) >= ((i - nHole) & Mask())) {
+                vSlots[nHole] = vSlots[i];
+                nHole = i;
+            }
+        }
+        vSlots[nHole].nIndex = NO_INDEX;
+    }
+
+    void DestroyAll() {
+        for (uint32_t i = NextUsed(0); i < nTop; i = NextUsed(i + 1)) {
+            GetEntry(i).~value_type();
+        }
+    }
+
+    template <bool fConst> class iter {
+    private:
+        typedef typename std::conditional<fConst, const flathashmap,
+                                          flathashmap>::type map_type;
+        map_type *map;
+        uint32_t nIndex;
+
+        friend class flathashmap;
+        template <bool> friend class iter;
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename flathashmap::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<fConst, const value_type *,
+                                          value_type *>::type pointer;
+        typedef typename std::conditional<fConst, const value_type &,
+                                          value_type &>::type reference;
+
+        iter() : map(nullptr), nIndex(0) {}
+        iter(map_type *mapIn, uint32_t nIndexIn)
+            : map(mapIn), nIndex(nIndexIn) {}
+        // Allow iterator to const_iterator conversion.
+        template <bool fOtherConst,
+                  typename = typename std::enable_if<fConst &&
+                                                     !fOtherConst>::type>
+        iter(const iter<fOtherConst> &it) : map(it.map), nIndex(it.nIndex) {}
+
+        reference operator*() const { return map->GetEntry(nIndex); }
+        pointer operator->() const { return &map->GetEntry(nIndex); }
+
+        iter &operator++() {
+            nIndex = map->NextUsed(nIndex + 1);
+            return *this;
+        }
+        iter operator++(int) {
+            iter copy(*this);
+            ++(*this);
+            return copy;
+        }
+
+        bool operator==(const iter &it) const { return nIndex == it.nIndex; }
+        bool operator!=(const iter &it) const { return nIndex != it.nIndex; }
+    };
+
+public:
+    typedef iter<false> iterator;
+    typedef iter<true> const_iterator;
+
+private:
+    /**
+     * Insert an entry for key, constructed from args, unless there is one
+     * already. The arguments are only used once the key is known to be
+     * missing, and the table grows before the entry is constructed, so that
+     * nothing is consumed or left behind if the key exists or anything throws.
+     */
+    template <typename... Args>
+    std::pair<iterator, bool> EmplaceKey(const K &key, Args &&... args) {
+        uint32_t nHash = HashKey(key);
+        size_t nPos = FindSlot(key, nHash);
+        if (nPos != vSlots.size()) {
+            return std::make_pair(iterator(this, vSlots[nPos].nIndex), false);
+        }
+
+        // Keep the load factor at or below 3/4.
+        if (4 * (nSize + 1) > 3 * vSlots.size()) {
+            Rehash(std::max<size_t>(16, 2 * vSlots.size()));
+        }
+
+        uint32_t nIndex = AllocateEntry();
+        try {
+            new (&GetStorage(nIndex)) value_type(std::forward<Args>(args)...);
+        } catch (...) {
+            ReleaseEntry(nIndex);
+            throw;
+        }
+        InsertSlot(vSlots, Slot{nHash, nIndex});
+        SetUsed(nIndex, true);
+        nSize++;
+        return std::make_pair(iterator(this, nIndex), true);
+    }
+
+public:
+    flathashmap() : nTop(0), nFree(NO_INDEX), nSize(0) {}
+
+    flathashmap(flathashmap &&other) : flathashmap() { swap(other); }
+
+    flathashmap &operator=(flathashmap &&other) {
+        swap(other);
+        return *this;
+    }
+
+    flathashmap(const flathashmap &) = delete;
+    flathashmap &operator=(const flathashmap &) = delete;
+
+    ~flathashmap() { DestroyAll(); }
+
+    iterator begin() { return iterator(this, NextUsed(0)); }
+    iterator end() { return iterator(this, nTop); }
+    const_iterator begin() const { return const_iterator(this, NextUsed(0)); }
+    const_iterator end() const { return const_iterator(this, nTop); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    bool empty() const { return nSize == 0; }
+    size_type size() const { return nSize; }
+
+    //! Number of slots in the hash table.
+    size_t slot_count() const { return vSlots.size(); }
+    //! Number of chunks of entries allocated.
+    size_t chunk_count() const { return vChunks.size(); }
+    //! Capacity of the vector of pointers to the chunks.
+    size_t chunk_capacity() const { return vChunks.capacity(); }
+
+    iterator find(const K &key) {
+        size_t nPos = FindSlot(key, HashKey(key));
+        return nPos == vSlots.size() ? end()
+                                     : iterator(this, vSlots[nPos].nIndex);
+    }
+
+    const_iterator find(const K &key) const {
+        size_t nPos = FindSlot(key, HashKey(key));
+        return nPos == vSlots.size()
+                   ? end()
+                   : const_iterator(this, vSlots[nPos].nIndex);
+    }
+
+    size_type count(const K &key) const {
+        return FindSlot(key, HashKey(key)) == vSlots.size() ? 0 : 1;
+    }
+
+    //! The key is constructed from the first of the key arguments.
+    template <typename KeyArgs, typename ValueArgs>
+    std::pair<iterator, bool> emplace(std::piecewise_construct_t pc,
+                                      KeyArgs &&keyArgs,
+                                      ValueArgs &&valueArgs) {
+        const K &key = std::get<0>(keyArgs);
+        return EmplaceKey(key, pc, std::forward<KeyArgs>(keyArgs),
+                          std::forward<ValueArgs>(valueArgs));
+    }
+
+    template <typename KeyArg, typename ValueArg>
+    std::pair<iterator, bool> emplace(KeyArg &&keyArg, ValueArg &&valueArg) {
+        const K &key = keyArg;
+        return EmplaceKey(key, std::forward<KeyArg>(keyArg),
+                          std::forward<ValueArg>(valueArg));
+    }
+
+    std::pair<iterator, bool> emplace(const value_type &value) {
+        return EmplaceKey(value.first, value);
+    }
+
+    std::pair<iterator, bool> emplace(value_type &&value) {
+        return EmplaceKey(value.first, std::move(value));
+    }
+
+    std::pair<iterator, bool> insert(const value_type &value) {
+        return emplace(value);
+    }
+
+    std::pair<iterator, bool> insert(value_type &&value) {
+        return emplace(std::move(value));
+    }
+
+    T &operator[](const K &key) {
+        iterator it = find(key);
+        if (it != end()) {
+            return it->second;
+        }
+        return emplace(std::piecewise_construct, std::forward_as_tuple(key),
+                       std::forward_as_tuple())
+            .first->second;
+    }
+
+    /**
+     * Unlike with std::unordered_map, no iterator to the next entry is
+     * returned: finding it means scanning the arena past the freed entries,
+     * which made every erase from a large, sparse cache as slow as a walk over
+     * it. Use erase(it++) to erase while iterating.
+     */
+    void erase(const_iterator it) {
+        uint32_t nIndex = it.nIndex;
+        size_t nPos = HashKey(GetEntry(nIndex).first) & Mask();
+        while (vSlots[nPos].nIndex != nIndex) {
+            nPos = (nPos + 1) & Mask();
+        }
+        RemoveSlot(nPos);
+        GetEntry(nIndex).~value_type();
+        SetUsed(nIndex, false);
+        ReleaseEntry(nIndex);
+        nSize--;
+    }
+
+    size_type erase(const K &key) {
+        const_iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    /**
+     * Remove all the entries and release their arena. The hash table keeps its
+     * size, as the buckets of std::unordered_map do.
+     */
+    void clear() {
+        DestroyAll();
+        vChunks.clear();
+        nTop = 0;
+        nFree = NO_INDEX;
+        nSize = 0;
+        for (Slot &slot : vSlots) {
+            slot.nIndex = NO_INDEX;
+        }
+    }
+
+    void swap(flathashmap &other) {
+        using std::swap;
+        swap(vSlots, other.vSlots);
+        swap(vChunks, other.vChunks);
+        swap(nTop, other.nTop);
+        swap(nFree, other.nFree);
+        swap(nSize, other.nSize);
+        swap(hash, other.hash);
+    }
+};
+
+#endif // BITCOIN_FLATHASHMAP_H
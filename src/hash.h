@@ -143,6 +143,9 @@ private:
 public:
     CHashWriter(int nTypeIn, int nVersionIn)
         : nType(nTypeIn), nVersion(nVersionIn) {}
+    //! Carry on from a hasher which already hashed a prefix.
+    CHashWriter(int nTypeIn, int nVersionIn, const CHash256 &ctxIn)
+        : ctx(ctxIn), nType(nTypeIn), nVersion(nVersionIn) {}
 
     int GetType() const { return nType; }
     int GetVersion() const { return nVersion; }
@@ -151,6 +154,9 @@ public:
         ctx.Write((const uint8_t *)pch, size);
     }
 
+    //! The state of the hasher, to carry on from later.
+    const CHash256 &GetState() const { return ctx; }
+
     // invalidates the object
     uint256 GetHash() {
         uint256 result;
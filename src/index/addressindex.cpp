@@ -0,0 +1,229 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/addressindex.h"
+
+#include "chain.h"
+#include "crypto/sha256.h"
+#include "script/script.h"
+#include "undo.h"
+#include "util.h"
+#include "validation.h"
+
+//! Every output paying to a script, along with what spent it
+static const char DB_ADDRESS_OUTPUT = 'o';
+//! The unspent outputs paying to a script
+static const char DB_ADDRESS_UNSPENT = 'u';
+
+std::unique_ptr<CAddressIndex> g_addressindex;
+
+uint256 GetScriptHash(const CScript &script) {
+    uint256 hash;
+    CSHA256().Write(script.data(), script.size()).Finalize(hash.begin());
+    return hash;
+}
+
+namespace {
+
+/**
+ * Key of an output in the index. The height and output index are stored big
+ * endian, so that the outputs of a script are sorted by position.
+ */
+struct AddressIndexKey {
+    char chType;
+    uint256 scriptHash;
+    CAddressIndexPos pos;
+
+    AddressIndexKey() : chType(0) {}
+    AddressIndexKey(char chTypeIn, const uint256 &scriptHashIn,
+                    const CAddressIndexPos &posIn)
+        : chType(chTypeIn), scriptHash(scriptHashIn), pos(posIn) {}
+
+    template <typename Stream> void Serialize(Stream &s) const {
+        ser_writedata8(s, chType);
+        s << scriptHash;
+        ser_writedata32be(s, pos.nHeight);
+        s << pos.outpoint.hash;
+        ser_writedata32be(s, pos.outpoint.n);
+    }
+
+    template <typename Stream> void Unserialize(Stream &s) {
+        chType = ser_readdata8(s);
+        s >> scriptHash;
+        pos.nHeight = ser_readdata32be(s);
+        s >> pos.outpoint.hash;
+        pos.outpoint.n = ser_readdata32be(s);
+    }
+};
+
+/** Value of a DB_ADDRESS_OUTPUT entry. */
+struct AddressOutputValue {
+    Amount nValue;
+    uint256 spentTxid;
+    uint32_t nSpentInput;
+    int32_t nSpentHeight;
+
+    AddressOutputValue() : nValue(0), nSpentInput(0), nSpentHeight(-1) {}
+    explicit AddressOutputValue(const Amount nValueIn)
+        : nValue(nValueIn), nSpentInput(0), nSpentHeight(-1) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(nValue);
+        READWRITE(spentTxid);
+        READWRITE(nSpentInput);
+        READWRITE(nSpentHeight);
+    }
+};
+
+void WriteUnspent(CDBBatch &batch, const uint256 &scriptHash,
+                  const CAddressIndexPos &pos, const Amount nValue) {
+    batch.Write(AddressIndexKey(DB_ADDRESS_OUTPUT, scriptHash, pos),
+                AddressOutputValue(nValue));
+    batch.Write(AddressIndexKey(DB_ADDRESS_UNSPENT, scriptHash, pos), nValue);
+}
+
+} // namespace
+
+CAddressIndex::CAddressIndex(size_t nCacheSize, bool fMemory, bool fWipe)
+    : db(new DB(GetDataDir() / "indexes" / "addressindex", nCacheSize,
+                fMemory, fWipe)) {}
+
+CAddressIndex::~CAddressIndex() {
+    Stop();
+}
+
+bool CAddressIndex::WriteBlock(CDBBatch &batch, const CBlock &block,
+                               const CBlockIndex *pindex) {
+    // The outputs of the genesis block are not part of the UTXO set.
+    if (pindex->pprev == nullptr) {
+        return true;
+    }
+    CBlockUndo blockundo;
+    if (!ReadBlockUndoFromDisk(blockundo, pindex) ||
+        blockundo.vtxundo.size() + 1 != block.vtx.size()) {
+        return error("%s: failed to read undo data of block %s", __func__,
+                     pindex->GetBlockHash().ToString());
+    }
+
+    // Outputs spent in the block they are created in are added, then marked
+    // spent, as the batch is applied in order.
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction &tx = *block.vtx[i];
+        if (i > 0) {
+            const CTxUndo &txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const Coin &coin = txundo.vprevout[j];
+                const uint256 scriptHash =
+                    GetScriptHash(coin.GetTxOut().scriptPubKey);
+                const CAddressIndexPos pos(coin.GetHeight(), tx.vin[j].prevout);
+                AddressOutputValue value(coin.GetTxOut().nValue);
+                value.spentTxid = tx.GetId();
+                value.nSpentInput = j;
+                value.nSpentHeight = pindex->nHeight;
+                batch.Write(
+                    AddressIndexKey(DB_ADDRESS_OUTPUT, scriptHash, pos), value);
+                batch.Erase(
+                    AddressIndexKey(DB_ADDRESS_UNSPENT, scriptHash, pos));
+            }
+        }
+        for (size_t n = 0; n < tx.vout.size(); n++) {
+            const CTxOut &txout = tx.vout[n];
+            if (txout.scriptPubKey.IsUnspendable()) {
+                continue;
+            }
+            WriteUnspent(batch, GetScriptHash(txout.scriptPubKey),
+                         CAddressIndexPos(pindex->nHeight,
+                                          COutPoint(tx.GetId(), n)),
+                         txout.nValue);
+        }
+    }
+    return true;
+}
+
+bool CAddressIndex::EraseBlock(CDBBatch &batch, const CBlock &block,
+                               const CBlockIndex *pindex) {
+    if (pindex->pprev == nullptr) {
+        return true;
+    }
+    CBlockUndo blockundo;
+    if (!ReadBlockUndoFromDisk(blockundo, pindex) ||
+        blockundo.vtxundo.size() + 1 != block.vtx.size()) {
+        return error("%s: failed to read undo data of block %s", __func__,
+                     pindex->GetBlockHash().ToString());
+    }
+
+    // Undo the transactions in reverse order, so that outputs spent in the
+    // block they are created in end up erased.
+    for (size_t i = block.vtx.size(); i-- > 0;) {
+        const CTransaction &tx = *block.vtx[i];
+        for (size_t n = 0; n < tx.vout.size(); n++) {
+            const CTxOut &txout = tx.vout[n];
+            if (txout.scriptPubKey.IsUnspendable()) {
+                continue;
+            }
+            const uint256 scriptHash = GetScriptHash(txout.scriptPubKey);
+            const CAddressIndexPos pos(pindex->nHeight,
+                                       COutPoint(tx.GetId(), n));
+            batch.Erase(AddressIndexKey(DB_ADDRESS_OUTPUT, scriptHash, pos));
+            batch.Erase(AddressIndexKey(DB_ADDRESS_UNSPENT, scriptHash, pos));
+        }
+        if (i > 0) {
+            const CTxUndo &txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const Coin &coin = txundo.vprevout[j];
+                WriteUnspent(batch, GetScriptHash(coin.GetTxOut().scriptPubKey),
+                             CAddressIndexPos(coin.GetHeight(),
+                                              tx.vin[j].prevout),
+                             coin.GetTxOut().nValue);
+            }
+        }
+    }
+    return true;
+}
+
+bool CAddressIndex::Find(bool fUnspentOnly, const uint256 &scriptHash,
+                         const CAddressIndexPos &start, size_t nMaxOutputs,
+                         std::vector<CAddressOutput> &vOutputs,
+                         CAddressIndexPos &next) const {
+    const char chType = fUnspentOnly ? DB_ADDRESS_UNSPENT : DB_ADDRESS_OUTPUT;
+    // start and next may be the same object.
+    const AddressIndexKey keyStart(chType, scriptHash, start);
+    vOutputs.clear();
+    next.SetNull();
+
+    std::unique_ptr<CDBIterator> pcursor(db->NewIterator());
+    for (pcursor->Seek(keyStart); pcursor->Valid(); pcursor->Next()) {
+        AddressIndexKey key;
+        if (!pcursor->GetKey(key) || key.chType != chType ||
+            key.scriptHash != scriptHash) {
+            break;
+        }
+        if (vOutputs.size() == nMaxOutputs) {
+            next = key.pos;
+            break;
+        }
+
+        CAddressOutput output;
+        output.pos = key.pos;
+        if (fUnspentOnly) {
+            if (!pcursor->GetValue(output.nValue)) {
+                return error("%s: unable to read value", __func__);
+            }
+        } else {
+            AddressOutputValue value;
+            if (!pcursor->GetValue(value)) {
+                return error("%s: unable to read value", __func__);
+            }
+            output.nValue = value.nValue;
+            output.spentTxid = value.spentTxid;
+            output.nSpentInput = value.nSpentInput;
+            output.nSpentHeight = value.nSpentHeight;
+        }
+        vOutputs.push_back(output);
+    }
+    return true;
+}
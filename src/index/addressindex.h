@@ -0,0 +1,113 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_ADDRESSINDEX_H
+#define BITCOIN_INDEX_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "index/base.h"
+#include "primitives/transaction.h"
+#include "uint256.h"
+
+#include <memory>
+#include <vector>
+
+class CScript;
+
+//! -addressindex default
+static const bool DEFAULT_ADDRESSINDEX = false;
+//! Number of outputs returned by an address index query, unless specified
+static const int64_t DEFAULT_ADDRESS_QUERY_OUTPUTS = 100;
+//! Maximum number of outputs returned by a single address index query
+static const size_t MAX_ADDRESS_QUERY_OUTPUTS = 1000;
+
+//! Hash identifying a script in the address index: its single SHA256.
+uint256 GetScriptHash(const CScript &script);
+
+/**
+ * Position of an output in the history of a script. Outputs are ordered by
+ * the height of the block creating them, then by outpoint.
+ */
+struct CAddressIndexPos {
+    int nHeight;
+    COutPoint outpoint;
+
+    //! The first possible position.
+    CAddressIndexPos() : nHeight(0), outpoint(uint256(), 0) {}
+    CAddressIndexPos(int nHeightIn, const COutPoint &outpointIn)
+        : nHeight(nHeightIn), outpoint(outpointIn) {}
+
+    void SetNull() { nHeight = -1; }
+    bool IsNull() const { return nHeight < 0; }
+};
+
+/** Output paying to a script, as recorded in the address index. */
+struct CAddressOutput {
+    CAddressIndexPos pos;
+    Amount nValue;
+    //! Transaction spending the output, null if unspent.
+    uint256 spentTxid;
+    //! Input of spentTxid spending the output.
+    uint32_t nSpentInput;
+    //! Height of the block spending the output, -1 if unspent.
+    int nSpentHeight;
+
+    CAddressOutput() : nValue(0), nSpentInput(0), nSpentHeight(-1) {}
+
+    bool IsSpent() const { return nSpentHeight >= 0; }
+};
+
+/**
+ * Address index (-addressindex), recording every output of the active chain
+ * under the hash of the script it pays to, along with the input spending it
+ * if any. The unspent outputs are also kept apart, so that they can be listed
+ * without going through the whole history of a script. It lives in its own
+ * database, under indexes/addressindex.
+ */
+class CAddressIndex final : public CBaseIndex {
+private:
+    const std::unique_ptr<DB> db;
+
+    bool Find(bool fUnspentOnly, const uint256 &scriptHash,
+              const CAddressIndexPos &start, size_t nMaxOutputs,
+              std::vector<CAddressOutput> &vOutputs,
+              CAddressIndexPos &next) const;
+
+protected:
+    bool WriteBlock(CDBBatch &batch, const CBlock &block,
+                    const CBlockIndex *pindex) override;
+    bool EraseBlock(CDBBatch &batch, const CBlock &block,
+                    const CBlockIndex *pindex) override;
+
+    DB &GetDB() const override { return *db; }
+    const char *GetName() const override { return "addressindex"; }
+
+public:
+    explicit CAddressIndex(size_t nCacheSize, bool fMemory = false,
+                           bool fWipe = false);
+    ~CAddressIndex();
+
+    /**
+     * Get up to nMaxOutputs outputs paying to the script with hash scriptHash,
+     * from position start on. next is set to the position to resume from, or
+     * null if there are no more outputs.
+     */
+    bool FindOutputs(const uint256 &scriptHash, const CAddressIndexPos &start,
+                     size_t nMaxOutputs, std::vector<CAddressOutput> &vOutputs,
+                     CAddressIndexPos &next) const {
+        return Find(false, scriptHash, start, nMaxOutputs, vOutputs, next);
+    }
+
+    //! Same as FindOutputs, for the unspent outputs only.
+    bool FindUnspent(const uint256 &scriptHash, const CAddressIndexPos &start,
+                     size_t nMaxOutputs, std::vector<CAddressOutput> &vOutputs,
+                     CAddressIndexPos &next) const {
+        return Find(true, scriptHash, start, nMaxOutputs, vOutputs, next);
+    }
+};
+
+//! The address index, if enabled.
+extern std::unique_ptr<CAddressIndex> g_addressindex;
+
+#endif // BITCOIN_INDEX_ADDRESSINDEX_H
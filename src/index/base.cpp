@@ -0,0 +1,296 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/base.h"
+
+#include "chain.h"
+#include "config.h"
+#include "init.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <vector>
+
+static const char DB_BEST_BLOCK = 'B';
+
+//! Seconds between progress messages while catching up
+static const int64_t SYNC_LOG_INTERVAL = 30;
+
+CBaseIndex::DB::DB(const fs::path &path, size_t nCacheSize, bool fMemory,
+                   bool fWipe)
+    : CDBWrapper(path, nCacheSize, fMemory, fWipe) {}
+
+bool CBaseIndex::DB::ReadBestBlock(uint256 &hashBlock) const {
+    return Read(DB_BEST_BLOCK, hashBlock);
+}
+
+void CBaseIndex::DB::WriteBestBlock(CDBBatch &batch, const uint256 &hashBlock) {
+    batch.Write(DB_BEST_BLOCK, hashBlock);
+}
+
+CBaseIndex::CBaseIndex()
+    : fSynced(false), pindexBest(nullptr), fProcessing(false), fStop(false) {}
+
+CBaseIndex::~CBaseIndex() {}
+
+void CBaseIndex::BlockConnected(
+    const std::shared_ptr<const CBlock> &block, const CBlockIndex *pindex,
+    const std::vector<CTransactionRef> &txnConflicted) {
+    // Until the index caught up, the blocks are read from disk instead. The
+    // notifications sent from then on all get here, along with some sent
+    // before, which are ignored by ThreadIndex.
+    if (!fSynced) {
+        return;
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queue.push_back({block, pindex, true});
+    }
+    cond.notify_all();
+}
+
+void CBaseIndex::BlockDisconnected(const std::shared_ptr<const CBlock> &block) {
+    if (!fSynced) {
+        return;
+    }
+    // With -asyncnotifications, this runs on the scheduler thread.
+    const CBlockIndex *pindex;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(block->GetHash());
+        assert(it != mapBlockIndex.end());
+        pindex = it->second;
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queue.push_back({block, pindex, false});
+    }
+    cond.notify_all();
+}
+
+bool CBaseIndex::IsStopping() const {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return fStop;
+}
+
+bool CBaseIndex::WaitForNotifications() const {
+    std::shared_ptr<std::promise<void>> promise =
+        std::make_shared<std::promise<void>>();
+    std::future<void> future = promise->get_future();
+    CallFunctionInValidationInterfaceQueue([promise] { promise->set_value(); });
+    // The scheduler is stopped before the index on shutdown.
+    while (future.wait_for(std::chrono::milliseconds(100)) !=
+           std::future_status::ready) {
+        if (IsStopping()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CBaseIndex::Contains(const CBlockIndex *pindex) const {
+    return pindexBest && pindexBest->GetAncestor(pindex->nHeight) == pindex;
+}
+
+bool CBaseIndex::Apply(const CBlock &block, const CBlockIndex *pindex,
+                       bool fConnect) {
+    DB &db = GetDB();
+    CDBBatch batch(db);
+    const CBlockIndex *pindexNew = fConnect ? pindex : pindex->pprev;
+    if (fConnect ? !WriteBlock(batch, block, pindex)
+                 : !EraseBlock(batch, block, pindex)) {
+        return error("%s: failed to %s block %s in %s", __func__,
+                     fConnect ? "index" : "unindex",
+                     pindex->GetBlockHash().ToString(), GetName());
+    }
+    db.WriteBestBlock(batch, pindexNew ? pindexNew->GetBlockHash()
+                                       : uint256());
+    if (!db.WriteBatch(batch)) {
+        return error("%s: failed to write %s", __func__, GetName());
+    }
+    boost::unique_lock<boost::mutex> lock(mutex);
+    pindexBest = pindexNew;
+    return true;
+}
+
+bool CBaseIndex::MoveTo(const CBlockIndex *pindexTarget) {
+    // pindexBest is only modified by this thread.
+    const CBlockIndex *pindex = pindexBest;
+    const CBlockIndex *pindexFork =
+        pindex && pindexTarget ? LastCommonAncestor(pindex, pindexTarget)
+                               : nullptr;
+    const Config &config = GetConfig();
+    int64_t nLastLog = GetTime();
+
+    // Undo the blocks of the branch that is no longer active...
+    while (pindex != pindexFork) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, config)) {
+            return error("%s: failed to read block %s from disk", __func__,
+                         pindex->GetBlockHash().ToString());
+        }
+        if (!Apply(block, pindex, false)) {
+            return false;
+        }
+        pindex = pindex->pprev;
+        if (IsStopping()) {
+            return false;
+        }
+    }
+
+    // ...then index the blocks leading to pindexTarget.
+    std::vector<const CBlockIndex *> vConnect;
+    for (const CBlockIndex *p = pindexTarget; p != pindexFork; p = p->pprev) {
+        vConnect.push_back(p);
+    }
+    std::reverse(vConnect.begin(), vConnect.end());
+    for (const CBlockIndex *p : vConnect) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, p, config)) {
+            return error("%s: failed to read block %s from disk", __func__,
+                         p->GetBlockHash().ToString());
+        }
+        if (!Apply(block, p, true)) {
+            return false;
+        }
+        if (IsStopping()) {
+            return false;
+        }
+        if (GetTime() - nLastLog >= SYNC_LOG_INTERVAL) {
+            LogPrintf("Syncing %s with block chain from height %d\n",
+                      GetName(), p->nHeight);
+            nLastLog = GetTime();
+        }
+    }
+    return true;
+}
+
+bool CBaseIndex::Sync() {
+    while (!IsStopping()) {
+        const CBlockIndex *pindexTip;
+        {
+            LOCK(cs_main);
+            pindexTip = chainActive.Tip();
+            if (pindexTip == pindexBest) {
+                // From now on, the notifications take over.
+                fSynced = true;
+                LogPrintf("%s is enabled at height %d\n", GetName(),
+                          pindexTip ? pindexTip->nHeight : -1);
+                return true;
+            }
+        }
+        if (!MoveTo(pindexTip)) {
+            return false;
+        }
+        // Let the notifications about the blocks read from disk through while
+        // they are still ignored, rather than have the index thread go over
+        // them again.
+        if (!WaitForNotifications()) {
+            return false;
+        }
+    }
+    return false;
+}
+
+void CBaseIndex::ThreadIndex() {
+    bool fOk = Sync();
+    while (fOk) {
+        Notification notification;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fProcessing = false;
+            cond.notify_all();
+            while (queue.empty() && !fStop) {
+                cond.wait(lock);
+            }
+            if (fStop) {
+                return;
+            }
+            notification = std::move(queue.front());
+            queue.pop_front();
+            fProcessing = true;
+        }
+
+        const CBlockIndex *pindex = notification.pindex;
+        if (notification.fConnect ? pindex->pprev == pindexBest
+                                  : pindex == pindexBest) {
+            fOk = Apply(*notification.pblock, pindex, notification.fConnect);
+        } else if (notification.fConnect == Contains(pindex)) {
+            // Sent before the index caught up, which took care of it.
+            continue;
+        } else {
+            // A notification was missed, catch up from disk.
+            LogPrintf("%s: %s is out of sync with block %s, catching up\n",
+                      __func__, GetName(), pindex->GetBlockHash().ToString());
+            fOk = MoveTo(notification.fConnect ? pindex : pindex->pprev);
+        }
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fStop) {
+            return;
+        }
+        // Do not let anyone wait for an index that is no longer maintained.
+        fSynced = false;
+        fProcessing = false;
+        queue.clear();
+    }
+    cond.notify_all();
+    LogPrintf("*** Failed to update %s\n", GetName());
+    uiInterface.ThreadSafeMessageBox(
+        _("Error: A fatal internal error occurred, see debug.log for details"),
+        "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+}
+
+bool CBaseIndex::BlockUntilSyncedToCurrentChain() const {
+    // The notifications may still be on their way to the index.
+    SyncWithValidationInterfaceQueue();
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (fSynced && !fStop && (!queue.empty() || fProcessing)) {
+        cond.wait(lock);
+    }
+    return fSynced && !fStop;
+}
+
+bool CBaseIndex::Start() {
+    uint256 hashBest;
+    if (GetDB().ReadBestBlock(hashBest) && !hashBest.IsNull()) {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBest);
+        if (it == mapBlockIndex.end()) {
+            // Indexing from genesis would leave the entries of the unknown
+            // blocks behind.
+            return error("%s: best block %s of %s is unknown", __func__,
+                         hashBest.ToString(), GetName());
+        }
+        pindexBest = it->second;
+    }
+
+    RegisterValidationInterface(this);
+    thread = boost::thread([this] {
+        RenameThread(strprintf("bitcoin-%s", GetName()).c_str());
+        ThreadIndex();
+    });
+    return true;
+}
+
+void CBaseIndex::Stop() {
+    UnregisterValidationInterface(this);
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
@@ -0,0 +1,129 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_BASE_H
+#define BITCOIN_INDEX_BASE_H
+
+#include "dbwrapper.h"
+#include "primitives/block.h"
+#include "validationinterface.h"
+
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+
+class CBlockIndex;
+
+/**
+ * Base class for the optional indexes, which are kept in their own database
+ * and maintained on a background thread, off the validation path.
+ *
+ * When started, the index first catches up with the active chain by reading
+ * blocks from disk, undoing the blocks of stale branches it may have indexed.
+ * From then on, it follows the BlockConnected and BlockDisconnected
+ * notifications, which are queued and applied in order by the same thread.
+ * Each block is written atomically along with the new best block of the index,
+ * so that an index stopped at any point resumes where it left off.
+ */
+class CBaseIndex : public CValidationInterface {
+protected:
+    class DB : public CDBWrapper {
+    public:
+        DB(const fs::path &path, size_t nCacheSize, bool fMemory = false,
+           bool fWipe = false);
+
+        //! Read the hash of the block the index is up to date with.
+        bool ReadBestBlock(uint256 &hashBlock) const;
+        //! Record the block the index is up to date with in batch.
+        void WriteBestBlock(CDBBatch &batch, const uint256 &hashBlock);
+    };
+
+private:
+    struct Notification {
+        std::shared_ptr<const CBlock> pblock;
+        const CBlockIndex *pindex;
+        bool fConnect;
+    };
+
+    //! Set once the index caught up with the active chain.
+    std::atomic<bool> fSynced;
+
+    mutable boost::mutex mutex;
+    mutable boost::condition_variable cond;
+    //! Notifications not yet applied.
+    std::deque<Notification> queue;
+    //! Block the index is up to date with, null if none. Only modified by the
+    //! index thread.
+    const CBlockIndex *pindexBest;
+    //! Whether a notification is being applied.
+    bool fProcessing;
+    bool fStop;
+
+    boost::thread thread;
+
+    void ThreadIndex();
+    //! Catch up with the active chain. Returns false if interrupted or failed.
+    bool Sync();
+    /**
+     * Bring the index to pindexTarget, undoing and applying blocks read from
+     * disk. Returns false if interrupted or failed.
+     */
+    bool MoveTo(const CBlockIndex *pindexTarget);
+    //! Apply the connection or disconnection of a block to the index.
+    bool Apply(const CBlock &block, const CBlockIndex *pindex, bool fConnect);
+    /**
+     * Wait for the validation notifications sent so far to be dispatched.
+     * Returns false if interrupted.
+     */
+    bool WaitForNotifications() const;
+    //! Whether pindex is on the chain the index is up to date with.
+    bool Contains(const CBlockIndex *pindex) const;
+    bool IsStopping() const;
+
+protected:
+    void BlockConnected(const std::shared_ptr<const CBlock> &block,
+                        const CBlockIndex *pindex,
+                        const std::vector<CTransactionRef> &txnConflicted)
+        override;
+    void BlockDisconnected(const std::shared_ptr<const CBlock> &block) override;
+
+    //! Add the entries of block, at pindex, to batch.
+    virtual bool WriteBlock(CDBBatch &batch, const CBlock &block,
+                            const CBlockIndex *pindex) = 0;
+    //! Add the removal of the entries of block, at pindex, to batch.
+    virtual bool EraseBlock(CDBBatch &batch, const CBlock &block,
+                            const CBlockIndex *pindex) = 0;
+
+    virtual DB &GetDB() const = 0;
+    //! Name of the index, for logging and the thread name.
+    virtual const char *GetName() const = 0;
+
+public:
+    CBaseIndex();
+    virtual ~CBaseIndex();
+
+    //! Whether the index caught up with the active chain.
+    bool IsSynced() const { return fSynced; }
+
+    /**
+     * Wait until the index is up to date with the notifications sent so far,
+     * which makes it consistent with chainActive as seen by the caller.
+     * Returns false without waiting if the index is still catching up. Must
+     * not be called with cs_main held.
+     */
+    bool BlockUntilSyncedToCurrentChain() const;
+
+    /**
+     * Register for notifications and start catching up. Returns false, without
+     * starting, if the index is up to date with a block the block index does
+     * not know, in which case it has to be rebuilt.
+     */
+    bool Start();
+    //! Stop following the chain. Notifications not applied yet are dropped.
+    void Stop();
+};
+
+#endif // BITCOIN_INDEX_BASE_H
@@ -0,0 +1,67 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/txindex.h"
+
+#include "clientversion.h"
+#include "streams.h"
+#include "util.h"
+#include "validation.h"
+
+static const char DB_TXINDEX = 't';
+
+std::unique_ptr<CTxIndex> g_txindex;
+
+CTxIndex::CTxIndex(size_t nCacheSize, bool fMemory, bool fWipe)
+    : db(new DB(GetDataDir() / "indexes" / "txindex", nCacheSize, fMemory,
+                fWipe)) {}
+
+CTxIndex::~CTxIndex() {
+    Stop();
+}
+
+bool CTxIndex::WriteBlock(CDBBatch &batch, const CBlock &block,
+                          const CBlockIndex *pindex) {
+    CDiskTxPos pos(pindex->GetBlockPos(),
+                   GetSizeOfCompactSize(block.vtx.size()));
+    for (const CTransactionRef &tx : block.vtx) {
+        batch.Write(std::make_pair(DB_TXINDEX, tx->GetId()), pos);
+        pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+    return true;
+}
+
+bool CTxIndex::EraseBlock(CDBBatch &batch, const CBlock &block,
+                          const CBlockIndex *pindex) {
+    for (const CTransactionRef &tx : block.vtx) {
+        batch.Erase(std::make_pair(DB_TXINDEX, tx->GetId()));
+    }
+    return true;
+}
+
+bool CTxIndex::FindTx(const uint256 &txid, uint256 &hashBlock,
+                      CTransactionRef &tx) const {
+    CDiskTxPos postx;
+    if (!db->Read(std::make_pair(DB_TXINDEX, txid), postx)) {
+        return false;
+    }
+
+    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        return error("%s: OpenBlockFile failed", __func__);
+    }
+    CBlockHeader header;
+    try {
+        file >> header;
+        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+        file >> tx;
+    } catch (const std::exception &e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (tx->GetId() != txid) {
+        return error("%s: txid mismatch", __func__);
+    }
+    hashBlock = header.GetHash();
+    return true;
+}
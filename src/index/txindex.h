@@ -0,0 +1,70 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_TXINDEX_H
+#define BITCOIN_INDEX_TXINDEX_H
+
+#include "chain.h"
+#include "index/base.h"
+
+#include <memory>
+
+struct CDiskTxPos : public CDiskBlockPos {
+    unsigned int nTxOffset; // after header
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action) {
+        READWRITE(*(CDiskBlockPos *)this);
+        READWRITE(VARINT(nTxOffset));
+    }
+
+    CDiskTxPos(const CDiskBlockPos &blockIn, unsigned int nTxOffsetIn)
+        : CDiskBlockPos(blockIn.nFile, blockIn.nPos), nTxOffset(nTxOffsetIn) {}
+
+    CDiskTxPos() { SetNull(); }
+
+    void SetNull() {
+        CDiskBlockPos::SetNull();
+        nTxOffset = 0;
+    }
+};
+
+/**
+ * Transaction index (-txindex), mapping the txid of every transaction of the
+ * active chain to its position in the block files. It lives in its own
+ * database, under indexes/txindex, and can be enabled or disabled without
+ * reindexing.
+ */
+class CTxIndex final : public CBaseIndex {
+private:
+    const std::unique_ptr<DB> db;
+
+protected:
+    bool WriteBlock(CDBBatch &batch, const CBlock &block,
+                    const CBlockIndex *pindex) override;
+    bool EraseBlock(CDBBatch &batch, const CBlock &block,
+                    const CBlockIndex *pindex) override;
+
+    DB &GetDB() const override { return *db; }
+    const char *GetName() const override { return "txindex"; }
+
+public:
+    explicit CTxIndex(size_t nCacheSize, bool fMemory = false,
+                      bool fWipe = false);
+    ~CTxIndex();
+
+    /**
+     * Look up a transaction in the index and read it from disk, along with
+     * the hash of the block it is in.
+     */
+    bool FindTx(const uint256 &txid, uint256 &hashBlock,
+                CTransactionRef &tx) const;
+};
+
+//! The transaction index, if enabled.
+extern std::unique_ptr<CTxIndex> g_txindex;
+
+#endif // BITCOIN_INDEX_TXINDEX_H
@@ -11,15 +11,19 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "blockcache.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "coinstats.h"
 #include "compat/sanity.h"
 #include "config.h"
 #include "consensus/validation.h"
 #include "fs.h"
 #include "httprpc.h"
 #include "httpserver.h"
+#include "index/addressindex.h"
+#include "index/txindex.h"
 #include "key.h"
 #include "miner.h"
 #include "net.h"
@@ -72,6 +76,11 @@ static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
 static const bool DEFAULT_DISABLE_SAFEMODE = false;
 static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
+#ifdef HAVE_SYS_EPOLL_H
+static const char *DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char *DEFAULT_SOCKETEVENTS = "select";
+#endif
 
 std::unique_ptr<CConnman> g_connman;
 std::unique_ptr<PeerLogicValidation> peerLogic;
@@ -126,6 +135,7 @@ static const char *FEE_ESTIMATES_FILENAME = "fee_estimates.dat";
 
 std::atomic<bool> fRequestShutdown(false);
 std::atomic<bool> fDumpMempoolLater(false);
+std::atomic<bool> fDumpScriptCachesLater(false);
 
 void StartShutdown() {
     fRequestShutdown = true;
@@ -146,23 +156,35 @@ public:
         try {
             return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch (const std::runtime_error &e) {
-            uiInterface.ThreadSafeMessageBox(
-                _("Error reading from database, shutting down."), "",
-                CClientUIInterface::MSG_ERROR);
-            LogPrintf("Error reading from database: %s\n", e.what());
-            // Starting the shutdown sequence and returning false to the caller
-            // would be interpreted as 'entry not found' (as opposed to unable
-            // to read data), and could lead to invalid interpretation. Just
-            // exit immediately, as we can't continue anyway, and all writes
-            // should be atomic.
-            abort();
+            ReadError(e);
+        }
+    }
+    void GetCoins(const std::vector<COutPoint> &vOutpoints,
+                  std::vector<Coin> &vCoins) const override {
+        try {
+            CCoinsViewBacked::GetCoins(vOutpoints, vCoins);
+        } catch (const std::runtime_error &e) {
+            ReadError(e);
         }
     }
     // Writes do not need similar protection, as failure to write is handled by
     // the caller.
+
+private:
+    [[noreturn]] static void ReadError(const std::runtime_error &e) {
+        uiInterface.ThreadSafeMessageBox(
+            _("Error reading from database, shutting down."), "",
+            CClientUIInterface::MSG_ERROR);
+        LogPrintf("Error reading from database: %s\n", e.what());
+        // Starting the shutdown sequence and returning false to the caller
+        // would be interpreted as 'entry not found' (as opposed to unable to
+        // read data), and could lead to invalid interpretation. Just exit
+        // immediately, as we can't continue anyway, and all writes should be
+        // atomic.
+        abort();
+    }
 };
 
-static CCoinsViewDB *pcoinsdbview = nullptr;
 static CCoinsViewErrorCatcher *pcoinscatcher = nullptr;
 static std::unique_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -199,16 +221,37 @@ void Shutdown() {
     }
 #endif
     MapPort(false);
+    // The scheduler thread is stopped by now: dispatch the notifications it
+    // left behind while their listeners are still around.
+    GetMainSignals().FlushBackgroundCallbacks();
     UnregisterValidationInterface(peerLogic.get());
     peerLogic.reset();
     g_connman.reset();
 
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
+    if (g_txindex) {
+        g_txindex->Stop();
+        g_txindex.reset();
+    }
+    if (g_addressindex) {
+        g_addressindex->Stop();
+        g_addressindex.reset();
+    }
+    if (g_templateupdater) {
+        g_templateupdater->Stop();
+        g_templateupdater.reset();
+    }
+    g_rawblockcache.reset();
+    g_blockfilepool.reset();
     if (fDumpMempoolLater &&
         gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         DumpMempool();
     }
+    if (fDumpScriptCachesLater &&
+        gArgs.GetBoolArg("-persistsigcache", DEFAULT_PERSIST_SIGCACHE)) {
+        DumpScriptCaches();
+    }
 
     if (fFeeEstimatesInitialized) {
         fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
@@ -226,6 +269,10 @@ void Shutdown() {
         LOCK(cs_main);
         if (pcoinsTip != nullptr) {
             FlushStateToDisk();
+            if (gArgs.GetBoolArg("-blockindexsnapshot",
+                                 DEFAULT_BLOCK_INDEX_SNAPSHOT)) {
+                DumpBlockIndexSnapshot();
+            }
         }
         delete pcoinsTip;
         pcoinsTip = nullptr;
@@ -236,6 +283,8 @@ void Shutdown() {
         delete pblocktree;
         pblocktree = nullptr;
     }
+    // Flushing the state notifies the new best chain.
+    GetMainSignals().FlushBackgroundCallbacks();
 #ifdef ENABLE_WALLET
     for (CWalletRef pwallet : vpwallets) {
         pwallet->Flush(true);
@@ -258,6 +307,7 @@ void Shutdown() {
     }
 #endif
     UnregisterAllValidationInterfaces();
+    GetMainSignals().UnregisterBackgroundSignalScheduler();
 #ifdef ENABLE_WALLET
     for (CWalletRef pwallet : vpwallets) {
         delete pwallet;
@@ -327,10 +377,22 @@ std::string HelpMessage(HelpMessageMode mode) {
     std::string strUsage = HelpMessageGroup(_("Options:"));
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
+    strUsage += HelpMessageOpt(
+        "-addressindex",
+        strprintf(_("Maintain an index of the outputs paying to each address, "
+                    "used by the getaddresshistory and getaddressutxos rpc "
+                    "calls (default: %d)"),
+                  DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt(
         "-alertnotify=<cmd>",
         _("Execute command when a relevant alert is received or we see a "
           "really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt(
+        "-asyncnotifications",
+        strprintf(_("Notify the wallet, indexes and peers of new blocks and "
+                    "transactions from a background thread rather than while "
+                    "validating (default: %d)"),
+                  DEFAULT_ASYNC_NOTIFICATIONS));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>",
                                _("Execute command when the best block changes "
                                  "(%s in cmd is replaced by block hash)"));
@@ -348,6 +410,18 @@ std::string HelpMessage(HelpMessageMode mode) {
               "verify all, default: %s, testnet: %s)"),
             defaultChainParams->GetConsensus().defaultAssumeValid.GetHex(),
             testnetChainParams->GetConsensus().defaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt(
+        "-asyncflush",
+        strprintf(_("Write the UTXO cache to disk in the background, letting "
+                    "block validation continue meanwhile. This can use up to "
+                    "twice the -dbcache memory while writing (default: %u)"),
+                  DEFAULT_ASYNC_FLUSH));
+    strUsage += HelpMessageOpt(
+        "-blockindexsnapshot",
+        strprintf(_("Write a snapshot of the block index at shutdown, and load "
+                    "the block index from it at the next startup if nothing "
+                    "changed meanwhile (default: %u)"),
+                  DEFAULT_BLOCK_INDEX_SNAPSHOT));
     strUsage += HelpMessageOpt(
         "-conf=<file>", strprintf(_("Specify configuration file (default: %s)"),
                                   BITCOIN_CONF_FILENAME));
@@ -365,6 +439,11 @@ std::string HelpMessage(HelpMessageMode mode) {
             strprintf(
                 "Maximum database write batch size in bytes (default: %u)",
                 nDefaultDbBatchSize));
+        strUsage += HelpMessageOpt(
+            "-dbreadthreads=<n>",
+            strprintf("Set the number of threads reading coins from the "
+                      "database in parallel (1 to %d, 0 = auto, default: %d)",
+                      MAX_COINS_READ_THREADS, DEFAULT_COINS_READ_THREADS));
     }
     strUsage += HelpMessageOpt(
         "-dbcache=<n>",
@@ -408,17 +487,36 @@ std::string HelpMessage(HelpMessageMode mode) {
                        strprintf(_("Whether to save the mempool on shutdown "
                                    "and load on restart (default: %u)"),
                                  DEFAULT_PERSIST_MEMPOOL));
+    strUsage += HelpMessageOpt(
+        "-persistsigcache",
+        strprintf(_("Whether to save the signature and script execution "
+                    "caches on shutdown and load them on restart (default: "
+                    "%u)"),
+                  DEFAULT_PERSIST_SIGCACHE));
     strUsage += HelpMessageOpt(
         "-blockreconstructionextratxn=<n>",
         strprintf(_("Extra transactions to keep in memory for compact block "
                     "reconstructions (default: %u)"),
                   DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
+    strUsage += HelpMessageOpt(
+        "-cutthroughrelay",
+        strprintf(_("Relay compact blocks to peers that want them as soon as "
+                    "their header is valid, before the block is validated "
+                    "(default: %u)"),
+                  DEFAULT_CUTTHROUGH_RELAY));
     strUsage += HelpMessageOpt(
         "-par=<n>",
         strprintf(_("Set the number of script verification threads (%u to %d, "
                     "0 = auto, <0 = leave that many cores free, default: %d)"),
                   -GetNumCores(), MAX_SCRIPTCHECK_THREADS,
                   DEFAULT_SCRIPTCHECK_THREADS));
+    if (showDebug) {
+        strUsage += HelpMessageOpt(
+            "-parengine=<engine>",
+            strprintf("Select the script verification queue implementation "
+                      "(legacy, workstealing, default: %s)",
+                      DEFAULT_SCRIPTCHECK_ENGINE));
+    }
 #ifndef WIN32
     strUsage += HelpMessageOpt(
         "-pid=<file>",
@@ -454,6 +552,13 @@ std::string HelpMessage(HelpMessageMode mode) {
         "-txindex", strprintf(_("Maintain a full transaction index, used by "
                                 "the getrawtransaction rpc call (default: %d)"),
                               DEFAULT_TXINDEX));
+    strUsage += HelpMessageOpt(
+        "-utxosummary",
+        strprintf(_("Maintain statistics of the UTXO set as blocks are "
+                    "connected, so that gettxoutsetinfo answers immediately, "
+                    "with utxo_set_hash instead of transactions and "
+                    "hash_serialized (default: %d)"),
+                  DEFAULT_UTXO_SUMMARY));
     strUsage += HelpMessageOpt(
         "-usecashaddr", _("Use Cash Address for destination encoding instead "
                           "of base58 (activate by default on Jan, 14)"));
@@ -515,6 +620,12 @@ std::string HelpMessage(HelpMessageMode mode) {
         "-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, "
                                           "<n>*1000 bytes (default: %u)"),
                                         DEFAULT_MAXSENDBUFFER));
+    strUsage += HelpMessageOpt(
+        "-msghandlerthreads=<n>",
+        strprintf(_("Number of threads to process peer messages with, the "
+                    "messages of each peer are processed in order by one of "
+                    "them (1 to %d, default: %d)"),
+                  MAX_MSGHANDLER_THREADS, DEFAULT_MSGHANDLER_THREADS));
     strUsage += HelpMessageOpt(
         "-maxtimeadjustment",
         strprintf(_("Maximum allowed median peer time offset adjustment. Local "
@@ -554,6 +665,11 @@ std::string HelpMessage(HelpMessageMode mode) {
     strUsage += HelpMessageOpt(
         "-seednode=<ip>",
         _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt(
+        "-socketevents=<mode>",
+        strprintf(_("Wait for socket events with <mode>, select or epoll "
+                    "where supported (default: %s)"),
+                  DEFAULT_SOCKETEVENTS));
     strUsage += HelpMessageOpt(
         "-timeout=<n>", strprintf(_("Specify connection timeout in "
                                     "milliseconds (minimum: 1, default: %d)"),
@@ -753,6 +869,11 @@ std::string HelpMessage(HelpMessageMode mode) {
             "-maxscriptcachesize=<n>",
             strprintf("Limit size of script cache to <n> MiB (default: %u)",
                       DEFAULT_MAX_SCRIPT_CACHE_SIZE));
+        strUsage += HelpMessageOpt(
+            "-rawblockcache=<n>",
+            strprintf("Keep up to <n> MiB of the serialized blocks served to "
+                      "peers in memory (default: %u)",
+                      DEFAULT_RAW_BLOCK_CACHE_SIZE));
         strUsage += HelpMessageOpt(
             "-maxtipage=<n>",
             strprintf("Maximum tip age in seconds to consider node in initial "
@@ -848,6 +969,12 @@ std::string HelpMessage(HelpMessageMode mode) {
         strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be "
                     "included in block creation. (default: %s)"),
                   CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)));
+    strUsage += HelpMessageOpt(
+        "-incrementaltemplate",
+        strprintf(_("Keep the block template for getblocktemplate up to date "
+                    "in the background, as transactions enter and leave the "
+                    "mempool (default: %u)"),
+                  DEFAULT_INCREMENTAL_TEMPLATE));
     if (showDebug) {
         strUsage +=
             HelpMessageOpt("-blockversion=<n>",
@@ -1254,6 +1381,7 @@ ServiceFlags nRelevantServices = NODE_NETWORK;
 int nMaxConnections;
 int nUserMaxConnections;
 int nFD;
+bool fUseEpoll;
 ServiceFlags nLocalServices = NODE_NETWORK;
 } // namespace
 
@@ -1338,6 +1466,9 @@ bool AppInitParameterInteraction(Config &config) {
     if (gArgs.GetArg("-prune", 0)) {
         if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+            return InitError(
+                _("Prune mode is incompatible with -addressindex."));
     }
 
     // if space reserved for high priority transactions is misconfigured
@@ -1359,12 +1490,30 @@ bool AppInitParameterInteraction(Config &config) {
         gArgs.GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
-    // Trim requested connection counts, to fit into system limitations
-    nMaxConnections =
-        std::max(std::min(nMaxConnections,
-                          (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS -
-                                MAX_ADDNODE_CONNECTIONS)),
-                 0);
+    std::string strSocketEvents =
+        gArgs.GetArg("-socketevents", DEFAULT_SOCKETEVENTS);
+    if (strSocketEvents == "epoll") {
+#ifndef HAVE_SYS_EPOLL_H
+        return InitError(
+            _("-socketevents=epoll is not supported on this system."));
+#endif
+        fUseEpoll = true;
+    } else if (strSocketEvents == "select") {
+        fUseEpoll = false;
+    } else {
+        return InitError(strprintf(_("Unknown -socketevents mode '%s'"),
+                                   strSocketEvents));
+    }
+
+    // Trim requested connection counts, to fit into system limitations. Only
+    // select is limited to sockets below FD_SETSIZE.
+    if (!fUseEpoll) {
+        nMaxConnections = std::max(
+            std::min(nMaxConnections,
+                     (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS -
+                           MAX_ADDNODE_CONNECTIONS)),
+            0);
+    }
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS +
                                    MAX_ADDNODE_CONNECTIONS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
@@ -1507,6 +1656,13 @@ bool AppInitParameterInteraction(Config &config) {
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    const std::string strScriptCheckEngine =
+        gArgs.GetArg("-parengine", DEFAULT_SCRIPTCHECK_ENGINE);
+    if (!InitScriptCheckQueue(strScriptCheckEngine)) {
+        return InitError(strprintf("Unknown -parengine value: %s",
+                                   strScriptCheckEngine));
+    }
+
     // Configure excessive block size.
     const uint64_t nProposedExcessiveBlockSize =
         gArgs.GetArg("-excessiveblocksize", DEFAULT_MAX_BLOCK_SIZE);
@@ -1744,6 +1900,7 @@ bool AppInitSanityChecks() {
 bool AppInitMain(Config &config, boost::thread_group &threadGroup,
                  CScheduler &scheduler) {
     const CChainParams &chainparams = config.GetChainParams();
+    const int64_t nInitStart = GetTimeMicros();
     // Step 4a: application initialization
 
     // After daemonization get the data directory lock again and hold on to it
@@ -1786,6 +1943,15 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
 
     InitSignatureCache();
     InitScriptExecutionCache();
+    g_rawblockcache.reset(new CRawBlockCache(
+        std::max(int64_t(0), gArgs.GetArg("-rawblockcache",
+                                          DEFAULT_RAW_BLOCK_CACHE_SIZE))
+        << 20));
+    g_blockfilepool.reset(new CBlockFilePool(MAX_OPEN_BLOCK_FILES));
+    if (gArgs.GetBoolArg("-persistsigcache", DEFAULT_PERSIST_SIGCACHE)) {
+        LoadScriptCaches();
+        fDumpScriptCachesLater = true;
+    }
 
     LogPrintf("Using %u threads for script verification\n",
               nScriptCheckThreads);
@@ -1793,6 +1959,11 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
         for (int i = 0; i < nScriptCheckThreads - 1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
         }
+        // Transactions relayed together have their scripts checked by these,
+        // without holding cs_main.
+        for (int i = 0; i < nScriptCheckThreads - 1; i++) {
+            threadGroup.create_thread(&ThreadMempoolCheck);
+        }
     }
 
     // Start the lightweight task scheduler thread
@@ -1801,6 +1972,10 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>,
                                           "scheduler", serviceLoop));
 
+    if (gArgs.GetBoolArg("-asyncnotifications", DEFAULT_ASYNC_NOTIFICATIONS)) {
+        GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+    }
+
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
      * that the server is there and will be ready later).  Warmup mode will
@@ -2004,13 +2179,19 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20);
     // total cache cannot be greater than nMaxDbcache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20);
-    int64_t nBlockTreeDBCache = nTotalCache / 8;
-    nBlockTreeDBCache = std::min(nBlockTreeDBCache,
-                                 (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)
-                                      ? nMaxBlockDBAndTxIndexCache
-                                      : nMaxBlockDBCache)
-                                     << 20);
+    int64_t nBlockTreeDBCache =
+        std::min(nTotalCache / 8, nMaxBlockDBCache << 20);
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nTxIndexCache =
+        std::min(nTotalCache / 8, gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)
+                                      ? nMaxTxIndexCache << 20
+                                      : 0);
+    nTotalCache -= nTxIndexCache;
+    int64_t nAddressIndexCache = std::min(
+        nTotalCache / 8, gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)
+                             ? nMaxAddressIndexCache << 20
+                             : 0);
+    nTotalCache -= nAddressIndexCache;
     // use 25%-50% of the remainder for disk cache
     int64_t nCoinDBCache =
         std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23));
@@ -2024,6 +2205,14 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n",
               nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+        LogPrintf("* Using %.1fMiB for transaction index database\n",
+                  nTxIndexCache * (1.0 / 1024 / 1024));
+    }
+    if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+        LogPrintf("* Using %.1fMiB for address index database\n",
+                  nAddressIndexCache * (1.0 / 1024 / 1024));
+    }
     LogPrintf("* Using %.1fMiB for chain state database\n",
               nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of "
@@ -2031,6 +2220,15 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
               nCoinCacheUsage * (1.0 / 1024 / 1024),
               nMempoolSizeMax * (1.0 / 1024 / 1024));
 
+    // -dbreadthreads=0 means autodetect
+    int nCoinsReadThreads =
+        gArgs.GetArg("-dbreadthreads", DEFAULT_COINS_READ_THREADS);
+    if (nCoinsReadThreads <= 0) nCoinsReadThreads = GetNumCores();
+    nCoinsReadThreads =
+        std::max(1, std::min(nCoinsReadThreads, MAX_COINS_READ_THREADS));
+    LogPrintf("Using %d threads for reading coins from the database\n",
+              nCoinsReadThreads);
+
     bool fLoaded = false;
     while (!fLoaded && !fRequestShutdown) {
         bool fReset = fReindex;
@@ -2049,8 +2247,10 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
 
                 pblocktree =
                     new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false,
-                                                fReindex || fReindexChainState);
+                pcoinsdbview = new CCoinsViewDB(
+                    nCoinDBCache, false, fReindex || fReindexChainState,
+                    nCoinsReadThreads,
+                    gArgs.GetBoolArg("-asyncflush", DEFAULT_ASYNC_FLUSH));
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
 
                 if (fReindex) {
@@ -2066,10 +2266,14 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
                 }
                 if (fRequestShutdown) break;
 
-                if (!LoadBlockIndex(chainparams)) {
+                int64_t nPhaseStart = GetTimeMicros();
+                if (!LoadBlockIndex(chainparams,
+                                    pcoinsdbview->GetBestBlock())) {
                     strLoadError = _("Error loading block database");
                     break;
                 }
+                RecordStartupPhase("loadblockindex",
+                                   GetTimeMicros() - nPhaseStart);
 
                 // If the loaded chain has a wrong genesis, bail out immediately
                 // (we're likely using a testnet datadir, or the other way
@@ -2088,13 +2292,6 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
                     break;
                 }
 
-                // Check for changed -txindex state
-                if (fTxIndex != gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using "
-                                     "-reindex-chainstate to change -txindex");
-                    break;
-                }
-
                 // Check for changed -prune state.  What we are concerned about
                 // is a user who has pruned blocks in the past, but is now
                 // trying to run unpruned.
@@ -2106,12 +2303,15 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
                     break;
                 }
 
+                nPhaseStart = GetTimeMicros();
                 if (!ReplayBlocks(config, pcoinsdbview)) {
                     strLoadError =
                         _("Unable to replay blocks. You will need to rebuild "
                           "the database using -reindex-chainstate.");
                     break;
                 }
+                RecordStartupPhase("replayblocks",
+                                   GetTimeMicros() - nPhaseStart);
 
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
                 LoadChainTip(chainparams);
@@ -2153,6 +2353,7 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
                     }
                 }
 
+                nPhaseStart = GetTimeMicros();
                 if (!CVerifyDB().VerifyDB(
                         config, pcoinsdbview,
                         gArgs.GetArg("-checklevel", DEFAULT_CHECKLEVEL),
@@ -2160,6 +2361,18 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
                     strLoadError = _("Corrupted block database detected");
                     break;
                 }
+                RecordStartupPhase("verifydb", GetTimeMicros() - nPhaseStart);
+
+                if (gArgs.GetBoolArg("-utxosummary", DEFAULT_UTXO_SUMMARY)) {
+                    uiInterface.InitMessage(_("Loading UTXO set summary..."));
+                    nPhaseStart = GetTimeMicros();
+                    if (!LoadUTXOSummary()) {
+                        strLoadError = _("Error loading UTXO set summary");
+                        break;
+                    }
+                    RecordStartupPhase("utxosummary",
+                                       GetTimeMicros() - nPhaseStart);
+                }
             } catch (const std::exception &e) {
                 LogPrintf("%s\n", e.what());
                 strLoadError = _("Error opening block database");
@@ -2203,6 +2416,30 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    // The indexes catch up with the chain in the background.
+    if (gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+        g_txindex.reset(new CTxIndex(nTxIndexCache, false, fReindex));
+        if (!g_txindex->Start()) {
+            return InitError(_("The transaction index was built on blocks "
+                               "this node does not know. You need to rebuild "
+                               "it using -reindex."));
+        }
+    }
+    if (gArgs.GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+        g_addressindex.reset(
+            new CAddressIndex(nAddressIndexCache, false, fReindex));
+        if (!g_addressindex->Start()) {
+            return InitError(_("The address index was built on blocks this "
+                               "node does not know. You need to rebuild it "
+                               "using -reindex."));
+        }
+    }
+    if (gArgs.GetBoolArg("-incrementaltemplate",
+                         DEFAULT_INCREMENTAL_TEMPLATE)) {
+        g_templateupdater.reset(new BlockTemplateUpdater(config));
+        g_templateupdater->Start();
+    }
+
     fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fsbridge::fopen(est_path, "rb"), SER_DISK,
                          CLIENT_VERSION);
@@ -2305,6 +2542,11 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
+    connOptions.fUseEpoll = fUseEpoll;
+    connOptions.nMessageHandlerThreads = std::max(
+        1, std::min<int>(MAX_MSGHANDLER_THREADS,
+                         gArgs.GetArg("-msghandlerthreads",
+                                      DEFAULT_MSGHANDLER_THREADS)));
 
     if (!connman.Start(scheduler, strNodeError, connOptions)) {
         return InitError(strNodeError);
@@ -2312,6 +2554,7 @@ bool AppInitMain(Config &config, boost::thread_group &threadGroup,
 
     // Step 12: finished
 
+    RecordStartupPhase("init", GetTimeMicros() - nInitStart);
     SetRPCWarmupFinished();
     uiInterface.InitMessage(_("Done loading"));
 
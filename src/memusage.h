@@ -5,8 +5,11 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "flathashmap.h"
 #include "indirectmap.h"
+#include "prevector.h"
 
+#include <cassert>
 #include <cstdlib>
 
 #include <map>
@@ -178,6 +181,16 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z> &m) {
                m.size() +
            MallocUsage(sizeof(void *) * m.bucket_count());
 }
+
+// flathashmap allocates its entries by chunks, next to its table of slots
+
+template <typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const flathashmap<X, Y, Z> &m) {
+    return MallocUsage(sizeof(typename flathashmap<X, Y, Z>::Slot) *
+                       m.slot_count()) +
+           MallocUsage(flathashmap<X, Y, Z>::CHUNK_SIZE) * m.chunk_count() +
+           MallocUsage(sizeof(void *) * m.chunk_capacity());
+}
 } // namespace memusage
 
 #endif // BITCOIN_MEMUSAGE_H
@@ -30,6 +30,7 @@
 #include <queue>
 #include <utility>
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 
@@ -234,8 +235,8 @@ BlockAssembler::CreateNewBlock(const CScript &scriptPubKeyIn) {
 }
 
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter) {
-    for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(iter)) {
-        if (!inBlock.count(parent)) {
+    for (const CTxMemPoolEntry *parent : mempool.GetMemPoolParents(iter)) {
+        if (!inBlock.count(mempool.mapTx.iterator_to(*parent))) {
             return true;
         }
     }
@@ -632,7 +633,9 @@ void BlockAssembler::addPriorityTxs() {
 
             // This tx was successfully added, so add transactions that depend
             // on this one to the priority queue to try again.
-            for (CTxMemPool::txiter child : mempool.GetMemPoolChildren(iter)) {
+            for (const CTxMemPoolEntry *childEntry :
+                 mempool.GetMemPoolChildren(iter)) {
+                CTxMemPool::txiter child = mempool.mapTx.iterator_to(*childEntry);
                 waitPriIter wpiter = waitPriMap.find(child);
                 if (wpiter != waitPriMap.end()) {
                     vecPriority.push_back(
@@ -668,3 +671,532 @@ void IncrementExtraNonce(const Config &config, CBlock *pblock,
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+//! Seconds between assemblies of a template transactions were left out of.
+static const int64_t TEMPLATE_REASSEMBLE_INTERVAL = 30;
+//! Number of template updates kept for long polling clients.
+static const size_t MAX_TEMPLATE_CHANGES = 256;
+
+std::unique_ptr<BlockTemplateUpdater> g_templateupdater;
+
+BlockTemplateUpdater::BlockTemplateUpdater(const Config &configIn)
+    : config(&configIn), fTipChanged(false), fReassemble(false),
+      fProcessing(false), fStop(false), nSequence(0), fChecked(false),
+      pindexPrev(nullptr), nBlockSize(0), nBlockSigOps(0),
+      nFees(0), nLockTimeCutoff(0), nMaxGeneratedBlockSize(0), fDirty(false),
+      nLastAssembled(0) {}
+
+BlockTemplateUpdater::~BlockTemplateUpdater() {
+    Stop();
+}
+
+void BlockTemplateUpdater::Start() {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = false;
+        fTipChanged = true;
+    }
+    mempool.NotifyEntryAdded.connect(
+        boost::bind(&BlockTemplateUpdater::TransactionAdded, this, _1));
+    mempool.NotifyEntryRemoved.connect(
+        boost::bind(&BlockTemplateUpdater::TransactionRemoved, this, _1, _2));
+    RegisterValidationInterface(this);
+    thread = boost::thread([this] {
+        RenameThread("bitcoin-template");
+        ThreadUpdate();
+    });
+}
+
+void BlockTemplateUpdater::Stop() {
+    if (!thread.joinable()) {
+        return;
+    }
+    UnregisterValidationInterface(this);
+    mempool.NotifyEntryRemoved.disconnect(
+        boost::bind(&BlockTemplateUpdater::TransactionRemoved, this, _1, _2));
+    mempool.NotifyEntryAdded.disconnect(
+        boost::bind(&BlockTemplateUpdater::TransactionAdded, this, _1));
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+        queue.clear();
+    }
+    cond.notify_all();
+    thread.join();
+}
+
+void BlockTemplateUpdater::TransactionAdded(CTransactionRef tx) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queue.push_back(Event{tx, true, MemPoolRemovalReason::UNKNOWN});
+    }
+    cond.notify_all();
+}
+
+void BlockTemplateUpdater::TransactionRemoved(CTransactionRef tx,
+                                              MemPoolRemovalReason reason) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        queue.push_back(Event{tx, false, reason});
+    }
+    cond.notify_all();
+}
+
+void BlockTemplateUpdater::UpdatedBlockTip(const CBlockIndex *pindexNew,
+                                           const CBlockIndex *pindexFork,
+                                           bool fInitialDownload) {
+    // Nobody mines on a chain still catching up, the template is assembled on
+    // the next mempool event instead.
+    if (fInitialDownload) {
+        return;
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fTipChanged = true;
+    }
+    cond.notify_all();
+}
+
+void BlockTemplateUpdater::ThreadUpdate() {
+    while (true) {
+        std::deque<Event> events;
+        bool fAssemble;
+        bool fReset;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fStop && queue.empty() && !fTipChanged && !fReassemble) {
+                if (!fDirty) {
+                    cond.wait(lock);
+                    continue;
+                }
+                // Assemble the template again once in a while, to pick up the
+                // transactions which could not be patched in.
+                int64_t nWait = nLastAssembled + TEMPLATE_REASSEMBLE_INTERVAL -
+                                GetTime();
+                if (nWait <= 0) {
+                    break;
+                }
+                cond.timed_wait(lock, boost::posix_time::seconds(nWait));
+            }
+            if (fStop) {
+                return;
+            }
+            events.swap(queue);
+            // Start again from the mempool if the template is invalid. The
+            // changes from the previous template are then not known.
+            fReset = fReassemble || pindexPrev == nullptr;
+            if (fReassemble) {
+                pindexPrev = nullptr;
+            }
+            fAssemble = fTipChanged || pindexPrev == nullptr ||
+                        (fDirty && GetTime() >= nLastAssembled +
+                                                    TEMPLATE_REASSEMBLE_INTERVAL);
+            fTipChanged = false;
+            fReassemble = false;
+            fProcessing = true;
+        }
+
+        std::vector<uint256> vAdded, vRemoved;
+        try {
+            for (const Event &event : events) {
+                // Transactions are mined or disconnected: the tip changed.
+                if (!event.fAdded &&
+                    (event.reason == MemPoolRemovalReason::BLOCK ||
+                     event.reason == MemPoolRemovalReason::REORG)) {
+                    fAssemble = true;
+                }
+            }
+            bool fHaveTip;
+            {
+                LOCK(cs_main);
+                fHaveTip = chainActive.Tip() != nullptr;
+                fAssemble = fAssemble || chainActive.Tip() != pindexPrev;
+            }
+            if (!fHaveTip) {
+                // Nothing to mine on before the genesis block is connected.
+                fAssemble = false;
+            } else if (fAssemble) {
+                Assemble(vAdded, vRemoved);
+            } else {
+                Apply(events, vAdded, vRemoved);
+            }
+            if (fAssemble || !vAdded.empty() || !vRemoved.empty()) {
+                Publish(MakeTemplate(), vAdded, vRemoved, fReset, fAssemble);
+            }
+        } catch (const std::exception &e) {
+            // Try again from scratch on the next event.
+            LogPrintf("%s: failed to update the block template: %s\n",
+                      __func__, e.what());
+            pindexPrev = nullptr;
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fProcessing = false;
+        }
+        cond.notify_all();
+    }
+}
+
+void BlockTemplateUpdater::Assemble(std::vector<uint256> &vAdded,
+                                    std::vector<uint256> &vRemoved) {
+    int64_t nTimeStart = GetTimeMicros();
+    // Mark as assembled right away, so that a failure is not retried in a
+    // loop.
+    nLastAssembled = GetTime();
+    fDirty = false;
+
+    BlockAssembler assembler(*config);
+    std::unique_ptr<CBlockTemplate> pblocktemplate =
+        assembler.CreateNewBlock(CScript() << OP_TRUE);
+    const CBlock &block = pblocktemplate->block;
+
+    const CBlockIndex *pindexPrevNew;
+    {
+        LOCK(cs_main);
+        pindexPrevNew = mapBlockIndex.at(block.hashPrevBlock);
+    }
+    std::unordered_set<uint256, SaltedTxidHasher> setTxidsNew;
+    std::vector<Entry> vEntriesNew;
+    vEntriesNew.reserve(block.vtx.size() - 1);
+    nBlockSize = 1000;
+    nBlockSigOps = 100;
+    nFees = Amount(0);
+    {
+        LOCK(mempool.cs);
+        for (size_t i = 1; i < block.vtx.size(); i++) {
+            const CTransactionRef &tx = block.vtx[i];
+            Entry entry{tx, pblocktemplate->vTxFees[i],
+                        pblocktemplate->vTxFees[i],
+                        ::GetSerializeSize(*tx, SER_NETWORK, PROTOCOL_VERSION),
+                        pblocktemplate->vTxSigOpsCount[i]};
+            CTxMemPool::txiter it = mempool.mapTx.find(tx->GetId());
+            if (it != mempool.mapTx.end()) {
+                entry.nModFee = it->GetModifiedFee();
+            }
+            nBlockSize += entry.nSize;
+            nBlockSigOps += entry.nSigOps;
+            nFees += entry.nFee;
+            setTxidsNew.insert(tx->GetId());
+            vEntriesNew.push_back(std::move(entry));
+        }
+    }
+
+    // Tell what changed, if the template is on the same block.
+    if (pindexPrevNew == pindexPrev) {
+        for (const Entry &entry : vEntries) {
+            if (!setTxidsNew.count(entry.tx->GetId())) {
+                vRemoved.push_back(entry.tx->GetId());
+            }
+        }
+        for (const Entry &entry : vEntriesNew) {
+            if (!setTxids.count(entry.tx->GetId())) {
+                vAdded.push_back(entry.tx->GetId());
+            }
+        }
+    }
+
+    pindexPrev = pindexPrevNew;
+    header = block.GetBlockHeader();
+    vEntries.swap(vEntriesNew);
+    setTxids.clear();
+    setTxids.insert(setTxidsNew.begin(), setTxidsNew.end());
+    nMaxGeneratedBlockSize = assembler.GetMaxGeneratedBlockSize();
+    blockMinFeeRate = assembler.GetBlockMinFeeRate();
+    nLockTimeCutoff =
+        (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+            ? pindexPrev->GetMedianTimePast()
+            : header.GetBlockTime();
+
+    LogPrint(BCLog::BENCH, "BlockTemplateUpdater: assembled template with %u "
+                           "txs in %.2fms\n",
+             vEntries.size(), 0.001 * (GetTimeMicros() - nTimeStart));
+}
+
+void BlockTemplateUpdater::RemoveEntries(
+    std::unordered_set<uint256, SaltedTxidHasher> &setRemove,
+    std::vector<uint256> &vRemoved) {
+    // Parents come before their children, so a single pass catches the
+    // transactions spending removed ones.
+    std::vector<Entry> vKept;
+    vKept.reserve(vEntries.size());
+    for (Entry &entry : vEntries) {
+        bool fRemove = setRemove.count(entry.tx->GetId()) > 0;
+        for (size_t i = 0; !fRemove && i < entry.tx->vin.size(); i++) {
+            fRemove = setRemove.count(entry.tx->vin[i].prevout.hash) > 0;
+        }
+        if (!fRemove) {
+            vKept.push_back(std::move(entry));
+            continue;
+        }
+        setRemove.insert(entry.tx->GetId());
+        setTxids.erase(entry.tx->GetId());
+        nBlockSize -= entry.nSize;
+        nBlockSigOps -= entry.nSigOps;
+        nFees -= entry.nFee;
+        vRemoved.push_back(entry.tx->GetId());
+    }
+    vEntries.swap(vKept);
+    setRemove.clear();
+}
+
+void BlockTemplateUpdater::Apply(const std::deque<Event> &events,
+                                 std::vector<uint256> &vAdded,
+                                 std::vector<uint256> &vRemoved) {
+    const int nHeight = pindexPrev->nHeight + 1;
+    std::unordered_set<uint256, SaltedTxidHasher> setRemove;
+
+    LOCK(mempool.cs);
+    for (const Event &event : events) {
+        const uint256 &txid = event.tx->GetId();
+        if (!event.fAdded) {
+            // Removals are gathered, to go through the template once.
+            if (setTxids.count(txid)) {
+                setRemove.insert(txid);
+            }
+            continue;
+        }
+        if (!setRemove.empty()) {
+            RemoveEntries(setRemove, vRemoved);
+        }
+
+        CTxMemPool::txiter it = mempool.mapTx.find(txid);
+        if (setTxids.count(txid) || it == mempool.mapTx.end()) {
+            continue;
+        }
+
+        // Transactions whose parents were left out need the package selection
+        // of BlockAssembler.
+        bool fMissingParent = false;
+        std::unordered_set<uint256, SaltedTxidHasher> setParents;
+        for (const CTxIn &txin : event.tx->vin) {
+            if (setTxids.count(txin.prevout.hash)) {
+                setParents.insert(txin.prevout.hash);
+            } else if (mempool.mapTx.count(txin.prevout.hash)) {
+                fMissingParent = true;
+                break;
+            }
+        }
+        if (fMissingParent) {
+            fDirty = true;
+            continue;
+        }
+
+        const uint64_t nSize = it->GetTxSize();
+        const int64_t nSigOps = it->GetSigOpCount();
+        const Amount nModFee = it->GetModifiedFee();
+        if (nModFee < blockMinFeeRate.GetFee(nSize)) {
+            continue;
+        }
+        CValidationState state;
+        if (!ContextualCheckTransaction(*config, *event.tx, state, nHeight,
+                                        nLockTimeCutoff)) {
+            continue;
+        }
+
+        // Make room by dropping the transactions with a lower fee rate at the
+        // end of the block. Nothing in the block depends on the last one, but
+        // the new transaction may: its parents are kept.
+        const CFeeRate feeRate(nModFee, nSize);
+        auto fits = [&]() {
+            return nBlockSize + nSize < nMaxGeneratedBlockSize &&
+                   nBlockSigOps + nSigOps <
+                       int64_t(GetMaxBlockSigOpsCount(nBlockSize + nSize));
+        };
+        while (!fits() && !vEntries.empty() &&
+               !setParents.count(vEntries.back().tx->GetId()) &&
+               CFeeRate(vEntries.back().nModFee, vEntries.back().nSize) <
+                   feeRate) {
+            const Entry &last = vEntries.back();
+            setTxids.erase(last.tx->GetId());
+            nBlockSize -= last.nSize;
+            nBlockSigOps -= last.nSigOps;
+            nFees -= last.nFee;
+            vRemoved.push_back(last.tx->GetId());
+            vEntries.pop_back();
+            fDirty = true;
+        }
+        if (!fits()) {
+            fDirty = true;
+            continue;
+        }
+
+        vEntries.push_back(Entry{event.tx, it->GetFee(), nModFee, nSize,
+                                 nSigOps});
+        setTxids.insert(txid);
+        nBlockSize += nSize;
+        nBlockSigOps += nSigOps;
+        nFees += it->GetFee();
+        vAdded.push_back(txid);
+    }
+    if (!setRemove.empty()) {
+        RemoveEntries(setRemove, vRemoved);
+    }
+}
+
+std::shared_ptr<CBlockTemplate> BlockTemplateUpdater::MakeTemplate() const {
+    const int nHeight = pindexPrev->nHeight + 1;
+    std::shared_ptr<CBlockTemplate> pblocktemplate =
+        std::make_shared<CBlockTemplate>();
+    CBlock &block = pblocktemplate->block;
+    block.nVersion = header.nVersion;
+    block.hashPrevBlock = header.hashPrevBlock;
+    block.nTime = header.nTime;
+    block.nBits = header.nBits;
+    block.nNonce = 0;
+
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout.SetNull();
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    coinbaseTx.vout[0].nValue =
+        nFees +
+        GetBlockSubsidy(nHeight, config->GetChainParams().GetConsensus());
+
+    block.vtx.reserve(vEntries.size() + 1);
+    pblocktemplate->vTxFees.reserve(vEntries.size() + 1);
+    pblocktemplate->vTxSigOpsCount.reserve(vEntries.size() + 1);
+    block.vtx.push_back(MakeTransactionRef(coinbaseTx));
+    pblocktemplate->vTxFees.push_back(-1 * nFees);
+    pblocktemplate->vTxSigOpsCount.push_back(
+        GetSigOpCountWithoutP2SH(*block.vtx[0]));
+    for (const Entry &entry : vEntries) {
+        block.vtx.push_back(entry.tx);
+        pblocktemplate->vTxFees.push_back(entry.nFee);
+        pblocktemplate->vTxSigOpsCount.push_back(entry.nSigOps);
+    }
+    return pblocktemplate;
+}
+
+void BlockTemplateUpdater::Publish(
+    const std::shared_ptr<const CBlockTemplate> &pblocktemplate,
+    std::vector<uint256> &vAdded, std::vector<uint256> &vRemoved,
+    bool fReset, bool fCheckedIn) {
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fChecked = fCheckedIn;
+        const uint256 &hashPrev = pblocktemplate->block.hashPrevBlock;
+        if (fReset || hashPrevBlock != hashPrev) {
+            changes.clear();
+            hashPrevBlock = hashPrev;
+        }
+        ptemplate = pblocktemplate;
+        nSequence++;
+        if (!fReset) {
+            changes.push_back(Change{nSequence, std::move(vAdded),
+                                     std::move(vRemoved)});
+        }
+        if (changes.size() > MAX_TEMPLATE_CHANGES) {
+            changes.pop_front();
+        }
+    }
+    cond.notify_all();
+}
+
+std::shared_ptr<const CBlockTemplate>
+BlockTemplateUpdater::GetTemplate(uint64_t &nSequenceOut) const {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nSequenceOut = nSequence;
+    return ptemplate;
+}
+
+bool BlockTemplateUpdater::CheckTemplate(const CBlockTemplate &blocktemplate,
+                                         uint64_t nSequenceIn) {
+    AssertLockHeld(cs_main);
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fChecked && nSequenceIn == nSequence) {
+            return true;
+        }
+    }
+
+    const CBlock &block = blocktemplate.block;
+    if (block.hashPrevBlock != chainActive.Tip()->GetBlockHash()) {
+        // Stale: the template on the new tip is on its way.
+        return false;
+    }
+    CValidationState state;
+    const bool fValid =
+        TestBlockValidity(*config, state, block, chainActive.Tip(),
+                          BlockValidationOptions(false, false));
+    if (!fValid) {
+        LogPrintf("%s: updated block template is invalid: %s\n", __func__,
+                  FormatStateMessage(state));
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nSequenceIn == nSequence) {
+            fChecked = fValid;
+            fReassemble = !fValid;
+        }
+    }
+    cond.notify_all();
+    return fValid;
+}
+
+void BlockTemplateUpdater::BlockUntilUpToDate() const {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!fStop &&
+           (!queue.empty() || fTipChanged || fReassemble || fProcessing)) {
+        cond.wait(lock);
+    }
+}
+
+bool BlockTemplateUpdater::WaitForChange(
+    const uint256 &hashPrev, uint64_t nSequenceKnown,
+    const boost::system_time &minTime,
+    const boost::system_time &deadline) const {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        if (hashPrevBlock != hashPrev ||
+            (nSequence != nSequenceKnown &&
+             boost::get_system_time() >= minTime)) {
+            return true;
+        }
+        if (fStop || boost::get_system_time() >= deadline) {
+            return false;
+        }
+        // Wake up at minTime if an update is only held back by it.
+        boost::system_time wakeTime = deadline;
+        if (nSequence != nSequenceKnown && minTime < deadline) {
+            wakeTime = minTime;
+        }
+        cond.timed_wait(lock, wakeTime);
+    }
+}
+
+bool BlockTemplateUpdater::GetDelta(const uint256 &hashPrev, uint64_t nFrom,
+                                    uint64_t nTo, std::vector<uint256> &vAdded,
+                                    std::vector<uint256> &vRemoved) const {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    // The update to nFrom + 1 must still be known.
+    if (hashPrev != hashPrevBlock || nFrom >= nTo || changes.empty() ||
+        changes.front().nSequence > nFrom + 1 ||
+        changes.back().nSequence < nTo) {
+        return false;
+    }
+
+    std::unordered_set<uint256, SaltedTxidHasher> setAdded, setRemoved;
+    for (const Change &change : changes) {
+        if (change.nSequence <= nFrom || change.nSequence > nTo) {
+            continue;
+        }
+        for (const uint256 &txid : change.vRemoved) {
+            // Added then removed: nothing changed for the client.
+            if (!setAdded.erase(txid)) {
+                setRemoved.insert(txid);
+            }
+        }
+        for (const uint256 &txid : change.vAdded) {
+            if (!setRemoved.erase(txid)) {
+                setAdded.insert(txid);
+            }
+        }
+    }
+    vAdded.assign(setAdded.begin(), setAdded.end());
+    vRemoved.assign(setRemoved.begin(), setRemoved.end());
+    return true;
+}
@@ -8,12 +8,17 @@
 
 #include "primitives/block.h"
 #include "txmempool.h"
+#include "validationinterface.h"
 
 #include "boost/multi_index/ordered_index.hpp"
 #include "boost/multi_index_container.hpp"
 
+#include <boost/thread.hpp>
+
 #include <cstdint>
+#include <deque>
 #include <memory>
+#include <unordered_set>
 
 class CBlockIndex;
 class CChainParams;
@@ -23,6 +28,8 @@ class CScript;
 class CWallet;
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+//! -incrementaltemplate default
+static const bool DEFAULT_INCREMENTAL_TEMPLATE = false;
 
 struct CBlockTemplate {
     CBlock block;
@@ -161,6 +168,7 @@ public:
     CreateNewBlock(const CScript &scriptPubKeyIn);
 
     uint64_t GetMaxGeneratedBlockSize() const { return nMaxGeneratedBlockSize; }
+    CFeeRate GetBlockMinFeeRate() const { return blockMinFeeRate; }
 
 private:
     // utility functions
@@ -209,6 +217,164 @@ private:
                                indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * Keeps a block template on the current tip up to date in the background
+ * (-incrementaltemplate), so that getblocktemplate does not have to assemble a
+ * block under cs_main on every call.
+ *
+ * The template is assembled by BlockAssembler when the tip changes, then
+ * patched as transactions enter and leave the mempool: a transaction whose
+ * in-mempool parents are all in the template is appended to it, making room by
+ * dropping transactions with a lower fee rate from the end if the block is
+ * full, and a transaction leaving the mempool is removed along with the
+ * transactions spending it. When transactions could not be patched in, for
+ * instance because they pay for a parent left out, the template is assembled
+ * again once in a while.
+ *
+ * Each published template has a sequence number, and the transactions added and
+ * removed by the last updates are kept, so that long polling clients can be
+ * told what changed since the template they have.
+ *
+ * A patched template is only checked against the consensus rules when it is
+ * handed out, by CheckTemplate. If it turns out invalid, it is assembled again.
+ */
+class BlockTemplateUpdater : public CValidationInterface {
+private:
+    struct Event {
+        CTransactionRef tx;
+        bool fAdded;
+        MemPoolRemovalReason reason;
+    };
+
+    struct Entry {
+        CTransactionRef tx;
+        Amount nFee;
+        Amount nModFee;
+        uint64_t nSize;
+        int64_t nSigOps;
+    };
+
+    //! Transactions added and removed by the update to nSequence.
+    struct Change {
+        uint64_t nSequence;
+        std::vector<uint256> vAdded;
+        std::vector<uint256> vRemoved;
+    };
+
+    const Config *config;
+
+    mutable boost::mutex mutex;
+    mutable boost::condition_variable cond;
+    //! Mempool events not applied yet.
+    std::deque<Event> queue;
+    bool fTipChanged;
+    //! The published template is invalid, and needs to be assembled again.
+    bool fReassemble;
+    bool fProcessing;
+    bool fStop;
+    //! The published template, with its previous block and sequence number.
+    std::shared_ptr<const CBlockTemplate> ptemplate;
+    uint256 hashPrevBlock;
+    uint64_t nSequence;
+    //! Whether the published template is known to be valid.
+    bool fChecked;
+    //! Last updates of the template on hashPrevBlock.
+    std::deque<Change> changes;
+
+    boost::thread thread;
+
+    // Working state, only used by the updater thread.
+    const CBlockIndex *pindexPrev;
+    CBlockHeader header;
+    std::vector<Entry> vEntries;
+    std::unordered_set<uint256, SaltedTxidHasher> setTxids;
+    uint64_t nBlockSize;
+    int64_t nBlockSigOps;
+    Amount nFees;
+    int64_t nLockTimeCutoff;
+    uint64_t nMaxGeneratedBlockSize;
+    CFeeRate blockMinFeeRate;
+    //! Whether transactions were left out since the template was assembled.
+    bool fDirty;
+    int64_t nLastAssembled;
+
+    void ThreadUpdate();
+    //! Assemble the template from scratch.
+    void Assemble(std::vector<uint256> &vAdded, std::vector<uint256> &vRemoved);
+    //! Patch the template with the mempool events.
+    void Apply(const std::deque<Event> &events, std::vector<uint256> &vAdded,
+               std::vector<uint256> &vRemoved);
+    //! Drop the transactions of setRemove, and those spending them.
+    void RemoveEntries(std::unordered_set<uint256, SaltedTxidHasher> &setRemove,
+                       std::vector<uint256> &vRemoved);
+    //! Build the template out of the working state.
+    std::shared_ptr<CBlockTemplate> MakeTemplate() const;
+    /**
+     * Hand the template out to the clients. With fReset, the changes from the
+     * previous template are not known and clients need the whole template.
+     * fChecked tells whether the template is known to be valid, as it is once
+     * assembled by BlockAssembler.
+     */
+    void Publish(const std::shared_ptr<const CBlockTemplate> &pblocktemplate,
+                 std::vector<uint256> &vAdded, std::vector<uint256> &vRemoved,
+                 bool fReset, bool fChecked);
+
+    void TransactionAdded(CTransactionRef tx);
+    void TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew,
+                         const CBlockIndex *pindexFork,
+                         bool fInitialDownload) override;
+
+public:
+    explicit BlockTemplateUpdater(const Config &configIn);
+    ~BlockTemplateUpdater();
+
+    void Start();
+    void Stop();
+
+    /**
+     * Get the current template and its sequence number, null if there is none
+     * yet. The template may be on a previous tip for a short while after the
+     * tip changed.
+     */
+    std::shared_ptr<const CBlockTemplate> GetTemplate(uint64_t &nSequenceOut) const;
+
+    /**
+     * Check the template of sequence number nSequenceIn, as got from
+     * GetTemplate, against the consensus rules on the tip, once. If it is
+     * invalid, it is assembled again in the background. Returns whether it is
+     * valid.
+     */
+    bool CheckTemplate(const CBlockTemplate &blocktemplate,
+                       uint64_t nSequenceIn);
+
+    /** Wait until the mempool events and tip changes so far are applied. */
+    void BlockUntilUpToDate() const;
+
+    /**
+     * Wait until deadline for the template to be built on another block than
+     * hashPrev, or to be updated past nSequenceKnown if it is later than
+     * minTime. Returns whether it was.
+     */
+    bool WaitForChange(const uint256 &hashPrev, uint64_t nSequenceKnown,
+                       const boost::system_time &minTime,
+                       const boost::system_time &deadline) const;
+
+    /**
+     * Get the transactions added to and removed from the template on hashPrev
+     * between sequence numbers nFrom and nTo. Returns false if these updates
+     * are not known (anymore).
+     */
+    bool GetDelta(const uint256 &hashPrev, uint64_t nFrom, uint64_t nTo,
+                  std::vector<uint256> &vAdded,
+                  std::vector<uint256> &vRemoved) const;
+};
+
+//! The block template updater, if enabled.
+extern std::unique_ptr<BlockTemplateUpdater> g_templateupdater;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(const Config &config, CBlock *pblock,
                          const CBlockIndex *pindexPrev,
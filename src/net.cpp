@@ -18,6 +18,7 @@
 #include "crypto/sha256.h"
 #include "hash.h"
 #include "netbase.h"
+#include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
 #include "ui_interface.h"
@@ -36,11 +37,37 @@
 #include <miniupnpc/upnperrors.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #include <cmath>
 
 // Dump addresses to peers.dat and banlist.dat every 15 minutes (900s)
 #define DUMP_ADDRESSES_INTERVAL 900
 
+// Size of the buffer a socket is read into, typical socket buffers are 8K-64K.
+static const int RECV_BUFFER_SIZE = 0x10000;
+
+// Maximum number of socket events taken from the epoll instance at once.
+static const int MAX_SOCKET_EVENTS = 64;
+
+// Maximum number of buffers queued messages are sent from in one call.
+static const int MAX_SEND_BUFFERS = 64;
+
+// Space reserved for a message's data when its header arrives. The size in the
+// header is not trusted beyond this, the buffer then grows with what arrives.
+static const uint32_t RECV_MESSAGE_RESERVE = 256 * 1024;
+
+// Receive buffers up to this size are kept for reuse, at most this many.
+static const size_t MAX_POOLED_RECV_BUFFER_SIZE = 256 * 1024;
+static const size_t MAX_POOLED_RECV_BUFFERS = 64;
+
+// Data a block transaction which did not parse yet needs to grow by before it
+// is parsed again. Beyond this, the wait doubles with the partial transaction,
+// so that a transaction trickling in is parsed in linear time.
+static const uint32_t MIN_BLOCK_PARSE_RETRY = 1024;
+
 // We add a random period time (0 to 1 seconds) to feeler connections to prevent
 // synchronization.
 #define FEELER_SLEEP_WINDOW 1
@@ -61,8 +88,6 @@
 #endif
 #endif
 
-static const std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
-
 // SHA256("netgroup")[0:8]
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL;
 // SHA256("localhostnonce")[0:8]
@@ -356,7 +381,7 @@ CNode *CConnman::ConnectNode(CAddress addrConnect, const char *pszDest,
                                       nConnectTimeout, &proxyConnectionFailed)
                 : ConnectSocket(addrConnect, hSocket, nConnectTimeout,
                                 &proxyConnectionFailed)) {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!fUseEpoll && !IsSelectableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created "
                       "(fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
@@ -669,6 +694,11 @@ void CNode::copyStats(CNodeStats &stats) {
         stats.mapRecvBytesPerMsgCmd = mapRecvBytesPerMsgCmd;
         stats.nRecvBytes = nRecvBytes;
     }
+    {
+        LOCK(cs_vProcessMsg);
+        stats.nProcessQueueCount = vProcessMsg.size();
+        stats.nProcessQueueSize = nProcessQueueSize;
+    }
     stats.fWhitelisted = fWhitelisted;
 
     // It is common for nodes with good ping times to suddenly become lagged,
@@ -714,8 +744,8 @@ bool CNode::ReceiveMsgBytes(const Config &config, const char *pch,
     while (nBytes > 0) {
         // Get current incomplete message, or create a new one.
         if (vRecvMsg.empty() || vRecvMsg.back().complete()) {
-            vRecvMsg.push_back(CNetMessage(Params().NetMagic(), SER_NETWORK,
-                                           INIT_PROTO_VERSION));
+            vRecvMsg.emplace_back(Params().NetMagic(), SER_NETWORK,
+                                  INIT_PROTO_VERSION);
         }
 
         CNetMessage &msg = vRecvMsg.back();
@@ -788,6 +818,74 @@ int CNode::GetSendVersion() const {
     return nSendVersion;
 }
 
+namespace {
+/**
+ * Deserializes from the part of a message that has been received so far.
+ * Running out of data throws, like other streams do, but is told apart from
+ * malformed data by AtEnd().
+ */
+class PartialDataReader {
+private:
+    const int nType;
+    const int nVersion;
+    const char *pbegin;
+    size_t nSize;
+    size_t nPos;
+    bool fAtEnd;
+
+public:
+    PartialDataReader(int nTypeIn, int nVersionIn, const char *pbeginIn,
+                      size_t nSizeIn, size_t nPosIn)
+        : nType(nTypeIn), nVersion(nVersionIn), pbegin(pbeginIn),
+          nSize(nSizeIn), nPos(nPosIn), fAtEnd(false) {}
+
+    template <typename T> PartialDataReader &operator>>(T &obj) {
+        ::Unserialize(*this, obj);
+        return *this;
+    }
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+    size_t GetPos() const { return nPos; }
+    bool AtEnd() const { return fAtEnd; }
+
+    void read(char *dst, size_t n) {
+        if (n > nSize - nPos) {
+            fAtEnd = true;
+            throw std::ios_base::failure(
+                "PartialDataReader::read(): end of data");
+        }
+        memcpy(dst, pbegin + nPos, n);
+        nPos += n;
+    }
+};
+
+/** Buffers of processed messages, kept to receive later messages into. */
+CCriticalSection cs_recvBufferPool;
+std::vector<CSerializeData> vRecvBufferPool;
+
+void TakeRecvBuffer(CDataStream &stream) {
+    LOCK(cs_recvBufferPool);
+    if (!vRecvBufferPool.empty()) {
+        stream.swap(vRecvBufferPool.back());
+        vRecvBufferPool.pop_back();
+    }
+}
+
+void ReturnRecvBuffer(CDataStream &stream) {
+    if (stream.capacity() == 0 ||
+        stream.capacity() > MAX_POOLED_RECV_BUFFER_SIZE) {
+        return;
+    }
+    stream.clear();
+    LOCK(cs_recvBufferPool);
+    if (vRecvBufferPool.size() < MAX_POOLED_RECV_BUFFERS) {
+        vRecvBufferPool.emplace_back();
+        stream.swap(vRecvBufferPool.back());
+    }
+}
+} // namespace
+
 int CNetMessage::readHeader(const Config &config, const char *pch,
                             uint32_t nBytes) {
     // copy data to temporary parsing buffer
@@ -818,6 +916,12 @@ int CNetMessage::readHeader(const Config &config, const char *pch,
     // switch state to reading message data
     in_data = true;
 
+    TakeRecvBuffer(vRecv);
+    vRecv.reserve(std::min(hdr.nMessageSize, RECV_MESSAGE_RESERVE));
+    if (hdr.GetCommand() == NetMsgType::BLOCK) {
+        pblock = std::make_shared<CBlock>();
+    }
+
     return nCopy;
 }
 
@@ -825,19 +929,65 @@ int CNetMessage::readData(const char *pch, uint32_t nBytes) {
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message
-        // size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+    if (vRecv.capacity() < nDataPos + nCopy) {
+        // Double the buffer, but never beyond the total message size, so that
+        // a peer only gets as much allocated as it has already sent.
+        vRecv.reserve(std::min<size_t>(
+            hdr.nMessageSize,
+            std::max<size_t>(nDataPos + nCopy, 2 * vRecv.capacity())));
     }
 
     hasher.Write((const uint8_t *)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    vRecv.write(pch, nCopy);
     nDataPos += nCopy;
 
+    if (pblock && (complete() || nDataPos >= nParseRetryPos)) {
+        ParseBlock();
+    }
+
     return nCopy;
 }
 
+void CNetMessage::ParseBlock() {
+    nParseCount++;
+    PartialDataReader reader(vRecv.GetType(), vRecv.GetVersion(),
+                             vRecv.data(), nDataPos, nParsePos);
+    try {
+        if (!fBlockHeaderParsed) {
+            reader >> *static_cast<CBlockHeader *>(pblock.get());
+            nParseTxLeft = ReadCompactSize(reader);
+            nParsePos = reader.GetPos();
+            fBlockHeaderParsed = true;
+        }
+        while (nParseTxLeft > 0) {
+            CTransactionRef tx;
+            reader >> tx;
+            pblock->vtx.push_back(std::move(tx));
+            nParsePos = reader.GetPos();
+            nParseTxLeft--;
+        }
+    } catch (const std::ios_base::failure &) {
+        // Running out of data only means the rest has yet to arrive.
+        if (!reader.AtEnd() || complete()) {
+            pblock.reset();
+            return;
+        }
+        nParseRetryPos =
+            nDataPos + std::max(nDataPos - nParsePos, MIN_BLOCK_PARSE_RETRY);
+    }
+}
+
+std::shared_ptr<CBlock> CNetMessage::GetReceivedBlock() const {
+    if (!complete() || !fBlockHeaderParsed || nParseTxLeft > 0) {
+        return nullptr;
+    }
+    return pblock;
+}
+
+CNetMessage::~CNetMessage() {
+    ReturnRecvBuffer(vRecv);
+}
+
 const uint256 &CNetMessage::GetMessageHash() const {
     assert(complete());
     if (data_hash.IsNull()) {
@@ -847,14 +997,67 @@ const uint256 &CNetMessage::GetMessageHash() const {
 }
 
 // requires LOCK(cs_vSend)
+/**
+ * Send the unsent part of the queued messages, starting nOffset bytes into the
+ * first one. Where the platform allows it, as many buffers as fit in one call
+ * are handed to the socket at once. Returns what send returns.
+ */
+static ssize_t SendQueuedMessages(SOCKET hSocket,
+                                  std::deque<CQueuedNetMsg>::const_iterator it,
+                                  std::deque<CQueuedNetMsg>::const_iterator end,
+                                  size_t nOffset, size_t &nGathered) {
+#ifndef WIN32
+    struct iovec iov[MAX_SEND_BUFFERS];
+    int nBuffers = 0;
+    nGathered = 0;
+    for (; it != end && nBuffers + 2 <= MAX_SEND_BUFFERS; ++it) {
+        const std::vector<uint8_t> &data = it->payload->GetData();
+        if (nOffset < CMessageHeader::HEADER_SIZE) {
+            iov[nBuffers].iov_base = const_cast<uint8_t *>(it->header) + nOffset;
+            iov[nBuffers].iov_len = CMessageHeader::HEADER_SIZE - nOffset;
+            nGathered += iov[nBuffers].iov_len;
+            nBuffers++;
+            nOffset = CMessageHeader::HEADER_SIZE;
+        }
+        if (nOffset < it->size()) {
+            size_t nDataOffset = nOffset - CMessageHeader::HEADER_SIZE;
+            iov[nBuffers].iov_base =
+                const_cast<uint8_t *>(data.data()) + nDataOffset;
+            iov[nBuffers].iov_len = data.size() - nDataOffset;
+            nGathered += iov[nBuffers].iov_len;
+            nBuffers++;
+        }
+        nOffset = 0;
+    }
+
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nBuffers;
+    return sendmsg(hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    const uint8_t *pchData;
+    if (nOffset < CMessageHeader::HEADER_SIZE) {
+        pchData = it->header + nOffset;
+        nGathered = CMessageHeader::HEADER_SIZE - nOffset;
+    } else {
+        size_t nDataOffset = nOffset - CMessageHeader::HEADER_SIZE;
+        pchData = it->payload->GetData().data() + nDataOffset;
+        nGathered = it->payload->size() - nDataOffset;
+    }
+    return send(hSocket, reinterpret_cast<const char *>(pchData), nGathered,
+                MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
+
 size_t CConnman::SocketSendData(CNode *pnode) const {
     AssertLockHeld(pnode->cs_vSend);
     size_t nSentSize = 0;
     size_t nMsgCount = 0;
 
-    for (const auto &data : pnode->vSendMsg) {
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = 0;
+    while (nMsgCount < pnode->vSendMsg.size()) {
+        assert(pnode->vSendMsg[nMsgCount].size() > pnode->nSendOffset);
+        ssize_t nBytes = 0;
+        size_t nGathered = 0;
 
         {
             LOCK(pnode->cs_hSocket);
@@ -862,11 +1065,9 @@ size_t CConnman::SocketSendData(CNode *pnode) const {
                 break;
             }
 
-            nBytes = send(pnode->hSocket,
-                          reinterpret_cast<const char *>(data.data()) +
-                              pnode->nSendOffset,
-                          data.size() - pnode->nSendOffset,
-                          MSG_NOSIGNAL | MSG_DONTWAIT);
+            nBytes = SendQueuedMessages(
+                pnode->hSocket, pnode->vSendMsg.begin() + nMsgCount,
+                pnode->vSendMsg.end(), pnode->nSendOffset, nGathered);
         }
 
         if (nBytes == 0) {
@@ -889,17 +1090,27 @@ size_t CConnman::SocketSendData(CNode *pnode) const {
         assert(nBytes > 0);
         pnode->nLastSend = GetSystemTimeInSeconds();
         pnode->nSendBytes += nBytes;
-        pnode->nSendOffset += nBytes;
         nSentSize += nBytes;
-        if (pnode->nSendOffset != data.size()) {
-            // could not send full message; stop sending more
-            break;
+
+        // Drop the messages that were sent in full.
+        size_t nLeft = nBytes;
+        while (nLeft > 0) {
+            const size_t nMsgSize = pnode->vSendMsg[nMsgCount].size();
+            if (pnode->nSendOffset + nLeft < nMsgSize) {
+                pnode->nSendOffset += nLeft;
+                break;
+            }
+            nLeft -= nMsgSize - pnode->nSendOffset;
+            pnode->nSendOffset = 0;
+            pnode->nSendSize -= nMsgSize;
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            nMsgCount++;
         }
 
-        pnode->nSendOffset = 0;
-        pnode->nSendSize -= data.size();
-        pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
-        nMsgCount++;
+        if (size_t(nBytes) != nGathered) {
+            // could not send everything; stop sending more
+            break;
+        }
     }
 
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(),
@@ -1158,7 +1369,7 @@ void CConnman::AcceptConnection(const ListenSocket &hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket)) {
+    if (!fUseEpoll && !IsSelectableSocket(hSocket)) {
         LogPrintf("connection from %s dropped: non-selectable socket\n",
                   addr.ToString());
         CloseSocket(hSocket);
@@ -1205,322 +1416,482 @@ void CConnman::AcceptConnection(const ListenSocket &hListenSocket) {
 
     LogPrint(BCLog::NET, "connection from %s accepted\n", addr.ToString());
 
+    AddSocketEvents(pnode);
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
 }
 
-void CConnman::ThreadSocketHandler() {
-    unsigned int nPrevNodeCount = 0;
-    while (!interruptNet) {
-        //
-        // Disconnect nodes
-        //
-        {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            std::vector<CNode *> vNodesCopy = vNodes;
-            for (CNode *pnode : vNodesCopy) {
-                if (pnode->fDisconnect) {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode),
-                                 vNodes.end());
+void CConnman::DisconnectNodes() {
+    {
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        std::vector<CNode *> vNodesCopy = vNodes;
+        for (CNode *pnode : vNodesCopy) {
+            if (pnode->fDisconnect) {
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode),
+                             vNodes.end());
+                setNodesRecvReady.erase(pnode);
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
-                    pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // hold in disconnected pool until all refs are released
+                pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
-        {
-            // Delete disconnected nodes
-            std::list<CNode *> vNodesDisconnectedCopy = vNodesDisconnected;
-            for (CNode *pnode : vNodesDisconnectedCopy) {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_inventory, lockInv);
-                        if (lockInv) {
-                            TRY_LOCK(pnode->cs_vSend, lockSend);
-                            if (lockSend) {
-                                fDelete = true;
-                            }
+    }
+    {
+        // Delete disconnected nodes
+        std::list<CNode *> vNodesDisconnectedCopy = vNodesDisconnected;
+        for (CNode *pnode : vNodesDisconnectedCopy) {
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_inventory, lockInv);
+                    if (lockInv) {
+                        TRY_LOCK(pnode->cs_vSend, lockSend);
+                        if (lockSend) {
+                            fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        DeleteNode(pnode);
-                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    DeleteNode(pnode);
                 }
             }
         }
-        size_t vNodesSize;
-        {
-            LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
+    }
+}
+
+void CConnman::NotifyNumConnectionsChanged() {
+    size_t vNodesSize;
+    {
+        LOCK(cs_vNodes);
+        vNodesSize = vNodes.size();
+    }
+    if (vNodesSize != nPrevNodeCount) {
+        nPrevNodeCount = vNodesSize;
+        if (clientInterface) {
+            clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
         }
-        if (vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            if (clientInterface) {
-                clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
-            }
+    }
+}
+
+void CConnman::InactivityCheck(CNode *pnode) {
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint(BCLog::NET,
+                     "socket no message in first 60 seconds, %d %d from %d\n",
+                     pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv >
+                   (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL
+                                                      : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent &&
+                   pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 <
+                       GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n",
+                      0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        } else if (!pnode->fSuccessfullyConnected) {
+            LogPrintf("version handshake timeout from %d\n", pnode->id);
+            pnode->fDisconnect = true;
         }
+    }
+}
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        // Frequency to poll pnode->vSend
-        timeout.tv_usec = 50000;
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+/**
+ * Read once from the node's socket and hand off all complete messages to the
+ * processor. Returns the number of bytes read, which is 0 if the socket was
+ * closed, had no data or failed.
+ */
+int CConnman::SocketRecv(CNode *pnode) {
+    char pchBuf[RECV_BUFFER_SIZE];
+    int32_t nBytes = 0;
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET) {
+            return 0;
+        }
+        nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    }
+    if (nBytes > 0) {
+        bool notify = false;
+        if (!pnode->ReceiveMsgBytes(*config, pchBuf, nBytes, notify)) {
+            pnode->CloseSocketDisconnect();
+        }
+        RecordBytesRecv(nBytes);
+        if (notify) {
+            size_t nSizeAdded = 0;
+            auto it(pnode->vRecvMsg.begin());
+            for (; it != pnode->vRecvMsg.end(); ++it) {
+                if (!it->complete()) {
+                    break;
+                }
+                nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+            }
+            {
+                LOCK(pnode->cs_vProcessMsg);
+                pnode->vProcessMsg.splice(pnode->vProcessMsg.end(),
+                                          pnode->vRecvMsg,
+                                          pnode->vRecvMsg.begin(), it);
+                pnode->nProcessQueueSize += nSizeAdded;
+                pnode->fPauseRecv =
+                    pnode->nProcessQueueSize > nReceiveFloodSize;
+            }
+            WakeMessageHandler();
+        }
+        return nBytes;
+    }
 
-        for (const ListenSocket &hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+    if (nBytes == 0) {
+        // socket closed gracefully
+        if (!pnode->fDisconnect) {
+            LogPrint(BCLog::NET, "socket closed\n");
+        }
+        pnode->CloseSocketDisconnect();
+    } else {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE &&
+            nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
+            if (!pnode->fDisconnect) {
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            }
+            pnode->CloseSocketDisconnect();
         }
+    }
+    return 0;
+}
 
-        {
-            LOCK(cs_vNodes);
-            for (CNode *pnode : vNodes) {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As
-                // this only happens when optimistic write failed, we choose to
-                // first drain the write buffer in this case before receiving
-                // more. This avoids needlessly queueing received data, if the
-                // remote peer is not themselves receiving data. This means
-                // properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer,
-                // select() for receiving data.
-                // * Hand off all complete messages to the processor, to be
-                // handled without blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
+void CConnman::SocketHandlerSelect() {
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    // Frequency to poll pnode->vSend
+    timeout.tv_usec = 50000;
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for (const ListenSocket &hListenSocket : vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
 
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET) {
-                    continue;
-                }
+    {
+        LOCK(cs_vNodes);
+        for (CNode *pnode : vNodes) {
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this
+            // only happens when optimistic write failed, we choose to first
+            // drain the write buffer in this case before receiving more. This
+            // avoids needlessly queueing received data, if the remote peer is
+            // not themselves receiving data. This means properly utilizing
+            // TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer,
+            // select() for receiving data.
+            // * Hand off all complete messages to the processor, to be handled
+            // without blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
+            {
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET) {
+                continue;
+            }
 
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = std::max(hSocketMax, pnode->hSocket);
+            have_fds = true;
+
+            if (select_send) {
+                FD_SET(pnode->hSocket, &fdsetSend);
+                continue;
+            }
+            if (select_recv) {
+                FD_SET(pnode->hSocket, &fdsetRecv);
             }
         }
+    }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0, &fdsetRecv,
-                             &fdsetSend, &fdsetError, &timeout);
-        if (interruptNet) {
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0, &fdsetRecv, &fdsetSend,
+                         &fdsetError, &timeout);
+    if (interruptNet) {
+        return;
+    }
+
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++) {
+                FD_SET(i, &fdsetRecv);
+            }
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        if (!interruptNet.sleep_for(
+                std::chrono::milliseconds(timeout.tv_usec / 1000))) {
             return;
         }
+    }
 
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++) {
-                    FD_SET(i, &fdsetRecv);
-                }
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(
-                    std::chrono::milliseconds(timeout.tv_usec / 1000))) {
-                return;
-            }
+    //
+    // Accept new connections
+    //
+    for (const ListenSocket &hListenSocket : vhListenSocket) {
+        if (hListenSocket.socket != INVALID_SOCKET &&
+            FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
+            AcceptConnection(hListenSocket);
+        }
+    }
+
+    //
+    // Service each socket
+    //
+    std::vector<CNode *> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        for (CNode *pnode : vNodesCopy) {
+            pnode->AddRef();
+        }
+    }
+    for (CNode *pnode : vNodesCopy) {
+        if (interruptNet) {
+            return;
         }
 
         //
-        // Accept new connections
+        // Receive
         //
-        for (const ListenSocket &hListenSocket : vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET &&
-                FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                AcceptConnection(hListenSocket);
+        bool recvSet = false;
+        bool sendSet = false;
+        bool errorSet = false;
+        {
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET) {
+                continue;
             }
+            recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
+            sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
+            errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+        }
+        if (recvSet || errorSet) {
+            SocketRecv(pnode);
         }
 
         //
-        // Service each socket
+        // Send
         //
-        std::vector<CNode *> vNodesCopy;
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode *pnode : vNodesCopy) {
-                pnode->AddRef();
+        if (sendSet) {
+            LOCK(pnode->cs_vSend);
+            size_t nBytes = SocketSendData(pnode);
+            if (nBytes) {
+                RecordBytesSent(nBytes);
             }
         }
+
+        //
+        // Inactivity checking
+        //
+        InactivityCheck(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
         for (CNode *pnode : vNodesCopy) {
-            if (interruptNet) {
+            pnode->Release();
+        }
+    }
+}
+
+void CConnman::SocketHandlerEpoll() {
+#ifdef HAVE_SYS_EPOLL_H
+    // Sockets are edge triggered, so a node stays in setNodesRecvReady until
+    // a read comes up short. Reading one buffer per node per pass keeps a busy
+    // peer from starving the others, and while any of them can make progress
+    // the wait below must not block. The same flow control as the select loop
+    // applies: a node with queued sends is not read from until they drain.
+    bool fRecvPending = false;
+    for (CNode *pnode : setNodesRecvReady) {
+        if (pnode->fPauseRecv) {
+            continue;
+        }
+        LOCK(pnode->cs_vSend);
+        if (pnode->vSendMsg.empty()) {
+            fRecvPending = true;
+            break;
+        }
+    }
+
+    struct epoll_event events[MAX_SOCKET_EVENTS];
+    int nEvents =
+        epoll_wait(epollfd, events, MAX_SOCKET_EVENTS, fRecvPending ? 0 : 50);
+    if (interruptNet) {
+        return;
+    }
+
+    if (nEvents < 0) {
+        int nErr = errno;
+        if (nErr != EINTR) {
+            LogPrintf("socket epoll error %s\n", NetworkErrorString(nErr));
+            if (!interruptNet.sleep_for(std::chrono::milliseconds(50))) {
                 return;
             }
+        }
+        nEvents = 0;
+    }
 
-            //
-            // Receive
-            //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
-            {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET) {
-                    continue;
-                }
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
-            }
-            if (recvSet || errorSet) {
-                // typical socket buffer is 8K-64K
-                char pchBuf[0x10000];
-                int32_t nBytes = 0;
-                {
-                    LOCK(pnode->cs_hSocket);
-                    if (pnode->hSocket == INVALID_SOCKET) {
-                        continue;
-                    }
-                    nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf),
-                                  MSG_DONTWAIT);
-                }
-                if (nBytes > 0) {
-                    bool notify = false;
-                    if (!pnode->ReceiveMsgBytes(*config, pchBuf, nBytes,
-                                                notify)) {
-                        pnode->CloseSocketDisconnect();
-                    }
-                    RecordBytesRecv(nBytes);
-                    if (notify) {
-                        size_t nSizeAdded = 0;
-                        auto it(pnode->vRecvMsg.begin());
-                        for (; it != pnode->vRecvMsg.end(); ++it) {
-                            if (!it->complete()) {
-                                break;
-                            }
-                            nSizeAdded +=
-                                it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                        }
-                        {
-                            LOCK(pnode->cs_vProcessMsg);
-                            pnode->vProcessMsg.splice(
-                                pnode->vProcessMsg.end(), pnode->vRecvMsg,
-                                pnode->vRecvMsg.begin(), it);
-                            pnode->nProcessQueueSize += nSizeAdded;
-                            pnode->fPauseRecv =
-                                pnode->nProcessQueueSize > nReceiveFloodSize;
-                        }
-                        WakeMessageHandler();
-                    }
-                } else if (nBytes == 0) {
-                    // socket closed gracefully
-                    if (!pnode->fDisconnect) {
-                        LogPrint(BCLog::NET, "socket closed\n");
-                    }
-                    pnode->CloseSocketDisconnect();
-                } else if (nBytes < 0) {
-                    // error
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE &&
-                        nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                        if (!pnode->fDisconnect) {
-                            LogPrintf("socket recv error %s\n",
-                                      NetworkErrorString(nErr));
-                        }
-                        pnode->CloseSocketDisconnect();
-                    }
-                }
+    std::vector<CNode *> vNodesSendReady;
+    for (int i = 0; i < nEvents; i++) {
+        // Listening sockets are registered with a pointer to their entry in
+        // vhListenSocket, nodes with a pointer to the node.
+        const ListenSocket *pListenSocket = nullptr;
+        for (const ListenSocket &hListenSocket : vhListenSocket) {
+            if (events[i].data.ptr == &hListenSocket) {
+                pListenSocket = &hListenSocket;
+                break;
             }
+        }
+        if (pListenSocket) {
+            AcceptConnection(*pListenSocket);
+            continue;
+        }
 
-            //
-            // Send
-            //
-            if (sendSet) {
-                LOCK(pnode->cs_vSend);
-                size_t nBytes = SocketSendData(pnode);
-                if (nBytes) {
-                    RecordBytesSent(nBytes);
-                }
-            }
+        // Nodes are only deleted by this thread, and closing their socket
+        // removes it from the epoll set, so the pointer is still valid here.
+        CNode *pnode = static_cast<CNode *>(events[i].data.ptr);
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+            setNodesRecvReady.insert(pnode);
+        }
+        if (events[i].events & EPOLLOUT) {
+            vNodesSendReady.push_back(pnode);
+        }
+    }
 
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint(BCLog::NET, "socket no message in first 60 "
-                                         "seconds, %d %d from %d\n",
-                             pnode->nLastRecv != 0, pnode->nLastSend != 0,
-                             pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n",
-                              nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv >
-                           (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL
-                                                              : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n",
-                              nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent &&
-                           pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 <
-                               GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n",
-                              0.000001 *
-                                  (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                } else if (!pnode->fSuccessfullyConnected) {
-                    LogPrintf("version handshake timeout from %d\n", pnode->id);
-                    pnode->fDisconnect = true;
-                }
-            }
+    //
+    // Send
+    //
+    for (CNode *pnode : vNodesSendReady) {
+        if (interruptNet) {
+            return;
+        }
+        LOCK(pnode->cs_vSend);
+        size_t nBytes = SocketSendData(pnode);
+        if (nBytes) {
+            RecordBytesSent(nBytes);
+        }
+    }
+
+    //
+    // Receive
+    //
+    auto it = setNodesRecvReady.begin();
+    while (it != setNodesRecvReady.end()) {
+        if (interruptNet) {
+            return;
+        }
+        CNode *pnode = *it;
+        if (pnode->fPauseRecv) {
+            ++it;
+            continue;
         }
         {
-            LOCK(cs_vNodes);
-            for (CNode *pnode : vNodesCopy) {
-                pnode->Release();
+            LOCK(pnode->cs_vSend);
+            if (!pnode->vSendMsg.empty()) {
+                ++it;
+                continue;
             }
         }
+        if (SocketRecv(pnode) == RECV_BUFFER_SIZE) {
+            ++it;
+        } else {
+            it = setNodesRecvReady.erase(it);
+        }
+    }
+
+    //
+    // Inactivity checking
+    //
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime != nLastInactivityCheck) {
+        nLastInactivityCheck = nTime;
+        LOCK(cs_vNodes);
+        for (CNode *pnode : vNodes) {
+            InactivityCheck(pnode);
+        }
+    }
+#endif
+}
+
+void CConnman::AddSocketEvents(CNode *pnode) {
+#ifdef HAVE_SYS_EPOLL_H
+    if (epollfd == -1) {
+        return;
+    }
+
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET) {
+        return;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("socket epoll_ctl error %s\n", NetworkErrorString(errno));
+        pnode->fDisconnect = true;
+    }
+#endif
+}
+
+void CConnman::ThreadSocketHandler() {
+    while (!interruptNet) {
+        DisconnectNodes();
+        NotifyNumConnectionsChanged();
+        if (fUseEpoll) {
+            SocketHandlerEpoll();
+        } else {
+            SocketHandlerSelect();
+        }
     }
 }
 
 void CConnman::WakeMessageHandler() {
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        vMsgProcWake.assign(vMsgProcWake.size(), true);
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
 }
 
 #ifdef USE_UPNP
@@ -2082,6 +2453,7 @@ bool CConnman::OpenNetworkConnection(const CAddress &addrConnect,
     }
 
     GetNodeSignals().InitializeNode(*config, pnode, *this);
+    AddSocketEvents(pnode);
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
@@ -2090,14 +2462,15 @@ bool CConnman::OpenNetworkConnection(const CAddress &addrConnect,
     return true;
 }
 
-void CConnman::ThreadMessageHandler() {
+void CConnman::ThreadMessageHandler(int nThread) {
     while (!flagInterruptMsgProc) {
         std::vector<CNode *> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode *pnode : vNodesCopy) {
-                pnode->AddRef();
+            for (CNode *pnode : vNodes) {
+                if (pnode->GetId() % nMessageHandlerThreads == nThread) {
+                    vNodesCopy.push_back(pnode->AddRef());
+                }
             }
         }
 
@@ -2127,6 +2500,8 @@ void CConnman::ThreadMessageHandler() {
             }
         }
 
+        GetNodeSignals().ProcessDeferredMessages(*config, *this, nThread);
+
         {
             LOCK(cs_vNodes);
             for (CNode *pnode : vNodesCopy) {
@@ -2139,9 +2514,11 @@ void CConnman::ThreadMessageHandler() {
             condMsgProc.wait_until(lock,
                                    std::chrono::steady_clock::now() +
                                        std::chrono::milliseconds(100),
-                                   [this] { return fMsgProcWake; });
+                                   [this, nThread] {
+                                       return vMsgProcWake[nThread];
+                                   });
         }
-        fMsgProcWake = false;
+        vMsgProcWake[nThread] = false;
     }
 }
 
@@ -2347,6 +2724,11 @@ CConnman::CConnman(const Config &configIn, uint64_t nSeed0In, uint64_t nSeed1In)
     nMaxAddnode = 0;
     nBestHeight = 0;
     clientInterface = nullptr;
+    nPrevNodeCount = 0;
+    fUseEpoll = false;
+    epollfd = -1;
+    nLastInactivityCheck = 0;
+    nMessageHandlerThreads = 1;
     flagInterruptMsgProc = false;
 }
 
@@ -2370,6 +2752,7 @@ bool CConnman::Start(CScheduler &scheduler, std::string &strNodeError,
 
     nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
     nReceiveFloodSize = connOptions.nReceiveFloodSize;
+    nMessageHandlerThreads = std::max(connOptions.nMessageHandlerThreads, 1);
 
     nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
     nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
@@ -2442,8 +2825,36 @@ bool CConnman::Start(CScheduler &scheduler, std::string &strNodeError,
 
     {
         std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
+        vMsgProcWake.assign(nMessageHandlerThreads, false);
+    }
+
+    fUseEpoll = connOptions.fUseEpoll;
+#ifdef HAVE_SYS_EPOLL_H
+    if (fUseEpoll) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd == -1) {
+            LogPrintf("epoll_create1 failed with error %s, falling back to "
+                      "select\n",
+                      NetworkErrorString(errno));
+            fUseEpoll = false;
+        }
+    }
+    if (fUseEpoll) {
+        for (ListenSocket &hListenSocket : vhListenSocket) {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = &hListenSocket;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket,
+                          &event) != 0) {
+                LogPrintf("socket epoll_ctl error %s\n",
+                          NetworkErrorString(errno));
+            }
+        }
     }
+#else
+    fUseEpoll = false;
+#endif
+    LogPrintf("Using %s for socket events\n", fUseEpoll ? "epoll" : "select");
 
     // Send and receive from sockets, accept connections
     threadSocketHandler = std::thread(
@@ -2475,10 +2886,12 @@ bool CConnman::Start(CScheduler &scheduler, std::string &strNodeError,
     }
 
     // Process messages
-    threadMessageHandler =
-        std::thread(&TraceThread<std::function<void()>>, "msghand",
-                    std::function<void()>(
-                        std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        threadMessageHandlers.emplace_back(
+            &TraceThread<std::function<void()>>, "msghand",
+            std::function<void()>(
+                std::bind(&CConnman::ThreadMessageHandler, this, i)));
+    }
 
     // Dump network addresses
     scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this),
@@ -2523,9 +2936,10 @@ void CConnman::Interrupt() {
 }
 
 void CConnman::Stop() {
-    if (threadMessageHandler.joinable()) {
-        threadMessageHandler.join();
+    for (std::thread &thread : threadMessageHandlers) {
+        thread.join();
     }
+    threadMessageHandlers.clear();
     if (threadOpenConnections.joinable()) {
         threadOpenConnections.join();
     }
@@ -2566,7 +2980,14 @@ void CConnman::Stop() {
     }
     vNodes.clear();
     vNodesDisconnected.clear();
+    setNodesRecvReady.clear();
     vhListenSocket.clear();
+#ifdef HAVE_SYS_EPOLL_H
+    if (epollfd != -1) {
+        close(epollfd);
+        epollfd = -1;
+    }
+#endif
     delete semOutbound;
     semOutbound = nullptr;
     delete semAddnode;
@@ -2802,6 +3223,9 @@ int CConnman::GetBestHeight() const {
 unsigned int CConnman::GetReceiveFloodSize() const {
     return nReceiveFloodSize;
 }
+int CConnman::GetMessageHandlerThreads() const {
+    return nMessageHandlerThreads;
+}
 unsigned int CConnman::GetSendBufferSize() const {
     return nSendBufferMaxSize;
 }
@@ -2931,20 +3355,44 @@ bool CConnman::NodeFullyConnected(const CNode *pnode) {
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
+CNetMsgPayload::CNetMsgPayload(std::vector<uint8_t> &&dataIn)
+    : data(std::move(dataIn)) {
+    uint256 hash = Hash(data.data(), data.data() + data.size());
+    memcpy(checksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+}
+
+CNetMsgPayload::CNetMsgPayload(
+    std::shared_ptr<const std::vector<uint8_t>> sharedIn)
+    : shared(std::move(sharedIn)) {
+    uint256 hash = Hash(shared->data(), shared->data() + shared->size());
+    memcpy(checksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+}
+
 void CConnman::PushMessage(CNode *pnode, CSerializedNetMsg &&msg) {
-    size_t nMessageSize = msg.data.size();
+    PushMessage(pnode, msg.command,
+                std::make_shared<const CNetMsgPayload>(std::move(msg.data)));
+}
+
+void CConnman::PushMessage(CNode *pnode, const std::string &command,
+                           NetMsgPayloadRef payload) {
+    size_t nMessageSize = payload->size();
     size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
     LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",
-             SanitizeString(msg.command.c_str()), nMessageSize, pnode->id);
+             SanitizeString(command.c_str()), nMessageSize, pnode->id);
 
-    std::vector<uint8_t> serializedHeader;
-    serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
-    CMessageHeader hdr(config->GetChainParams().NetMagic(), msg.command.c_str(),
+    // The header is written in place, so it needs no buffer of its own.
+    CQueuedNetMsg queued;
+    CMessageHeader hdr(config->GetChainParams().NetMagic(), command.c_str(),
                        nMessageSize);
-    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
-
-    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+    memcpy(queued.header, hdr.pchMessageStart.data(),
+           CMessageHeader::MESSAGE_START_SIZE);
+    memcpy(queued.header + CMessageHeader::MESSAGE_START_SIZE, hdr.pchCommand,
+           CMessageHeader::COMMAND_SIZE);
+    WriteLE32(queued.header + CMessageHeader::MESSAGE_SIZE_OFFSET,
+              hdr.nMessageSize);
+    memcpy(queued.header + CMessageHeader::CHECKSUM_OFFSET,
+           payload->GetChecksum(), CMessageHeader::CHECKSUM_SIZE);
+    queued.payload = std::move(payload);
 
     size_t nBytesSent = 0;
     {
@@ -2952,16 +3400,13 @@ void CConnman::PushMessage(CNode *pnode, CSerializedNetMsg &&msg) {
         bool optimisticSend(pnode->vSendMsg.empty());
 
         // log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        pnode->mapSendBytesPerMsgCmd[command] += nTotalSize;
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize) {
             pnode->fPauseSend = true;
         }
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize) {
-            pnode->vSendMsg.push_back(std::move(msg.data));
-        }
+        pnode->vSendMsg.push_back(std::move(queued));
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true) {
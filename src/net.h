@@ -29,6 +29,7 @@
 #include <cstdint>
 #include <deque>
 #include <memory>
+#include <set>
 #include <thread>
 
 #ifndef WIN32
@@ -38,6 +39,7 @@
 #include <boost/signals2/signal.hpp>
 
 class CAddrMan;
+class CBlock;
 class Config;
 class CNode;
 class CScheduler;
@@ -91,6 +93,9 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = true;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER = 1 * 1000;
+/** Default and maximum number of threads processing peer messages */
+static const int DEFAULT_MSGHANDLER_THREADS = 4;
+static const int MAX_MSGHANDLER_THREADS = 16;
 
 static const ServiceFlags REQUIRED_SERVICES = ServiceFlags(NODE_NETWORK);
 
@@ -123,6 +128,40 @@ struct CSerializedNetMsg {
     std::string command;
 };
 
+/**
+ * The payload of a serialized message and its checksum. A payload is not
+ * modified once built, so the same one can be queued for any number of peers,
+ * which then neither copy nor hash it again.
+ */
+class CNetMsgPayload {
+private:
+    //! Set if the payload is a buffer shared with its owner, otherwise data.
+    std::shared_ptr<const std::vector<uint8_t>> shared;
+    std::vector<uint8_t> data;
+    uint8_t checksum[CMessageHeader::CHECKSUM_SIZE];
+
+public:
+    explicit CNetMsgPayload(std::vector<uint8_t> &&dataIn);
+    explicit CNetMsgPayload(std::shared_ptr<const std::vector<uint8_t>> sharedIn);
+
+    const std::vector<uint8_t> &GetData() const {
+        return shared ? *shared : data;
+    }
+    size_t size() const { return GetData().size(); }
+    const uint8_t *GetChecksum() const { return checksum; }
+};
+typedef std::shared_ptr<const CNetMsgPayload> NetMsgPayloadRef;
+
+/** A message queued for sending, with its header serialized in place. */
+struct CQueuedNetMsg {
+    uint8_t header[CMessageHeader::HEADER_SIZE];
+    NetMsgPayloadRef payload;
+
+    size_t size() const {
+        return CMessageHeader::HEADER_SIZE + payload->size();
+    }
+};
+
 class CConnman {
 public:
     enum NumConnections {
@@ -145,6 +184,8 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        bool fUseEpoll = false;
+        int nMessageHandlerThreads = 1;
     };
     CConnman(const Config &configIn, uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -166,6 +207,9 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode *pnode)> func);
 
     void PushMessage(CNode *pnode, CSerializedNetMsg &&msg);
+    /** Queue a message whose payload may also be queued for other peers. */
+    void PushMessage(CNode *pnode, const std::string &command,
+                     NetMsgPayloadRef payload);
 
     template <typename Callable> void ForEachNode(Callable &&func) {
         LOCK(cs_vNodes);
@@ -281,10 +325,13 @@ public:
     CSipHasher GetDeterministicRandomizer(uint64_t id) const;
 
     unsigned int GetReceiveFloodSize() const;
+    int GetMessageHandlerThreads() const;
 
     void WakeMessageHandler();
 
 private:
+    friend struct CConnmanTest;
+
     struct ListenSocket {
         SOCKET socket;
         bool whitelisted;
@@ -296,8 +343,15 @@ private:
     void ThreadOpenAddedConnections();
     void ProcessOneShot();
     void ThreadOpenConnections();
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nThread);
     void AcceptConnection(const ListenSocket &hListenSocket);
+    void DisconnectNodes();
+    void NotifyNumConnectionsChanged();
+    void InactivityCheck(CNode *pnode);
+    int SocketRecv(CNode *pnode);
+    void SocketHandlerSelect();
+    void SocketHandlerEpoll();
+    void AddSocketEvents(CNode *pnode);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -387,12 +441,30 @@ private:
     int nMaxFeeler;
     std::atomic<int> nBestHeight;
     CClientUIInterface *clientInterface;
+    unsigned int nPrevNodeCount;
+
+    //! Whether the socket thread waits for events with epoll, not select.
+    bool fUseEpoll;
+    //! The epoll instance the sockets are registered with, or -1.
+    int epollfd;
+    /**
+     * Nodes whose socket may have more data to read. Sockets are registered
+     * edge triggered, so they are not reported again until this data has been
+     * read. Only used by the socket thread.
+     */
+    std::set<CNode *> setNodesRecvReady;
+    int64_t nLastInactivityCheck;
 
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /**
+     * Peers are sharded over the message handler threads by id, so that the
+     * messages of each peer are still processed in order.
+     */
+    int nMessageHandlerThreads;
+    /** flags for waking each message processing thread. */
+    std::vector<bool> vMsgProcWake;
 
     std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
@@ -404,7 +476,7 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group &threadGroup);
@@ -440,6 +512,8 @@ struct CNodeSignals {
     boost::signals2::signal<void(const Config &, CNode *, CConnman &)>
         InitializeNode;
     boost::signals2::signal<void(NodeId, bool &)> FinalizeNode;
+    boost::signals2::signal<void(const Config &, CConnman &, int)>
+        ProcessDeferredMessages;
 };
 
 CNodeSignals &GetNodeSignals();
@@ -491,6 +565,8 @@ extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
 // Command, total bytes
 typedef std::map<std::string, uint64_t> mapMsgCmdSize;
+// Key under which the statistics of unknown commands are aggregated
+static const std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
 class CNodeStats {
 public:
@@ -511,6 +587,8 @@ public:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
     uint64_t nRecvBytes;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
+    size_t nProcessQueueCount;
+    size_t nProcessQueueSize;
     bool fWhitelisted;
     double dPingTime;
     double dPingWait;
@@ -524,6 +602,20 @@ private:
     mutable CHash256 hasher;
     mutable uint256 data_hash;
 
+    // Block deserialized from vRecv as the data arrives, for block messages.
+    std::shared_ptr<CBlock> pblock;
+    // Whether the block header and transaction count have been read.
+    bool fBlockHeaderParsed;
+    // Bytes of vRecv consumed by the block parser, and transactions left.
+    uint32_t nParsePos;
+    uint64_t nParseTxLeft;
+    // How much of vRecv there must be before the parser tries again.
+    uint32_t nParseRetryPos;
+    // How many times the parser ran, for the tests.
+    uint32_t nParseCount;
+
+    void ParseBlock();
+
 public:
     // Parsing header (false) or data (true)
     bool in_data;
@@ -550,7 +642,13 @@ public:
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        fBlockHeaderParsed = false;
+        nParsePos = 0;
+        nParseTxLeft = 0;
+        nParseRetryPos = 0;
+        nParseCount = 0;
     }
+    ~CNetMessage();
 
     bool complete() const {
         if (!in_data) {
@@ -562,6 +660,16 @@ public:
 
     const uint256 &GetMessageHash() const;
 
+    /**
+     * For a complete block message, the block built while it was received, or
+     * nullptr if it could not be built that way and vRecv has to be
+     * deserialized instead.
+     */
+    std::shared_ptr<CBlock> GetReceivedBlock() const;
+
+    /** How many times the block parser ran on the data received so far. */
+    uint32_t GetParseCount() const { return nParseCount; }
+
     void SetVersion(int nVersionIn) {
         hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
@@ -586,7 +694,7 @@ public:
     // Offset inside the first vSendMsg already sent.
     size_t nSendOffset;
     uint64_t nSendBytes;
-    std::deque<std::vector<uint8_t>> vSendMsg;
+    std::deque<CQueuedNetMsg> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -652,7 +760,9 @@ public:
     uint256 hashContinue;
     std::atomic<int> nStartingHeight;
 
-    // flood relay
+    // flood relay, protected by cs_vAddrToSend as other peers' message
+    // handler threads relay addresses to this one
+    CCriticalSection cs_vAddrToSend;
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -759,6 +869,7 @@ public:
     void Release() { nRefCount--; }
 
     void AddAddressKnown(const CAddress &_addr) {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -766,6 +877,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] =
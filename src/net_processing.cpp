@@ -100,6 +100,32 @@ std::map<uint256, std::pair<NodeId, bool>> mapBlockSource;
 std::unique_ptr<CRollingBloomFilter> recentRejects;
 uint256 hashRecentRejectsChainTip;
 
+/**
+ * Transactions received during the current pass of a message handler thread
+ * over its peers. They are submitted to the mempool together once every peer
+ * had its turn, and hold a reference to the peer they came from until then.
+ * Kept by message handler thread, so that each thread only deals with the
+ * transactions of its own peers. Protected by cs_main.
+ */
+struct PendingTransaction {
+    CNode *pfrom;
+    CTransactionRef ptx;
+};
+struct PendingTransactions {
+    std::vector<PendingTransaction> vtx;
+    std::set<uint256> setTxids;
+};
+std::map<int, PendingTransactions> mapPendingTransactions;
+
+bool IsTransactionPending(const uint256 &txid) {
+    for (const auto &pending : mapPendingTransactions) {
+        if (pending.second.setTxids.count(txid)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /** Blocks that are in flight, and that are in the queue to be downloaded.
  * Protected by cs_main. */
 struct QueuedBlock {
@@ -207,6 +233,12 @@ struct CNodeState {
      * non-witnesses in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! The last block we relayed to this peer before having validated it.
+    uint256 hashCutThroughSent;
+    //! Whether the peer asked for transactions of that block before we had
+    //! them, and what it asked for.
+    bool fBlockTxnRequestPending;
+    BlockTransactionsRequest blockTxnRequestPending;
 
     CNodeState(CAddress addrIn, std::string addrNameIn)
         : address(addrIn), name(addrNameIn) {
@@ -228,6 +260,8 @@ struct CNodeState {
         fPreferHeaderAndIDs = false;
         fProvidesHeaderAndIDs = false;
         fSupportsDesiredCmpctVersion = false;
+        hashCutThroughSent.SetNull();
+        fBlockTxnRequestPending = false;
     }
 };
 
@@ -309,6 +343,20 @@ void FinalizeNode(NodeId nodeid, bool &fUpdateConnectionTime) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
 
+    // Only on shutdown can a peer go away with transactions still pending.
+    for (auto &item : mapPendingTransactions) {
+        PendingTransactions &pending = item.second;
+        auto itPending = std::remove_if(
+            pending.vtx.begin(), pending.vtx.end(),
+            [nodeid](const PendingTransaction &ptx) {
+                return ptx.pfrom->GetId() == nodeid;
+            });
+        for (auto it = itPending; it != pending.vtx.end(); ++it) {
+            pending.setTxids.erase(it->ptx->GetId());
+        }
+        pending.vtx.erase(itPending, pending.vtx.end());
+    }
+
     if (state->fSyncStarted) {
         nSyncStarted--;
     }
@@ -676,6 +724,7 @@ void RegisterNodeSignals(CNodeSignals &nodeSignals) {
     nodeSignals.SendMessages.connect(&SendMessages);
     nodeSignals.InitializeNode.connect(&InitializeNode);
     nodeSignals.FinalizeNode.connect(&FinalizeNode);
+    nodeSignals.ProcessDeferredMessages.connect(&ProcessDeferredMessages);
 }
 
 void UnregisterNodeSignals(CNodeSignals &nodeSignals) {
@@ -683,6 +732,7 @@ void UnregisterNodeSignals(CNodeSignals &nodeSignals) {
     nodeSignals.SendMessages.disconnect(&SendMessages);
     nodeSignals.InitializeNode.disconnect(&InitializeNode);
     nodeSignals.FinalizeNode.disconnect(&FinalizeNode);
+    nodeSignals.ProcessDeferredMessages.disconnect(&ProcessDeferredMessages);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -902,11 +952,150 @@ void PeerLogicValidation::BlockConnected(
     }
 }
 
+static CCriticalSection cs_msgProcessingStats;
+static std::map<std::string, MessageProcessingStats>
+    mapMsgProcessingStats GUARDED_BY(cs_msgProcessingStats);
+
+static void RecordMessageProcessingTime(const std::string &strCommand,
+                                        int64_t nTime) {
+    LOCK(cs_msgProcessingStats);
+    if (mapMsgProcessingStats.empty()) {
+        for (const std::string &msg : getAllNetMessageTypes()) {
+            mapMsgProcessingStats[msg];
+        }
+        mapMsgProcessingStats[NET_MESSAGE_COMMAND_OTHER];
+    }
+    // Peers choose the command, so unknown ones share a single entry.
+    auto it = mapMsgProcessingStats.find(strCommand);
+    if (it == mapMsgProcessingStats.end()) {
+        it = mapMsgProcessingStats.find(NET_MESSAGE_COMMAND_OTHER);
+    }
+    MessageProcessingStats &stats = it->second;
+    stats.nCount++;
+    stats.nTotalTime += nTime;
+    stats.nMaxTime = std::max(stats.nMaxTime, nTime);
+}
+
+std::map<std::string, MessageProcessingStats> GetMessageProcessingStats() {
+    LOCK(cs_msgProcessingStats);
+    return mapMsgProcessingStats;
+}
+
+static CCriticalSection cs_blockRelayStats;
+static BlockRelayStats
+    cutThroughRelayStats GUARDED_BY(cs_blockRelayStats);
+static BlockRelayStats validatedRelayStats GUARDED_BY(cs_blockRelayStats);
+
+static void RecordBlockRelayLatency(bool fCutThrough, int64_t nLatency) {
+    LOCK(cs_blockRelayStats);
+    BlockRelayStats &stats =
+        fCutThrough ? cutThroughRelayStats : validatedRelayStats;
+    stats.nCount++;
+    stats.nTotalLatency += nLatency;
+    stats.nMaxLatency = std::max(stats.nMaxLatency, nLatency);
+}
+
+BlockRelayStats GetBlockRelayStats(bool fCutThrough) {
+    LOCK(cs_blockRelayStats);
+    return fCutThrough ? cutThroughRelayStats : validatedRelayStats;
+}
+
+/**
+ * When the blocks being downloaded were first received from a peer, in
+ * microseconds, to measure how long they take to be relayed.
+ */
+static const size_t MAX_BLOCK_RECEIVE_TIMES = 16;
+static std::map<uint256, int64_t> mapBlockReceiveTime GUARDED_BY(cs_main);
+
+// Requires cs_main.
+static void RecordBlockReceived(const uint256 &hash, int64_t nTimeReceived) {
+    if (mapBlockReceiveTime.count(hash)) {
+        return;
+    }
+    if (mapBlockReceiveTime.size() >= MAX_BLOCK_RECEIVE_TIMES) {
+        // Blocks that were never relayed, forget the one received first.
+        auto oldest = mapBlockReceiveTime.begin();
+        for (auto it = mapBlockReceiveTime.begin();
+             it != mapBlockReceiveTime.end(); ++it) {
+            if (it->second < oldest->second) {
+                oldest = it;
+            }
+        }
+        mapBlockReceiveTime.erase(oldest);
+    }
+    mapBlockReceiveTime.emplace(hash, nTimeReceived);
+}
+
+// Requires cs_main.
+static void RecordBlockRelayed(const uint256 &hash, bool fCutThrough) {
+    auto it = mapBlockReceiveTime.find(hash);
+    if (it == mapBlockReceiveTime.end()) {
+        // Mined locally, or relayed already.
+        return;
+    }
+    RecordBlockRelayLatency(fCutThrough, GetTimeMicros() - it->second);
+    mapBlockReceiveTime.erase(it);
+}
+
+static void SendBlockTransactions(const CBlock &block,
+                                  const BlockTransactionsRequest &req,
+                                  CNode *pfrom, CConnman &connman);
+
+/**
+ * Give up on the getblocktxn request a peer sent for a block we relayed before
+ * having it, and tell the peer we do not have the block, so that it gets it
+ * elsewhere rather than wait for us.
+ */
+static void AbandonBlockTxnRequest(CNode *pnode, CNodeState &state,
+                                   CConnman &connman) {
+    AssertLockHeld(cs_main);
+    const uint256 &hashBlock = state.blockTxnRequestPending.blockhash;
+    LogPrint(BCLog::NET,
+             "abandoning the getblocktxn for block %s of peer=%d\n",
+             hashBlock.ToString(), pnode->id);
+    state.fBlockTxnRequestPending = false;
+    const CNetMsgMaker msgMaker(pnode->GetSendVersion());
+    connman.PushMessage(
+        pnode, msgMaker.Make(NetMsgType::NOTFOUND,
+                             std::vector<CInv>{CInv(MSG_BLOCK, hashBlock)}));
+}
+
 static CCriticalSection cs_most_recent_block;
 static std::shared_ptr<const CBlock> most_recent_block;
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs>
     most_recent_compact_block;
 static uint256 most_recent_block_hash;
+// The payload of the most recent block, once a peer asked for it in full,
+// which the other peers share rather than reading and hashing it again. It is
+// only kept for the block most_recent_block holds anyway, so that it does not
+// pin any other block outside of the raw block cache.
+static uint256 last_block_payload_hash;
+static NetMsgPayloadRef last_block_payload;
+
+static NetMsgPayloadRef GetBlockPayload(const uint256 &hash,
+                                        const CDiskBlockPos &pos,
+                                        const Config &config) {
+    {
+        LOCK(cs_most_recent_block);
+        if (last_block_payload && last_block_payload_hash == hash) {
+            return last_block_payload;
+        }
+    }
+
+    std::shared_ptr<const std::vector<uint8_t>> raw =
+        ReadRawBlock(hash, pos, config);
+    if (!raw) {
+        return nullptr;
+    }
+    auto payload = std::make_shared<const CNetMsgPayload>(std::move(raw));
+
+    LOCK(cs_most_recent_block);
+    if (hash == most_recent_block_hash) {
+        last_block_payload_hash = hash;
+        last_block_payload = payload;
+    }
+    return payload;
+}
 
 void PeerLogicValidation::NewPoWValidBlock(
     const CBlockIndex *pindex, const std::shared_ptr<const CBlock> &pblock) {
@@ -916,24 +1105,38 @@ void PeerLogicValidation::NewPoWValidBlock(
 
     LOCK(cs_main);
 
+    uint256 hashBlock(pblock->GetHash());
+
+    // Answer the peers that asked for the transactions of this block after we
+    // relayed it to them, but before we had it.
+    connman->ForEachNode([this, &pblock, &hashBlock](CNode *pnode) {
+        CNodeState &state = *State(pnode->GetId());
+        if (state.fBlockTxnRequestPending &&
+            state.blockTxnRequestPending.blockhash == hashBlock) {
+            state.fBlockTxnRequestPending = false;
+            SendBlockTransactions(*pblock, state.blockTxnRequestPending, pnode,
+                                  *connman);
+        }
+    });
+
     static int nHighestFastAnnounce = 0;
     if (pindex->nHeight <= nHighestFastAnnounce) {
         return;
     }
     nHighestFastAnnounce = pindex->nHeight;
 
-    uint256 hashBlock(pblock->GetHash());
-
     {
         LOCK(cs_most_recent_block);
         most_recent_block_hash = hashBlock;
         most_recent_block = pblock;
         most_recent_compact_block = pcmpctblock;
+        last_block_payload.reset();
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker,
-                          &hashBlock](CNode *pnode) {
-        // TODO: Avoid the repeated-serialization here
+    // Serialized once, when the first peer needs it.
+    NetMsgPayloadRef cmpctpayload;
+    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, &hashBlock,
+                          &cmpctpayload](CNode *pnode) {
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect) {
             return;
         }
@@ -947,11 +1150,57 @@ void PeerLogicValidation::NewPoWValidBlock(
             LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n",
                      "PeerLogicValidation::NewPoWValidBlock",
                      hashBlock.ToString(), pnode->id);
-            connman->PushMessage(
-                pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            if (!cmpctpayload) {
+                cmpctpayload = std::make_shared<const CNetMsgPayload>(
+                    msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock).data);
+            }
+            connman->PushMessage(pnode, NetMsgType::CMPCTBLOCK, cmpctpayload);
+            state.pindexBestHeaderSent = pindex;
+        }
+    });
+    if (cmpctpayload) {
+        RecordBlockRelayed(hashBlock, false);
+    }
+}
+
+/**
+ * Relay a compact block to the peers that want them as soon as its header is
+ * valid, before it has been reconstructed and validated, as BIP 152 permits.
+ * Peers recent enough not to punish us for an invalid block get it from
+ * NewPoWValidBlock otherwise, once it is.
+ */
+static void
+RelayCompactBlockCutThrough(const CBlockIndex *pindex,
+                            const CBlockHeaderAndShortTxIDs &cmpctblock,
+                            CConnman &connman) {
+    AssertLockHeld(cs_main);
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    const uint256 &hashBlock = pindex->GetBlockHash();
+    NetMsgPayloadRef cmpctpayload;
+    connman.ForEachNode([pindex, &cmpctblock, &msgMaker, &hashBlock,
+                         &cmpctpayload, &connman](CNode *pnode) {
+        if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect) {
+            return;
+        }
+        ProcessBlockAvailability(pnode->GetId());
+        CNodeState &state = *State(pnode->GetId());
+        if (state.fPreferHeaderAndIDs && !PeerHasHeader(&state, pindex) &&
+            PeerHasHeader(&state, pindex->pprev)) {
+            LogPrint(BCLog::NET,
+                     "%s sending unvalidated header-and-ids %s to peer=%d\n",
+                     __func__, hashBlock.ToString(), pnode->id);
+            if (!cmpctpayload) {
+                cmpctpayload = std::make_shared<const CNetMsgPayload>(
+                    msgMaker.Make(NetMsgType::CMPCTBLOCK, cmpctblock).data);
+            }
+            connman.PushMessage(pnode, NetMsgType::CMPCTBLOCK, cmpctpayload);
             state.pindexBestHeaderSent = pindex;
+            state.hashCutThroughSent = hashBlock;
         }
     });
+    if (cmpctpayload) {
+        RecordBlockRelayed(hashBlock, true);
+    }
 }
 
 void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex *pindexNew,
@@ -988,6 +1237,35 @@ void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex *pindexNew,
         connman->WakeMessageHandler();
     }
 
+    // NewPoWValidBlock only answers the requests held for a block extending
+    // the tip. Once the tip got as high, answer them from disk if the block
+    // arrived anyway, or give up on them if it lost a race without arriving.
+    {
+        LOCK(cs_main);
+        connman->ForEachNode([this, nNewHeight](CNode *pnode) {
+            CNodeState &state = *State(pnode->GetId());
+            if (!state.fBlockTxnRequestPending) {
+                return;
+            }
+            BlockMap::const_iterator it =
+                mapBlockIndex.find(state.blockTxnRequestPending.blockhash);
+            if (it != mapBlockIndex.end() &&
+                it->second->nHeight > nNewHeight) {
+                return;
+            }
+            CBlock block;
+            if (it != mapBlockIndex.end() &&
+                (it->second->nStatus & BLOCK_HAVE_DATA) &&
+                ReadBlockFromDisk(block, it->second, GetConfig())) {
+                state.fBlockTxnRequestPending = false;
+                SendBlockTransactions(block, state.blockTxnRequestPending,
+                                      pnode, *connman);
+                return;
+            }
+            AbandonBlockTxnRequest(pnode, state, *connman);
+        });
+    }
+
     nTimeBestReceived = GetTime();
 }
 
@@ -1001,6 +1279,14 @@ void PeerLogicValidation::BlockChecked(const CBlock &block,
 
     int nDoS = 0;
     if (state.IsInvalid(nDoS)) {
+        // Nothing is going to answer the requests held for an invalid block.
+        connman->ForEachNode([this, &hash](CNode *pnode) {
+            CNodeState &nodestate = *State(pnode->GetId());
+            if (nodestate.fBlockTxnRequestPending &&
+                nodestate.blockTxnRequestPending.blockhash == hash) {
+                AbandonBlockTxnRequest(pnode, nodestate, *connman);
+            }
+        });
         // Don't send reject message with code 0 or an internal reject code.
         if (it != mapBlockSource.end() && State(it->second.first) &&
             state.GetRejectCode() > 0 &&
@@ -1117,6 +1403,81 @@ static void RelayAddress(const CAddress &addr, bool fReachable,
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+/**
+ * Send the block inv asks for, stored at pos, as a full, filtered or compact
+ * block. This reads it from disk, so it is called without cs_main.
+ */
+static void SendBlock(const Config &config, CNode *pfrom, const CInv &inv,
+                      const CDiskBlockPos &pos, bool fSendCmpct,
+                      CConnman &connman) {
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+
+    // Full blocks are sent from disk as they are stored, which is how they are
+    // serialized on the network, so only parse the block when it has to be
+    // filtered or compacted. The buffer is shared with the cache and the other
+    // peers.
+    CBlock block;
+    bool fRead;
+    if (inv.type == MSG_BLOCK || (inv.type == MSG_CMPCT_BLOCK && !fSendCmpct)) {
+        NetMsgPayloadRef payload = GetBlockPayload(inv.hash, pos, config);
+        fRead = payload != nullptr;
+        if (fRead) {
+            connman.PushMessage(pfrom, NetMsgType::BLOCK, std::move(payload));
+        }
+    } else {
+        fRead = ReadBlockFromDisk(block, inv.hash, pos, config);
+    }
+    if (!fRead) {
+        // The block may have been pruned since it was looked up.
+        if (!fPruneMode) {
+            assert(!"cannot load block from disk");
+        }
+        LogPrint(BCLog::NET, "cannot load block %s from disk, disconnect "
+                             "peer=%d\n",
+                 inv.hash.ToString(), pfrom->GetId());
+        pfrom->fDisconnect = true;
+        return;
+    }
+
+    if (inv.type == MSG_FILTERED_BLOCK) {
+        bool sendMerkleBlock = false;
+        CMerkleBlock merkleBlock;
+        {
+            LOCK(pfrom->cs_filter);
+            if (pfrom->pfilter) {
+                sendMerkleBlock = true;
+                merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
+            }
+        }
+        if (sendMerkleBlock) {
+            connman.PushMessage(
+                pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
+            // CMerkleBlock just contains hashes, so also push any transactions
+            // in the block the client did not see. This avoids hurting
+            // performance by pointlessly requiring a round-trip. Note that
+            // there is currently no way for a node to request any single
+            // transactions we didn't send here - they must either disconnect
+            // and retry or request the full block. Thus, the protocol spec
+            // specified allows for us to provide duplicate txn here, however we
+            // MUST always provide at least what the remote peer needs.
+            typedef std::pair<unsigned int, uint256> PairType;
+            for (PairType &pair : merkleBlock.vMatchedTxn) {
+                connman.PushMessage(
+                    pfrom,
+                    msgMaker.Make(NetMsgType::TX, *block.vtx[pair.first]));
+            }
+        }
+        // else
+        // no response
+    } else if (inv.type == MSG_CMPCT_BLOCK && fSendCmpct) {
+        int nSendFlags = 0;
+        CBlockHeaderAndShortTxIDs cmpctblock(block);
+        connman.PushMessage(pfrom, msgMaker.Make(nSendFlags,
+                                                 NetMsgType::CMPCTBLOCK,
+                                                 cmpctblock));
+    }
+}
+
 static void ProcessGetData(const Config &config, CNode *pfrom,
                            const Consensus::Params &consensusParams,
                            CConnman &connman,
@@ -1124,214 +1485,191 @@ static void ProcessGetData(const Config &config, CNode *pfrom,
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
-    LOCK(cs_main);
-
-    while (it != pfrom->vRecvGetData.end()) {
-        // Don't bother if send buffer is too full to respond anyway.
-        if (pfrom->fPauseSend) {
+    // The block asked for is looked up under cs_main, but read from disk and
+    // sent once it is released.
+    bool fSendBlock = false;
+    CInv invBlock;
+    CDiskBlockPos posBlock;
+    bool fSendCmpct = false;
+    uint256 hashContinueTip;
+
+    // If we have the first block asked for and all of its parents, but have
+    // not yet validated it, we might be in the middle of connecting it (ie in
+    // the unlock of cs_main before ActivateBestChain but after AcceptBlock).
+    // In this case, we need to run ActivateBestChain prior to checking the
+    // relay conditions below, and it must be called without cs_main.
+    bool fActivateChain = false;
+    {
+        LOCK(cs_main);
+        for (auto itBlock = it; itBlock != pfrom->vRecvGetData.end();
+             ++itBlock) {
+            if (itBlock->type != MSG_BLOCK &&
+                itBlock->type != MSG_FILTERED_BLOCK &&
+                itBlock->type != MSG_CMPCT_BLOCK) {
+                continue;
+            }
+            BlockMap::iterator mi = mapBlockIndex.find(itBlock->hash);
+            fActivateChain = mi != mapBlockIndex.end() &&
+                             mi->second->nChainTx &&
+                             !mi->second->IsValid(BLOCK_VALID_SCRIPTS) &&
+                             mi->second->IsValid(BLOCK_VALID_TREE);
             break;
         }
-
-        const CInv &inv = *it;
+    }
+    if (fActivateChain) {
+        std::shared_ptr<const CBlock> a_recent_block;
         {
-            if (interruptMsgProc) {
-                return;
+            LOCK(cs_most_recent_block);
+            a_recent_block = most_recent_block;
+        }
+        CValidationState dummy;
+        ActivateBestChain(config, dummy, a_recent_block);
+    }
+
+    {
+        LOCK(cs_main);
+
+        while (it != pfrom->vRecvGetData.end()) {
+            // Don't bother if send buffer is too full to respond anyway.
+            if (pfrom->fPauseSend) {
+                break;
             }
 
-            it++;
-
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK ||
-                inv.type == MSG_CMPCT_BLOCK) {
-                bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end()) {
-                    if (mi->second->nChainTx &&
-                        !mi->second->IsValid(BLOCK_VALID_SCRIPTS) &&
-                        mi->second->IsValid(BLOCK_VALID_TREE)) {
-                        // If we have the block and all of its parents, but have
-                        // not yet validated it, we might be in the middle of
-                        // connecting it (ie in the unlock of cs_main before
-                        // ActivateBestChain but after AcceptBlock). In this
-                        // case, we need to run ActivateBestChain prior to
-                        // checking the relay conditions below.
-                        std::shared_ptr<const CBlock> a_recent_block;
-                        {
-                            LOCK(cs_most_recent_block);
-                            a_recent_block = most_recent_block;
-                        }
-                        CValidationState dummy;
-                        ActivateBestChain(config, dummy, a_recent_block);
-                    }
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        static const int nOneMonth = 30 * 24 * 60 * 60;
-                        // To prevent fingerprinting attacks, only send blocks
-                        // outside of the active chain if they are valid, and no
-                        // more than a month older (both in time, and in best
-                        // equivalent proof of work) than the best header chain
-                        // we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) &&
-                               (pindexBestHeader != nullptr) &&
-                               (pindexBestHeader->GetBlockTime() -
-                                    mi->second->GetBlockTime() <
-                                nOneMonth) &&
-                               (GetBlockProofEquivalentTime(
-                                    *pindexBestHeader, *mi->second,
-                                    *pindexBestHeader,
-                                    consensusParams) < nOneMonth);
-                        if (!send) {
-                            LogPrintf("%s: ignoring request from peer=%i for "
-                                      "old block that isn't in the main "
-                                      "chain\n",
-                                      __func__, pfrom->GetId());
-                        }
-                    }
+            const CInv &inv = *it;
+            {
+                if (interruptMsgProc) {
+                    return;
                 }
 
-                // Disconnect node in case we have reached the outbound limit
-                // for serving historical blocks never disconnect whitelisted
-                // nodes.
-                // assume > 1 week = historical
-                static const int nOneWeek = 7 * 24 * 60 * 60;
-                if (send && connman.OutboundTargetReached(true) &&
-                    (((pindexBestHeader != nullptr) &&
-                      (pindexBestHeader->GetBlockTime() -
-                           mi->second->GetBlockTime() >
-                       nOneWeek)) ||
-                     inv.type == MSG_FILTERED_BLOCK) &&
-                    !pfrom->fWhitelisted) {
-                    LogPrint(BCLog::NET, "historical block serving limit "
-                                         "reached, disconnect peer=%d\n",
-                             pfrom->GetId());
-
-                    // disconnect node
-                    pfrom->fDisconnect = true;
-                    send = false;
-                }
-                // Pruned nodes may have deleted the block, so check whether
-                // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, config)) {
-                        assert(!"cannot load block from disk");
-                    }
+                it++;
 
-                    if (inv.type == MSG_BLOCK) {
-                        connman.PushMessage(
-                            pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
-                    } else if (inv.type == MSG_FILTERED_BLOCK) {
-                        bool sendMerkleBlock = false;
-                        CMerkleBlock merkleBlock;
-                        {
-                            LOCK(pfrom->cs_filter);
-                            if (pfrom->pfilter) {
-                                sendMerkleBlock = true;
-                                merkleBlock =
-                                    CMerkleBlock(block, *pfrom->pfilter);
-                            }
-                        }
-                        if (sendMerkleBlock) {
-                            connman.PushMessage(
-                                pfrom,
-                                msgMaker.Make(NetMsgType::MERKLEBLOCK,
-                                              merkleBlock));
-                            // CMerkleBlock just contains hashes, so also push
-                            // any transactions in the block the client did not
-                            // see. This avoids hurting performance by
-                            // pointlessly requiring a round-trip. Note that
-                            // there is currently no way for a node to request
-                            // any single transactions we didn't send here -
-                            // they must either disconnect and retry or request
-                            // the full block. Thus, the protocol spec specified
-                            // allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the
-                            // remote peer needs.
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            for (PairType &pair : merkleBlock.vMatchedTxn) {
-                                connman.PushMessage(
-                                    pfrom,
-                                    msgMaker.Make(NetMsgType::TX,
-                                                  *block.vtx[pair.first]));
+                if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK ||
+                    inv.type == MSG_CMPCT_BLOCK) {
+                    bool send = false;
+                    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                    if (mi != mapBlockIndex.end()) {
+                        if (chainActive.Contains(mi->second)) {
+                            send = true;
+                        } else {
+                            static const int nOneMonth = 30 * 24 * 60 * 60;
+                            // To prevent fingerprinting attacks, only send
+                            // blocks outside of the active chain if they are
+                            // valid, and no more than a month older (both in
+                            // time, and in best equivalent proof of work) than
+                            // the best header chain we know about.
+                            send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) &&
+                                   (pindexBestHeader != nullptr) &&
+                                   (pindexBestHeader->GetBlockTime() -
+                                        mi->second->GetBlockTime() <
+                                    nOneMonth) &&
+                                   (GetBlockProofEquivalentTime(
+                                        *pindexBestHeader, *mi->second,
+                                        *pindexBestHeader,
+                                        consensusParams) < nOneMonth);
+                            if (!send) {
+                                LogPrintf("%s: ignoring request from "
+                                          "peer=%i for old block that isn't "
+                                          "in the main chain\n",
+                                          __func__, pfrom->GetId());
                             }
                         }
-                        // else
-                        // no response
-                    } else if (inv.type == MSG_CMPCT_BLOCK) {
+                    }
+
+                    // Disconnect node in case we have reached the outbound
+                    // limit for serving historical blocks never disconnect
+                    // whitelisted nodes.
+                    // assume > 1 week = historical
+                    static const int nOneWeek = 7 * 24 * 60 * 60;
+                    if (send && connman.OutboundTargetReached(true) &&
+                        (((pindexBestHeader != nullptr) &&
+                          (pindexBestHeader->GetBlockTime() -
+                               mi->second->GetBlockTime() >
+                           nOneWeek)) ||
+                         inv.type == MSG_FILTERED_BLOCK) &&
+                        !pfrom->fWhitelisted) {
+                        LogPrint(BCLog::NET, "historical block serving limit "
+                                             "reached, disconnect peer=%d\n",
+                                 pfrom->GetId());
+
+                        // disconnect node
+                        pfrom->fDisconnect = true;
+                        send = false;
+                    }
+                    // Pruned nodes may have deleted the block, so check whether
+                    // it's available before trying to send.
+                    if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
                         // If a peer is asking for old blocks, we're almost
                         // guaranteed they won't have a useful mempool to match
                         // against a compact block, and we don't feel like
                         // constructing the object for them, so instead we
                         // respond with the full, non-compact block.
-                        int nSendFlags = 0;
-                        if (CanDirectFetch(consensusParams) &&
+                        fSendCmpct =
+                            inv.type == MSG_CMPCT_BLOCK &&
+                            CanDirectFetch(consensusParams) &&
                             mi->second->nHeight >=
-                                chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                            CBlockHeaderAndShortTxIDs cmpctblock(block);
-                            connman.PushMessage(
-                                pfrom,
-                                msgMaker.Make(nSendFlags,
-                                              NetMsgType::CMPCTBLOCK,
-                                              cmpctblock));
-                        } else {
-                            connman.PushMessage(pfrom,
-                                                msgMaker.Make(nSendFlags,
-                                                              NetMsgType::BLOCK,
-                                                              block));
+                                chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                        fSendBlock = true;
+                        invBlock = inv;
+                        posBlock = mi->second->GetBlockPos();
+
+                        // Trigger the peer node to send a getblocks request for
+                        // the next batch of inventory.
+                        if (inv.hash == pfrom->hashContinue) {
+                            hashContinueTip = chainActive.Tip()->GetBlockHash();
+                            pfrom->hashContinue.SetNull();
                         }
                     }
-
-                    // Trigger the peer node to send a getblocks request for the
-                    // next batch of inventory.
-                    if (inv.hash == pfrom->hashContinue) {
-                        // Bypass PushInventory, this must send even if
-                        // redundant, and we want it right after the last block
-                        // so they don't wait for other stuff first.
-                        std::vector<CInv> vInv;
-                        vInv.push_back(
-                            CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-                        connman.PushMessage(
-                            pfrom, msgMaker.Make(NetMsgType::INV, vInv));
-                        pfrom->hashContinue.SetNull();
-                    }
-                }
-            } else if (inv.type == MSG_TX) {
-                // Send stream from relay memory
-                bool push = false;
-                auto mi = mapRelay.find(inv.hash);
-                int nSendFlags = 0;
-                if (mi != mapRelay.end()) {
-                    connman.PushMessage(
-                        pfrom,
-                        msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second));
-                    push = true;
-                } else if (pfrom->timeLastMempoolReq) {
-                    auto txinfo = mempool.info(inv.hash);
-                    // To protect privacy, do not answer getdata using the
-                    // mempool when that TX couldn't have been INVed in reply to
-                    // a MEMPOOL request.
-                    if (txinfo.tx &&
-                        txinfo.nTime <= pfrom->timeLastMempoolReq) {
+                } else if (inv.type == MSG_TX) {
+                    // Send stream from relay memory
+                    bool push = false;
+                    auto mi = mapRelay.find(inv.hash);
+                    int nSendFlags = 0;
+                    if (mi != mapRelay.end()) {
                         connman.PushMessage(pfrom,
                                             msgMaker.Make(nSendFlags,
                                                           NetMsgType::TX,
-                                                          *txinfo.tx));
+                                                          *mi->second));
                         push = true;
+                    } else if (pfrom->timeLastMempoolReq) {
+                        auto txinfo = mempool.info(inv.hash);
+                        // To protect privacy, do not answer getdata using the
+                        // mempool when that TX couldn't have been INVed in
+                        // reply to a MEMPOOL request.
+                        if (txinfo.tx &&
+                            txinfo.nTime <= pfrom->timeLastMempoolReq) {
+                            connman.PushMessage(pfrom,
+                                                msgMaker.Make(nSendFlags,
+                                                              NetMsgType::TX,
+                                                              *txinfo.tx));
+                            push = true;
+                        }
+                    }
+                    if (!push) {
+                        vNotFound.push_back(inv);
                     }
                 }
-                if (!push) {
-                    vNotFound.push_back(inv);
+
+                // Track requests for our stuff.
+                GetMainSignals().Inventory(inv.hash);
+
+                if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK ||
+                    inv.type == MSG_CMPCT_BLOCK) {
+                    break;
                 }
             }
+        }
+    }
 
-            // Track requests for our stuff.
-            GetMainSignals().Inventory(inv.hash);
+    if (fSendBlock) {
+        SendBlock(config, pfrom, invBlock, posBlock, fSendCmpct, connman);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK ||
-                inv.type == MSG_CMPCT_BLOCK) {
-                break;
-            }
+        if (!hashContinueTip.IsNull()) {
+            // Bypass PushInventory, this must send even if redundant, and we
+            // want it right after the last block so they don't wait for other
+            // stuff first.
+            std::vector<CInv> vInv;
+            vInv.push_back(CInv(MSG_BLOCK, hashContinueTip));
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
         }
     }
 
@@ -1379,11 +1717,212 @@ inline static void SendBlockTransactions(const CBlock &block,
                         msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
 }
 
+/**
+ * Deal with the outcome of submitting a transaction received from pfrom to the
+ * mempool: relay it along with the orphans it makes valid, keep it as an orphan
+ * or reject it.
+ */
+static void ProcessTransactionResult(const Config &config, CNode *pfrom,
+                                     const CTransactionRef &ptx,
+                                     bool fAccepted, bool fMissingInputs,
+                                     const CValidationState &state,
+                                     CConnman &connman)
+    EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+    const CChainParams &chainparams = config.GetChainParams();
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    const CTransaction &tx = *ptx;
+    const CInv inv(MSG_TX, tx.GetId());
+    std::deque<COutPoint> vWorkQueue;
+    std::vector<uint256> vEraseQueue;
+
+    if (fAccepted) {
+        mempool.check(pcoinsTip);
+        RelayTransaction(tx, connman);
+        for (size_t i = 0; i < tx.vout.size(); i++) {
+            vWorkQueue.emplace_back(inv.hash, i);
+        }
+
+        pfrom->nLastTXTime = GetTime();
+
+        LogPrint(BCLog::MEMPOOL, "AcceptToMemoryPool: peer=%d: accepted %s "
+                                 "(poolsz %u txn, %u kB)\n",
+                 pfrom->id, tx.GetId().ToString(), mempool.size(),
+                 mempool.DynamicMemoryUsage() / 1000);
+
+        // Recursively process any orphan transactions that depended on this
+        // one
+        std::set<NodeId> setMisbehaving;
+        while (!vWorkQueue.empty()) {
+            auto itByPrev =
+                mapOrphanTransactionsByPrev.find(vWorkQueue.front());
+            vWorkQueue.pop_front();
+            if (itByPrev == mapOrphanTransactionsByPrev.end()) {
+                continue;
+            }
+            for (auto mi = itByPrev->second.begin();
+                 mi != itByPrev->second.end(); ++mi) {
+                const CTransactionRef &porphanTx = (*mi)->second.tx;
+                const CTransaction &orphanTx = *porphanTx;
+                const uint256 &orphanId = orphanTx.GetId();
+                NodeId fromPeer = (*mi)->second.fromPeer;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes
+                // to counter-DoS based on orphan resolution (that is,
+                // feeding people an invalid transaction based on LegitTxX
+                // in order to get anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+                if (setMisbehaving.count(fromPeer)) {
+                    continue;
+                }
+                if (AcceptToMemoryPool(config, mempool, stateDummy,
+                                       porphanTx, true, &fMissingInputs2)) {
+                    LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n",
+                             orphanId.ToString());
+                    RelayTransaction(orphanTx, connman);
+                    for (size_t i = 0; i < orphanTx.vout.size(); i++) {
+                        vWorkQueue.emplace_back(orphanId, i);
+                    }
+                    vEraseQueue.push_back(orphanId);
+                } else if (!fMissingInputs2) {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0) {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos, "invalid-orphan-tx");
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint(BCLog::MEMPOOL,
+                                 "   invalid orphan tx %s\n",
+                                 orphanId.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n",
+                             orphanId.ToString());
+                    vEraseQueue.push_back(orphanId);
+                    if (!stateDummy.CorruptionPossible()) {
+                        // Do not use rejection cache for witness
+                        // transactions or witness-stripped transactions, as
+                        // they can have been malleated. See
+                        // https://github.com/bitcoin/bitcoin/issues/8279
+                        // for details.
+                        assert(recentRejects);
+                        recentRejects->insert(orphanId);
+                    }
+                }
+                mempool.check(pcoinsTip);
+            }
+        }
+
+        for (uint256 hash : vEraseQueue) {
+            EraseOrphanTx(hash);
+        }
+    } else if (fMissingInputs) {
+        // It may be the case that the orphans parents have all been
+        // rejected.
+        bool fRejectedParents = false;
+        for (const CTxIn &txin : tx.vin) {
+            if (recentRejects->contains(txin.prevout.hash)) {
+                fRejectedParents = true;
+                break;
+            }
+        }
+        if (!fRejectedParents) {
+            uint32_t nFetchFlags = GetFetchFlags(
+                pfrom, chainActive.Tip(), chainparams.GetConsensus());
+            for (const CTxIn &txin : tx.vin) {
+                CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
+                pfrom->AddInventoryKnown(_inv);
+                if (!AlreadyHave(_inv)) {
+                    pfrom->AskFor(_inv);
+                }
+            }
+            AddOrphanTx(ptx, pfrom->GetId());
+
+            // DoS prevention: do not allow mapOrphanTransactions to grow
+            // unbounded
+            unsigned int nMaxOrphanTx = (unsigned int)std::max(
+                int64_t(0),
+                gArgs.GetArg("-maxorphantx",
+                             DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+            if (nEvicted > 0) {
+                LogPrint(BCLog::MEMPOOL,
+                         "mapOrphan overflow, removed %u tx\n", nEvicted);
+            }
+        } else {
+            LogPrint(BCLog::MEMPOOL,
+                     "not keeping orphan with rejected parents %s\n",
+                     tx.GetId().ToString());
+            // We will continue to reject this tx since it has rejected
+            // parents so avoid re-requesting it from other peers.
+            recentRejects->insert(tx.GetId());
+        }
+    } else {
+        if (!state.CorruptionPossible()) {
+            // Do not use rejection cache for witness transactions or
+            // witness-stripped transactions, as they can have been
+            // malleated. See https://github.com/bitcoin/bitcoin/issues/8279
+            // for details.
+            assert(recentRejects);
+            recentRejects->insert(tx.GetId());
+            if (RecursiveDynamicUsage(*ptx) < 100000) {
+                AddToCompactExtraTransactions(ptx);
+            }
+        }
+
+        if (pfrom->fWhitelisted &&
+            gArgs.GetBoolArg("-whitelistforcerelay",
+                             DEFAULT_WHITELISTFORCERELAY)) {
+            // Always relay transactions received from whitelisted peers,
+            // even if they were already in the mempool or rejected from it
+            // due to policy, allowing the node to function as a gateway for
+            // nodes hidden behind it.
+            //
+            // Never relay transactions that we would assign a non-zero DoS
+            // score for, as we expect peers to do the same with us in that
+            // case.
+            int nDoS = 0;
+            if (!state.IsInvalid(nDoS) || nDoS == 0) {
+                LogPrintf("Force relaying tx %s from whitelisted peer=%d\n",
+                          tx.GetId().ToString(), pfrom->id);
+                RelayTransaction(tx, connman);
+            } else {
+                LogPrintf("Not relaying invalid transaction %s from "
+                          "whitelisted peer=%d (%s)\n",
+                          tx.GetId().ToString(), pfrom->id,
+                          FormatStateMessage(state));
+            }
+        }
+    }
+
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS)) {
+        LogPrint(
+            BCLog::MEMPOOLREJ, "%s from peer=%d was not accepted: %s\n",
+            tx.GetHash().ToString(), pfrom->id, FormatStateMessage(state));
+        // Never send AcceptToMemoryPool's internal codes over P2P.
+        if (state.GetRejectCode() > 0 &&
+            state.GetRejectCode() < REJECT_INTERNAL) {
+            connman.PushMessage(
+                pfrom, msgMaker.Make(NetMsgType::REJECT,
+                                     std::string(NetMsgType::TX),
+                                     uint8_t(state.GetRejectCode()),
+                                     state.GetRejectReason().substr(
+                                         0, MAX_REJECT_MESSAGE_LENGTH),
+                                     inv.hash));
+        }
+        if (nDoS > 0) {
+            Misbehaving(pfrom, nDoS, state.GetRejectReason());
+        }
+    }
+}
+
 static bool ProcessMessage(const Config &config, CNode *pfrom,
                            const std::string &strCommand, CDataStream &vRecv,
                            int64_t nTimeReceived,
                            const CChainParams &chainparams, CConnman &connman,
-                           const std::atomic<bool> &interruptMsgProc) {
+                           const std::atomic<bool> &interruptMsgProc,
+                           std::shared_ptr<CBlock> pblockReceived = nullptr) {
     LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n",
              SanitizeString(strCommand), vRecv.size(), pfrom->id);
     if (gArgs.IsArgSet("-dropmessagestest") &&
@@ -1945,6 +2484,18 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
         if (it == mapBlockIndex.end() ||
             !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+            CNodeState *nodestate = State(pfrom->GetId());
+            if (it != mapBlockIndex.end() &&
+                nodestate->hashCutThroughSent == req.blockhash) {
+                // We relayed this block before having it, answer once we do.
+                LogPrint(BCLog::NET,
+                         "Peer %d sent us a getblocktxn for a block we are "
+                         "still downloading\n",
+                         pfrom->id);
+                nodestate->fBlockTxnRequestPending = true;
+                nodestate->blockTxnRequestPending = req;
+                return true;
+            }
             LogPrintf("Peer %d sent us a getblocktxn for a block we don't have",
                       pfrom->id);
             return true;
@@ -2050,203 +2601,33 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             return true;
         }
 
-        std::deque<COutPoint> vWorkQueue;
-        std::vector<uint256> vEraseQueue;
         CTransactionRef ptx;
         vRecv >> ptx;
-        const CTransaction &tx = *ptx;
 
-        CInv inv(MSG_TX, tx.GetId());
+        CInv inv(MSG_TX, ptx->GetId());
         pfrom->AddInventoryKnown(inv);
 
         LOCK(cs_main);
 
-        bool fMissingInputs = false;
-        CValidationState state;
-
         pfrom->setAskFor.erase(inv.hash);
         mapAlreadyAskedFor.erase(inv.hash);
 
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(config, mempool, state, ptx,
-                                                    true, &fMissingInputs)) {
-            mempool.check(pcoinsTip);
-            RelayTransaction(tx, connman);
-            for (size_t i = 0; i < tx.vout.size(); i++) {
-                vWorkQueue.emplace_back(inv.hash, i);
-            }
-
-            pfrom->nLastTXTime = GetTime();
-
-            LogPrint(BCLog::MEMPOOL, "AcceptToMemoryPool: peer=%d: accepted %s "
-                                     "(poolsz %u txn, %u kB)\n",
-                     pfrom->id, tx.GetId().ToString(), mempool.size(),
-                     mempool.DynamicMemoryUsage() / 1000);
-
-            // Recursively process any orphan transactions that depended on this
-            // one
-            std::set<NodeId> setMisbehaving;
-            while (!vWorkQueue.empty()) {
-                auto itByPrev =
-                    mapOrphanTransactionsByPrev.find(vWorkQueue.front());
-                vWorkQueue.pop_front();
-                if (itByPrev == mapOrphanTransactionsByPrev.end()) {
-                    continue;
-                }
-                for (auto mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end(); ++mi) {
-                    const CTransactionRef &porphanTx = (*mi)->second.tx;
-                    const CTransaction &orphanTx = *porphanTx;
-                    const uint256 &orphanId = orphanTx.GetId();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes
-                    // to counter-DoS based on orphan resolution (that is,
-                    // feeding people an invalid transaction based on LegitTxX
-                    // in order to get anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-                    if (setMisbehaving.count(fromPeer)) {
-                        continue;
-                    }
-                    if (AcceptToMemoryPool(config, mempool, stateDummy,
-                                           porphanTx, true, &fMissingInputs2)) {
-                        LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n",
-                                 orphanId.ToString());
-                        RelayTransaction(orphanTx, connman);
-                        for (size_t i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanId, i);
-                        }
-                        vEraseQueue.push_back(orphanId);
-                    } else if (!fMissingInputs2) {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0) {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos, "invalid-orphan-tx");
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint(BCLog::MEMPOOL,
-                                     "   invalid orphan tx %s\n",
-                                     orphanId.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n",
-                                 orphanId.ToString());
-                        vEraseQueue.push_back(orphanId);
-                        if (!stateDummy.CorruptionPossible()) {
-                            // Do not use rejection cache for witness
-                            // transactions or witness-stripped transactions, as
-                            // they can have been malleated. See
-                            // https://github.com/bitcoin/bitcoin/issues/8279
-                            // for details.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanId);
-                        }
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            for (uint256 hash : vEraseQueue) {
-                EraseOrphanTx(hash);
-            }
-        } else if (fMissingInputs) {
-            // It may be the case that the orphans parents have all been
-            // rejected.
-            bool fRejectedParents = false;
-            for (const CTxIn &txin : tx.vin) {
-                if (recentRejects->contains(txin.prevout.hash)) {
-                    fRejectedParents = true;
-                    break;
-                }
-            }
-            if (!fRejectedParents) {
-                uint32_t nFetchFlags = GetFetchFlags(
-                    pfrom, chainActive.Tip(), chainparams.GetConsensus());
-                for (const CTxIn &txin : tx.vin) {
-                    CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
-                    pfrom->AddInventoryKnown(_inv);
-                    if (!AlreadyHave(_inv)) {
-                        pfrom->AskFor(_inv);
-                    }
-                }
-                AddOrphanTx(ptx, pfrom->GetId());
-
-                // DoS prevention: do not allow mapOrphanTransactions to grow
-                // unbounded
-                unsigned int nMaxOrphanTx = (unsigned int)std::max(
-                    int64_t(0),
-                    gArgs.GetArg("-maxorphantx",
-                                 DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-                if (nEvicted > 0) {
-                    LogPrint(BCLog::MEMPOOL,
-                             "mapOrphan overflow, removed %u tx\n", nEvicted);
-                }
-            } else {
-                LogPrint(BCLog::MEMPOOL,
-                         "not keeping orphan with rejected parents %s\n",
-                         tx.GetId().ToString());
-                // We will continue to reject this tx since it has rejected
-                // parents so avoid re-requesting it from other peers.
-                recentRejects->insert(tx.GetId());
-            }
-        } else {
-            if (!state.CorruptionPossible()) {
-                // Do not use rejection cache for witness transactions or
-                // witness-stripped transactions, as they can have been
-                // malleated. See https://github.com/bitcoin/bitcoin/issues/8279
-                // for details.
-                assert(recentRejects);
-                recentRejects->insert(tx.GetId());
-                if (RecursiveDynamicUsage(*ptx) < 100000) {
-                    AddToCompactExtraTransactions(ptx);
-                }
-            }
-
-            if (pfrom->fWhitelisted &&
-                gArgs.GetBoolArg("-whitelistforcerelay",
-                                 DEFAULT_WHITELISTFORCERELAY)) {
-                // Always relay transactions received from whitelisted peers,
-                // even if they were already in the mempool or rejected from it
-                // due to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that we would assign a non-zero DoS
-                // score for, as we expect peers to do the same with us in that
-                // case.
-                int nDoS = 0;
-                if (!state.IsInvalid(nDoS) || nDoS == 0) {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n",
-                              tx.GetId().ToString(), pfrom->id);
-                    RelayTransaction(tx, connman);
-                } else {
-                    LogPrintf("Not relaying invalid transaction %s from "
-                              "whitelisted peer=%d (%s)\n",
-                              tx.GetId().ToString(), pfrom->id,
-                              FormatStateMessage(state));
-                }
-            }
+        if (IsTransactionPending(inv.hash)) {
+            // Another peer sent it during this pass. Whether it is valid is
+            // not known until its copy is submitted.
+            return true;
         }
-
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS)) {
-            LogPrint(
-                BCLog::MEMPOOLREJ, "%s from peer=%d was not accepted: %s\n",
-                tx.GetHash().ToString(), pfrom->id, FormatStateMessage(state));
-            // Never send AcceptToMemoryPool's internal codes over P2P.
-            if (state.GetRejectCode() > 0 &&
-                state.GetRejectCode() < REJECT_INTERNAL) {
-                connman.PushMessage(
-                    pfrom,
-                    msgMaker.Make(NetMsgType::REJECT, strCommand,
-                                  uint8_t(state.GetRejectCode()),
-                                  state.GetRejectReason().substr(
-                                      0, MAX_REJECT_MESSAGE_LENGTH),
-                                  inv.hash));
-            }
-            if (nDoS > 0) {
-                Misbehaving(pfrom, nDoS, state.GetRejectReason());
-            }
+        if (AlreadyHave(inv)) {
+            ProcessTransactionResult(config, pfrom, ptx, false, false,
+                                     CValidationState(), connman);
+        } else {
+            // Submitted to the mempool along with the transactions the other
+            // peers sent during this pass, by ProcessDeferredMessages.
+            PendingTransactions &pending = mapPendingTransactions
+                [pfrom->GetId() % connman.GetMessageHandlerThreads()];
+            pfrom->AddRef();
+            pending.vtx.push_back({pfrom, ptx});
+            pending.setTxids.insert(inv.hash);
         }
     }
 
@@ -2307,6 +2688,9 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
         bool fBlockReconstructed = false;
 
+        // Transactions of the block whose inputs to prefetch.
+        std::vector<CTransactionRef> vPrefetchTxs;
+
         {
             LOCK(cs_main);
             // If AcceptBlockHeader returned true, it set pindex
@@ -2324,6 +2708,21 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                 return true;
             }
 
+            if (pindex->nChainWork > chainActive.Tip()->nChainWork &&
+                pindex->nTx == 0) {
+                RecordBlockReceived(pindex->GetBlockHash(), nTimeReceived);
+                if (pindex->pprev == chainActive.Tip() &&
+                    !IsInitialBlockDownload() &&
+                    gArgs.GetBoolArg("-cutthroughrelay",
+                                     DEFAULT_CUTTHROUGH_RELAY)) {
+                    // Only the relay is cut through: reconstructing the block
+                    // and ProcessNewBlock still run below on this thread, and
+                    // hold cs_main like they did, so they still delay the
+                    // peers of other threads that need it.
+                    RelayCompactBlockCutThrough(pindex, cmpctblock, connman);
+                }
+            }
+
             if (pindex->nChainWork <=
                     chainActive.Tip()->nChainWork || // We know something better
                 pindex->nTx != 0) {
@@ -2421,6 +2820,13 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
                         req.blockhash = pindex->GetBlockHash();
                         connman.PushMessage(
                             pfrom, msgMaker.Make(NetMsgType::GETBLOCKTXN, req));
+                        // While the missing transactions are on their way,
+                        // load the coins spent by the ones we already have,
+                        // once cs_main is released.
+                        if (pindex->pprev == chainActive.Tip()) {
+                            vPrefetchTxs =
+                                partialBlock.GetAvailableTransactions();
+                        }
                     }
                 } else {
                     // This block is either already in flight from a different
@@ -2466,6 +2872,10 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
             }
         } // cs_main
 
+        if (!vPrefetchTxs.empty()) {
+            PrefetchBlockInputs(vPrefetchTxs);
+        }
+
         if (fProcessBLOCKTXN) {
             return ProcessMessage(config, pfrom, NetMsgType::BLOCKTXN,
                                   blockTxnMsg, nTimeReceived, chainparams,
@@ -2793,8 +3203,12 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
     else if (strCommand == NetMsgType::BLOCK && !fImporting &&
              !fReindex) // Ignore blocks received while importing
     {
-        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-        vRecv >> *pblock;
+        // The block may already have been deserialized as it arrived.
+        std::shared_ptr<CBlock> pblock = pblockReceived;
+        if (!pblock) {
+            pblock = std::make_shared<CBlock>();
+            vRecv >> *pblock;
+        }
 
         LogPrint(BCLog::NET, "received block %s peer=%d\n",
                  pblock->GetHash().ToString(), pfrom->id);
@@ -2807,6 +3221,7 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         const uint256 hash(pblock->GetHash());
         {
             LOCK(cs_main);
+            RecordBlockReceived(hash, nTimeReceived);
             // Also always process if we requested the block explicitly, as we
             // may need it even though it is not a candidate for a new best tip.
             forceProcessing |= MarkBlockAsReceived(hash);
@@ -2845,9 +3260,10 @@ static bool ProcessMessage(const Config &config, CNode *pfrom,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
         std::vector<CAddress> vAddr = connman.GetAddresses();
         FastRandomContext insecure_rand;
+        LOCK(pfrom->cs_vAddrToSend);
+        pfrom->vAddrToSend.clear();
         for (const CAddress &addr : vAddr) {
             pfrom->PushAddress(addr, insecure_rand);
         }
@@ -3068,6 +3484,37 @@ static bool SendRejectsAndCheckIfBanned(CNode *pnode, CConnman &connman) {
     return false;
 }
 
+void ProcessDeferredMessages(const Config &config, CConnman &connman,
+                             int nThread) {
+    std::vector<PendingTransaction> vPending;
+    {
+        LOCK(cs_main);
+        PendingTransactions &pending = mapPendingTransactions[nThread];
+        vPending.swap(pending.vtx);
+        pending.setTxids.clear();
+    }
+    if (vPending.empty()) {
+        return;
+    }
+
+    std::vector<CTransactionRef> vtx;
+    vtx.reserve(vPending.size());
+    for (const PendingTransaction &pending : vPending) {
+        vtx.push_back(pending.ptx);
+    }
+    const std::vector<MempoolAcceptResult> results =
+        AcceptToMemoryPoolBatch(config, mempool, vtx, true);
+
+    LOCK(cs_main);
+    for (size_t i = 0; i < vPending.size(); i++) {
+        ProcessTransactionResult(config, vPending[i].pfrom, vPending[i].ptx,
+                                 results[i].fAccepted,
+                                 results[i].fMissingInputs, results[i].state,
+                                 connman);
+        vPending[i].pfrom->Release();
+    }
+}
+
 bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
                      const std::atomic<bool> &interruptMsgProc) {
     const CChainParams &chainparams = config.GetChainParams();
@@ -3161,9 +3608,11 @@ bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
 
     // Process message
     bool fRet = false;
+    int64_t nTimeStart = GetTimeMicros();
     try {
         fRet = ProcessMessage(config, pfrom, strCommand, vRecv, msg.nTime,
-                              chainparams, connman, interruptMsgProc);
+                              chainparams, connman, interruptMsgProc,
+                              msg.GetReceivedBlock());
         if (interruptMsgProc) {
             return false;
         }
@@ -3198,6 +3647,7 @@ bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
     } catch (...) {
         PrintExceptionContinue(nullptr, "ProcessMessages()");
     }
+    RecordMessageProcessingTime(strCommand, GetTimeMicros() - nTimeStart);
 
     if (!fRet) {
         LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__,
@@ -3269,7 +3719,9 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
         }
     }
 
-    // Acquire cs_main for IsInitialBlockDownload() and CNodeState()
+    // Acquire cs_main for IsInitialBlockDownload() and CNodeState(). If
+    // another thread holds it, the node gets its turn on the next pass rather
+    // than holding up the other nodes of this thread.
     TRY_LOCK(cs_main, lockMain);
     if (!lockMain) {
         return true;
@@ -3292,6 +3744,7 @@ bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
     // Message: addr
     //
     if (pto->nNextAddrSend < nNow) {
+        LOCK(pto->cs_vAddrToSend);
         pto->nNextAddrSend =
             PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
         std::vector<CAddress> vAddr;
@@ -21,6 +21,9 @@ static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default number of orphan+recently-replaced txn to keep around for block
  * reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
+/** Default for -cutthroughrelay, relaying compact blocks before validating
+ * them */
+static const bool DEFAULT_CUTTHROUGH_RELAY = false;
 
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals &nodeSignals);
@@ -62,6 +65,13 @@ void Misbehaving(NodeId nodeid, int howmuch, const std::string &reason);
 /** Process protocol messages received from a given node */
 bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
                      const std::atomic<bool> &interrupt);
+/**
+ * Process the work ProcessMessages deferred until message handler thread
+ * nThread gave each of its nodes a turn: the transactions they sent meanwhile
+ * are submitted to the mempool together.
+ */
+void ProcessDeferredMessages(const Config &config, CConnman &connman,
+                             int nThread);
 /**
  * Send queued protocol messages to be sent to a give node.
  *
@@ -73,4 +83,27 @@ bool ProcessMessages(const Config &config, CNode *pfrom, CConnman &connman,
 bool SendMessages(const Config &config, CNode *pto, CConnman &connman,
                   const std::atomic<bool> &interrupt);
 
+/** Number of messages of one type processed and the time it took */
+struct MessageProcessingStats {
+    uint64_t nCount = 0;
+    //! Total and longest processing time, in microseconds.
+    int64_t nTotalTime = 0;
+    int64_t nMaxTime = 0;
+};
+/** Get the processing statistics of each message type since startup */
+std::map<std::string, MessageProcessingStats> GetMessageProcessingStats();
+
+/** Number of blocks relayed to peers and the time it took from receiving them */
+struct BlockRelayStats {
+    uint64_t nCount = 0;
+    //! Total and longest time from receipt to relay, in microseconds.
+    int64_t nTotalLatency = 0;
+    int64_t nMaxLatency = 0;
+};
+/**
+ * Get the relay statistics since startup of the blocks relayed before they
+ * were validated (fCutThrough) or after.
+ */
+BlockRelayStats GetBlockRelayStats(bool fCutThrough);
+
 #endif // BITCOIN_NET_PROCESSING_H
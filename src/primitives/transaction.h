@@ -7,6 +7,7 @@
 #define BITCOIN_PRIMITIVES_TRANSACTION_H
 
 #include "amount.h"
+#include "hash.h"
 #include "script/script.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -384,13 +385,17 @@ static inline CTransactionRef MakeTransactionRef(Tx &&txIn) {
 /** Precompute sighash midstate to avoid quadratic hashing */
 struct PrecomputedTransactionData {
     uint256 hashPrevouts, hashSequence, hashOutputs;
+    //! Hasher fed with the version, hashPrevouts and hashSequence: the start of
+    //! the preimage of every signature hash which commits to all the inputs.
+    CHash256 hashPrefixAll;
 
     PrecomputedTransactionData()
-        : hashPrevouts(), hashSequence(), hashOutputs() {}
+        : hashPrevouts(), hashSequence(), hashOutputs(), hashPrefixAll() {}
 
     PrecomputedTransactionData(const PrecomputedTransactionData &txdata)
         : hashPrevouts(txdata.hashPrevouts), hashSequence(txdata.hashSequence),
-          hashOutputs(txdata.hashOutputs) {}
+          hashOutputs(txdata.hashOutputs), hashPrefixAll(txdata.hashPrefixAll) {
+    }
 
     PrecomputedTransactionData(const CTransaction &tx);
 };
@@ -7,6 +7,7 @@
 #include "chainparams.h"
 #include "config.h"
 #include "httpserver.h"
+#include "index/addressindex.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "rpc/blockchain.h"
@@ -227,6 +228,7 @@ static bool rest_block(const Config &config, HTTPRequest *req,
     }
 
     CBlock block;
+    std::shared_ptr<const std::vector<uint8_t>> rawBlock;
     CBlockIndex *pblockindex = nullptr;
     {
         LOCK(cs_main);
@@ -241,25 +243,31 @@ static bool rest_block(const Config &config, HTTPRequest *req,
                            hashStr + " not available (pruned data)");
         }
 
-        if (!ReadBlockFromDisk(block, pblockindex, config)) {
-            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        // The binary and hex formats are the block as it is stored on disk,
+        // so it only needs to be parsed for JSON.
+        if (rf == RF_JSON) {
+            if (!ReadBlockFromDisk(block, pblockindex, config)) {
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+            }
+        } else {
+            rawBlock = ReadRawBlock(pblockindex, config);
+            if (!rawBlock) {
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+            }
         }
     }
 
-    CDataStream ssBlock(SER_NETWORK,
-                        PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
-
     switch (rf) {
         case RF_BINARY: {
-            std::string binaryBlock = ssBlock.str();
+            std::string binaryBlock(rawBlock->begin(), rawBlock->end());
             req->WriteHeader("Content-Type", "application/octet-stream");
             req->WriteReply(HTTP_OK, binaryBlock);
             return true;
         }
 
         case RF_HEX: {
-            std::string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+            std::string strHex =
+                HexStr(rawBlock->begin(), rawBlock->end()) + "\n";
             req->WriteHeader("Content-Type", "text/plain");
             req->WriteReply(HTTP_OK, strHex);
             return true;
@@ -443,6 +451,72 @@ static bool rest_tx(Config &config, HTTPRequest *req,
     return true;
 }
 
+static bool rest_address(Config &config, HTTPRequest *req,
+                         const std::string &strURIPart, bool fUnspentOnly) {
+    if (!CheckWarmup(req)) {
+        return false;
+    }
+
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.empty() || path.size() > 3 || path[0].empty()) {
+        return RESTERR(req, HTTP_BAD_REQUEST,
+                       "Invalid URI format. Expected "
+                       "/rest/address/<history|utxos>/<address>[/<count>[/"
+                       "<start>]].json");
+    }
+
+    int64_t nCount = DEFAULT_ADDRESS_QUERY_OUTPUTS;
+    if (path.size() > 1 && !ParseInt64(path[1], &nCount)) {
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid count: " + path[1]);
+    }
+
+    switch (rf) {
+        case RF_JSON: {
+            UniValue result;
+            try {
+                result = AddressIndexQuery(config, path[0], fUnspentOnly,
+                                           nCount,
+                                           path.size() > 2 ? path[2] : "");
+            } catch (const UniValue &objError) {
+                // The index being disabled or not ready is not the fault of
+                // the request.
+                const bool fUnavailable =
+                    find_value(objError, "code").get_int() == RPC_MISC_ERROR;
+                return RESTERR(req, fUnavailable ? HTTP_SERVICE_UNAVAILABLE
+                                                 : HTTP_BAD_REQUEST,
+                               find_value(objError, "message").get_str());
+            }
+            std::string strJSON = result.write() + "\n";
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, strJSON);
+            return true;
+        }
+
+        default: {
+            return RESTERR(req, HTTP_NOT_FOUND,
+                           "output format not found (available: json)");
+        }
+    }
+
+    // not reached
+    // continue to process further HTTP reqs on this cxn
+    return true;
+}
+
+static bool rest_address_history(Config &config, HTTPRequest *req,
+                                 const std::string &strURIPart) {
+    return rest_address(config, req, strURIPart, false);
+}
+
+static bool rest_address_utxos(Config &config, HTTPRequest *req,
+                               const std::string &strURIPart) {
+    return rest_address(config, req, strURIPart, true);
+}
+
 static bool rest_getutxos(Config &config, HTTPRequest *req,
                           const std::string &strURIPart) {
     if (!CheckWarmup(req)) {
@@ -678,6 +752,8 @@ static const struct {
     {"/rest/mempool/contents", rest_mempool_contents},
     {"/rest/headers/", rest_headers},
     {"/rest/getutxos", rest_getutxos},
+    {"/rest/address/history/", rest_address_history},
+    {"/rest/address/utxos/", rest_address_utxos},
 };
 
 bool StartREST() {
@@ -6,24 +6,30 @@
 #include "rpc/blockchain.h"
 
 #include "amount.h"
+#include "blockcache.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "coinstats.h"
 #include "coins.h"
 #include "config.h"
 #include "consensus/validation.h"
+#include "dstencode.h"
 #include "hash.h"
+#include "index/addressindex.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
 #include "rpc/tojson.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "validation.h"
 
+#include <boost/algorithm/string.hpp>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 #include <condition_variable>
@@ -850,79 +856,6 @@ UniValue getblock(const Config &config, const JSONRPCRequest &request) {
     return blockToJSON(config, block, pblockindex);
 }
 
-struct CCoinsStats {
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    Amount nTotalAmount;
-
-    CCoinsStats()
-        : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0),
-          nDiskSize(0), nTotalAmount(0) {}
-};
-
-static void ApplyStats(CCoinsStats &stats, CHashWriter &ss, const uint256 &hash,
-                       const std::map<uint32_t, Coin> &outputs) {
-    assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.GetHeight() * 2 +
-                 outputs.begin()->second.IsCoinBase());
-    stats.nTransactions++;
-    for (const auto output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.GetTxOut().scriptPubKey;
-        ss << VARINT(output.second.GetTxOut().nValue.GetSatoshis());
-        stats.nTransactionOutputs++;
-        stats.nTotalAmount += output.second.GetTxOut().nValue;
-        stats.nBogoSize +=
-            32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ +
-            8 /* amount */ + 2 /* scriptPubKey len */ +
-            output.second.GetTxOut().scriptPubKey.size() /* scriptPubKey */;
-    }
-    ss << VARINT(0);
-}
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats) {
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
-    }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hash;
-            outputs[key.n] = std::move(coin);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
-    return true;
-}
-
 UniValue pruneblockchain(const Config &config, const JSONRPCRequest &request) {
     if (request.fHelp || request.params.size() != 1) {
         throw std::runtime_error(
@@ -991,17 +924,27 @@ UniValue gettxoutsetinfo(const Config &config, const JSONRPCRequest &request) {
         throw std::runtime_error(
             "gettxoutsetinfo\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless -utxosummary is set.\n"
+            "\nWith -utxosummary, the statistics maintained as blocks are "
+            "connected are\nreturned: \"utxo_set_hash\" replaces "
+            "\"transactions\" and \"hash_serialized\",\nwhich take a walk "
+            "over the whole UTXO set. Without -utxosummary, or while\nthe "
+            "statistics are not up to date with the tip, the UTXO set is "
+            "walked and\n\"utxo_set_hash\" is not returned.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions "
+            "(without -utxosummary)\n"
             "  \"txouts\": n,            (numeric) The number of output "
             "transactions\n"
             "  \"bogosize\": n,          (numeric) A database-independent "
             "metric for UTXO set size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash "
+            "(without -utxosummary)\n"
+            "  \"utxo_set_hash\": \"hash\",     (string) The rolling hash of "
+            "the UTXO set (with -utxosummary)\n"
             "  \"disk_size\": n,         (numeric) The estimated size of the "
             "chainstate on disk\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
@@ -1013,9 +956,25 @@ UniValue gettxoutsetinfo(const Config &config, const JSONRPCRequest &request) {
 
     UniValue ret(UniValue::VOBJ);
 
+    // The statistics of the tip are readily available if they are maintained
+    // as blocks are connected.
+    CUTXOSummary summary;
+    if (GetUTXOSummary(summary)) {
+        ret.push_back(Pair("height", int64_t(summary.nHeight)));
+        ret.push_back(Pair("bestblock", summary.hashBlock.GetHex()));
+        ret.push_back(Pair("txouts", int64_t(summary.nTransactionOutputs)));
+        ret.push_back(Pair("bogosize", int64_t(summary.nBogoSize)));
+        ret.push_back(
+            Pair("utxo_set_hash", summary.setHash.GetHash().GetHex()));
+        ret.push_back(Pair("disk_size", pcoinsdbview->EstimateSize()));
+        ret.push_back(
+            Pair("total_amount", ValueFromAmount(summary.nTotalAmount)));
+        return ret;
+    }
+
     CCoinsStats stats;
     FlushStateToDisk();
-    if (GetUTXOStats(pcoinsTip, stats)) {
+    if (GetUTXOStats(pcoinsdbview, stats, GetNumCores())) {
         ret.push_back(Pair("height", int64_t(stats.nHeight)));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", int64_t(stats.nTransactions)));
@@ -1121,6 +1080,175 @@ UniValue gettxout(const Config &config, const JSONRPCRequest &request) {
     return ret;
 }
 
+UniValue AddressIndexQuery(const Config &config, const std::string &strAddress,
+                           bool fUnspentOnly, int64_t nCount,
+                           const std::string &strStart) {
+    if (!g_addressindex) {
+        throw JSONRPCError(RPC_MISC_ERROR, "The address index is disabled. "
+                                           "Use -addressindex to enable it");
+    }
+
+    uint256 scriptHash;
+    CTxDestination dest =
+        DecodeDestination(strAddress, config.GetChainParams());
+    if (IsValidDestination(dest)) {
+        scriptHash = GetScriptHash(GetScriptForDestination(dest));
+    } else if (IsHex(strAddress) && strAddress.size() == 64) {
+        scriptHash = uint256S(strAddress);
+    } else {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
+                           "Invalid address or script hash");
+    }
+
+    if (nCount < 1 || nCount > int64_t(MAX_ADDRESS_QUERY_OUTPUTS)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER,
+                           strprintf("Count must be between 1 and %u",
+                                     MAX_ADDRESS_QUERY_OUTPUTS));
+    }
+
+    // Positions are given as height:txid:vout.
+    CAddressIndexPos start;
+    if (!strStart.empty()) {
+        std::vector<std::string> vParts;
+        boost::split(vParts, strStart, boost::is_any_of(":"));
+        int32_t nHeight, nOutput;
+        if (vParts.size() != 3 || !ParseInt32(vParts[0], &nHeight) ||
+            nHeight < 0 || !IsHex(vParts[1]) || vParts[1].size() != 64 ||
+            !ParseInt32(vParts[2], &nOutput) || nOutput < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER,
+                               "Invalid start position: " + strStart);
+        }
+        start = CAddressIndexPos(nHeight,
+                                 COutPoint(uint256S(vParts[1]), nOutput));
+    }
+
+    if (!g_addressindex->BlockUntilSyncedToCurrentChain()) {
+        throw JSONRPCError(RPC_MISC_ERROR,
+                           "The address index is still being built");
+    }
+
+    std::vector<CAddressOutput> vOutputs;
+    CAddressIndexPos next;
+    if (fUnspentOnly ? !g_addressindex->FindUnspent(scriptHash, start, nCount,
+                                                    vOutputs, next)
+                     : !g_addressindex->FindOutputs(scriptHash, start, nCount,
+                                                    vOutputs, next)) {
+        throw JSONRPCError(RPC_DATABASE_ERROR,
+                           "Unable to read the address index");
+    }
+
+    UniValue outputs(UniValue::VARR);
+    for (const CAddressOutput &output : vOutputs) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("height", output.pos.nHeight));
+        entry.push_back(Pair("txid", output.pos.outpoint.hash.GetHex()));
+        entry.push_back(Pair("vout", int64_t(output.pos.outpoint.n)));
+        entry.push_back(Pair("amount", ValueFromAmount(output.nValue)));
+        if (output.IsSpent()) {
+            UniValue spent(UniValue::VOBJ);
+            spent.push_back(Pair("txid", output.spentTxid.GetHex()));
+            spent.push_back(Pair("vin", int64_t(output.nSpentInput)));
+            spent.push_back(Pair("height", output.nSpentHeight));
+            entry.push_back(Pair("spent", spent));
+        }
+        outputs.push_back(entry);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("scripthash", scriptHash.GetHex()));
+    ret.push_back(Pair("outputs", outputs));
+    if (!next.IsNull()) {
+        ret.push_back(Pair("next", strprintf("%d:%s:%u", next.nHeight,
+                                             next.outpoint.hash.GetHex(),
+                                             next.outpoint.n)));
+    }
+    return ret;
+}
+
+static std::string AddressIndexQueryHelp(const std::string &strMethod,
+                                         bool fUnspentOnly) {
+    return strMethod +
+           " \"address\" ( count \"start\" )\n"
+           "\nReturns the " +
+           std::string(fUnspentOnly ? "unspent outputs"
+                                    : "outputs, spent or not,") +
+           " paying to an address, by increasing\n"
+           "height, from the address index (requires -addressindex).\n"
+           "\nArguments:\n"
+           "1. \"address\"   (string, required) The address, or the script "
+           "hash (hex of the\n"
+           "                 reversed SHA256 of the script)\n"
+           "2. count       (numeric, optional, default=100) The maximum "
+           "number of outputs\n"
+           "                 to return, up to " +
+           strprintf("%u", MAX_ADDRESS_QUERY_OUTPUTS) +
+           "\n"
+           "3. \"start\"     (string, optional) Where to start from, as "
+           "returned in \"next\"\n"
+           "\nResult:\n"
+           "{\n"
+           "  \"scripthash\" : \"hash\",  (string) The script hash\n"
+           "  \"outputs\" : [\n"
+           "    {\n"
+           "      \"height\" : n,         (numeric) The height of the "
+           "block creating the output\n"
+           "      \"txid\" : \"id\",        (string) The transaction id\n"
+           "      \"vout\" : n,           (numeric) The output number\n"
+           "      \"amount\" : x.xxx,     (numeric) The amount in " +
+           CURRENCY_UNIT + "\n" +
+           (fUnspentOnly
+                ? std::string()
+                : "      \"spent\" : {          (json object, only if spent)\n"
+                  "        \"txid\" : \"id\",      (string) The spending "
+                  "transaction id\n"
+                  "        \"vin\" : n,          (numeric) The input "
+                  "number\n"
+                  "        \"height\" : n        (numeric) The height of "
+                  "the spending block\n"
+                  "      }\n") +
+           "    }\n"
+           "    ,...\n"
+           "  ],\n"
+           "  \"next\" : \"pos\"         (string, only if there are more "
+           "outputs) Where to\n"
+           "                           continue from\n"
+           "}\n"
+           "\nExamples:\n" +
+           HelpExampleCli(strMethod, "\"address\"") +
+           HelpExampleCli(strMethod, "\"address\" 10 \"pos\"") +
+           HelpExampleRpc(strMethod, "\"address\", 10");
+}
+
+static UniValue getaddresshistory(const Config &config,
+                                  const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() < 1 ||
+        request.params.size() > 3) {
+        throw std::runtime_error(
+            AddressIndexQueryHelp("getaddresshistory", false));
+    }
+
+    return AddressIndexQuery(
+        config, request.params[0].get_str(), false,
+        request.params[1].isNull() ? DEFAULT_ADDRESS_QUERY_OUTPUTS
+                                   : request.params[1].get_int64(),
+        request.params[2].isNull() ? "" : request.params[2].get_str());
+}
+
+static UniValue getaddressutxos(const Config &config,
+                                const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() < 1 ||
+        request.params.size() > 3) {
+        throw std::runtime_error(
+            AddressIndexQueryHelp("getaddressutxos", true));
+    }
+
+    return AddressIndexQuery(
+        config, request.params[0].get_str(), true,
+        request.params[1].isNull() ? DEFAULT_ADDRESS_QUERY_OUTPUTS
+                                   : request.params[1].get_int64(),
+        request.params[2].isNull() ? "" : request.params[2].get_str());
+}
+
 UniValue verifychain(const Config &config, const JSONRPCRequest &request) {
     int nCheckLevel = gArgs.GetArg("-checklevel", DEFAULT_CHECKLEVEL);
     int nCheckDepth = gArgs.GetArg("-checkblocks", DEFAULT_CHECKBLOCKS);
@@ -1506,6 +1634,49 @@ UniValue getmempoolinfo(const Config &config, const JSONRPCRequest &request) {
     return mempoolInfoToJSON();
 }
 
+static UniValue getblockcacheinfo(const Config &config,
+                                  const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() != 0) {
+        throw std::runtime_error(
+            "getblockcacheinfo\n"
+            "\nReturns details on the cache of serialized blocks and the block "
+            "files kept open to read blocks from.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"size\": xxxxx,               (numeric) Cached block count\n"
+            "  \"bytes\": xxxxx,              (numeric) Size of the cached "
+            "blocks\n"
+            "  \"maxbytes\": xxxxx,           (numeric) Maximum size of the "
+            "cached blocks\n"
+            "  \"hits\": xxxxx,               (numeric) Block reads served "
+            "from the cache\n"
+            "  \"misses\": xxxxx,             (numeric) Block reads which "
+            "went to disk\n"
+            "  \"openfiles\": xxxxx,          (numeric) Block files currently "
+            "open\n"
+            "  \"fileopens\": xxxxx           (numeric) Times a block file "
+            "was opened\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getblockcacheinfo", "") +
+            HelpExampleRpc("getblockcacheinfo", ""));
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    if (g_rawblockcache) {
+        ret.push_back(Pair("size", uint64_t(g_rawblockcache->Size())));
+        ret.push_back(Pair("bytes", uint64_t(g_rawblockcache->Bytes())));
+        ret.push_back(Pair("maxbytes", uint64_t(g_rawblockcache->MaxBytes())));
+        ret.push_back(Pair("hits", g_rawblockcache->Hits()));
+        ret.push_back(Pair("misses", g_rawblockcache->Misses()));
+    }
+    if (g_blockfilepool) {
+        ret.push_back(Pair("openfiles", uint64_t(g_blockfilepool->Size())));
+        ret.push_back(Pair("fileopens", g_blockfilepool->Opened()));
+    }
+    return ret;
+}
+
 UniValue preciousblock(const Config &config, const JSONRPCRequest &request) {
     if (request.fHelp || request.params.size() != 1) {
         throw std::runtime_error(
@@ -1737,6 +1908,7 @@ static const CRPCCommand commands[] = {
     { "blockchain",         "getblock",               getblock,               true,  {"blockhash","verbose"} },
     { "blockchain",         "getblockhash",           getblockhash,           true,  {"height"} },
     { "blockchain",         "getblockheader",         getblockheader,         true,  {"blockhash","verbose"} },
+    { "blockchain",         "getblockcacheinfo",      getblockcacheinfo,      true,  {} },
     { "blockchain",         "getchaintips",           getchaintips,           true,  {} },
     { "blockchain",         "getdifficulty",          getdifficulty,          true,  {} },
     { "blockchain",         "getmempoolancestors",    getmempoolancestors,    true,  {"txid","verbose"} },
@@ -1746,6 +1918,8 @@ static const CRPCCommand commands[] = {
     { "blockchain",         "getrawmempool",          getrawmempool,          true,  {"verbose"} },
     { "blockchain",         "gettxout",               gettxout,               true,  {"txid","n","include_mempool"} },
     { "blockchain",         "gettxoutsetinfo",        gettxoutsetinfo,        true,  {} },
+    { "blockchain",         "getaddresshistory",      getaddresshistory,      true,  {"address","count","start"} },
+    { "blockchain",         "getaddressutxos",        getaddressutxos,        true,  {"address","count","start"} },
     { "blockchain",         "pruneblockchain",        pruneblockchain,        true,  {"height"} },
     { "blockchain",         "verifychain",            verifychain,            true,  {"checklevel","nblocks"} },
     { "blockchain",         "preciousblock",          preciousblock,          true,  {"blockhash"} },
@@ -5,6 +5,9 @@
 #ifndef BITCOIN_RPCBLOCKCHAIN_H
 #define BITCOIN_RPCBLOCKCHAIN_H
 
+#include <cstdint>
+#include <string>
+
 #include <univalue.h>
 
 class CBlockIndex;
@@ -15,4 +18,13 @@ UniValue getblockchaininfo(const Config &config, const JSONRPCRequest &request);
 
 double GetDifficulty(const CBlockIndex *blockindex);
 
+/**
+ * Get up to nCount outputs paying to an address or script hash from the
+ * address index, starting from strStart (empty for the first ones), as JSON.
+ * Throws a JSONRPCError on failure.
+ */
+UniValue AddressIndexQuery(const Config &config, const std::string &strAddress,
+                           bool fUnspentOnly, int64_t nCount,
+                           const std::string &strStart);
+
 #endif // BITCOIN_RPCBLOCKCHAIN_H
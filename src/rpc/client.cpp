@@ -78,6 +78,8 @@ static const CRPCConvertParam vRPCConvertParams[] = {
     {"getblock", 1, "verbose"},
     {"getblockheader", 1, "verbose"},
     {"getchaintxstats", 0, "nblocks"},
+    {"getaddresshistory", 1, "count"},
+    {"getaddressutxos", 1, "count"},
     {"gettransaction", 1, "include_watchonly"},
     {"getrawtransaction", 1, "verbose"},
     {"createrawtransaction", 0, "inputs"},
@@ -457,8 +457,18 @@ static UniValue getblocktemplate(const Config &config,
             "in seconds since epoch (Jan 1 1970 GMT)\n"
             "  \"bits\" : \"xxxxxxxx\",              (string) compressed "
             "target of next block\n"
-            "  \"height\" : n                      (numeric) The height of the "
+            "  \"height\" : n,                     (numeric) The height of the "
             "next block\n"
+            "  \"delta\" : {                       (json object, optional) "
+            "with -incrementaltemplate, the transactions which changed since "
+            "the template of the given longpollid on the same block\n"
+            "      \"longpollid\" : \"str\",         (string) the longpollid "
+            "the changes are relative to\n"
+            "      \"added\" : [ \"txid\", ... ],     (array of string) "
+            "transactions added to the template\n"
+            "      \"removed\" : [ \"txid\", ... ],   (array of string) "
+            "transactions removed from the template\n"
+            "  }\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -560,30 +570,46 @@ static UniValue getblocktemplate(const Config &config,
     }
 
     static unsigned int nTransactionsUpdatedLast;
+    // Sequence number of the maintained template in pblocktemplate, or 0.
+    static uint64_t nTemplateSequence;
 
+    uint256 hashWatchedChain;
+    // nTransactionsUpdatedLast, or the template sequence with
+    // -incrementaltemplate.
+    uint64_t nUpdatedLastLP = 0;
     if (!lpval.isNull()) {
         // Wait to respond until either the best block changes, OR a minute has
         // passed and there are more transactions
-        uint256 hashWatchedChain;
         boost::system_time checktxtime;
-        unsigned int nTransactionsUpdatedLastLP;
 
         if (lpval.isStr()) {
             // Format: <hashBestChain><nTransactionsUpdatedLast>
             std::string lpstr = lpval.get_str();
 
             hashWatchedChain.SetHex(lpstr.substr(0, 64));
-            nTransactionsUpdatedLastLP = atoi64(lpstr.substr(64));
+            nUpdatedLastLP = atoi64(lpstr.substr(64));
         } else {
             // NOTE: Spec does not specify behaviour for non-string longpollid,
             // but this makes testing easier
             hashWatchedChain = chainActive.Tip()->GetBlockHash();
-            nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
+            nUpdatedLastLP = g_templateupdater ? nTemplateSequence
+                                               : nTransactionsUpdatedLast;
         }
 
         // Release the wallet and main lock while waiting
         LEAVE_CRITICAL_SECTION(cs_main);
-        {
+        if (g_templateupdater) {
+            // The template is kept up to date: respond as soon as it changes,
+            // but no more than every 10 seconds on the same tip.
+            const boost::system_time minTime =
+                boost::get_system_time() + boost::posix_time::seconds(10);
+            while (IsRPCRunning() &&
+                   !g_templateupdater->WaitForChange(
+                       hashWatchedChain, nUpdatedLastLP, minTime,
+                       boost::get_system_time() +
+                           boost::posix_time::seconds(1))) {
+            }
+        } else {
             checktxtime =
                 boost::get_system_time() + boost::posix_time::minutes(1);
 
@@ -593,7 +619,7 @@ static UniValue getblocktemplate(const Config &config,
                 if (!cvBlockChange.timed_wait(lock, checktxtime)) {
                     // Timeout: Check transactions for update
                     if (mempool.GetTransactionsUpdated() !=
-                        nTransactionsUpdatedLastLP) {
+                        nUpdatedLastLP) {
                         break;
                     }
                     checktxtime += boost::posix_time::seconds(10);
@@ -613,9 +639,31 @@ static UniValue getblocktemplate(const Config &config,
     static CBlockIndex *pindexPrev;
     static int64_t nStart;
     static std::unique_ptr<CBlockTemplate> pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast &&
-         GetTime() - nStart > 5)) {
+    uint64_t nSequence = 0;
+    std::shared_ptr<const CBlockTemplate> pmaintained;
+    if (g_templateupdater) {
+        pmaintained = g_templateupdater->GetTemplate(nSequence);
+    }
+    bool fMaintained =
+        pmaintained &&
+        pmaintained->block.hashPrevBlock == chainActive.Tip()->GetBlockHash();
+    if (fMaintained &&
+        (pindexPrev != chainActive.Tip() || nSequence != nTemplateSequence)) {
+        // The template maintained in the background is checked once, when it
+        // is first handed out.
+        fMaintained =
+            g_templateupdater->CheckTemplate(*pmaintained, nSequence);
+        if (fMaintained) {
+            pblocktemplate.reset(new CBlockTemplate(*pmaintained));
+            nTemplateSequence = nSequence;
+            pindexPrev = chainActive.Tip();
+            nStart = GetTime();
+        }
+    }
+    if (!fMaintained &&
+        (pindexPrev != chainActive.Tip() || nTemplateSequence != 0 ||
+         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast &&
+          GetTime() - nStart > 5))) {
         // Clear pindexPrev so future calls make a new block, despite any
         // failures from here on
         pindexPrev = nullptr;
@@ -634,6 +682,7 @@ static UniValue getblocktemplate(const Config &config,
 
         // Need to update only after we know CreateNewBlock succeeded
         pindexPrev = pindexPrevNew;
+        nTemplateSequence = 0;
     }
 
     // pointer for convenience
@@ -772,9 +821,31 @@ static UniValue getblocktemplate(const Config &config,
     result.push_back(
         Pair("coinbasevalue",
              (int64_t)pblock->vtx[0]->vout[0].nValue.GetSatoshis()));
-    result.push_back(Pair("longpollid",
-                          chainActive.Tip()->GetBlockHash().GetHex() +
-                              i64tostr(nTransactionsUpdatedLast)));
+    // A template built here when the maintained one is not usable has
+    // sequence number 0, which no maintained template has.
+    result.push_back(Pair(
+        "longpollid",
+        chainActive.Tip()->GetBlockHash().GetHex() +
+            i64tostr(g_templateupdater ? nTemplateSequence
+                                       : nTransactionsUpdatedLast)));
+    std::vector<uint256> vAdded, vRemoved;
+    if (nTemplateSequence != 0 && nUpdatedLastLP != 0 && lpval.isStr() &&
+        g_templateupdater->GetDelta(pblock->hashPrevBlock, nUpdatedLastLP,
+                                    nTemplateSequence, vAdded, vRemoved)) {
+        UniValue added(UniValue::VARR);
+        for (const uint256 &txid : vAdded) {
+            added.push_back(txid.GetHex());
+        }
+        UniValue removed(UniValue::VARR);
+        for (const uint256 &txid : vRemoved) {
+            removed.push_back(txid.GetHex());
+        }
+        UniValue delta(UniValue::VOBJ);
+        delta.push_back(Pair("longpollid", lpval.get_str()));
+        delta.push_back(Pair("added", added));
+        delta.push_back(Pair("removed", removed));
+        result.push_back(Pair("delta", delta));
+    }
     result.push_back(Pair("target", hashTarget.GetHex()));
     result.push_back(
         Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast() + 1));
@@ -614,6 +614,38 @@ static UniValue getmemoryinfo(const Config &config,
     return obj;
 }
 
+static UniValue getstartuptimes(const Config &config,
+                                const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() != 0) {
+        throw std::runtime_error(
+            "getstartuptimes\n"
+            "Returns how long each phase of the node startup took, in the "
+            "order the phases completed. Sub-phases are named after their "
+            "phase, and complete before it.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"phase\": \"name\",   (string) The name of the phase\n"
+            "    \"time\": xxx.xx,      (numeric) How long it took, in "
+            "milliseconds\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getstartuptimes", "") +
+            HelpExampleRpc("getstartuptimes", ""));
+    }
+
+    UniValue ret(UniValue::VARR);
+    for (const std::pair<std::string, int64_t> &phase : GetStartupPhases()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("phase", phase.first));
+        obj.push_back(Pair("time", phase.second * 0.001));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 static UniValue echo(const Config &config, const JSONRPCRequest &request) {
     if (request.fHelp) {
         throw std::runtime_error(
@@ -634,6 +666,7 @@ static const CRPCCommand commands[] = {
     //  ------------------- ------------------------  ----------------------  ----------
     { "control",            "getinfo",                getinfo,                true,  {} }, /* uses wallet if enabled */
     { "control",            "getmemoryinfo",          getmemoryinfo,          true,  {} },
+    { "control",            "getstartuptimes",        getstartuptimes,        true,  {} },
     { "util",               "validateaddress",        validateaddress,        true,  {"address"} }, /* uses wallet if enabled */
     { "util",               "createmultisig",         createmultisig,         true,  {"nrequired","keys"} },
     { "util",               "verifymessage",          verifymessage,          true,  {"address","signature","message"} },
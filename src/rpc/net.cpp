@@ -122,6 +122,10 @@ static UniValue getpeerinfo(const Config &config,
             "    ],\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is "
             "whitelisted\n"
+            "    \"processqueue\": n,         (numeric) The number of received "
+            "messages waiting to be processed\n"
+            "    \"processqueuebytes\": n,    (numeric) The size of these "
+            "messages in bytes\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent "
             "aggregated by message type\n"
@@ -196,6 +200,9 @@ static UniValue getpeerinfo(const Config &config,
             obj.push_back(Pair("inflight", heights));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        obj.push_back(Pair("processqueue", uint64_t(stats.nProcessQueueCount)));
+        obj.push_back(
+            Pair("processqueuebytes", uint64_t(stats.nProcessQueueSize)));
 
         UniValue sendPerMsgCmd(UniValue::VOBJ);
         for (const mapMsgCmdSize::value_type &i : stats.mapSendBytesPerMsgCmd) {
@@ -458,6 +465,120 @@ static UniValue getnettotals(const Config &config,
     return obj;
 }
 
+static UniValue getmessageprocessinginfo(const Config &config,
+                                         const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() > 0) {
+        throw std::runtime_error(
+            "getmessageprocessinginfo\n"
+            "\nReturns information about the processing of peer messages.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"threads\": n,            (numeric) The number of message "
+            "handler threads\n"
+            "  \"queued\": n,             (numeric) The number of received "
+            "messages waiting to be processed\n"
+            "  \"queuedbytes\": n,        (numeric) The size of these "
+            "messages in bytes\n"
+            "  \"messages\": {\n"
+            "    \"addr\": {              (object) The statistics of each "
+            "message type processed since startup\n"
+            "      \"count\": n,          (numeric) The number of messages\n"
+            "      \"totaltime\": n,      (numeric) The total processing "
+            "time in microseconds\n"
+            "      \"maxtime\": n         (numeric) The longest processing "
+            "time in microseconds\n"
+            "    },\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getmessageprocessinginfo", "") +
+            HelpExampleRpc("getmessageprocessinginfo", ""));
+    }
+
+    if (!g_connman) {
+        throw JSONRPCError(
+            RPC_CLIENT_P2P_DISABLED,
+            "Error: Peer-to-peer functionality missing or disabled");
+    }
+
+    std::vector<CNodeStats> vstats;
+    g_connman->GetNodeStats(vstats);
+    uint64_t nQueued = 0;
+    uint64_t nQueuedBytes = 0;
+    for (const CNodeStats &stats : vstats) {
+        nQueued += stats.nProcessQueueCount;
+        nQueuedBytes += stats.nProcessQueueSize;
+    }
+
+    UniValue messages(UniValue::VOBJ);
+    for (const auto &entry : GetMessageProcessingStats()) {
+        if (entry.second.nCount == 0) {
+            continue;
+        }
+        UniValue msg(UniValue::VOBJ);
+        msg.push_back(Pair("count", entry.second.nCount));
+        msg.push_back(Pair("totaltime", entry.second.nTotalTime));
+        msg.push_back(Pair("maxtime", entry.second.nMaxTime));
+        messages.push_back(Pair(entry.first, msg));
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("threads", g_connman->GetMessageHandlerThreads()));
+    obj.push_back(Pair("queued", nQueued));
+    obj.push_back(Pair("queuedbytes", nQueuedBytes));
+    obj.push_back(Pair("messages", messages));
+    return obj;
+}
+
+static UniValue BlockRelayStatsToJSON(const BlockRelayStats &stats) {
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", stats.nCount));
+    obj.push_back(Pair("totallatency", stats.nTotalLatency));
+    obj.push_back(Pair("maxlatency", stats.nMaxLatency));
+    return obj;
+}
+
+static UniValue getblockrelayinfo(const Config &config,
+                                  const JSONRPCRequest &request) {
+    if (request.fHelp || request.params.size() > 0) {
+        throw std::runtime_error(
+            "getblockrelayinfo\n"
+            "\nReturns how long blocks received from peers took to be relayed "
+            "to other peers.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"cutthroughrelay\": true|false, (boolean) Whether compact "
+            "blocks are relayed before being validated\n"
+            "  \"cutthrough\": {          (object) The blocks relayed before "
+            "being validated\n"
+            "    \"count\": n,            (numeric) The number of blocks\n"
+            "    \"totallatency\": n,     (numeric) The total time from "
+            "receipt to relay in microseconds\n"
+            "    \"maxlatency\": n        (numeric) The longest time from "
+            "receipt to relay in microseconds\n"
+            "  },\n"
+            "  \"validated\": {           (object) The blocks relayed once "
+            "validated, same fields\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getblockrelayinfo", "") +
+            HelpExampleRpc("getblockrelayinfo", ""));
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("cutthroughrelay",
+                       gArgs.GetBoolArg("-cutthroughrelay",
+                                        DEFAULT_CUTTHROUGH_RELAY)));
+    obj.push_back(Pair("cutthrough", BlockRelayStatsToJSON(
+                                         GetBlockRelayStats(true))));
+    obj.push_back(Pair("validated", BlockRelayStatsToJSON(
+                                        GetBlockRelayStats(false))));
+    return obj;
+}
+
 static UniValue GetNetworksInfo() {
     UniValue networks(UniValue::VARR);
     for (int n = 0; n < NET_MAX; ++n) {
@@ -761,6 +882,8 @@ static const CRPCCommand commands[] = {
     { "network",            "disconnectnode",         disconnectnode,         true,  {"address", "nodeid"} },
     { "network",            "getaddednodeinfo",       getaddednodeinfo,       true,  {"node"} },
     { "network",            "getnettotals",           getnettotals,           true,  {} },
+    { "network",            "getmessageprocessinginfo", getmessageprocessinginfo, true, {} },
+    { "network",            "getblockrelayinfo",      getblockrelayinfo,      true,  {} },
     { "network",            "getnetworkinfo",         getnetworkinfo,         true,  {} },
     { "network",            "setban",                 setban,                 true,  {"subnet", "command", "bantime", "absolute"} },
     { "network",            "listbanned",             listbanned,             true,  {} },
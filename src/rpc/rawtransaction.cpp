@@ -10,6 +10,7 @@
 #include "consensus/validation.h"
 #include "core_io.h"
 #include "dstencode.h"
+#include "index/txindex.h"
 #include "init.h"
 #include "keystore.h"
 #include "merkleblock.h"
@@ -237,12 +238,19 @@ static UniValue getrawtransaction(const Config &config,
     CTransactionRef tx;
     uint256 hashBlock;
     if (!GetTransaction(config, hash, tx, hashBlock, true)) {
-        throw JSONRPCError(
-            RPC_INVALID_ADDRESS_OR_KEY,
-            std::string(fTxIndex ? "No such mempool or blockchain transaction"
-                                 : "No such mempool transaction. Use -txindex "
-                                   "to enable blockchain transaction queries") +
-                ". Use gettransaction for wallet transactions.");
+        std::string errmsg;
+        if (!g_txindex) {
+            errmsg = "No such mempool transaction. Use -txindex to enable "
+                     "blockchain transaction queries";
+        } else if (!g_txindex->IsSynced()) {
+            errmsg = "No such mempool transaction. Blockchain transactions "
+                     "are still in the process of being indexed";
+        } else {
+            errmsg = "No such mempool or blockchain transaction";
+        }
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
+                           errmsg +
+                               ". Use gettransaction for wallet transactions.");
     }
 
     std::string strHex = EncodeHexTx(*tx, RPCSerializationFlags());
@@ -308,12 +316,11 @@ static UniValue gettxoutproof(const Config &config,
         oneTxid = hash;
     }
 
-    LOCK(cs_main);
-
     CBlockIndex *pblockindex = nullptr;
 
     uint256 hashBlock;
     if (request.params.size() > 1) {
+        LOCK(cs_main);
         hashBlock = uint256S(request.params[1].get_str());
         if (!mapBlockIndex.count(hashBlock))
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
@@ -321,6 +328,7 @@ static UniValue gettxoutproof(const Config &config,
     } else {
         // Loop through txids and try to find which block they're in. Exit loop
         // once a block is found.
+        LOCK(cs_main);
         for (const auto &tx : setTxids) {
             const Coin &coin = AccessByTxid(*pcoinsTip, tx);
             if (!coin.IsSpent()) {
@@ -330,6 +338,8 @@ static UniValue gettxoutproof(const Config &config,
         }
     }
 
+    // Without cs_main, as the transaction index may have to wait for the
+    // validation notifications.
     if (pblockindex == nullptr) {
         CTransactionRef tx;
         if (!GetTransaction(config, oneTxid, tx, hashBlock, false) ||
@@ -337,7 +347,11 @@ static UniValue gettxoutproof(const Config &config,
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
                                "Transaction not yet in block");
         }
+    }
 
+    LOCK(cs_main);
+
+    if (pblockindex == nullptr) {
         if (!mapBlockIndex.count(hashBlock)) {
             throw JSONRPCError(RPC_INTERNAL_ERROR, "Transaction index corrupt");
         }
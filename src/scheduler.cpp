@@ -142,3 +142,80 @@ CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
     }
     return result;
 }
+
+bool CScheduler::AreThreadsServicingQueue() const {
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    return nThreadsServicingQueue > 0;
+}
+
+void SingleThreadedSchedulerClient::MaybeScheduleProcessQueue() {
+    {
+        boost::unique_lock<boost::mutex> lock(m_callbacks_mutex);
+        // Try to avoid scheduling too many copies here, but if we
+        // accidentally have two ProcessQueue's scheduled at once its
+        // not a big deal.
+        if (m_are_callbacks_running) return;
+        if (m_callbacks_pending.empty()) return;
+    }
+    m_pscheduler->schedule(
+        std::bind(&SingleThreadedSchedulerClient::ProcessQueue, this),
+        boost::chrono::system_clock::now());
+}
+
+void SingleThreadedSchedulerClient::ProcessQueue() {
+    std::function<void(void)> callback;
+    {
+        boost::unique_lock<boost::mutex> lock(m_callbacks_mutex);
+        if (m_are_callbacks_running) return;
+        if (m_callbacks_pending.empty()) return;
+        m_are_callbacks_running = true;
+
+        callback = std::move(m_callbacks_pending.front());
+        m_callbacks_pending.pop_front();
+    }
+
+    // RAII the setting of m_are_callbacks_running and calling
+    // MaybeScheduleProcessQueue to ensure both happen safely even if
+    // callback() throws.
+    struct RAIICallbacksRunning {
+        SingleThreadedSchedulerClient *instance;
+        explicit RAIICallbacksRunning(SingleThreadedSchedulerClient *_instance)
+            : instance(_instance) {}
+        ~RAIICallbacksRunning() {
+            {
+                boost::unique_lock<boost::mutex> lock(
+                    instance->m_callbacks_mutex);
+                instance->m_are_callbacks_running = false;
+            }
+            instance->MaybeScheduleProcessQueue();
+        }
+    } raiicallbacksrunning(this);
+
+    callback();
+}
+
+void SingleThreadedSchedulerClient::AddToProcessQueue(
+    std::function<void(void)> func) {
+    assert(m_pscheduler);
+
+    {
+        boost::unique_lock<boost::mutex> lock(m_callbacks_mutex);
+        m_callbacks_pending.emplace_back(std::move(func));
+    }
+    MaybeScheduleProcessQueue();
+}
+
+void SingleThreadedSchedulerClient::EmptyQueue() {
+    assert(!m_pscheduler->AreThreadsServicingQueue());
+    bool should_continue = true;
+    while (should_continue) {
+        ProcessQueue();
+        boost::unique_lock<boost::mutex> lock(m_callbacks_mutex);
+        should_continue = !m_callbacks_pending.empty();
+    }
+}
+
+size_t SingleThreadedSchedulerClient::CallbacksPending() {
+    boost::unique_lock<boost::mutex> lock(m_callbacks_mutex);
+    return m_callbacks_pending.size();
+}
@@ -12,6 +12,8 @@
 //
 #include <boost/chrono/chrono.hpp>
 #include <boost/thread.hpp>
+#include <functional>
+#include <list>
 #include <map>
 
 //
@@ -68,6 +70,9 @@ public:
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    // Returns true if there are threads actively running in serviceQueue()
+    bool AreThreadsServicingQueue() const;
+
 private:
     std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
     boost::condition_variable newTaskScheduled;
@@ -80,4 +85,39 @@ private:
     }
 };
 
+/**
+ * Class used by CScheduler clients which may schedule multiple jobs which are
+ * required to be run serially. Jobs may not be run on the same thread, but no
+ * two jobs will be executed at the same time, and they are run in the order
+ * they were added.
+ */
+class SingleThreadedSchedulerClient {
+private:
+    CScheduler *m_pscheduler;
+
+    boost::mutex m_callbacks_mutex;
+    std::list<std::function<void(void)>> m_callbacks_pending;
+    bool m_are_callbacks_running = false;
+
+    void MaybeScheduleProcessQueue();
+    void ProcessQueue();
+
+public:
+    explicit SingleThreadedSchedulerClient(CScheduler *pschedulerIn)
+        : m_pscheduler(pschedulerIn) {}
+
+    /**
+     * Add a callback to be executed. Callbacks are executed serially and
+     * memory is released upon execution.
+     */
+    void AddToProcessQueue(std::function<void(void)> func);
+
+    // Processes all remaining queue members on the calling thread, blocking
+    // until the queue is empty. Must be called after the CScheduler has no
+    // remaining processing threads!
+    void EmptyQueue();
+
+    size_t CallbacksPending();
+};
+
 #endif
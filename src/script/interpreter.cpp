@@ -1535,6 +1535,9 @@ PrecomputedTransactionData::PrecomputedTransactionData(
     hashPrevouts = GetPrevoutHash(txTo);
     hashSequence = GetSequenceHash(txTo);
     hashOutputs = GetOutputsHash(txTo);
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion << hashPrevouts << hashSequence;
+    hashPrefixAll = ss.GetState();
 }
 
 uint256 SignatureHash(const CScript &scriptCode, const CTransaction &txTo,
@@ -1574,12 +1577,21 @@ uint256 SignatureHash(const CScript &scriptCode, const CTransaction &txTo,
             hashOutputs = ss.GetHash();
         }
 
-        CHashWriter ss(SER_GETHASH, 0);
-        // Version
-        ss << txTo.nVersion;
-        // Input prevouts/nSequence (none/all, depending on flags)
-        ss << hashPrevouts;
-        ss << hashSequence;
+        // Version, and input prevouts/nSequence (none/all, depending on
+        // flags). This prefix is the same for all the inputs signing all of
+        // them, so it may be hashed already.
+        const bool fPrefixAll = cache && !sigHashType.hasAnyoneCanPay() &&
+                                (sigHashType.getBaseType() !=
+                                 BaseSigHashType::SINGLE) &&
+                                (sigHashType.getBaseType() !=
+                                 BaseSigHashType::NONE);
+        CHashWriter ss(SER_GETHASH, 0,
+                       fPrefixAll ? cache->hashPrefixAll : CHash256());
+        if (!fPrefixAll) {
+            ss << txTo.nVersion;
+            ss << hashPrevouts;
+            ss << hashSequence;
+        }
         // The input being signed (replacing the scriptSig with scriptCode +
         // amount). The prevout may already be contained in hashPrevout, and the
         // nSequence may already be contain in hashSequence.
@@ -1627,6 +1639,27 @@ bool TransactionSignatureChecker::VerifySignature(
     return pubkey.Verify(sighash, vchSig);
 }
 
+uint256 TransactionSignatureChecker::GetSignatureHash(const CScript &scriptCode,
+                                                      SigHashType sigHashType,
+                                                      uint32_t flags) const {
+    // Only these flags change the signature hash.
+    flags &= SCRIPT_ENABLE_SIGHASH_FORKID | SCRIPT_ENABLE_REPLAY_PROTECTION;
+    if (lastSigHash.fValid && lastSigHash.flags == flags &&
+        lastSigHash.sigHashType.getRawSigHashType() ==
+            sigHashType.getRawSigHashType() &&
+        lastSigHash.scriptCode == scriptCode) {
+        return lastSigHash.sighash;
+    }
+
+    lastSigHash.sighash = SignatureHash(scriptCode, *txTo, nIn, sigHashType,
+                                        amount, this->txdata, flags);
+    lastSigHash.scriptCode = scriptCode;
+    lastSigHash.sigHashType = sigHashType;
+    lastSigHash.flags = flags;
+    lastSigHash.fValid = true;
+    return lastSigHash.sighash;
+}
+
 bool TransactionSignatureChecker::CheckSig(
     const std::vector<uint8_t> &vchSigIn, const std::vector<uint8_t> &vchPubKey,
     const CScript &scriptCode, uint32_t flags) const {
@@ -1643,8 +1676,7 @@ bool TransactionSignatureChecker::CheckSig(
     SigHashType sigHashType = GetHashType(vchSig);
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, sigHashType, amount,
-                                    this->txdata, flags);
+    uint256 sighash = GetSignatureHash(scriptCode, sigHashType, flags);
 
     if (!VerifySignature(vchSig, pubkey, sighash)) {
         return false;
@@ -152,6 +152,21 @@ private:
     const Amount amount;
     const PrecomputedTransactionData *txdata;
 
+    //! The last signature hash computed. CHECKMULTISIG needs the same one for
+    //! every key a signature is tried against, and usually for every
+    //! signature.
+    struct LastSigHash {
+        bool fValid = false;
+        CScript scriptCode;
+        SigHashType sigHashType;
+        uint32_t flags = 0;
+        uint256 sighash;
+    };
+    mutable LastSigHash lastSigHash;
+
+    uint256 GetSignatureHash(const CScript &scriptCode,
+                             SigHashType sigHashType, uint32_t flags) const;
+
 protected:
     virtual bool VerifySignature(const std::vector<uint8_t> &vchSig,
                                  const CPubKey &vchPubKey,
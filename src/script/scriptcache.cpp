@@ -9,11 +9,15 @@
 #include "primitives/transaction.h"
 #include "random.h"
 #include "script/sigcache.h"
-#include "sync.h"
 #include "util.h"
 #include "validation.h"
 
+#include <boost/thread.hpp>
+
 static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+// The mempool checks the scripts of several transactions at once, outside of
+// cs_main.
+static boost::shared_mutex cs_scriptExecutionCache;
 static uint256 scriptExecutionCacheNonce(GetRandHash());
 
 void InitScriptExecutionCache() {
@@ -47,15 +51,26 @@ uint256 GetScriptCacheKey(const CTransaction &tx, uint32_t flags) {
 }
 
 bool IsKeyInScriptCache(uint256 key, bool erase) {
-    // TODO: Remove this requirement by making CuckooCache not require external
-    // locks
-    AssertLockHeld(cs_main);
+    boost::shared_lock<boost::shared_mutex> lock(cs_scriptExecutionCache);
     return scriptExecutionCache.contains(key, erase);
 }
 
 void AddKeyInScriptCache(uint256 key) {
-    // TODO: Remove this requirement by making CuckooCache not require external
-    // locks
-    AssertLockHeld(cs_main);
+    boost::unique_lock<boost::shared_mutex> lock(cs_scriptExecutionCache);
     scriptExecutionCache.insert(key);
 }
+
+void DumpScriptExecutionCache(uint256 &nonce, std::vector<uint256> &entries) {
+    boost::shared_lock<boost::shared_mutex> lock(cs_scriptExecutionCache);
+    nonce = scriptExecutionCacheNonce;
+    scriptExecutionCache.get_elements(entries);
+}
+
+void LoadScriptExecutionCache(const uint256 &nonce,
+                              const std::vector<uint256> &entries) {
+    boost::unique_lock<boost::shared_mutex> lock(cs_scriptExecutionCache);
+    scriptExecutionCacheNonce = nonce;
+    for (const uint256 &entry : entries) {
+        scriptExecutionCache.insert(entry);
+    }
+}
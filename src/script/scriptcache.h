@@ -8,6 +8,7 @@
 #include "uint256.h"
 
 #include <cstdint>
+#include <vector>
 
 class CTransaction;
 
@@ -30,4 +31,14 @@ bool IsKeyInScriptCache(uint256 key, bool erase);
 /** Add an entry in the cache. */
 void AddKeyInScriptCache(uint256 key);
 
+/** Get the nonce of the cache and append its entries to entries. */
+void DumpScriptExecutionCache(uint256 &nonce, std::vector<uint256> &entries);
+
+/**
+ * Replace the nonce of the cache and insert entries computed with it. This
+ * must be called before the cache is used.
+ */
+void LoadScriptExecutionCache(const uint256 &nonce,
+                              const std::vector<uint256> &entries);
+
 #endif // BITCOIN_SCRIPT_SCRIPTCACHE_H
@@ -53,6 +53,20 @@ public:
         setValid.insert(entry);
     }
     uint32_t setup_bytes(size_t n) { return setValid.setup_bytes(n); }
+
+    void Dump(uint256 &nonceOut, std::vector<uint256> &entries) {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        nonceOut = nonce;
+        setValid.get_elements(entries);
+    }
+
+    void Load(const uint256 &nonceIn, const std::vector<uint256> &entries) {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        nonce = nonceIn;
+        for (const uint256 &entry : entries) {
+            setValid.insert(entry);
+        }
+    }
 };
 
 /**
@@ -81,6 +95,15 @@ void InitSignatureCache() {
               (nElems * sizeof(uint256)) >> 20, nMaxCacheSize >> 20, nElems);
 }
 
+void DumpSignatureCache(uint256 &nonce, std::vector<uint256> &entries) {
+    signatureCache.Dump(nonce, entries);
+}
+
+void LoadSignatureCache(const uint256 &nonce,
+                        const std::vector<uint256> &entries) {
+    signatureCache.Load(nonce, entries);
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(
     const std::vector<uint8_t> &vchSig, const CPubKey &pubkey,
     const uint256 &sighash) const {
@@ -58,4 +58,15 @@ public:
 
 void InitSignatureCache();
 
+/** Get the nonce of the signature cache and append its entries to entries. */
+void DumpSignatureCache(uint256 &nonce, std::vector<uint256> &entries);
+
+/**
+ * Replace the nonce of the signature cache and insert entries computed with it.
+ * The entries already in the cache are no longer found, so this must be called
+ * before the cache is used.
+ */
+void LoadSignatureCache(const uint256 &nonce,
+                        const std::vector<uint256> &entries);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -120,6 +120,61 @@ private:
     size_t nPos;
 };
 
+/**
+ * Minimal stream for reading from an existing byte vector by reference.
+ */
+class VectorReader {
+private:
+    const int nType;
+    const int nVersion;
+    const std::vector<uint8_t> &vchData;
+    size_t nPos;
+
+public:
+    /**
+     * @param[in]  nTypeIn Serialization Type
+     * @param[in]  nVersionIn Serialization Version (including any flags)
+     * @param[in]  vchDataIn  Referenced byte vector to read from
+     * @param[in]  nPosIn Starting position. Vector index where reads should
+     * start.
+     */
+    VectorReader(int nTypeIn, int nVersionIn,
+                 const std::vector<uint8_t> &vchDataIn, size_t nPosIn)
+        : nType(nTypeIn), nVersion(nVersionIn), vchData(vchDataIn),
+          nPos(nPosIn) {
+        if (nPos > vchData.size()) {
+            throw std::ios_base::failure(
+                "VectorReader(...): end of data (nPos > vchData.size())");
+        }
+    }
+
+    template <typename T> VectorReader &operator>>(T &obj) {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+
+    int GetVersion() const { return nVersion; }
+    int GetType() const { return nType; }
+
+    size_t size() const { return vchData.size() - nPos; }
+    bool empty() const { return vchData.size() == nPos; }
+
+    void read(char *dst, size_t n) {
+        if (n == 0) {
+            return;
+        }
+
+        // Read from the beginning of the buffer
+        size_t pos_next = nPos + n;
+        if (pos_next > vchData.size()) {
+            throw std::ios_base::failure("VectorReader::read(): end of data");
+        }
+        memcpy(dst, vchData.data() + nPos, n);
+        nPos = pos_next;
+    }
+};
+
 /**
  * Double ended buffer combining vector and stream-like interfaces.
  *
@@ -214,6 +269,7 @@ public:
     bool empty() const { return vch.size() == nReadPos; }
     void resize(size_type n, value_type c = 0) { vch.resize(n + nReadPos, c); }
     void reserve(size_type n) { vch.reserve(n + nReadPos); }
+    size_type capacity() const { return vch.capacity() - nReadPos; }
     const_reference operator[](size_type pos) const {
         return vch[pos + nReadPos];
     }
@@ -222,6 +278,14 @@ public:
         vch.clear();
         nReadPos = 0;
     }
+    /**
+     * Exchange the underlying buffer with vchOther, so that an allocation can
+     * be handed from one stream to another. The read position is reset.
+     */
+    void swap(vector_type &vchOther) {
+        vch.swap(vchOther);
+        nReadPos = 0;
+    }
     iterator insert(iterator it, const char &x = char()) {
         return vch.insert(it, x);
     }
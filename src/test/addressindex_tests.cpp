@@ -0,0 +1,188 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/addressindex.h"
+
+#include "config.h"
+#include "consensus/validation.h"
+#include "script/script.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+bool WaitForSync(const CAddressIndex &index) {
+    int64_t nStart = GetTimeMillis();
+    while (!index.BlockUntilSyncedToCurrentChain()) {
+        if (GetTimeMillis() - nStart > 10 * 1000) {
+            return false;
+        }
+        MilliSleep(100);
+    }
+    return true;
+}
+
+std::vector<CAddressOutput> GetOutputs(const CAddressIndex &index,
+                                       const CScript &script,
+                                       bool fUnspentOnly) {
+    std::vector<CAddressOutput> vOutputs;
+    CAddressIndexPos next;
+    BOOST_CHECK(fUnspentOnly
+                    ? index.FindUnspent(GetScriptHash(script),
+                                        CAddressIndexPos(), 1000, vOutputs,
+                                        next)
+                    : index.FindOutputs(GetScriptHash(script),
+                                        CAddressIndexPos(), 1000, vOutputs,
+                                        next));
+    BOOST_CHECK(next.IsNull());
+    return vOutputs;
+}
+
+//! Transaction spending output 0 of txFrom, anyone can spend, to script.
+CMutableTransaction Spend(const CTransaction &txFrom, const CScript &script) {
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txFrom.GetId(), 0);
+    tx.vout.resize(2);
+    tx.vout[0].nValue = txFrom.vout[0].nValue - Amount(1000);
+    tx.vout[0].scriptPubKey = script;
+    // Not indexed, as unspendable.
+    tx.vout[1].nValue = Amount(0);
+    tx.vout[1].scriptPubKey = CScript() << OP_RETURN
+                                        << std::vector<uint8_t>(40, 0);
+    return tx;
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(addressindex_paging) {
+    CAddressIndex index(1 << 20, true);
+    BOOST_REQUIRE(index.Start());
+    BOOST_REQUIRE(WaitForSync(index));
+
+    // All the coinbases of the test chain pay to the same key.
+    const CScript script = CScript() << ToByteVector(coinbaseKey.GetPubKey())
+                                     << OP_CHECKSIG;
+    const uint256 scriptHash = GetScriptHash(script);
+    std::vector<CAddressOutput> vAll = GetOutputs(index, script, false);
+    BOOST_REQUIRE_EQUAL(vAll.size(), coinbaseTxns.size());
+    for (size_t i = 0; i < vAll.size(); i++) {
+        BOOST_CHECK_EQUAL(vAll[i].pos.nHeight, i + 1);
+        BOOST_CHECK(vAll[i].pos.outpoint ==
+                    COutPoint(coinbaseTxns[i].GetId(), 0));
+        BOOST_CHECK_EQUAL(vAll[i].nValue, coinbaseTxns[i].vout[0].nValue);
+        BOOST_CHECK(!vAll[i].IsSpent());
+    }
+    BOOST_CHECK_EQUAL(GetOutputs(index, script, true).size(), vAll.size());
+
+    // Pages follow each other.
+    std::vector<CAddressOutput> vPaged, vPage;
+    CAddressIndexPos pos;
+    do {
+        BOOST_CHECK(index.FindOutputs(scriptHash, pos, 30, vPage, pos));
+        BOOST_CHECK(vPage.size() == 30 || pos.IsNull());
+        vPaged.insert(vPaged.end(), vPage.begin(), vPage.end());
+    } while (!pos.IsNull());
+    BOOST_REQUIRE_EQUAL(vPaged.size(), vAll.size());
+    for (size_t i = 0; i < vAll.size(); i++) {
+        BOOST_CHECK(vPaged[i].pos.outpoint == vAll[i].pos.outpoint);
+    }
+
+    // Starting from a height skips the outputs below.
+    BOOST_CHECK(index.FindUnspent(scriptHash,
+                                  CAddressIndexPos(90, COutPoint(uint256(), 0)),
+                                  1000, vPage, pos));
+    BOOST_CHECK_EQUAL(vPage.size(), 11);
+    BOOST_CHECK_EQUAL(vPage[0].pos.nHeight, 90);
+
+    // Unknown scripts have no outputs.
+    BOOST_CHECK(GetOutputs(index, CScript() << OP_1, false).empty());
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_spends) {
+    CAddressIndex index(1 << 20, true);
+    BOOST_REQUIRE(index.Start());
+    BOOST_REQUIRE(WaitForSync(index));
+
+    // A coinbase anyone can spend, once mature.
+    const CScript scriptCoinbase = CScript() << OP_TRUE;
+    const CBlock blockCoinbase = CreateAndProcessBlock({}, scriptCoinbase);
+    const CTransaction &coinbase = *blockCoinbase.vtx[0];
+    for (int i = 0; i < COINBASE_MATURITY; i++) {
+        CreateAndProcessBlock({}, CScript() << OP_2);
+    }
+
+    // Spend it, then spend the result in the same block.
+    const CScript scriptA = CScript() << OP_3;
+    const CScript scriptB = CScript() << OP_4;
+    CMutableTransaction txA = Spend(coinbase, scriptA);
+    CMutableTransaction txB = Spend(CTransaction(txA), scriptB);
+    const CBlock block = CreateAndProcessBlock({txA, txB}, CScript() << OP_5);
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(block.GetHash() == chainActive.Tip()->GetBlockHash());
+    }
+    const int nHeight = 101 + COINBASE_MATURITY + 1;
+
+    BOOST_CHECK(index.BlockUntilSyncedToCurrentChain());
+    std::vector<CAddressOutput> vOutputs =
+        GetOutputs(index, scriptCoinbase, false);
+    BOOST_REQUIRE_EQUAL(vOutputs.size(), 1);
+    BOOST_CHECK_EQUAL(vOutputs[0].pos.nHeight, 101);
+    BOOST_CHECK(vOutputs[0].pos.outpoint == COutPoint(coinbase.GetId(), 0));
+    BOOST_CHECK(vOutputs[0].IsSpent());
+    BOOST_CHECK(vOutputs[0].spentTxid == txA.GetId());
+    BOOST_CHECK_EQUAL(vOutputs[0].nSpentInput, 0);
+    BOOST_CHECK_EQUAL(vOutputs[0].nSpentHeight, nHeight);
+    BOOST_CHECK(GetOutputs(index, scriptCoinbase, true).empty());
+
+    vOutputs = GetOutputs(index, scriptA, false);
+    BOOST_REQUIRE_EQUAL(vOutputs.size(), 1);
+    BOOST_CHECK_EQUAL(vOutputs[0].pos.nHeight, nHeight);
+    BOOST_CHECK(vOutputs[0].spentTxid == txB.GetId());
+    BOOST_CHECK_EQUAL(vOutputs[0].nSpentHeight, nHeight);
+    BOOST_CHECK(GetOutputs(index, scriptA, true).empty());
+
+    vOutputs = GetOutputs(index, scriptB, true);
+    BOOST_REQUIRE_EQUAL(vOutputs.size(), 1);
+    BOOST_CHECK(vOutputs[0].pos.outpoint == COutPoint(txB.GetId(), 0));
+    BOOST_CHECK_EQUAL(vOutputs[0].nValue, txB.vout[0].nValue);
+    BOOST_CHECK(!vOutputs[0].IsSpent());
+
+    // Disconnecting the block restores the coinbase and forgets the rest.
+    const Config &config = GetConfig();
+    CBlockIndex *pindex;
+    {
+        LOCK(cs_main);
+        pindex = mapBlockIndex[block.GetHash()];
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(config, state, pindex));
+    }
+    BOOST_CHECK(index.BlockUntilSyncedToCurrentChain());
+    vOutputs = GetOutputs(index, scriptCoinbase, true);
+    BOOST_REQUIRE_EQUAL(vOutputs.size(), 1);
+    BOOST_CHECK(!vOutputs[0].IsSpent());
+    BOOST_CHECK_EQUAL(GetOutputs(index, scriptCoinbase, false).size(), 1);
+    BOOST_CHECK(GetOutputs(index, scriptA, false).empty());
+    BOOST_CHECK(GetOutputs(index, scriptB, false).empty());
+    BOOST_CHECK(GetOutputs(index, CScript() << OP_5, false).empty());
+
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ResetBlockFailureFlags(pindex));
+    }
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(config, state));
+    BOOST_CHECK(index.BlockUntilSyncedToCurrentChain());
+    BOOST_CHECK(GetOutputs(index, scriptCoinbase, true).empty());
+    BOOST_CHECK_EQUAL(GetOutputs(index, scriptB, true).size(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,147 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "config.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+RawBlockRef MakeRawBlock(size_t size) {
+    return std::make_shared<const std::vector<uint8_t>>(size);
+}
+
+uint256 HashOf(int n) {
+    uint256 hash;
+    *hash.begin() = n;
+    return hash;
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(blockcache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(rawblockcache_lru) {
+    CRawBlockCache cache(100);
+
+    cache.Add(HashOf(1), MakeRawBlock(40));
+    cache.Add(HashOf(2), MakeRawBlock(40));
+    BOOST_CHECK_EQUAL(cache.Size(), 2);
+    BOOST_CHECK_EQUAL(cache.Bytes(), 80);
+
+    // Using the first block makes the second the least recently used.
+    BOOST_CHECK(cache.Get(HashOf(1)));
+    cache.Add(HashOf(3), MakeRawBlock(40));
+    BOOST_CHECK_EQUAL(cache.Size(), 2);
+    BOOST_CHECK_EQUAL(cache.Bytes(), 80);
+    BOOST_CHECK(cache.Get(HashOf(1)));
+    BOOST_CHECK(!cache.Get(HashOf(2)));
+    BOOST_CHECK(cache.Get(HashOf(3)));
+
+    BOOST_CHECK_EQUAL(cache.Hits(), 3);
+    BOOST_CHECK_EQUAL(cache.Misses(), 1);
+
+    // A block larger than the cache is not added and evicts nothing.
+    cache.Add(HashOf(4), MakeRawBlock(101));
+    BOOST_CHECK(!cache.Get(HashOf(4)));
+    BOOST_CHECK_EQUAL(cache.Size(), 2);
+
+    // A block as large as the cache evicts everything else.
+    cache.Add(HashOf(5), MakeRawBlock(100));
+    BOOST_CHECK_EQUAL(cache.Size(), 1);
+    BOOST_CHECK_EQUAL(cache.Bytes(), 100);
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.Size(), 0);
+    BOOST_CHECK_EQUAL(cache.Bytes(), 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(read_raw_block, TestChain100Setup) {
+    const Config &config = GetConfig();
+    g_rawblockcache.reset(
+        new CRawBlockCache(DEFAULT_RAW_BLOCK_CACHE_SIZE << 20));
+
+    for (const CBlockIndex *pindex :
+         {chainActive.Genesis(), chainActive.Tip()}) {
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, pindex->GetBlockPos(), config));
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << block;
+
+        // The raw block is the block serialized for the network, and is the
+        // same whether it comes from disk or from the cache.
+        std::vector<uint8_t> raw;
+        BOOST_CHECK(ReadRawBlockFromDisk(raw, pindex->GetBlockPos(), config));
+        BOOST_CHECK(std::vector<uint8_t>(ss.begin(), ss.end()) == raw);
+        BOOST_CHECK(!g_rawblockcache->Get(pindex->GetBlockHash()));
+
+        RawBlockRef praw = ReadRawBlock(pindex, config);
+        BOOST_REQUIRE(praw);
+        BOOST_CHECK(std::vector<uint8_t>(ss.begin(), ss.end()) == *praw);
+        BOOST_CHECK(g_rawblockcache->Get(pindex->GetBlockHash()) == praw);
+
+        // A cache hit shares the buffer, rather than copying it.
+        BOOST_CHECK(ReadRawBlock(pindex, config) == praw);
+
+        // Blocks are also deserialized from the cache.
+        uint64_t nHits = g_rawblockcache->Hits();
+        CBlock cached;
+        BOOST_CHECK(ReadBlockFromDisk(cached, pindex, config));
+        BOOST_CHECK(cached.GetHash() == block.GetHash());
+        BOOST_CHECK_EQUAL(cached.vtx.size(), block.vtx.size());
+        BOOST_CHECK_EQUAL(g_rawblockcache->Hits(), nHits + 1);
+    }
+
+    // The header of the block read must match the index.
+    CBlockIndex index(*chainActive.Tip());
+    uint256 wrongHash = chainActive.Genesis()->GetBlockHash();
+    index.phashBlock = &wrongHash;
+    g_rawblockcache->Clear();
+    BOOST_CHECK(!ReadRawBlock(&index, config));
+
+    g_rawblockcache.reset();
+}
+
+BOOST_FIXTURE_TEST_CASE(blockfilepool, TestChain100Setup) {
+    const Config &config = GetConfig();
+    g_blockfilepool.reset(new CBlockFilePool(1));
+
+    // Reading any number of blocks of the same file opens it once.
+    for (int i = 0; i < 3; i++) {
+        for (const CBlockIndex *pindex :
+             {chainActive.Genesis(), chainActive.Tip()}) {
+            CBlock block;
+            BOOST_CHECK(ReadBlockFromDisk(block, pindex, config));
+            BOOST_CHECK(block.GetHash() == pindex->GetBlockHash());
+        }
+    }
+    BOOST_CHECK_EQUAL(g_blockfilepool->Size(), 1);
+    BOOST_CHECK_EQUAL(g_blockfilepool->Opened(), 1);
+
+    // A file which does not exist is not added to the pool.
+    uint8_t byte;
+    BOOST_CHECK(!g_blockfilepool->Read(CDiskBlockPos(1, 0), &byte, 1));
+    BOOST_CHECK_EQUAL(g_blockfilepool->Size(), 1);
+    BOOST_CHECK(
+        g_blockfilepool->Read(chainActive.Tip()->GetBlockPos(), &byte, 1));
+    BOOST_CHECK_EQUAL(g_blockfilepool->Opened(), 1);
+
+    // Reads past the end of the file fail.
+    BOOST_CHECK(!g_blockfilepool->Read(CDiskBlockPos(0, 1 << 30), &byte, 1));
+
+    g_blockfilepool->Close(0);
+    BOOST_CHECK_EQUAL(g_blockfilepool->Size(), 0);
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, chainActive.Tip(), config));
+    BOOST_CHECK_EQUAL(g_blockfilepool->Opened(), 2);
+
+    g_blockfilepool.reset();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,239 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "miner.h"
+
+#include "chainparams.h"
+#include "config.h"
+#include "script/script.h"
+#include "test/test_bitcoin.h"
+#include "txmempool.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+
+namespace {
+
+struct BlockTemplateSetup : public AnyoneCanSpendSetup {
+    void AddToMempool(const CMutableTransaction &tx, Amount nFee) {
+        LOCK2(cs_main, mempool.cs);
+        TestMemPoolEntryHelper entry;
+        mempool.addUnchecked(tx.GetId(), entry.Fee(nFee).FromTx(tx));
+    }
+
+    ~BlockTemplateSetup() { mempool.clear(); }
+};
+
+std::vector<uint256> GetTxids(const CBlockTemplate &blocktemplate) {
+    std::vector<uint256> vTxids;
+    for (size_t i = 1; i < blocktemplate.block.vtx.size(); i++) {
+        vTxids.push_back(blocktemplate.block.vtx[i]->GetId());
+    }
+    return vTxids;
+}
+
+uint256 GetTipHash() {
+    LOCK(cs_main);
+    return chainActive.Tip()->GetBlockHash();
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(blocktemplate_tests, BlockTemplateSetup)
+
+BOOST_AUTO_TEST_CASE(blocktemplate_updates) {
+    const Config &config = GetConfig();
+    BlockTemplateUpdater updater(config);
+    updater.Start();
+    updater.BlockUntilUpToDate();
+
+    // The template is assembled on the tip.
+    uint64_t nSequence;
+    std::shared_ptr<const CBlockTemplate> ptemplate =
+        updater.GetTemplate(nSequence);
+    BOOST_REQUIRE(ptemplate);
+    const uint64_t nSequenceEmpty = nSequence;
+    const uint256 hashPrev = GetTipHash();
+    BOOST_CHECK(ptemplate->block.hashPrevBlock == hashPrev);
+    BOOST_CHECK_EQUAL(ptemplate->block.vtx.size(), 1);
+
+    // Transactions are appended, a child after its parent, but not those
+    // paying too little.
+    const CMutableTransaction txA = Spend(vCoinbases[0], Amount(1000));
+    const CMutableTransaction txB = Spend(CTransaction(txA), Amount(2000));
+    const CMutableTransaction txLow = Spend(vCoinbases[1], Amount(10));
+    AddToMempool(txA, Amount(1000));
+    AddToMempool(txB, Amount(2000));
+    AddToMempool(txLow, Amount(10));
+    updater.BlockUntilUpToDate();
+
+    ptemplate = updater.GetTemplate(nSequence);
+    const std::vector<uint256> vExpected = {txA.GetId(), txB.GetId()};
+    BOOST_CHECK(GetTxids(*ptemplate) == vExpected);
+    BOOST_CHECK(ptemplate->vTxFees[1] == Amount(1000));
+    BOOST_CHECK(ptemplate->vTxFees[2] == Amount(2000));
+    BOOST_CHECK(ptemplate->vTxFees[0] == Amount(-3000));
+    BOOST_CHECK(ptemplate->block.vtx[0]->vout[0].nValue ==
+                Amount(3000) +
+                    GetBlockSubsidy(chainActive.Height() + 1,
+                                    config.GetChainParams().GetConsensus()));
+    const uint64_t nSequenceAdded = nSequence;
+
+    // Long polling clients are told what changed.
+    std::vector<uint256> vAdded, vRemoved;
+    BOOST_CHECK(updater.GetDelta(hashPrev, nSequenceEmpty, nSequenceAdded,
+                                 vAdded, vRemoved));
+    std::sort(vAdded.begin(), vAdded.end());
+    std::vector<uint256> vSorted = vExpected;
+    std::sort(vSorted.begin(), vSorted.end());
+    BOOST_CHECK(vAdded == vSorted);
+    BOOST_CHECK(vRemoved.empty());
+    BOOST_CHECK(updater.WaitForChange(hashPrev, nSequenceEmpty,
+                                      boost::get_system_time(),
+                                      boost::get_system_time()));
+    BOOST_CHECK(!updater.WaitForChange(hashPrev, nSequenceAdded,
+                                       boost::get_system_time(),
+                                       boost::get_system_time()));
+
+    // A transaction leaving the mempool takes its children with it.
+    {
+        LOCK(mempool.cs);
+        mempool.removeRecursive(CTransaction(txA));
+    }
+    updater.BlockUntilUpToDate();
+    ptemplate = updater.GetTemplate(nSequence);
+    BOOST_CHECK(GetTxids(*ptemplate).empty());
+    BOOST_CHECK(updater.GetDelta(hashPrev, nSequenceAdded, nSequence, vAdded,
+                                 vRemoved));
+    std::sort(vRemoved.begin(), vRemoved.end());
+    BOOST_CHECK(vAdded.empty());
+    BOOST_CHECK(vRemoved == vSorted);
+    // Nothing changed since the empty template.
+    BOOST_CHECK(updater.GetDelta(hashPrev, nSequenceEmpty, nSequence, vAdded,
+                                 vRemoved));
+    BOOST_CHECK(vAdded.empty() && vRemoved.empty());
+
+    // A new tip gets a new template, without the mined transactions. The
+    // coinbase of the mined block claims the fees of the whole mempool.
+    const CMutableTransaction txC = Spend(vCoinbases[2], Amount(1000));
+    AddToMempool(txC, Amount(1000));
+    CreateAndProcessBlock({txC}, CScript() << OP_2);
+    const uint256 hashTip = GetTipHash();
+    BOOST_REQUIRE(hashTip != hashPrev);
+    BOOST_CHECK(updater.WaitForChange(hashPrev, nSequence,
+                                      boost::get_system_time(),
+                                      boost::get_system_time() +
+                                          boost::posix_time::seconds(10)));
+    const CMutableTransaction txD = Spend(vCoinbases[3], Amount(1000));
+    AddToMempool(txD, Amount(1000));
+    updater.BlockUntilUpToDate();
+    ptemplate = updater.GetTemplate(nSequence);
+    BOOST_CHECK(ptemplate->block.hashPrevBlock == hashTip);
+    // Assembled from scratch, the template also has the high priority
+    // transactions, like txLow.
+    std::vector<uint256> vTxids = GetTxids(*ptemplate);
+    BOOST_CHECK(std::count(vTxids.begin(), vTxids.end(), txD.GetId()) == 1);
+    BOOST_CHECK(std::count(vTxids.begin(), vTxids.end(), txC.GetId()) == 0);
+    // Changes on the previous tip are forgotten.
+    BOOST_CHECK(!updater.GetDelta(hashPrev, nSequenceEmpty, nSequence, vAdded,
+                                  vRemoved));
+
+    updater.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(blocktemplate_check) {
+    BlockTemplateUpdater updater(GetConfig());
+    updater.Start();
+    const CMutableTransaction tx = Spend(vCoinbases[0], Amount(1000));
+    AddToMempool(tx, Amount(1000));
+    updater.BlockUntilUpToDate();
+
+    // A valid template stays.
+    uint64_t nSequence;
+    std::shared_ptr<const CBlockTemplate> ptemplate =
+        updater.GetTemplate(nSequence);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(updater.CheckTemplate(*ptemplate, nSequence));
+    }
+    updater.BlockUntilUpToDate();
+    uint64_t nSequenceChecked;
+    updater.GetTemplate(nSequenceChecked);
+    BOOST_CHECK_EQUAL(nSequenceChecked, nSequence);
+
+    // The updater does not know the coins, so it patches in a transaction
+    // spending one which does not exist. The template is only found invalid
+    // when checked.
+    const CMutableTransaction txParent = Spend(CTransaction(tx), Amount(1000));
+    const CMutableTransaction txBad =
+        Spend(CTransaction(txParent), Amount(1000));
+    AddToMempool(txBad, Amount(1000));
+    updater.BlockUntilUpToDate();
+    ptemplate = updater.GetTemplate(nSequence);
+    const uint64_t nSequenceBad = nSequence;
+    const std::vector<uint256> vExpected = {tx.GetId(), txBad.GetId()};
+    BOOST_CHECK(GetTxids(*ptemplate) == vExpected);
+    {
+        LOCK(cs_main);
+        mempool.clear();
+        BOOST_CHECK(!updater.CheckTemplate(*ptemplate, nSequence));
+    }
+
+    // It is then assembled again, and clients need the whole template.
+    updater.BlockUntilUpToDate();
+    ptemplate = updater.GetTemplate(nSequence);
+    BOOST_CHECK(nSequence > nSequenceBad);
+    BOOST_CHECK(GetTxids(*ptemplate).empty());
+    std::vector<uint256> vAdded, vRemoved;
+    BOOST_CHECK(!updater.GetDelta(GetTipHash(), nSequenceBad, nSequence,
+                                  vAdded, vRemoved));
+
+    updater.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(blocktemplate_full) {
+    const CMutableTransaction tx1 = Spend(vCoinbases[0], Amount(1000));
+    const CMutableTransaction tx2 = Spend(vCoinbases[1], Amount(2000));
+    const CMutableTransaction tx3 = Spend(vCoinbases[2], Amount(3000));
+    const uint64_t nSize =
+        ::GetSerializeSize(tx1, SER_NETWORK, PROTOCOL_VERSION);
+
+    // Room for two transactions only.
+    gArgs.ForceSetArg("-blockmaxsize", std::to_string(1000 + 2 * nSize + 1));
+    BlockTemplateUpdater updater(GetConfig());
+    updater.Start();
+    updater.BlockUntilUpToDate();
+    AddToMempool(tx1, Amount(1000));
+    AddToMempool(tx2, Amount(2000));
+    updater.BlockUntilUpToDate();
+    uint64_t nSequence;
+    std::vector<uint256> vExpected = {tx1.GetId(), tx2.GetId()};
+    BOOST_CHECK(GetTxids(*updater.GetTemplate(nSequence)) == vExpected);
+
+    // A transaction paying more makes room for itself.
+    AddToMempool(tx3, Amount(3000));
+    updater.BlockUntilUpToDate();
+    vExpected = {tx1.GetId(), tx3.GetId()};
+    BOOST_CHECK(GetTxids(*updater.GetTemplate(nSequence)) == vExpected);
+
+    // But not one paying less.
+    const CMutableTransaction tx4 = Spend(vCoinbases[3], Amount(500));
+    AddToMempool(tx4, Amount(500));
+    updater.BlockUntilUpToDate();
+    BOOST_CHECK(GetTxids(*updater.GetTemplate(nSequence)) == vExpected);
+
+    // Nor one evicting its own parent.
+    const CMutableTransaction tx5 = Spend(CTransaction(tx3), Amount(5000));
+    AddToMempool(tx5, Amount(5000));
+    updater.BlockUntilUpToDate();
+    BOOST_CHECK(GetTxids(*updater.GetTemplate(nSequence)) == vExpected);
+
+    updater.Stop();
+    gArgs.ClearArg("-blockmaxsize");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
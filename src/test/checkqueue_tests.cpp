@@ -0,0 +1,103 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+static const unsigned int QUEUE_BATCH_SIZE = 128;
+static const int WORKER_THREADS = 3;
+
+static std::atomic<unsigned int> nChecksRun;
+
+struct FakeCheck {
+    bool fOk;
+
+    FakeCheck() : fOk(true) {}
+    explicit FakeCheck(bool fOkIn) : fOk(fOkIn) {}
+
+    bool operator()() {
+        nChecksRun++;
+        return fOk;
+    }
+    void swap(FakeCheck &x) { std::swap(fOk, x.fOk); }
+};
+
+static const CheckQueueEngine ENGINES[] = {CheckQueueEngine::LEGACY,
+                                           CheckQueueEngine::WORKSTEALING};
+
+/** Run nRounds rounds of nChecks checks, of which nFail fail, per engine. */
+static void RunRounds(CheckQueueEngine engine, size_t nRounds, size_t nChecks,
+                      size_t nFail) {
+    std::unique_ptr<CCheckQueueBase<FakeCheck>> queue =
+        MakeCheckQueue<FakeCheck>(engine, QUEUE_BATCH_SIZE);
+    boost::thread_group tg;
+    for (int i = 0; i < WORKER_THREADS; i++) {
+        tg.create_thread([&] { queue->Thread(); });
+    }
+
+    for (size_t round = 0; round < nRounds; round++) {
+        nChecksRun = 0;
+        CCheckQueueControl<FakeCheck> control(queue.get());
+        // Add the checks in uneven batches, so some deques get more work than
+        // others.
+        size_t nAdded = 0;
+        for (size_t nBatch = 1; nAdded < nChecks; nBatch *= 2) {
+            std::vector<FakeCheck> vChecks;
+            for (size_t i = 0; i < nBatch && nAdded < nChecks; i++, nAdded++) {
+                vChecks.emplace_back(nAdded >= nFail);
+            }
+            control.Add(vChecks);
+        }
+        BOOST_CHECK_EQUAL(control.Wait(), nFail == 0);
+        if (nFail == 0) {
+            BOOST_CHECK_EQUAL(nChecksRun.load(), nChecks);
+        }
+        BOOST_CHECK(queue->IsIdle());
+    }
+
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_ok) {
+    for (CheckQueueEngine engine : ENGINES) {
+        RunRounds(engine, 20, 0, 0);
+        RunRounds(engine, 20, 1, 0);
+        RunRounds(engine, 20, 10000, 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure) {
+    for (CheckQueueEngine engine : ENGINES) {
+        RunRounds(engine, 20, 1, 1);
+        RunRounds(engine, 20, 10000, 1);
+        RunRounds(engine, 20, 10000, 5000);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_no_workers) {
+    // The master must be able to complete all the work on its own.
+    for (CheckQueueEngine engine : ENGINES) {
+        std::unique_ptr<CCheckQueueBase<FakeCheck>> queue =
+            MakeCheckQueue<FakeCheck>(engine, QUEUE_BATCH_SIZE);
+        nChecksRun = 0;
+        CCheckQueueControl<FakeCheck> control(queue.get());
+        std::vector<FakeCheck> vChecks(1000);
+        control.Add(vChecks);
+        BOOST_CHECK(control.Wait());
+        BOOST_CHECK_EQUAL(nChecksRun.load(), 1000U);
+        BOOST_CHECK(queue->IsIdle());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
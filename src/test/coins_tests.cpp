@@ -6,12 +6,14 @@
 #include "consensus/validation.h"
 #include "script/standard.h"
 #include "test/test_bitcoin.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "undo.h"
 #include "utilstrencodings.h"
 #include "validation.h"
 
 #include <map>
+#include <memory>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
@@ -121,6 +123,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test) {
     bool found_an_entry = false;
     bool missed_an_entry = false;
     bool uncached_an_entry = false;
+    bool prefetched_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<COutPoint, Coin> result;
@@ -186,6 +189,21 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test) {
             uncached_an_entry |= !stack[cacheid]->HaveCoinInCache(out);
         }
 
+        // Once every 50 iterations, prefetch a few random entries into a random
+        // cache. This must not change what the cache stack represents.
+        if (InsecureRandRange(50) == 0) {
+            std::vector<COutPoint> outpoints;
+            for (int j = 0; j < 8; j++) {
+                outpoints.emplace_back(txids[insecure_rand() % txids.size()],
+                                       0);
+            }
+            int cacheid = insecure_rand() % stack.size();
+            stack[cacheid]->PrefetchCoins(outpoints);
+            for (const COutPoint &out : outpoints) {
+                prefetched_an_entry |= stack[cacheid]->HaveCoinInCache(out);
+            }
+        }
+
         // Once every 1000 iterations and at the end, verify the full cache.
         if (InsecureRandRange(1000) == 1 ||
             i == NUM_SIMULATION_ITERATIONS - 1) {
@@ -201,6 +219,17 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test) {
                     found_an_entry = true;
                 }
             }
+            // The bulk lookup must agree with the individual ones.
+            std::vector<COutPoint> outpoints;
+            for (auto it = result.begin(); it != result.end(); it++) {
+                outpoints.push_back(it->first);
+            }
+            std::vector<Coin> coins;
+            stack.back()->GetCoins(outpoints, coins);
+            BOOST_CHECK_EQUAL(coins.size(), outpoints.size());
+            for (size_t j = 0; j < outpoints.size(); j++) {
+                BOOST_CHECK(coins[j] == result[outpoints[j]]);
+            }
             for (const CCoinsViewCacheTest *test : stack) {
                 test->SelfTest();
             }
@@ -253,6 +282,109 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test) {
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
     BOOST_CHECK(uncached_an_entry);
+    BOOST_CHECK(prefetched_an_entry);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_getcoins) {
+    CCoinsViewDB db(1 << 20, true, false, 4);
+
+    // Enough outpoints for the lookups to be split over the read threads.
+    std::vector<COutPoint> outpoints;
+    std::map<COutPoint, Coin> expected;
+    CCoinsMap coins;
+    for (size_t i = 0; i < 50 * MIN_COINS_PER_READ_JOB; i++) {
+        COutPoint outpoint(InsecureRand256(), InsecureRandBits(4));
+        outpoints.push_back(outpoint);
+        if (InsecureRandBool()) {
+            // Leave this one missing from the database.
+            continue;
+        }
+
+        CTxOut txout;
+        txout.nValue = Amount(int64_t(insecure_rand()));
+        txout.scriptPubKey.assign(InsecureRandBits(6), 0);
+        Coin coin(txout, InsecureRandBits(20), InsecureRandBool());
+        expected[outpoint] = coin;
+        CCoinsCacheEntry &entry = coins[outpoint];
+        entry.coin = coin;
+        entry.flags = CCoinsCacheEntry::DIRTY;
+    }
+    BOOST_CHECK(db.BatchWrite(coins, InsecureRand256()));
+
+    std::vector<Coin> result;
+    db.GetCoins(outpoints, result);
+    BOOST_CHECK_EQUAL(result.size(), outpoints.size());
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        Coin coin;
+        BOOST_CHECK_EQUAL(db.GetCoin(outpoints[i], coin), !result[i].IsSpent());
+        BOOST_CHECK(result[i] == expected[outpoints[i]]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_async_write) {
+    CCoinsViewDB db(1 << 20, true, false, 4, true);
+
+    std::vector<COutPoint> outpoints;
+    for (size_t i = 0; i < 1000; i++) {
+        outpoints.emplace_back(InsecureRand256(), InsecureRandBits(4));
+    }
+
+    // Each round changes part of the coins and flushes them without waiting,
+    // so lookups are answered while the previous changes are being written.
+    std::map<COutPoint, Coin> expected;
+    for (int round = 0; round < 20; round++) {
+        CCoinsViewCache cache(&db);
+        for (const COutPoint &outpoint : outpoints) {
+            if (InsecureRandBits(2)) {
+                continue;
+            }
+            if (cache.HaveCoin(outpoint)) {
+                cache.SpendCoin(outpoint);
+                expected.erase(outpoint);
+                continue;
+            }
+            CTxOut txout;
+            txout.nValue = Amount(int64_t(insecure_rand()));
+            txout.scriptPubKey.assign(InsecureRandBits(6), 0);
+            Coin coin(txout, round, false);
+            expected[outpoint] = coin;
+            cache.AddCoin(outpoint, std::move(coin), false);
+        }
+        uint256 hashBlock = InsecureRand256();
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(db.GetBestBlock() == hashBlock);
+
+        std::vector<Coin> result;
+        db.GetCoins(outpoints, result);
+        for (size_t i = 0; i < outpoints.size(); i++) {
+            auto it = expected.find(outpoints[i]);
+            Coin coin;
+            bool fFound = it != expected.end();
+            BOOST_CHECK_EQUAL(db.GetCoin(outpoints[i], coin), fFound);
+            BOOST_CHECK_EQUAL(db.HaveCoin(outpoints[i]), fFound);
+            BOOST_CHECK_EQUAL(!result[i].IsSpent(), fFound);
+            if (fFound) {
+                BOOST_CHECK(coin == it->second);
+                BOOST_CHECK(result[i] == it->second);
+            }
+        }
+    }
+
+    // Once the writes are done, the database is consistent on its own.
+    BOOST_CHECK(db.WaitForWrites());
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    size_t nCoins = 0;
+    std::unique_ptr<CCoinsViewCursor> cursor(db.Cursor());
+    for (; cursor->Valid(); cursor->Next()) {
+        COutPoint outpoint;
+        Coin coin;
+        BOOST_CHECK(cursor->GetKey(outpoint));
+        BOOST_CHECK(cursor->GetValue(coin));
+        BOOST_CHECK(coin == expected[outpoint]);
+        nCoins++;
+    }
+    BOOST_CHECK_EQUAL(nCoins, expected.size());
 }
 
 // Store of all necessary tx and undo data for next test
@@ -0,0 +1,244 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinstats.h"
+
+#include "coins.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "test/test_bitcoin.h"
+#include "txdb.h"
+#include "undo.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace {
+
+Coin RandomCoin() {
+    CTxOut txout;
+    txout.nValue = Amount(int64_t(InsecureRandBits(40)));
+    txout.scriptPubKey.assign(InsecureRandBits(6), 0);
+    return Coin(txout, InsecureRandBits(20), InsecureRandBool());
+}
+
+/** Serial computation of hash_serialized, as gettxoutsetinfo used to do. */
+uint256 SerialHash(const CCoinsView &view) {
+    std::unique_ptr<CCoinsViewCursor> pcursor(view.Cursor());
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << pcursor->GetBestBlock();
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    auto applyOutputs = [&]() {
+        ss << prevkey;
+        ss << VARINT(outputs.begin()->second.GetHeight() * 2 +
+                     outputs.begin()->second.IsCoinBase());
+        for (const auto &output : outputs) {
+            ss << VARINT(output.first + 1);
+            ss << output.second.GetTxOut().scriptPubKey;
+            ss << VARINT(output.second.GetTxOut().nValue.GetSatoshis());
+        }
+        ss << VARINT(0);
+        outputs.clear();
+    };
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_REQUIRE(pcursor->GetKey(key) && pcursor->GetValue(coin));
+        if (!outputs.empty() && key.hash != prevkey) {
+            applyOutputs();
+        }
+        prevkey = key.hash;
+        outputs[key.n] = coin;
+    }
+    if (!outputs.empty()) {
+        applyOutputs();
+    }
+    return ss.GetHash();
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(coinstats_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(coins_set_hash) {
+    std::vector<std::pair<COutPoint, Coin>> coins;
+    for (int i = 0; i < 20; i++) {
+        coins.emplace_back(COutPoint(InsecureRand256(), InsecureRandBits(4)),
+                           RandomCoin());
+    }
+
+    CCoinsSetHash empty;
+    BOOST_CHECK(empty.GetHash().IsNull());
+
+    // The order coins are added in does not matter.
+    CCoinsSetHash forward, backward;
+    for (size_t i = 0; i < coins.size(); i++) {
+        forward.Add(coins[i].first, coins[i].second);
+        backward.Add(coins[coins.size() - 1 - i].first,
+                     coins[coins.size() - 1 - i].second);
+    }
+    BOOST_CHECK(forward.GetHash() == backward.GetHash());
+    BOOST_CHECK(forward.GetHash() != empty.GetHash());
+
+    // Nor does the way they are split between combined sets.
+    CCoinsSetHash first, second;
+    for (size_t i = 0; i < coins.size(); i++) {
+        (i % 3 ? first : second).Add(coins[i].first, coins[i].second);
+    }
+    first.Combine(second);
+    BOOST_CHECK(first.GetHash() == forward.GetHash());
+
+    // Removing a coin undoes adding it.
+    CCoinsSetHash removed = forward;
+    removed.Remove(coins[5].first, coins[5].second);
+    BOOST_CHECK(removed.GetHash() != forward.GetHash());
+    removed.Add(coins[5].first, coins[5].second);
+    BOOST_CHECK(removed.GetHash() == forward.GetHash());
+    for (const std::pair<COutPoint, Coin> &coin : coins) {
+        removed.Remove(coin.first, coin.second);
+    }
+    BOOST_CHECK(removed.GetHash() == empty.GetHash());
+
+    // The state survives serialization.
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << forward;
+    CCoinsSetHash read;
+    ss >> read;
+    BOOST_CHECK(read.GetHash() == forward.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(get_utxo_stats) {
+    CCoinsViewDB db(1 << 20, true);
+
+    // Several outputs per transaction, so that the outputs of a transaction
+    // have to be kept together.
+    CCoinsMap coins;
+    CCoinsSetHash setHash;
+    Amount nTotalAmount(0);
+    size_t nOutputs = 0;
+    const size_t nTransactions = 2000;
+    for (size_t i = 0; i < nTransactions; i++) {
+        const uint256 txid = InsecureRand256();
+        const size_t nTxOutputs = 1 + InsecureRandBits(2);
+        for (size_t n = 0; n < nTxOutputs; n++) {
+            COutPoint outpoint(txid, n * 3);
+            Coin coin = RandomCoin();
+            setHash.Add(outpoint, coin);
+            nTotalAmount += coin.GetTxOut().nValue;
+            CCoinsCacheEntry &entry = coins[outpoint];
+            entry.coin = std::move(coin);
+            entry.flags = CCoinsCacheEntry::DIRTY;
+            nOutputs++;
+        }
+    }
+    const uint256 hashBlock = InsecureRand256();
+    BOOST_CHECK(db.BatchWrite(coins, hashBlock));
+    const uint256 hashSerialized = SerialHash(db);
+
+    for (int nThreads : {1, 4}) {
+        CCoinsStats stats;
+        BOOST_CHECK(GetUTXOStats(&db, stats, nThreads, true));
+        BOOST_CHECK(stats.hashBlock == hashBlock);
+        BOOST_CHECK_EQUAL(stats.nTransactions, nTransactions);
+        BOOST_CHECK_EQUAL(stats.nTransactionOutputs, nOutputs);
+        BOOST_CHECK_EQUAL(stats.nTotalAmount, nTotalAmount);
+        BOOST_CHECK(stats.hashSerialized == hashSerialized);
+        BOOST_CHECK(stats.setHash.GetHash() == setHash.GetHash());
+
+        // The set hash is only computed on request.
+        CCoinsStats statsNoSetHash;
+        BOOST_CHECK(GetUTXOStats(&db, statsNoSetHash, nThreads));
+        BOOST_CHECK(statsNoSetHash.hashSerialized == hashSerialized);
+        BOOST_CHECK(statsNoSetHash.setHash.GetHash().IsNull());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(utxo_summary) {
+    // A block spending some existing coins, one of which is created in the
+    // block itself, and with an unspendable output.
+    std::vector<std::pair<COutPoint, Coin>> existing;
+    CUTXOSummary summary;
+    summary.hashBlock = InsecureRand256();
+    summary.nHeight = 100;
+    for (int i = 0; i < 4; i++) {
+        existing.emplace_back(COutPoint(InsecureRand256(), 0), RandomCoin());
+        summary.setHash.Add(existing.back().first, existing.back().second);
+        summary.nTotalAmount += existing.back().second.GetTxOut().nValue;
+        summary.nTransactionOutputs++;
+    }
+
+    CBlock block;
+    block.hashPrevBlock = summary.hashBlock;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = Amount(50);
+    coinbase.vout[0].scriptPubKey.assign(1, OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+
+    CBlockUndo blockundo;
+    CMutableTransaction tx;
+    for (int i = 0; i < 3; i++) {
+        tx.vin.push_back(CTxIn(existing[i].first));
+    }
+    tx.vout.resize(2);
+    tx.vout[0].nValue = Amount(10);
+    tx.vout[0].scriptPubKey.assign(1, OP_TRUE);
+    tx.vout[1].scriptPubKey.assign(1, OP_RETURN);
+    block.vtx.push_back(MakeTransactionRef(tx));
+    blockundo.vtxundo.emplace_back();
+    for (int i = 0; i < 3; i++) {
+        blockundo.vtxundo.back().vprevout.push_back(existing[i].second);
+    }
+
+    CMutableTransaction child;
+    child.vin.push_back(CTxIn(COutPoint(block.vtx[1]->GetId(), 0)));
+    child.vout.resize(1);
+    child.vout[0].nValue = Amount(7);
+    child.vout[0].scriptPubKey.assign(2, OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(child));
+    blockundo.vtxundo.emplace_back();
+    blockundo.vtxundo.back().vprevout.push_back(
+        Coin(tx.vout[0], summary.nHeight + 1, false));
+
+    const CUTXOSummary before = summary;
+    BOOST_CHECK(summary.ConnectBlock(block, blockundo, before.nHeight + 1));
+    BOOST_CHECK(summary.hashBlock == block.GetHash());
+    BOOST_CHECK_EQUAL(summary.nHeight, before.nHeight + 1);
+
+    // The resulting set: the unspent existing coin, and the outputs of the
+    // coinbase and of the child.
+    CCoinsSetHash expected;
+    expected.Add(existing[3].first, existing[3].second);
+    expected.Add(COutPoint(block.vtx[0]->GetId(), 0),
+                 Coin(coinbase.vout[0], before.nHeight + 1, true));
+    expected.Add(COutPoint(block.vtx[2]->GetId(), 0),
+                 Coin(child.vout[0], before.nHeight + 1, false));
+    BOOST_CHECK(summary.setHash.GetHash() == expected.GetHash());
+    BOOST_CHECK_EQUAL(summary.nTransactionOutputs, 3);
+    BOOST_CHECK_EQUAL(summary.nTotalAmount,
+                      existing[3].second.GetTxOut().nValue + Amount(57));
+
+    // A block that does not build on the summary is refused.
+    CUTXOSummary copy = summary;
+    BOOST_CHECK(!copy.ConnectBlock(block, blockundo, before.nHeight + 2));
+    BOOST_CHECK(!copy.DisconnectBlock(CBlock(), CBlockUndo()));
+    BOOST_CHECK(copy.hashBlock == summary.hashBlock);
+
+    // Disconnecting the block restores the summary.
+    BOOST_CHECK(summary.DisconnectBlock(block, blockundo));
+    BOOST_CHECK(summary.hashBlock == before.hashBlock);
+    BOOST_CHECK_EQUAL(summary.nHeight, before.nHeight);
+    BOOST_CHECK_EQUAL(summary.nTransactionOutputs, before.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(summary.nBogoSize, before.nBogoSize);
+    BOOST_CHECK_EQUAL(summary.nTotalAmount, before.nTotalAmount);
+    BOOST_CHECK(summary.setHash.GetHash() == before.setHash.GetHash());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include "script/sigcache.h"
 #include "test/test_bitcoin.h"
 
+#include <set>
 #include <thread>
 
 #include <boost/test/unit_test.hpp>
@@ -370,4 +371,40 @@ BOOST_AUTO_TEST_CASE(cuckoocache_generations) {
     test_cache_generations<CuckooCache::cache<uint256, SignatureCacheHasher>>();
 }
 
+/**
+ * Test that get_elements returns the elements which were not erased, and that
+ * inserting them into a new cache restores them.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_get_elements) {
+    local_rand_ctx = FastRandomContext(true);
+    CuckooCache::cache<uint256, SignatureCacheHasher> cc{};
+    cc.setup_bytes(1 << 20);
+    std::vector<uint256> hashes(10000);
+    for (uint256 &h : hashes) {
+        insecure_GetRandHash(h);
+        cc.insert(h);
+    }
+    for (size_t i = 0; i < hashes.size() / 4; ++i) {
+        cc.contains(hashes[i], true);
+    }
+
+    std::vector<uint256> elements;
+    cc.get_elements(elements);
+    BOOST_CHECK_EQUAL(elements.size(), hashes.size() - hashes.size() / 4);
+    std::set<uint256> set(elements.begin(), elements.end());
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        BOOST_CHECK_EQUAL(set.count(hashes[i]), i >= hashes.size() / 4);
+    }
+
+    CuckooCache::cache<uint256, SignatureCacheHasher> reloaded{};
+    reloaded.setup_bytes(1 << 20);
+    for (const uint256 &e : elements) {
+        reloaded.insert(e);
+    }
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        BOOST_CHECK_EQUAL(reloaded.contains(hashes[i], false),
+                          i >= hashes.size() / 4);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -43,6 +43,55 @@ BOOST_AUTO_TEST_CASE(dbwrapper) {
     }
 }
 
+// Test snapshot isolation
+BOOST_AUTO_TEST_CASE(dbwrapper_snapshot) {
+    // Perform tests both obfuscated and non-obfuscated.
+    for (int i = 0; i < 2; i++) {
+        bool obfuscate = (bool)i;
+        fs::path ph = fs::temp_directory_path() / fs::unique_path();
+        CDBWrapper dbw(ph, (1 << 20), true, false, obfuscate);
+
+        char key = 'i';
+        uint256 in = InsecureRand256();
+        char key2 = 'j';
+        uint256 in2 = InsecureRand256();
+        uint256 res;
+
+        BOOST_CHECK(dbw.Write(key, in));
+        CDBSnapshot snapshot(dbw);
+
+        // Writes after the snapshot was taken are not visible through it.
+        BOOST_CHECK(dbw.Write(key, in2));
+        BOOST_CHECK(dbw.Write(key2, in2));
+        BOOST_CHECK(snapshot.Read(key, res));
+        BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+        BOOST_CHECK(!snapshot.Read(key2, res));
+
+        // Nor through its iterators.
+        {
+            std::unique_ptr<CDBIterator> it(snapshot.NewIterator());
+            it->Seek(key);
+            char key_res;
+            BOOST_REQUIRE(it->Valid());
+            BOOST_CHECK(it->GetKey(key_res));
+            BOOST_CHECK_EQUAL(key_res, key);
+            BOOST_CHECK(it->GetValue(res));
+            BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+            it->Next();
+            BOOST_CHECK(!it->Valid());
+        }
+
+        BOOST_CHECK(dbw.Erase(key));
+        BOOST_CHECK(snapshot.Read(key, res));
+        BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+
+        // But they are through the database itself.
+        BOOST_CHECK(!dbw.Read(key, res));
+        BOOST_CHECK(dbw.Read(key2, res));
+        BOOST_CHECK_EQUAL(res.ToString(), in2.ToString());
+    }
+}
+
 // Test batch operations
 BOOST_AUTO_TEST_CASE(dbwrapper_batch) {
     // Perform tests both obfuscated and non-obfuscated.
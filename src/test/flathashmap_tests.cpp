@@ -0,0 +1,156 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "flathashmap.h"
+#include "memusage.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <map>
+#include <string>
+
+BOOST_FIXTURE_TEST_SUITE(flathashmap_tests, BasicTestingSetup)
+
+/** Hasher with few distinct values, so that the keys collide a lot. */
+struct CollidingHasher {
+    size_t operator()(uint32_t n) const { return n % 37; }
+};
+
+typedef flathashmap<uint32_t, std::string, CollidingHasher> TestMap;
+
+static void CheckEqual(const TestMap &map,
+                       const std::map<uint32_t, std::string> &expected) {
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    BOOST_CHECK_EQUAL(map.empty(), expected.empty());
+    size_t nIterated = 0;
+    for (const auto &entry : map) {
+        auto it = expected.find(entry.first);
+        BOOST_CHECK(it != expected.end() && it->second == entry.second);
+        nIterated++;
+    }
+    BOOST_CHECK_EQUAL(nIterated, expected.size());
+    for (const auto &entry : expected) {
+        TestMap::const_iterator it = map.find(entry.first);
+        BOOST_CHECK(it != map.end() && it->second == entry.second);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(flathashmap_random) {
+    TestMap map;
+    std::map<uint32_t, std::string> expected;
+
+    for (int i = 0; i < 20000; i++) {
+        uint32_t nKey = InsecureRandRange(2000);
+        switch (InsecureRandRange(4)) {
+            case 0: {
+                std::string strValue(InsecureRandRange(40), 'a' + i % 26);
+                bool fInserted = map.emplace(nKey, strValue).second;
+                BOOST_CHECK_EQUAL(fInserted,
+                                  expected.emplace(nKey, strValue).second);
+                break;
+            }
+            case 1:
+                map[nKey] = std::to_string(i);
+                expected[nKey] = std::to_string(i);
+                break;
+            case 2:
+                BOOST_CHECK_EQUAL(map.erase(nKey), expected.erase(nKey));
+                break;
+            case 3: {
+                TestMap::iterator it = map.find(nKey);
+                BOOST_CHECK_EQUAL(it != map.end(), expected.count(nKey) == 1);
+                BOOST_CHECK_EQUAL(map.count(nKey), expected.count(nKey));
+                if (it != map.end()) {
+                    map.erase(it);
+                    expected.erase(nKey);
+                }
+                break;
+            }
+        }
+    }
+    CheckEqual(map, expected);
+
+    // Erase part of the entries while iterating.
+    for (TestMap::iterator it = map.begin(); it != map.end();) {
+        if (it->first % 3 == 0) {
+            expected.erase(it->first);
+            map.erase(it++);
+        } else {
+            it++;
+        }
+    }
+    CheckEqual(map, expected);
+
+    map.clear();
+    expected.clear();
+    CheckEqual(map, expected);
+    BOOST_CHECK_EQUAL(map.chunk_count(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(flathashmap_stable_references) {
+    TestMap map;
+    std::string *pValue = &map[1];
+    *pValue = "one";
+    // Growing the table does not move the entries.
+    for (uint32_t i = 2; i < 10000; i++) {
+        map[i] = "other";
+    }
+    BOOST_CHECK_EQUAL(pValue, &map.find(1)->second);
+    BOOST_CHECK_EQUAL(*pValue, "one");
+}
+
+BOOST_AUTO_TEST_CASE(flathashmap_emplace_existing_key) {
+    TestMap map;
+    BOOST_CHECK(map.emplace(1, "one").second);
+
+    // The arguments are left alone when the key is there already.
+    std::string strValue = "other";
+    BOOST_CHECK(!map.emplace(1, std::move(strValue)).second);
+    BOOST_CHECK_EQUAL(strValue, "other");
+    TestMap::value_type value(1, "other");
+    BOOST_CHECK(!map.insert(std::move(value)).second);
+    BOOST_CHECK_EQUAL(value.second, "other");
+    strValue = "other";
+    BOOST_CHECK(!map.emplace(std::piecewise_construct,
+                             std::forward_as_tuple(1),
+                             std::forward_as_tuple(std::move(strValue)))
+                     .second);
+    BOOST_CHECK_EQUAL(strValue, "other");
+
+    BOOST_CHECK_EQUAL(map.size(), 1U);
+    BOOST_CHECK_EQUAL(map[1], "one");
+}
+
+BOOST_AUTO_TEST_CASE(flathashmap_swap_and_memusage) {
+    TestMap map1, map2;
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map1), 0U);
+    for (uint32_t i = 0; i < 1000; i++) {
+        map1[i] = "value";
+    }
+    size_t nUsage = memusage::DynamicUsage(map1);
+    BOOST_CHECK(nUsage > 0);
+
+    map1.swap(map2);
+    BOOST_CHECK(map1.empty());
+    BOOST_CHECK_EQUAL(map2.size(), 1000U);
+    BOOST_CHECK_EQUAL(map2[999], "value");
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map2), nUsage);
+
+    TestMap map3(std::move(map2));
+    BOOST_CHECK_EQUAL(map3.size(), 1000U);
+    BOOST_CHECK(map2.empty());
+
+    // Freed entries are reused before the arena grows.
+    size_t nChunks = map3.chunk_count();
+    for (uint32_t i = 0; i < 500; i++) {
+        map3.erase(i);
+    }
+    for (uint32_t i = 1000; i < 1500; i++) {
+        map3[i] = "value";
+    }
+    BOOST_CHECK_EQUAL(map3.chunk_count(), nChunks);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include "hash.h"
 #include "net.h"
 #include "netbase.h"
+#include "primitives/block.h"
 #include "serialize.h"
 #include "streams.h"
 #include "test/test_bitcoin.h"
@@ -65,6 +66,13 @@ CDataStream AddrmanToStream(CAddrManSerializationMock &_addrman) {
     return CDataStream(vchData, SER_DISK, CLIENT_VERSION);
 }
 
+struct CConnmanTest {
+    static size_t SocketSendData(CConnman &connman, CNode *pnode) {
+        LOCK(pnode->cs_vSend);
+        return connman.SocketSendData(pnode);
+    }
+};
+
 BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(caddrdb_read) {
@@ -168,6 +176,190 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test) {
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+static std::vector<char> MakeMessage(const char *pszCommand,
+                                     const CDataStream &payload) {
+    CMessageHeader hdr(Params().NetMagic(), pszCommand, payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream ss(SER_NETWORK, INIT_PROTO_VERSION);
+    ss << hdr;
+    std::vector<char> vMsg(ss.begin(), ss.end());
+    vMsg.insert(vMsg.end(), payload.begin(), payload.end());
+    return vMsg;
+}
+
+static void ReceiveInChunks(const Config &config, CNetMessage &msg,
+                            const std::vector<char> &vMsg, size_t nChunk) {
+    size_t nPos = 0;
+    while (nPos < vMsg.size()) {
+        uint32_t nBytes = std::min(nChunk, vMsg.size() - nPos);
+        int handled = msg.in_data ? msg.readData(&vMsg[nPos], nBytes)
+                                  : msg.readHeader(config, &vMsg[nPos], nBytes);
+        BOOST_REQUIRE(handled > 0);
+        nPos += handled;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cnetmessage_received_block) {
+    GlobalConfig config;
+
+    CBlock block;
+    block.nVersion = 1;
+    block.nTime = 1234567890;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(InsecureRand256(), i);
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = Amount(i);
+        block.vtx.push_back(MakeTransactionRef(mtx));
+    }
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    std::vector<char> vMsg = MakeMessage(NetMsgType::BLOCK, ssBlock);
+
+    // Whatever pieces the message arrives in, the block is built as it does.
+    for (size_t nChunk : {size_t(1), size_t(7), size_t(100), vMsg.size()}) {
+        CNetMessage msg(Params().NetMagic(), SER_NETWORK, INIT_PROTO_VERSION);
+        ReceiveInChunks(config, msg, vMsg, nChunk);
+        BOOST_CHECK(msg.complete());
+        BOOST_CHECK(msg.vRecv.str() == ssBlock.str());
+        std::shared_ptr<CBlock> pblock = msg.GetReceivedBlock();
+        BOOST_REQUIRE(pblock);
+        BOOST_CHECK(pblock->GetHash() == block.GetHash());
+        BOOST_REQUIRE_EQUAL(pblock->vtx.size(), block.vtx.size());
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            BOOST_CHECK(pblock->vtx[i]->GetId() == block.vtx[i]->GetId());
+        }
+    }
+
+    // A message that ends before the block does has to be deserialized the
+    // usual way, which reports the error.
+    CDataStream ssTruncated(ssBlock.begin(), ssBlock.end() - 1, SER_NETWORK,
+                            PROTOCOL_VERSION);
+    CNetMessage truncated(Params().NetMagic(), SER_NETWORK,
+                          INIT_PROTO_VERSION);
+    ReceiveInChunks(config, truncated,
+                    MakeMessage(NetMsgType::BLOCK, ssTruncated), 7);
+    BOOST_CHECK(truncated.complete());
+    BOOST_CHECK(!truncated.GetReceivedBlock());
+
+    // Other messages are left alone.
+    CNetMessage other(Params().NetMagic(), SER_NETWORK, INIT_PROTO_VERSION);
+    ReceiveInChunks(config, other, MakeMessage(NetMsgType::TX, ssBlock), 7);
+    BOOST_CHECK(other.complete());
+    BOOST_CHECK(!other.GetReceivedBlock());
+}
+
+#ifndef WIN32
+static std::vector<char> ReadAvailable(SOCKET hSocket) {
+    std::vector<char> vData;
+    char buf[4096];
+    ssize_t nBytes;
+    while ((nBytes = recv(hSocket, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        vData.insert(vData.end(), buf, buf + nBytes);
+    }
+    return vData;
+}
+
+BOOST_AUTO_TEST_CASE(cnode_send_partial) {
+    GlobalConfig config;
+    CConnman connman(config, 0x1337, 0x1337);
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CAddress addr(CService(), NODE_NETWORK);
+    CNode node(0, NODE_NETWORK, 0, fds[0], addr, 0, 0, "", false);
+
+    // Queues the messages without sending them, as if the socket was busy.
+    auto queue = [&](const std::vector<size_t> &vSizes) {
+        std::vector<char> vExpected;
+        SOCKET hSocket = node.hSocket;
+        node.hSocket = INVALID_SOCKET;
+        for (size_t nSize : vSizes) {
+            std::vector<uint8_t> payload = InsecureRandBytes(nSize);
+            CDataStream ss(SER_NETWORK, INIT_PROTO_VERSION);
+            ss.write(reinterpret_cast<const char *>(payload.data()),
+                     payload.size());
+            const std::vector<char> vMsg = MakeMessage(NetMsgType::PING, ss);
+            vExpected.insert(vExpected.end(), vMsg.begin(), vMsg.end());
+            connman.PushMessage(&node, NetMsgType::PING,
+                                std::make_shared<const CNetMsgPayload>(
+                                    std::move(payload)));
+        }
+        node.hSocket = hSocket;
+        return vExpected;
+    };
+
+    // The previous send ended on a message boundary, in the middle of a
+    // header, or in the middle of a payload: the rest goes out in order.
+    for (size_t nOffset : {size_t(0), size_t(10),
+                           size_t(CMessageHeader::HEADER_SIZE + 5)}) {
+        std::vector<char> vExpected = queue({8, 100, 0, 1000});
+        BOOST_CHECK_EQUAL(node.vSendMsg.size(), 4);
+        node.nSendOffset = nOffset;
+        BOOST_CHECK_EQUAL(CConnmanTest::SocketSendData(connman, &node),
+                          vExpected.size() - nOffset);
+        BOOST_CHECK(node.vSendMsg.empty());
+        BOOST_CHECK_EQUAL(node.nSendOffset, 0);
+        BOOST_CHECK_EQUAL(node.nSendSize, 0);
+        BOOST_CHECK(ReadAvailable(fds[1]) ==
+                    std::vector<char>(vExpected.begin() + nOffset,
+                                      vExpected.end()));
+    }
+
+    // A short send leaves the rest of the queue for the next ones.
+    int nSendBuffer = 4096;
+    BOOST_REQUIRE(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &nSendBuffer,
+                             sizeof(nSendBuffer)) == 0);
+    std::vector<char> vExpected = queue({1000000, 8, 1000});
+    const size_t nSendSize = node.nSendSize;
+    size_t nSent = CConnmanTest::SocketSendData(connman, &node);
+    BOOST_CHECK(nSent > 0 && nSent < 1000000);
+    BOOST_CHECK_EQUAL(node.vSendMsg.size(), 3);
+    BOOST_CHECK_EQUAL(node.nSendOffset, nSent);
+    BOOST_CHECK_EQUAL(node.nSendSize, nSendSize);
+    std::vector<char> vReceived = ReadAvailable(fds[1]);
+    for (int i = 0; i < 10000 && !node.vSendMsg.empty(); i++) {
+        CConnmanTest::SocketSendData(connman, &node);
+        std::vector<char> vData = ReadAvailable(fds[1]);
+        vReceived.insert(vReceived.end(), vData.begin(), vData.end());
+    }
+    BOOST_CHECK(node.vSendMsg.empty());
+    BOOST_CHECK_EQUAL(node.nSendSize, 0);
+    BOOST_CHECK(vReceived == vExpected);
+
+    close(fds[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(cnetmessage_trickled_block) {
+    GlobalConfig config;
+
+    // A large transaction arriving a few bytes at a time is not parsed again
+    // on each of them, which would take quadratic time. The parser only tries
+    // again once the data has doubled, so a few dozen attempts at most.
+    CBlock block;
+    block.nVersion = 1;
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    mtx.vout.resize(1);
+    const std::vector<uint8_t> vScript(1000000, OP_NOP);
+    mtx.vout[0].scriptPubKey = CScript(vScript.begin(), vScript.end());
+    block.vtx.push_back(MakeTransactionRef(mtx));
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+
+    CNetMessage msg(Params().NetMagic(), SER_NETWORK, INIT_PROTO_VERSION);
+    ReceiveInChunks(config, msg, MakeMessage(NetMsgType::BLOCK, ssBlock), 10);
+    BOOST_CHECK(msg.GetParseCount() <= 32);
+    std::shared_ptr<CBlock> pblock = msg.GetReceivedBlock();
+    BOOST_REQUIRE(pblock);
+    BOOST_CHECK(pblock->GetHash() == block.GetHash());
+    BOOST_REQUIRE_EQUAL(pblock->vtx.size(), 1);
+    BOOST_CHECK(pblock->vtx[0]->GetId() == block.vtx[0]->GetId());
+}
+
 BOOST_AUTO_TEST_CASE(test_getSubVersionEB) {
     BOOST_CHECK_EQUAL(getSubVersionEB(13800000000), "13800.0");
     BOOST_CHECK_EQUAL(getSubVersionEB(3800000000), "3800.0");
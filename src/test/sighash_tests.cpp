@@ -5,6 +5,7 @@
 #include "consensus/validation.h"
 #include "data/sighash.json.h"
 #include "hash.h"
+#include "key.h"
 #include "script/interpreter.h"
 #include "script/script.h"
 #include "serialize.h"
@@ -276,6 +277,75 @@ BOOST_AUTO_TEST_CASE(sighash_from_data) {
             scriptCode, *tx, nIn, sigHashType, Amount(0), nullptr,
             SCRIPT_ENABLE_SIGHASH_FORKID | SCRIPT_ENABLE_REPLAY_PROTECTION);
         BOOST_CHECK_MESSAGE(shrep.GetHex() == sigHashRepHex, strTest);
+
+        // The precomputed data gives the same hashes.
+        PrecomputedTransactionData txdata(*tx);
+        BOOST_CHECK_MESSAGE(SignatureHash(scriptCode, *tx, nIn, sigHashType,
+                                          Amount(0), &txdata) == shreg,
+                            strTest);
+        BOOST_CHECK_MESSAGE(
+            SignatureHash(scriptCode, *tx, nIn, sigHashType, Amount(0),
+                          &txdata,
+                          SCRIPT_ENABLE_SIGHASH_FORKID |
+                              SCRIPT_ENABLE_REPLAY_PROTECTION) == shrep,
+            strTest);
+    }
+}
+
+namespace {
+/** Records the signature hash of the last signature checked. */
+class SigHashRecordingChecker : public TransactionSignatureChecker {
+public:
+    mutable uint256 sighash;
+
+    SigHashRecordingChecker(const CTransaction *txToIn, unsigned int nInIn,
+                            const PrecomputedTransactionData &txdataIn)
+        : TransactionSignatureChecker(txToIn, nInIn, Amount(0), txdataIn) {}
+
+protected:
+    bool VerifySignature(const std::vector<uint8_t> &vchSig,
+                         const CPubKey &pubkey,
+                         const uint256 &sighashIn) const override {
+        sighash = sighashIn;
+        return true;
+    }
+};
+} // namespace
+
+// The signature hash reused from one signature to the next is only reused
+// when it is the same.
+BOOST_AUTO_TEST_CASE(sighash_checker_reuse) {
+    SeedInsecureRand(false);
+    CKey key;
+    key.MakeNewKey(true);
+    const std::vector<uint8_t> vchPubKey = ToByteVector(key.GetPubKey());
+
+    CMutableTransaction mtx;
+    RandomTransaction(mtx, false);
+    const CTransaction tx(mtx);
+    PrecomputedTransactionData txdata(tx);
+    const unsigned int nIn = tx.vin.size() - 1;
+    SigHashRecordingChecker checker(&tx, nIn, txdata);
+
+    CScript scriptCodes[2];
+    RandomScript(scriptCodes[0]);
+    scriptCodes[1] = scriptCodes[0] << OP_CHECKSIG;
+    const uint32_t vFlags[] = {
+        SCRIPT_ENABLE_SIGHASH_FORKID, 0,
+        SCRIPT_ENABLE_SIGHASH_FORKID | SCRIPT_ENABLE_REPLAY_PROTECTION};
+    const uint8_t vHashTypes[] = {SIGHASH_ALL | SIGHASH_FORKID,
+                                  SIGHASH_SINGLE | SIGHASH_FORKID,
+                                  SIGHASH_ALL | SIGHASH_ANYONECANPAY};
+    for (int i = 0; i < 100; i++) {
+        const CScript &scriptCode = scriptCodes[InsecureRandBits(1)];
+        const uint32_t flags = vFlags[InsecureRandRange(3)];
+        const uint8_t nHashType = vHashTypes[InsecureRandRange(3)];
+        std::vector<uint8_t> vchSig(72, 0x30);
+        vchSig.back() = nHashType;
+        BOOST_CHECK(checker.CheckSig(vchSig, vchPubKey, scriptCode, flags));
+        BOOST_CHECK(checker.sighash ==
+                    SignatureHash(scriptCode, tx, nIn, SigHashType(nHashType),
+                                  Amount(0), nullptr, flags));
     }
 }
 
@@ -97,6 +97,9 @@ TestingSetup::TestingSetup(const std::string &chainName)
     for (int i = 0; i < nScriptCheckThreads - 1; i++) {
         threadGroup.create_thread(&ThreadScriptCheck);
     }
+    for (int i = 0; i < nScriptCheckThreads - 1; i++) {
+        threadGroup.create_thread(&ThreadMempoolCheck);
+    }
 
     // Deterministic randomness for tests.
     g_connman = std::unique_ptr<CConnman>(new CConnman(config, 0x1337, 0x1337));
@@ -162,6 +165,32 @@ CBlock TestChain100Setup::CreateAndProcessBlock(
 
 TestChain100Setup::~TestChain100Setup() {}
 
+AnyoneCanSpendSetup::AnyoneCanSpendSetup() {
+    for (int i = 0; i < 4; i++) {
+        CBlock block = CreateAndProcessBlock({}, CScript() << OP_TRUE);
+        vCoinbases.push_back(*block.vtx[0]);
+    }
+    for (int i = 0; i < COINBASE_MATURITY; i++) {
+        CreateAndProcessBlock({}, CScript() << OP_2);
+    }
+}
+
+CMutableTransaction AnyoneCanSpendSetup::Spend(const CTransaction &txFrom,
+                                               Amount nFee) {
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txFrom.GetId(), 0);
+    tx.vout.resize(2);
+    tx.vout[0].nValue = txFrom.vout[0].nValue - nFee;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    // Padding, for the transaction to be large enough.
+    tx.vout[1].nValue = Amount(0);
+    tx.vout[1].scriptPubKey = CScript() << OP_RETURN
+                                        << std::vector<uint8_t>(40, 0);
+    return tx;
+}
+
 CTxMemPoolEntry TestMemPoolEntryHelper::FromTx(const CMutableTransaction &tx,
                                                CTxMemPool *pool) {
     CTransaction txn(tx);
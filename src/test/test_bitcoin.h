@@ -62,7 +62,6 @@ struct BasicTestingSetup {
  */
 class CConnman;
 struct TestingSetup : public BasicTestingSetup {
-    CCoinsViewDB *pcoinsdbview;
     fs::path pathTemp;
     boost::thread_group threadGroup;
     CConnman *connman;
@@ -95,6 +94,20 @@ struct TestChain100Setup : public TestingSetup {
     CKey coinbaseKey;
 };
 
+//
+// Testing fixture with a few mature coinbases anyone can spend, on top of
+// TestChain100Setup.
+//
+struct AnyoneCanSpendSetup : public TestChain100Setup {
+    AnyoneCanSpendSetup();
+
+    // Transaction spending output 0 of txFrom to an anyone can spend output.
+    static CMutableTransaction Spend(const CTransaction &txFrom, Amount nFee);
+
+    // Coinbase transactions paying to OP_TRUE.
+    std::vector<CTransaction> vCoinbases;
+};
+
 class CTxMemPoolEntry;
 class CTxMemPool;
 
@@ -0,0 +1,215 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txdb.h"
+
+#include "chain.h"
+#include "config.h"
+#include "pow.h"
+#include "primitives/block.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace {
+struct RegtestingSetup : public TestingSetup {
+    RegtestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+typedef std::map<uint256, std::unique_ptr<CBlockIndex>> TestBlockMap;
+
+/** Build a tree of blocks with valid regtest proof of work. */
+void BuildBlocks(std::vector<uint256> &vHashes,
+                 std::vector<std::unique_ptr<CBlockIndex>> &vBlocks,
+                 size_t nBlocks) {
+    const Config &config = GetConfig();
+    vHashes.reserve(nBlocks);
+    for (size_t i = 0; i < nBlocks; i++) {
+        CBlockHeader header;
+        header.nVersion = 1;
+        header.nTime = i;
+        header.nBits = 0x207fffff;
+        CBlockIndex *pprev = nullptr;
+        if (i > 0) {
+            // Fork every now and then.
+            pprev = vBlocks[i - 1 - InsecureRandRange(std::min<size_t>(i, 3))]
+                        .get();
+            header.hashPrevBlock = pprev->GetBlockHash();
+        }
+        while (!CheckProofOfWork(header.GetHash(), header.nBits, config)) {
+            header.nNonce++;
+        }
+        vHashes.push_back(header.GetHash());
+
+        vBlocks.emplace_back(new CBlockIndex(header));
+        CBlockIndex *pindex = vBlocks.back().get();
+        pindex->phashBlock = &vHashes.back();
+        pindex->pprev = pprev;
+        pindex->nHeight = pprev ? pprev->nHeight + 1 : 0;
+        pindex->nTx = 1 + InsecureRandRange(100);
+        pindex->nStatus = BLOCK_VALID_TREE;
+    }
+}
+
+std::function<CBlockIndex *(const uint256 &)>
+InsertInto(TestBlockMap &mapBlocks) {
+    return [&mapBlocks](const uint256 &hash) -> CBlockIndex * {
+        if (hash.IsNull()) {
+            return nullptr;
+        }
+        std::unique_ptr<CBlockIndex> &pindex = mapBlocks[hash];
+        if (!pindex) {
+            pindex.reset(new CBlockIndex());
+            pindex->phashBlock = &mapBlocks.find(hash)->first;
+        }
+        return pindex.get();
+    };
+}
+
+bool LoadBlocks(CBlockTreeDB &db, TestBlockMap &mapBlocks, int nThreads) {
+    return db.LoadBlockIndexGuts(InsertInto(mapBlocks), nThreads);
+}
+
+void CheckBlocks(const TestBlockMap &mapBlocks,
+                 const std::vector<std::unique_ptr<CBlockIndex>> &vBlocks) {
+    BOOST_CHECK_EQUAL(mapBlocks.size(), vBlocks.size());
+    for (const std::unique_ptr<CBlockIndex> &pindex : vBlocks) {
+        auto it = mapBlocks.find(pindex->GetBlockHash());
+        BOOST_REQUIRE(it != mapBlocks.end());
+        const CBlockIndex &loaded = *it->second;
+        BOOST_CHECK_EQUAL(loaded.nHeight, pindex->nHeight);
+        BOOST_CHECK_EQUAL(loaded.nTx, pindex->nTx);
+        BOOST_CHECK_EQUAL(loaded.nNonce, pindex->nNonce);
+        BOOST_CHECK_EQUAL(loaded.nBits, pindex->nBits);
+        BOOST_CHECK_EQUAL(loaded.nStatus, pindex->nStatus);
+        BOOST_CHECK(loaded.hashMerkleRoot == pindex->hashMerkleRoot);
+        if (pindex->pprev) {
+            auto itPrev = mapBlocks.find(pindex->pprev->GetBlockHash());
+            BOOST_REQUIRE(itPrev != mapBlocks.end());
+            BOOST_CHECK(loaded.pprev == itPrev->second.get());
+        } else {
+            BOOST_CHECK(loaded.pprev == nullptr);
+        }
+    }
+}
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(txdb_tests, RegtestingSetup)
+
+BOOST_AUTO_TEST_CASE(txdb_load_block_index) {
+    CBlockTreeDB db(1 << 20, true);
+    std::vector<uint256> vHashes;
+    std::vector<std::unique_ptr<CBlockIndex>> vBlocks;
+    BuildBlocks(vHashes, vBlocks, 1000);
+
+    std::vector<const CBlockIndex *> vWrite;
+    for (const std::unique_ptr<CBlockIndex> &pindex : vBlocks) {
+        vWrite.push_back(pindex.get());
+    }
+    BOOST_CHECK(db.WriteBatchSync({}, 0, vWrite));
+
+    for (int nThreads : {1, 3, 8}) {
+        TestBlockMap mapBlocks;
+        BOOST_CHECK(LoadBlocks(db, mapBlocks, nThreads));
+        CheckBlocks(mapBlocks, vBlocks);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(txdb_load_block_index_bad_pow) {
+    CBlockTreeDB db(1 << 20, true);
+    std::vector<uint256> vHashes;
+    std::vector<std::unique_ptr<CBlockIndex>> vBlocks;
+    BuildBlocks(vHashes, vBlocks, 100);
+
+    // An entry whose proof of work does not match its target fails the load,
+    // whichever thread reads it.
+    vBlocks[50]->nBits = 0x1d00ffff;
+    std::vector<const CBlockIndex *> vWrite;
+    for (const std::unique_ptr<CBlockIndex> &pindex : vBlocks) {
+        vWrite.push_back(pindex.get());
+    }
+    BOOST_CHECK(db.WriteBatchSync({}, 0, vWrite));
+
+    for (int nThreads : {1, 4}) {
+        TestBlockMap mapBlocks;
+        BOOST_CHECK(!LoadBlocks(db, mapBlocks, nThreads));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(txdb_block_index_snapshot) {
+    CBlockTreeDB db(1 << 20, true);
+    std::vector<uint256> vHashes;
+    std::vector<std::unique_ptr<CBlockIndex>> vBlocks;
+    BuildBlocks(vHashes, vBlocks, 500);
+    // The writer sorts the entries itself.
+    std::vector<const CBlockIndex *> vWrite;
+    for (const std::unique_ptr<CBlockIndex> &pindex : vBlocks) {
+        vWrite.push_back(pindex.get());
+    }
+    std::random_shuffle(vWrite.begin(), vWrite.end(),
+                        [](int n) { return InsecureRandRange(n); });
+    const fs::path path = pathTemp / "index.snapshot";
+    const uint256 hashBest = vHashes.back();
+
+    BOOST_CHECK(db.WriteBlockIndexSnapshot(path, vWrite, hashBest));
+    TestBlockMap mapBlocks;
+    BOOST_CHECK(db.LoadBlockIndexSnapshot(path, hashBest,
+                                          InsertInto(mapBlocks)));
+    CheckBlocks(mapBlocks, vBlocks);
+
+    // A snapshot can only be used once.
+    mapBlocks.clear();
+    BOOST_CHECK(!fs::exists(path));
+    BOOST_CHECK(!db.LoadBlockIndexSnapshot(path, hashBest,
+                                           InsertInto(mapBlocks)));
+
+    // A snapshot for another best block is stale.
+    BOOST_CHECK(db.WriteBlockIndexSnapshot(path, vWrite, hashBest));
+    BOOST_CHECK(!db.LoadBlockIndexSnapshot(path, vHashes[0],
+                                           InsertInto(mapBlocks)));
+    BOOST_CHECK(mapBlocks.empty());
+
+    // So is a snapshot that was invalidated.
+    BOOST_CHECK(db.WriteBlockIndexSnapshot(path, vWrite, hashBest));
+    fs::path pathCopy = pathTemp / "index.snapshot.copy";
+    fs::copy_file(path, pathCopy);
+    db.InvalidateBlockIndexSnapshot(path);
+    fs::rename(pathCopy, path);
+    BOOST_CHECK(!db.LoadBlockIndexSnapshot(path, hashBest,
+                                           InsertInto(mapBlocks)));
+    BOOST_CHECK(mapBlocks.empty());
+
+    // So is a snapshot followed by a write to the block index.
+    BOOST_CHECK(db.WriteBlockIndexSnapshot(path, vWrite, hashBest));
+    const uint64_t nGeneration = db.ReadBlockIndexGeneration();
+    BOOST_CHECK(db.WriteBatchSync({}, 0, {vWrite[0]}));
+    BOOST_CHECK_EQUAL(db.ReadBlockIndexGeneration(), nGeneration + 1);
+    BOOST_CHECK(!db.LoadBlockIndexSnapshot(path, hashBest,
+                                           InsertInto(mapBlocks)));
+    BOOST_CHECK(mapBlocks.empty());
+
+    // A corrupt snapshot is rejected.
+    BOOST_CHECK(db.WriteBlockIndexSnapshot(path, vWrite, hashBest));
+    {
+        FILE *file = fsbridge::fopen(path, "rb+");
+        BOOST_REQUIRE(file);
+        fseek(file, 1000, SEEK_SET);
+        int c = fgetc(file);
+        fseek(file, 1000, SEEK_SET);
+        fputc(c ^ 1, file);
+        fclose(file);
+    }
+    BOOST_CHECK(!db.LoadBlockIndexSnapshot(path, hashBest,
+                                           InsertInto(mapBlocks)));
+    BOOST_CHECK(mapBlocks.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
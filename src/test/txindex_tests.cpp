@@ -0,0 +1,203 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/txindex.h"
+
+#include "chainparams.h"
+#include "config.h"
+#include "consensus/validation.h"
+#include "scheduler.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+#include "validation.h"
+#include "validationinterface.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include <future>
+
+namespace {
+
+//! Wait for the index to catch up with the chain, for up to 10 seconds.
+bool WaitForSync(const CTxIndex &txindex) {
+    int64_t nStart = GetTimeMillis();
+    while (!txindex.BlockUntilSyncedToCurrentChain()) {
+        if (GetTimeMillis() - nStart > 10 * 1000) {
+            return false;
+        }
+        MilliSleep(100);
+    }
+    return true;
+}
+
+uint256 GetBlockHash(int nHeight) {
+    LOCK(cs_main);
+    return chainActive[nHeight]->GetBlockHash();
+}
+
+bool HasTx(const CTxIndex &txindex, const CTransaction &tx,
+           const uint256 &hashExpectedBlock) {
+    uint256 hashBlock;
+    CTransactionRef txDisk;
+    return txindex.FindTx(tx.GetId(), hashBlock, txDisk) &&
+           txDisk->GetId() == tx.GetId() && hashBlock == hashExpectedBlock;
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(txindex_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(txindex_initial_sync) {
+    CTxIndex txindex(1 << 20, true);
+
+    // Nothing is indexed, nor can be waited for, before the index is started.
+    uint256 hashBlock;
+    CTransactionRef txDisk;
+    for (const CTransaction &tx : coinbaseTxns) {
+        BOOST_CHECK(!txindex.FindTx(tx.GetId(), hashBlock, txDisk));
+    }
+    BOOST_CHECK(!txindex.IsSynced());
+    BOOST_CHECK(!txindex.BlockUntilSyncedToCurrentChain());
+
+    // The index catches up with the chain in the background.
+    BOOST_REQUIRE(txindex.Start());
+    BOOST_REQUIRE(WaitForSync(txindex));
+    for (size_t i = 0; i < coinbaseTxns.size(); i++) {
+        BOOST_CHECK(HasTx(txindex, coinbaseTxns[i], GetBlockHash(i + 1)));
+    }
+
+    // New blocks are indexed as they are connected.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey())
+                                     << OP_CHECKSIG;
+    std::vector<CBlock> vBlocks;
+    for (int i = 0; i < 5; i++) {
+        vBlocks.push_back(CreateAndProcessBlock({}, scriptPubKey));
+        BOOST_CHECK(txindex.BlockUntilSyncedToCurrentChain());
+        BOOST_CHECK(
+            HasTx(txindex, *vBlocks.back().vtx[0], vBlocks.back().GetHash()));
+    }
+
+    // And forgotten when they are disconnected.
+    const Config &config = GetConfig();
+    CBlockIndex *pindexInvalid;
+    {
+        LOCK(cs_main);
+        pindexInvalid = mapBlockIndex[vBlocks[2].GetHash()];
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(config, state, pindexInvalid));
+    }
+    BOOST_CHECK(txindex.BlockUntilSyncedToCurrentChain());
+    BOOST_CHECK(HasTx(txindex, *vBlocks[1].vtx[0], vBlocks[1].GetHash()));
+    for (size_t i = 2; i < vBlocks.size(); i++) {
+        BOOST_CHECK(
+            !txindex.FindTx(vBlocks[i].vtx[0]->GetId(), hashBlock, txDisk));
+    }
+
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ResetBlockFailureFlags(pindexInvalid));
+    }
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(config, state));
+    BOOST_CHECK(txindex.BlockUntilSyncedToCurrentChain());
+    for (const CBlock &block : vBlocks) {
+        BOOST_CHECK(HasTx(txindex, *block.vtx[0], block.GetHash()));
+    }
+
+    txindex.Stop();
+    BOOST_CHECK(!txindex.BlockUntilSyncedToCurrentChain());
+}
+
+BOOST_AUTO_TEST_CASE(txindex_resume) {
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey())
+                                     << OP_CHECKSIG;
+    const Config &config = GetConfig();
+
+    // Index the chain, then stop the index.
+    std::unique_ptr<CTxIndex> txindex(new CTxIndex(1 << 20, false, true));
+    BOOST_REQUIRE(txindex->Start());
+    BOOST_REQUIRE(WaitForSync(*txindex));
+    CBlock blockStale = CreateAndProcessBlock({}, scriptPubKey);
+    BOOST_CHECK(txindex->BlockUntilSyncedToCurrentChain());
+    BOOST_CHECK(HasTx(*txindex, *blockStale.vtx[0], blockStale.GetHash()));
+    txindex.reset();
+
+    // While it is stopped, the last indexed block is replaced, by blocks with
+    // a different coinbase.
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(config, state,
+                                    mapBlockIndex[blockStale.GetHash()]));
+    }
+    std::vector<CBlock> vBlocks;
+    for (int i = 0; i < 3; i++) {
+        vBlocks.push_back(CreateAndProcessBlock({}, CScript() << OP_TRUE));
+    }
+
+    // The index undoes the stale block and catches up when restarted.
+    txindex.reset(new CTxIndex(1 << 20));
+    BOOST_REQUIRE(txindex->Start());
+    BOOST_REQUIRE(WaitForSync(*txindex));
+    uint256 hashBlock;
+    CTransactionRef txDisk;
+    BOOST_CHECK(
+        !txindex->FindTx(blockStale.vtx[0]->GetId(), hashBlock, txDisk));
+    for (const CBlock &block : vBlocks) {
+        BOOST_CHECK(HasTx(*txindex, *block.vtx[0], block.GetHash()));
+    }
+    for (size_t i = 0; i < coinbaseTxns.size(); i++) {
+        BOOST_CHECK(HasTx(*txindex, coinbaseTxns[i], GetBlockHash(i + 1)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(txindex_background_notifications) {
+    CScheduler scheduler;
+    boost::thread schedulerThread(
+        boost::bind(&CScheduler::serviceQueue, &scheduler));
+    GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+
+    // Blocks are connected while the notifications are held up, and the index
+    // catches up from disk before they get through.
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    CallFunctionInValidationInterfaceQueue([released] { released.wait(); });
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    std::vector<CBlock> vBlocks;
+    for (int i = 0; i < 3; i++) {
+        vBlocks.push_back(CreateAndProcessBlock({}, scriptPubKey));
+    }
+    CTxIndex txindex(1 << 20, true);
+    BOOST_REQUIRE(txindex.Start());
+    MilliSleep(100);
+    release.set_value();
+    BOOST_REQUIRE(WaitForSync(txindex));
+    for (const CBlock &block : vBlocks) {
+        BOOST_CHECK(HasTx(txindex, *block.vtx[0], block.GetHash()));
+    }
+
+    // Disconnections are dispatched on the scheduler thread too.
+    const Config &config = GetConfig();
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(config, state,
+                                    mapBlockIndex[vBlocks[2].GetHash()]));
+    }
+    BOOST_CHECK(txindex.BlockUntilSyncedToCurrentChain());
+    uint256 hashBlock;
+    CTransactionRef txDisk;
+    BOOST_CHECK(!txindex.FindTx(vBlocks[2].vtx[0]->GetId(), hashBlock, txDisk));
+    BOOST_CHECK(HasTx(txindex, *vBlocks[1].vtx[0], vBlocks[1].GetHash()));
+
+    txindex.Stop();
+    schedulerThread.interrupt();
+    schedulerThread.join();
+    GetMainSignals().FlushBackgroundCallbacks();
+    GetMainSignals().UnregisterBackgroundSignalScheduler();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,8 +6,10 @@
 #include "chainparams.h"
 #include "config.h"
 #include "consensus/consensus.h"
+#include "consensus/validation.h"
 #include "primitives/transaction.h"
 #include "test/test_bitcoin.h"
+#include "txmempool.h"
 #include "util.h"
 #include "validation.h"
 
@@ -76,4 +78,60 @@ BOOST_AUTO_TEST_CASE(validation_load_external_block_file) {
     BOOST_CHECK_NO_THROW({ LoadExternalBlockFile(config, fp, 0); });
 }
 
+BOOST_FIXTURE_TEST_CASE(validation_mempool_batch, AnyoneCanSpendSetup) {
+    const Config &config = GetConfig();
+    // Anyone can spend outputs are not standard.
+    fRequireStandard = false;
+
+    const CMutableTransaction tx1 = Spend(vCoinbases[0], CENT);
+    const CMutableTransaction tx2 = Spend(vCoinbases[1], CENT);
+    const CMutableTransaction txChild = Spend(CTransaction(tx1), CENT);
+    // Its script fails.
+    CMutableTransaction txInvalid = Spend(vCoinbases[2], CENT);
+    txInvalid.vin[0].scriptSig = CScript() << OP_RETURN;
+
+    std::vector<MempoolAcceptResult> results = AcceptToMemoryPoolBatch(
+        config, mempool,
+        {MakeTransactionRef(txChild), MakeTransactionRef(tx1),
+         MakeTransactionRef(tx2), MakeTransactionRef(txInvalid),
+         MakeTransactionRef(tx2)},
+        false);
+    BOOST_REQUIRE_EQUAL(results.size(), 5);
+
+    // The child comes before its parent, so its inputs are missing.
+    BOOST_CHECK(!results[0].fAccepted);
+    BOOST_CHECK(results[0].fMissingInputs);
+    BOOST_CHECK(results[1].fAccepted);
+    BOOST_CHECK(results[2].fAccepted);
+    BOOST_CHECK(!results[3].fAccepted);
+    BOOST_CHECK(results[3].state.IsInvalid());
+    // Only the first copy of tx2 gets in.
+    BOOST_CHECK(!results[4].fAccepted);
+    BOOST_CHECK_EQUAL(results[4].state.GetRejectReason(),
+                      "txn-already-in-mempool");
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+
+    // A child following its parent gets in, but not a double spend of the
+    // parent.
+    const CMutableTransaction tx3 = Spend(vCoinbases[3], CENT);
+    const CMutableTransaction tx3Child = Spend(CTransaction(tx3), CENT);
+    const CMutableTransaction tx3Conflict = Spend(vCoinbases[3], 2 * CENT);
+    results = AcceptToMemoryPoolBatch(
+        config, mempool,
+        {MakeTransactionRef(tx3), MakeTransactionRef(tx3Child),
+         MakeTransactionRef(tx3Conflict), MakeTransactionRef(txChild)},
+        false);
+    BOOST_REQUIRE_EQUAL(results.size(), 4);
+    BOOST_CHECK(results[0].fAccepted);
+    BOOST_CHECK(results[1].fAccepted);
+    BOOST_CHECK(!results[2].fAccepted);
+    BOOST_CHECK_EQUAL(results[2].state.GetRejectReason(),
+                      "txn-mempool-conflict");
+    BOOST_CHECK(results[3].fAccepted);
+    BOOST_CHECK_EQUAL(mempool.size(), 5);
+
+    fRequireStandard = true;
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
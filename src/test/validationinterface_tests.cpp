@@ -0,0 +1,123 @@
+// Copyright (c) 2018 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "validationinterface.h"
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "scheduler.h"
+#include "test/test_bitcoin.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include <future>
+
+namespace {
+
+/** Records the heights of the blocks it is notified of, and can be held up. */
+class RecordingInterface : public CValidationInterface {
+public:
+    std::vector<int> vConnected;
+    std::vector<int> vTips;
+    boost::thread::id threadId;
+    std::shared_future<void> release;
+
+protected:
+    void BlockConnected(const std::shared_ptr<const CBlock> &block,
+                        const CBlockIndex *pindex,
+                        const std::vector<CTransactionRef> &txnConflicted)
+        override {
+        if (release.valid()) {
+            release.wait();
+        }
+        threadId = boost::this_thread::get_id();
+        vConnected.push_back(pindex->nHeight);
+    }
+
+    void UpdatedBlockTip(const CBlockIndex *pindexNew,
+                         const CBlockIndex *pindexFork,
+                         bool fInitialDownload) override {
+        vTips.push_back(pindexNew->nHeight);
+    }
+};
+
+/** Dispatches the notifications on a scheduler thread for its lifetime. */
+struct BackgroundNotificationsSetup : public TestChain100Setup {
+    CScheduler scheduler;
+    boost::thread schedulerThread;
+
+    BackgroundNotificationsSetup() {
+        schedulerThread =
+            boost::thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+        GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+    }
+
+    ~BackgroundNotificationsSetup() {
+        schedulerThread.interrupt();
+        schedulerThread.join();
+        GetMainSignals().FlushBackgroundCallbacks();
+        GetMainSignals().UnregisterBackgroundSignalScheduler();
+    }
+};
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(validationinterface_tests,
+                         BackgroundNotificationsSetup)
+
+BOOST_AUTO_TEST_CASE(background_notifications) {
+    RecordingInterface recorder;
+    RegisterValidationInterface(&recorder);
+
+    const CScript scriptPubKey = CScript() << OP_TRUE;
+    for (int i = 0; i < 5; i++) {
+        CreateAndProcessBlock({}, scriptPubKey);
+    }
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(GetMainSignals().CallbacksPending(), 0);
+
+    // The notifications are dispatched in order, away from validation.
+    const std::vector<int> vExpected = {101, 102, 103, 104, 105};
+    BOOST_CHECK(recorder.vConnected == vExpected);
+    BOOST_CHECK(recorder.vTips == vExpected);
+    BOOST_CHECK(recorder.threadId != boost::this_thread::get_id());
+
+    UnregisterValidationInterface(&recorder);
+}
+
+BOOST_AUTO_TEST_CASE(slow_listener) {
+    RecordingInterface recorder;
+    std::promise<void> release;
+    recorder.release = release.get_future().share();
+    RegisterValidationInterface(&recorder);
+
+    // Blocks are connected while the listener is stuck on the first one.
+    const CScript scriptPubKey = CScript() << OP_TRUE;
+    for (int i = 0; i < 3; i++) {
+        CreateAndProcessBlock({}, scriptPubKey);
+    }
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(chainActive.Height(), 103);
+    }
+    BOOST_CHECK(GetMainSignals().CallbacksPending() > 0);
+
+    bool fReached = false;
+    CallFunctionInValidationInterfaceQueue([&recorder, &fReached] {
+        // Everything queued before was dispatched.
+        fReached = recorder.vConnected.size() == 3;
+    });
+
+    release.set_value();
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK(fReached);
+    const std::vector<int> vExpected = {101, 102, 103};
+    BOOST_CHECK(recorder.vConnected == vExpected);
+
+    UnregisterValidationInterface(&recorder);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,8 @@
 #include "txdb.h"
 
 #include "chainparams.h"
+#include "checkqueue.h"
+#include "coinstats.h"
 #include "config.h"
 #include "hash.h"
 #include "init.h"
@@ -17,12 +19,23 @@
 
 #include <boost/thread.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstring>
+#include <exception>
+#include <unordered_map>
+
+#ifndef WIN32
+#include <fcntl.h>    // for open
+#include <sys/mman.h> // for mmap
+#include <sys/stat.h> // for fstat
+#include <unistd.h>   // for close
+#endif
 
 static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
-static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
@@ -30,6 +43,8 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_BLOCK_INDEX_GENERATION = 'G';
+static const char DB_UTXO_SUMMARY = 'U';
 
 namespace {
 
@@ -53,18 +68,352 @@ struct CoinEntry {
 };
 } // namespace
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe)
-    : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) {}
+/**
+ * Reads a slice of the coins requested by CCoinsViewDB::GetCoins. The slice is
+ * given as a range of indexes into the requested outpoints.
+ */
+class CCoinsReadJob {
+private:
+    const CDBSnapshot *snapshot;
+    const COutPoint *outpoints;
+    Coin *coins;
+    const size_t *begin;
+    const size_t *end;
+    std::string *pstrError;
+
+public:
+    CCoinsReadJob()
+        : snapshot(nullptr), outpoints(nullptr), coins(nullptr),
+          begin(nullptr), end(nullptr), pstrError(nullptr) {}
+
+    CCoinsReadJob(const CDBSnapshot *snapshotIn,
+                  const std::vector<COutPoint> &vOutpoints,
+                  std::vector<Coin> &vCoins, const size_t *beginIn,
+                  const size_t *endIn, std::string *pstrErrorIn)
+        : snapshot(snapshotIn), outpoints(vOutpoints.data()),
+          coins(vCoins.data()), begin(beginIn), end(endIn),
+          pstrError(pstrErrorIn) {}
+
+    bool operator()() {
+        try {
+            for (const size_t *it = begin; it != end; it++) {
+                if (!snapshot->Read(CoinEntry(&outpoints[*it]), coins[*it])) {
+                    coins[*it].Clear();
+                }
+            }
+        } catch (const std::runtime_error &e) {
+            *pstrError = e.what();
+            return false;
+        }
+        return true;
+    }
+
+    void swap(CCoinsReadJob &job) {
+        std::swap(snapshot, job.snapshot);
+        std::swap(outpoints, job.outpoints);
+        std::swap(coins, job.coins);
+        std::swap(begin, job.begin);
+        std::swap(end, job.end);
+        std::swap(pstrError, job.pstrError);
+    }
+};
+
+/** Pool of threads resolving the jobs of parallel coin lookups. */
+class CCoinsReadThreads {
+public:
+    CWorkStealingCheckQueue<CCoinsReadJob> queue;
+    //! Held by the lookup currently using the queue.
+    boost::mutex mutex;
+    const int nThreads;
+
+    explicit CCoinsReadThreads(int nThreadsIn)
+        : queue(1, nThreadsIn), nThreads(nThreadsIn) {
+        for (int i = 0; i < nThreads; i++) {
+            threadGroup.create_thread([this] {
+                RenameThread("bitcoin-coinsread");
+                queue.Thread();
+            });
+        }
+    }
+
+    ~CCoinsReadThreads() {
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+
+private:
+    boost::thread_group threadGroup;
+};
+
+/**
+ * Writes the changes passed to CCoinsViewDB::BatchWrite in the background.
+ *
+ * The changes being written are kept, unmodified, until they are all
+ * committed, so that lookups can be answered from them in the meantime: an
+ * outpoint that is not part of them is not touched by the write and can be
+ * read from the database at any point. If the write fails, the changes are
+ * kept for good and no further write is accepted.
+ */
+class CCoinsWriteThread {
+public:
+    explicit CCoinsWriteThread(CCoinsViewDB &dbIn)
+        : db(dbIn), fWriting(false), fFailed(false) {
+        thread = boost::thread([this] {
+            RenameThread("bitcoin-coinsflush");
+            ThreadWrite();
+        });
+    }
+
+    ~CCoinsWriteThread() {
+        Wait();
+        thread.interrupt();
+        thread.join();
+    }
+
+    /**
+     * Wait for the previous write, then take the content of mapCoins and start
+     * writing it. Returns false if a previous write failed.
+     */
+    bool Start(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (fWriting) {
+                cond.wait(lock);
+            }
+            if (fFailed) {
+                return false;
+            }
+            mapPending.swap(mapCoins);
+            hashPending = hashBlock;
+            fWriting = true;
+        }
+        cond.notify_all();
+        return true;
+    }
+
+    //! Wait for the current write, if any. Returns false if a write failed.
+    bool Wait() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (fWriting) {
+            cond.wait(lock);
+        }
+        return !fFailed;
+    }
+
+    //! Find the entry of outpoint among the changes not yet committed.
+    bool GetPendingCoin(const COutPoint &outpoint, Coin &coin) const {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CCoinsMap::const_iterator it = mapPending.find(outpoint);
+        if (it == mapPending.end()) {
+            return false;
+        }
+        coin = it->second.coin;
+        return true;
+    }
+
+    /**
+     * Find the entries of several outpoints among the changes not yet
+     * committed. vFound is set for the outpoints that are found.
+     */
+    void GetPendingCoins(const std::vector<COutPoint> &vOutpoints,
+                         std::vector<Coin> &vCoins,
+                         std::vector<bool> &vFound) const {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (mapPending.empty()) {
+            return;
+        }
+        for (size_t i = 0; i < vOutpoints.size(); i++) {
+            CCoinsMap::const_iterator it = mapPending.find(vOutpoints[i]);
+            if (it != mapPending.end()) {
+                vCoins[i] = it->second.coin;
+                vFound[i] = true;
+            }
+        }
+    }
+
+    //! Block the changes not yet committed lead to, if any.
+    bool GetPendingBestBlock(uint256 &hashBlock) const {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (hashPending.IsNull()) {
+            return false;
+        }
+        hashBlock = hashPending;
+        return true;
+    }
+
+private:
+    CCoinsViewDB &db;
+
+    mutable boost::mutex mutex;
+    boost::condition_variable cond;
+    //! Changes being written. Only modified while fWriting is unset.
+    CCoinsMap mapPending;
+    uint256 hashPending;
+    bool fWriting;
+    bool fFailed;
+
+    boost::thread thread;
+
+    void ThreadWrite() {
+        while (true) {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fWriting) {
+                    cond.wait(lock);
+                }
+            }
+
+            // The changes are only read while fWriting is set, so no lock is
+            // needed to write them.
+            int64_t nStart = GetTimeMicros();
+            bool fOk = false;
+            try {
+                fOk = db.WriteCoins(mapPending, hashPending, false);
+            } catch (const std::runtime_error &e) {
+                LogPrintf("%s: %s\n", __func__, e.what());
+            }
+            LogPrint(BCLog::COINDB,
+                     "Wrote %u coins in the background in %.2fms\n",
+                     mapPending.size(), (GetTimeMicros() - nStart) * 0.001);
+
+            CCoinsMap mapWritten;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (fOk) {
+                    mapWritten.swap(mapPending);
+                    hashPending.SetNull();
+                } else {
+                    fFailed = true;
+                }
+                fWriting = false;
+            }
+            cond.notify_all();
+
+            if (!fOk) {
+                LogPrintf("*** Failed to write to coin database\n");
+                uiInterface.ThreadSafeMessageBox(
+                    _("Error: A fatal internal error occurred, see debug.log "
+                      "for details"),
+                    "", CClientUIInterface::MSG_ERROR);
+                StartShutdown();
+            }
+        }
+    }
+};
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe,
+                           int nReadThreads, bool fAsyncWrite)
+    : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) {
+    // The calling thread takes part in the lookups as well.
+    if (nReadThreads > 1) {
+        pReadThreads.reset(new CCoinsReadThreads(nReadThreads - 1));
+    }
+    if (fAsyncWrite) {
+        pWriteThread.reset(new CCoinsWriteThread(*this));
+    }
+}
+
+CCoinsViewDB::~CCoinsViewDB() {}
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    if (pWriteThread && pWriteThread->GetPendingCoin(outpoint, coin)) {
+        return !coin.IsSpent();
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    Coin coin;
+    if (pWriteThread && pWriteThread->GetPendingCoin(outpoint, coin)) {
+        return !coin.IsSpent();
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
+void CCoinsViewDB::GetCoins(const std::vector<COutPoint> &vOutpoints,
+                            std::vector<Coin> &vCoins) const {
+    vCoins.assign(vOutpoints.size(), Coin());
+
+    // Changes that are still being written take precedence over the database.
+    // They must be looked up before the snapshot is taken, so that the
+    // snapshot includes them if they get committed in the meantime.
+    std::vector<bool> vFound(vOutpoints.size(), false);
+    if (pWriteThread) {
+        pWriteThread->GetPendingCoins(vOutpoints, vCoins, vFound);
+    }
+
+    // Resolve the lookups in key order, so that each thread reads entries that
+    // are close to each other in the database.
+    std::vector<size_t> vOrder;
+    vOrder.reserve(vOutpoints.size());
+    for (size_t i = 0; i < vOutpoints.size(); i++) {
+        if (!vFound[i]) {
+            vOrder.push_back(i);
+        }
+    }
+    std::sort(vOrder.begin(), vOrder.end(), [&](size_t a, size_t b) {
+        return vOutpoints[a] < vOutpoints[b];
+    });
+
+    // All the threads read from the same snapshot, so the result is
+    // consistent even if the database is written to in the meantime.
+    CDBSnapshot snapshot(db);
+
+    // Only one parallel lookup can use the read threads at a time, others
+    // read serially rather than waiting for them.
+    boost::unique_lock<boost::mutex> lock;
+    if (pReadThreads && vOrder.size() >= 2 * MIN_COINS_PER_READ_JOB) {
+        lock = boost::unique_lock<boost::mutex>(pReadThreads->mutex,
+                                                boost::try_to_lock);
+    }
+    if (!lock.owns_lock()) {
+        std::string strError;
+        CCoinsReadJob(&snapshot, vOutpoints, vCoins, vOrder.data(),
+                      vOrder.data() + vOrder.size(), &strError)();
+        if (!strError.empty()) {
+            throw dbwrapper_error(strError);
+        }
+        return;
+    }
+
+    // Use several jobs per thread, so that the threads can balance the work
+    // between themselves.
+    const size_t nJobSize =
+        std::max(MIN_COINS_PER_READ_JOB,
+                 vOrder.size() / (4 * (pReadThreads->nThreads + 1)));
+    const size_t nJobs = (vOrder.size() + nJobSize - 1) / nJobSize;
+    std::vector<std::string> vErrors(nJobs);
+    std::vector<CCoinsReadJob> vJobs;
+    vJobs.reserve(nJobs);
+    for (size_t i = 0; i < nJobs; i++) {
+        vJobs.emplace_back(
+            &snapshot, vOutpoints, vCoins, vOrder.data() + i * nJobSize,
+            vOrder.data() + std::min(vOrder.size(), (i + 1) * nJobSize),
+            &vErrors[i]);
+    }
+
+    CCheckQueueControl<CCoinsReadJob> control(&pReadThreads->queue);
+    control.Add(vJobs);
+    if (!control.Wait()) {
+        // Database errors are reported to the caller as if we had been reading
+        // serially.
+        for (const std::string &strError : vErrors) {
+            if (!strError.empty()) {
+                throw dbwrapper_error(strError);
+            }
+        }
+    }
+}
+
 uint256 CCoinsViewDB::GetBestBlock() const {
+    uint256 hashBestChain;
+    if (pWriteThread && pWriteThread->GetPendingBestBlock(hashBestChain)) {
+        return hashBestChain;
+    }
+    return ReadBestBlock();
+}
+
+uint256 CCoinsViewDB::ReadBestBlock() const {
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain)) return uint256();
     return hashBestChain;
@@ -79,6 +428,19 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    if (pWriteThread) {
+        assert(!hashBlock.IsNull());
+        return pWriteThread->Start(mapCoins, hashBlock);
+    }
+    return WriteCoins(mapCoins, hashBlock, true);
+}
+
+bool CCoinsViewDB::WaitForWrites() {
+    return !pWriteThread || pWriteThread->Wait();
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock,
+                              bool fErase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -87,7 +449,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
 
-    uint256 old_tip = GetBestBlock();
+    uint256 old_tip = ReadBestBlock();
     if (old_tip.IsNull()) {
         // We may be in the middle of replaying.
         std::vector<uint256> old_heads = GetHeadBlocks();
@@ -116,7 +478,9 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
         }
         count++;
         CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            mapCoins.erase(itOld);
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n",
                      batch.SizeEstimate() * (1.0 / 1048576.0));
@@ -173,7 +537,17 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+uint64_t CBlockTreeDB::ReadBlockIndexGeneration() {
+    uint64_t nGeneration = 0;
+    Read(DB_BLOCK_INDEX_GENERATION, nGeneration);
+    return nGeneration;
+}
+
 CCoinsViewCursor *CCoinsViewDB::Cursor() const {
+    // Iterate over a consistent database.
+    if (pWriteThread) {
+        pWriteThread->Wait();
+    }
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(
         const_cast<CDBWrapper &>(db).NewIterator(), GetBestBlock());
     /**
@@ -183,17 +557,37 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const {
      */
     i->pcursor->Seek(DB_COIN);
     // Cache key of first record
-    if (i->pcursor->Valid()) {
-        CoinEntry entry(&i->keyTmp.second);
-        i->pcursor->GetKey(entry);
-        i->keyTmp.first = entry.key;
-    } else {
-        // Make sure Valid() and GetKey() return false
-        i->keyTmp.first = 0;
+    i->ReadKey();
+    return i;
+}
+
+std::unique_ptr<CDBSnapshot> CCoinsViewDB::GetSnapshot() const {
+    if (pWriteThread) {
+        pWriteThread->Wait();
     }
+    return std::unique_ptr<CDBSnapshot>(new CDBSnapshot(db));
+}
+
+CCoinsViewCursor *CCoinsViewDB::Cursor(const CDBSnapshot &snapshot,
+                                       const uint256 &hashBegin,
+                                       const uint256 &hashEnd) const {
+    uint256 hashBestChain;
+    snapshot.Read(DB_BEST_BLOCK, hashBestChain);
+    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(snapshot.NewIterator(),
+                                                   hashBestChain, hashEnd);
+    i->pcursor->Seek(std::make_pair(DB_COIN, hashBegin));
+    i->ReadKey();
     return i;
 }
 
+bool CCoinsViewDB::ReadUTXOSummary(CUTXOSummary &summary) const {
+    return db.Read(DB_UTXO_SUMMARY, summary);
+}
+
+bool CCoinsViewDB::WriteUTXOSummary(const CUTXOSummary &summary) {
+    return db.Write(DB_UTXO_SUMMARY, summary);
+}
+
 bool CCoinsViewDBCursor::GetKey(COutPoint &key) const {
     // Return cached key
     if (keyTmp.first == DB_COIN) {
@@ -217,8 +611,14 @@ bool CCoinsViewDBCursor::Valid() const {
 
 void CCoinsViewDBCursor::Next() {
     pcursor->Next();
+    ReadKey();
+}
+
+void CCoinsViewDBCursor::ReadKey() {
     CoinEntry entry(&keyTmp.second);
-    if (!pcursor->Valid() || !pcursor->GetKey(entry)) {
+    if (!pcursor->Valid() || !pcursor->GetKey(entry) ||
+        (!hashEnd.IsNull() && entry.key == DB_COIN &&
+         !(keyTmp.second.hash < hashEnd))) {
         // Invalidate cached key after last record so that Valid() and GetKey()
         // return false
         keyTmp.first = 0;
@@ -237,6 +637,7 @@ bool CBlockTreeDB::WriteBatchSync(
         batch.Write(std::make_pair(DB_BLOCK_FILES, it->first), *it->second);
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
+    batch.Write(DB_BLOCK_INDEX_GENERATION, ReadBlockIndexGeneration() + 1);
     for (std::vector<const CBlockIndex *>::const_iterator it =
              blockinfo.begin();
          it != blockinfo.end(); it++) {
@@ -246,20 +647,6 @@ bool CBlockTreeDB::WriteBatchSync(
     return WriteBatch(batch, true);
 }
 
-bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
-    return Read(std::make_pair(DB_TXINDEX, txid), pos);
-}
-
-bool CBlockTreeDB::WriteTxIndex(
-    const std::vector<std::pair<uint256, CDiskTxPos>> &vect) {
-    CDBBatch batch(*this);
-    for (std::vector<std::pair<uint256, CDiskTxPos>>::const_iterator it =
-             vect.begin();
-         it != vect.end(); it++)
-        batch.Write(std::make_pair(DB_TXINDEX, it->first), it->second);
-    return WriteBatch(batch);
-}
-
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -272,53 +659,383 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
 }
 
 bool CBlockTreeDB::LoadBlockIndexGuts(
-    std::function<CBlockIndex *(const uint256 &)> insertBlockIndex) {
+    std::function<CBlockIndex *(const uint256 &)> insertBlockIndex,
+    int nThreads) {
     const Config &config = GetConfig();
+    nThreads = std::max(1, std::min(nThreads, MAX_BLOCK_INDEX_LOAD_THREADS));
 
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    // Block hashes are uniformly distributed, so sharding the key range by the
+    // first byte of the hash splits the work evenly.
+    std::vector<std::vector<std::pair<uint256, CDiskBlockIndex>>> vShards(
+        nThreads);
+    std::vector<std::string> vErrors(nThreads);
+    // Exceptions, including interruptions, are carried over to the calling
+    // thread, which throws them once all the threads are done.
+    std::vector<std::exception_ptr> vExceptions(nThreads);
+    std::atomic<bool> fAbort(false);
+    auto readShard = [&](int nShard) {
+        try {
+            const int nFirst = 256 * nShard / nThreads;
+            const int nEnd = 256 * (nShard + 1) / nThreads;
+            std::unique_ptr<CDBIterator> pcursor(NewIterator());
+            uint256 hashStart;
+            *hashStart.begin() = nFirst;
+            pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, hashStart));
+            while (pcursor->Valid()) {
+                if (fAbort) {
+                    return;
+                }
+                if (nShard == 0) {
+                    // Only the calling thread can be interrupted.
+                    boost::this_thread::interruption_point();
+                }
+                std::pair<char, uint256> key;
+                if (!pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX ||
+                    *key.second.begin() >= nEnd) {
+                    break;
+                }
 
-    pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
+                CDiskBlockIndex diskindex;
+                if (!pcursor->GetValue(diskindex)) {
+                    vErrors[nShard] = "failed to read value";
+                    fAbort = true;
+                    return;
+                }
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (!pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX) {
-            break;
+                uint256 hash = diskindex.GetBlockHash();
+                if (!CheckProofOfWork(hash, diskindex.nBits, config)) {
+                    vErrors[nShard] = strprintf(
+                        "CheckProofOfWork failed: %s", hash.ToString());
+                    fAbort = true;
+                    return;
+                }
+                vShards[nShard].emplace_back(hash, diskindex);
+
+                pcursor->Next();
+            }
+        } catch (...) {
+            vExceptions[nShard] = std::current_exception();
+            fAbort = true;
         }
+    };
 
-        CDiskBlockIndex diskindex;
-        if (!pcursor->GetValue(diskindex)) {
-            return error("LoadBlockIndex() : failed to read value");
+    int64_t nStart = GetTimeMicros();
+    {
+        boost::thread_group readThreads;
+        for (int i = 1; i < nThreads; i++) {
+            readThreads.create_thread([&readShard, i] {
+                RenameThread("bitcoin-loadidx");
+                readShard(i);
+            });
         }
+        readShard(0);
+        readThreads.join_all();
+    }
+    RecordStartupPhase("loadblockindex.read", GetTimeMicros() - nStart);
 
-        // Construct block index object
-        CBlockIndex *pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-        pindexNew->pprev = insertBlockIndex(diskindex.hashPrev);
-        pindexNew->nHeight = diskindex.nHeight;
-        pindexNew->nFile = diskindex.nFile;
-        pindexNew->nDataPos = diskindex.nDataPos;
-        pindexNew->nUndoPos = diskindex.nUndoPos;
-        pindexNew->nVersion = diskindex.nVersion;
-        pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-        pindexNew->nTime = diskindex.nTime;
-        pindexNew->nBits = diskindex.nBits;
-        pindexNew->nNonce = diskindex.nNonce;
-        pindexNew->nStatus = diskindex.nStatus;
-        pindexNew->nTx = diskindex.nTx;
+    for (const std::exception_ptr &e : vExceptions) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+    boost::this_thread::interruption_point();
+    for (const std::string &strError : vErrors) {
+        if (!strError.empty()) {
+            return error("LoadBlockIndex(): %s", strError);
+        }
+    }
 
-        if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits,
-                              config)) {
-            return error("LoadBlockIndex(): CheckProofOfWork failed: %s",
-                         pindexNew->ToString());
+    // Construct the block index objects and link them.
+    nStart = GetTimeMicros();
+    size_t nEntries = 0;
+    for (std::vector<std::pair<uint256, CDiskBlockIndex>> &vEntries : vShards) {
+        for (const std::pair<uint256, CDiskBlockIndex> &entry : vEntries) {
+            boost::this_thread::interruption_point();
+            const CDiskBlockIndex &diskindex = entry.second;
+            CBlockIndex *pindexNew = insertBlockIndex(entry.first);
+            pindexNew->pprev = insertBlockIndex(diskindex.hashPrev);
+            pindexNew->nHeight = diskindex.nHeight;
+            pindexNew->nFile = diskindex.nFile;
+            pindexNew->nDataPos = diskindex.nDataPos;
+            pindexNew->nUndoPos = diskindex.nUndoPos;
+            pindexNew->nVersion = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime = diskindex.nTime;
+            pindexNew->nBits = diskindex.nBits;
+            pindexNew->nNonce = diskindex.nNonce;
+            pindexNew->nStatus = diskindex.nStatus;
+            pindexNew->nTx = diskindex.nTx;
         }
+        nEntries += vEntries.size();
+        // Release each shard as soon as it is linked.
+        std::vector<std::pair<uint256, CDiskBlockIndex>>().swap(vEntries);
+    }
+    RecordStartupPhase("loadblockindex.link", GetTimeMicros() - nStart);
+    LogPrintf("%s: loaded %u block index entries using %d threads\n",
+              __func__, nEntries, nThreads);
 
-        pcursor->Next();
+    return true;
+}
+
+namespace {
+/**
+ * Layout of a block index snapshot: a header followed by one fixed size record
+ * per block index entry, in height order so that the record of the parent of
+ * an entry always comes before the entry itself. All the integers are little
+ * endian.
+ *
+ * Header: magic (8), version (4), record count (4), generation of the block
+ * tree database (8), best block of the coins database (32), checksum (8).
+ * Record: hash (32), merkle root (32), index of the parent record or -1 (4),
+ * height (4), status (4), file (4), data pos (4), undo pos (4), tx count (4),
+ * version (4), time (4), bits (4), nonce (4).
+ *
+ * The generation is a counter of the block tree database, bumped by every
+ * write to the block index, which ties a snapshot to the content it was
+ * written from. The checksum is a SipHash of the rest of the file.
+ */
+const uint8_t BLOCK_INDEX_SNAPSHOT_MAGIC[8] = {'b', 'i', 'd', 'x',
+                                              's', 'n', 'a', 'p'};
+const uint32_t BLOCK_INDEX_SNAPSHOT_VERSION = 2;
+const size_t BLOCK_INDEX_SNAPSHOT_HEADER_SIZE = 64;
+const size_t BLOCK_INDEX_SNAPSHOT_CHECKSUM_POS = 56;
+const size_t BLOCK_INDEX_SNAPSHOT_RECORD_SIZE = 108;
+
+uint64_t BlockIndexSnapshotChecksum(const uint8_t *pData, size_t nSize) {
+    return CSipHasher(0, 0)
+        .Write(pData, BLOCK_INDEX_SNAPSHOT_CHECKSUM_POS)
+        .Write(pData + BLOCK_INDEX_SNAPSHOT_HEADER_SIZE,
+               nSize - BLOCK_INDEX_SNAPSHOT_HEADER_SIZE)
+        .Finalize();
+}
+
+/** Read only view of a whole file, memory mapped where supported. */
+class CMappedFile {
+public:
+    explicit CMappedFile(const fs::path &path) {
+#ifndef WIN32
+        int fd = open(path.string().c_str(), O_RDONLY);
+        if (fd == -1) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                // The whole file is about to be read in order.
+                posix_madvise(p, st.st_size, POSIX_MADV_SEQUENTIAL);
+                pData = static_cast<const uint8_t *>(p);
+                nSize = st.st_size;
+            }
+        }
+        close(fd);
+#else
+        FILE *file = fsbridge::fopen(path, "rb");
+        if (!file) {
+            return;
+        }
+        uint8_t buf[65536];
+        size_t nRead;
+        while ((nRead = fread(buf, 1, sizeof(buf), file)) > 0) {
+            vData.insert(vData.end(), buf, buf + nRead);
+        }
+        fclose(file);
+        pData = vData.data();
+        nSize = vData.size();
+#endif
+    }
+
+    ~CMappedFile() {
+#ifndef WIN32
+        if (pData) {
+            munmap(const_cast<uint8_t *>(pData), nSize);
+        }
+#endif
+    }
+
+    const uint8_t *data() const { return pData; }
+    size_t size() const { return nSize; }
+
+private:
+    const uint8_t *pData = nullptr;
+    size_t nSize = 0;
+#ifdef WIN32
+    std::vector<uint8_t> vData;
+#endif
+
+    CMappedFile(const CMappedFile &) = delete;
+    CMappedFile &operator=(const CMappedFile &) = delete;
+};
+} // namespace
+
+bool CBlockTreeDB::WriteBlockIndexSnapshot(
+    const fs::path &path, const std::vector<const CBlockIndex *> &vBlocks,
+    const uint256 &hashBestChain) {
+    int64_t nStart = GetTimeMicros();
+    std::vector<const CBlockIndex *> vSorted(vBlocks);
+    std::sort(vSorted.begin(), vSorted.end(),
+              [](const CBlockIndex *a, const CBlockIndex *b) {
+                  return a->nHeight < b->nHeight;
+              });
+    std::unordered_map<const CBlockIndex *, uint32_t> mapRecord;
+    mapRecord.reserve(vSorted.size());
+
+    const uint64_t nGeneration = ReadBlockIndexGeneration();
+    std::vector<uint8_t> vData(BLOCK_INDEX_SNAPSHOT_HEADER_SIZE +
+                               vSorted.size() *
+                                   BLOCK_INDEX_SNAPSHOT_RECORD_SIZE);
+    uint8_t *p = vData.data();
+    memcpy(p, BLOCK_INDEX_SNAPSHOT_MAGIC, 8);
+    WriteLE32(p + 8, BLOCK_INDEX_SNAPSHOT_VERSION);
+    WriteLE32(p + 12, vSorted.size());
+    WriteLE64(p + 16, nGeneration);
+    memcpy(p + 24, hashBestChain.begin(), 32);
+    p += BLOCK_INDEX_SNAPSHOT_HEADER_SIZE;
+    for (const CBlockIndex *pindex : vSorted) {
+        uint32_t nPrev = uint32_t(-1);
+        if (pindex->pprev) {
+            auto it = mapRecord.find(pindex->pprev);
+            if (it == mapRecord.end()) {
+                return error("%s: parent of block %s missing", __func__,
+                             pindex->GetBlockHash().ToString());
+            }
+            nPrev = it->second;
+        }
+        mapRecord.emplace(pindex, mapRecord.size());
+
+        memcpy(p, pindex->GetBlockHash().begin(), 32);
+        memcpy(p + 32, pindex->hashMerkleRoot.begin(), 32);
+        WriteLE32(p + 64, nPrev);
+        WriteLE32(p + 68, pindex->nHeight);
+        WriteLE32(p + 72, pindex->nStatus);
+        WriteLE32(p + 76, pindex->nFile);
+        WriteLE32(p + 80, pindex->nDataPos);
+        WriteLE32(p + 84, pindex->nUndoPos);
+        WriteLE32(p + 88, pindex->nTx);
+        WriteLE32(p + 92, pindex->nVersion);
+        WriteLE32(p + 96, pindex->nTime);
+        WriteLE32(p + 100, pindex->nBits);
+        WriteLE32(p + 104, pindex->nNonce);
+        p += BLOCK_INDEX_SNAPSHOT_RECORD_SIZE;
     }
+    WriteLE64(vData.data() + BLOCK_INDEX_SNAPSHOT_CHECKSUM_POS,
+              BlockIndexSnapshotChecksum(vData.data(), vData.size()));
 
+    // Replace any previous snapshot atomically.
+    fs::path pathTmp = path;
+    pathTmp += ".new";
+    FILE *file = fsbridge::fopen(pathTmp, "wb");
+    if (!file) {
+        return error("%s: failed to open %s", __func__, pathTmp.string());
+    }
+    bool fWritten = fwrite(vData.data(), 1, vData.size(), file) == vData.size();
+    if (fWritten) {
+        FileCommit(file);
+    }
+    fclose(file);
+    if (!fWritten || !RenameOver(pathTmp, path)) {
+        fs::remove(pathTmp);
+        return error("%s: failed to write %s", __func__, path.string());
+    }
+
+    LogPrintf("Wrote block index snapshot of %u entries (%u kB) in %dms\n",
+              vSorted.size(), vData.size() >> 10,
+              (GetTimeMicros() - nStart) / 1000);
     return true;
 }
 
+bool CBlockTreeDB::LoadBlockIndexSnapshot(
+    const fs::path &path, const uint256 &hashBestChain,
+    std::function<CBlockIndex *(const uint256 &)> insertBlockIndex) {
+    if (!fs::exists(path)) {
+        return false;
+    }
+
+    int64_t nStart = GetTimeMicros();
+    const uint64_t nGeneration = ReadBlockIndexGeneration();
+    CMappedFile file(path);
+    // The database may change from now on, which would make the snapshot
+    // stale.
+    InvalidateBlockIndexSnapshot(path);
+
+    const uint8_t *p = file.data();
+    if (!p || file.size() < BLOCK_INDEX_SNAPSHOT_HEADER_SIZE ||
+        memcmp(p, BLOCK_INDEX_SNAPSHOT_MAGIC, 8) != 0 ||
+        ReadLE32(p + 8) != BLOCK_INDEX_SNAPSHOT_VERSION) {
+        LogPrintf("Ignoring unreadable block index snapshot\n");
+        return false;
+    }
+    const size_t nRecords = ReadLE32(p + 12);
+    if (file.size() != BLOCK_INDEX_SNAPSHOT_HEADER_SIZE +
+                           nRecords * BLOCK_INDEX_SNAPSHOT_RECORD_SIZE) {
+        LogPrintf("Ignoring truncated block index snapshot\n");
+        return false;
+    }
+    if (ReadLE64(p + 16) != nGeneration ||
+        memcmp(p + 24, hashBestChain.begin(), 32) != 0) {
+        LogPrintf("Ignoring stale block index snapshot\n");
+        return false;
+    }
+    // The entries were checked when they entered the block index this node
+    // wrote the snapshot from: checking that the file is the one it wrote is
+    // enough, and much cheaper than hashing every header again.
+    if (ReadLE64(p + BLOCK_INDEX_SNAPSHOT_CHECKSUM_POS) !=
+        BlockIndexSnapshotChecksum(p, file.size())) {
+        LogPrintf("Ignoring corrupt block index snapshot\n");
+        return false;
+    }
+    // Check the links before creating anything, so that a failure leaves the
+    // block index untouched.
+    const uint8_t *pRecords = p + BLOCK_INDEX_SNAPSHOT_HEADER_SIZE;
+    for (size_t i = 0; i < nRecords; i++) {
+        uint32_t nPrev =
+            ReadLE32(pRecords + i * BLOCK_INDEX_SNAPSHOT_RECORD_SIZE + 64);
+        if (nPrev != uint32_t(-1) && nPrev >= i) {
+            LogPrintf("Ignoring inconsistent block index snapshot\n");
+            return false;
+        }
+    }
+
+    std::vector<CBlockIndex *> vIndex(nRecords);
+    for (size_t i = 0; i < nRecords; i++) {
+        const uint8_t *pRecord =
+            pRecords + i * BLOCK_INDEX_SNAPSHOT_RECORD_SIZE;
+        uint256 hash;
+        memcpy(hash.begin(), pRecord, 32);
+        CBlockIndex *pindexNew = insertBlockIndex(hash);
+        memcpy(pindexNew->hashMerkleRoot.begin(), pRecord + 32, 32);
+        uint32_t nPrev = ReadLE32(pRecord + 64);
+        pindexNew->pprev = nPrev == uint32_t(-1) ? nullptr : vIndex[nPrev];
+        pindexNew->nHeight = ReadLE32(pRecord + 68);
+        pindexNew->nStatus = ReadLE32(pRecord + 72);
+        pindexNew->nFile = ReadLE32(pRecord + 76);
+        pindexNew->nDataPos = ReadLE32(pRecord + 80);
+        pindexNew->nUndoPos = ReadLE32(pRecord + 84);
+        pindexNew->nTx = ReadLE32(pRecord + 88);
+        pindexNew->nVersion = ReadLE32(pRecord + 92);
+        pindexNew->nTime = ReadLE32(pRecord + 96);
+        pindexNew->nBits = ReadLE32(pRecord + 100);
+        pindexNew->nNonce = ReadLE32(pRecord + 104);
+        vIndex[i] = pindexNew;
+    }
+
+    RecordStartupPhase("loadblockindex.snapshot", GetTimeMicros() - nStart);
+    LogPrintf("%s: loaded %u block index entries from snapshot\n", __func__,
+              nRecords);
+    return true;
+}
+
+void CBlockTreeDB::InvalidateBlockIndexSnapshot(const fs::path &path) {
+    Write(DB_BLOCK_INDEX_GENERATION, ReadBlockIndexGeneration() + 1, true);
+    // A mapping of the file stays readable after the file is removed.
+    try {
+        fs::remove(path);
+    } catch (const fs::filesystem_error &e) {
+        LogPrintf("%s: Unable to remove %s: %s\n", __func__, path.string(),
+                  e.what());
+    }
+}
+
 namespace {
 //! Legacy class to deserialize pre-pertxout database entries without reindex.
 class CCoins {
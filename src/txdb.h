@@ -11,12 +11,16 @@
 #include "dbwrapper.h"
 
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
 class CBlockIndex;
+class CCoinsReadThreads;
 class CCoinsViewDBCursor;
+class CCoinsWriteThread;
+class CUTXOSummary;
 class uint256;
 
 //! No need to periodic flush if at least this much space still available.
@@ -29,57 +33,100 @@ static const int64_t nDefaultDbBatchSize = 16 << 20;
 static const int64_t nMaxDbCache = sizeof(void *) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
 static const int64_t nMinDbCache = 4;
-//! Max memory allocated to block tree DB specific cache, if no -txindex (MiB)
+//! Max memory allocated to block tree DB specific cache (MiB)
 static const int64_t nMaxBlockDBCache = 2;
-//! Max memory allocated to block tree DB specific cache, if -txindex (MiB)
+//! Max memory allocated to tx index DB specific cache, if -txindex (MiB)
 // Unlike for the UTXO database, for the txindex scenario the leveldb cache make
 // a meaningful difference:
 // https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
-static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
+static const int64_t nMaxTxIndexCache = 1024;
+//! Max memory allocated to address index DB specific cache, if -addressindex
+//! (MiB)
+static const int64_t nMaxAddressIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
-
-struct CDiskTxPos : public CDiskBlockPos {
-    unsigned int nTxOffset; // after header
-
-    ADD_SERIALIZE_METHODS;
-
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream &s, Operation ser_action) {
-        READWRITE(*(CDiskBlockPos *)this);
-        READWRITE(VARINT(nTxOffset));
-    }
-
-    CDiskTxPos(const CDiskBlockPos &blockIn, unsigned int nTxOffsetIn)
-        : CDiskBlockPos(blockIn.nFile, blockIn.nPos), nTxOffset(nTxOffsetIn) {}
-
-    CDiskTxPos() { SetNull(); }
-
-    void SetNull() {
-        CDiskBlockPos::SetNull();
-        nTxOffset = 0;
-    }
-};
+//! Minimum number of coins read by each job of a parallel coin lookup
+static const size_t MIN_COINS_PER_READ_JOB = 64;
+//! Maximum number of threads reading coins from the database in parallel
+static const int MAX_COINS_READ_THREADS = 16;
+//! -dbreadthreads default (threads reading coins in parallel, 0 = auto)
+static const int DEFAULT_COINS_READ_THREADS = 0;
+//! Maximum number of threads reading the block index at startup
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 16;
+//! -asyncflush default
+static const bool DEFAULT_ASYNC_FLUSH = false;
+//! -blockindexsnapshot default
+static const bool DEFAULT_BLOCK_INDEX_SNAPSHOT = true;
 
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB final : public CCoinsView {
 protected:
     CDBWrapper db;
 
+    //! Threads resolving large GetCoins requests in parallel, if any.
+    std::unique_ptr<CCoinsReadThreads> pReadThreads;
+
+    //! Thread writing BatchWrite changes in the background, if enabled.
+    std::unique_ptr<CCoinsWriteThread> pWriteThread;
+
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    /**
+     * nReadThreads is the number of threads, including the calling one, used
+     * to resolve GetCoins requests in parallel.
+     *
+     * If fAsyncWrite is set, BatchWrite takes ownership of the changes and
+     * returns before they are written: they are written from a background
+     * thread while lookups keep seeing them. Use WaitForWrites to make sure
+     * they reached the disk.
+     */
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false,
+                 int nReadThreads = 1, bool fAsyncWrite = false);
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    void GetCoins(const std::vector<COutPoint> &vOutpoints,
+                  std::vector<Coin> &vCoins) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool WaitForWrites() override;
     CCoinsViewCursor *Cursor() const override;
 
+    /**
+     * Snapshot of the database once the pending writes are committed, for
+     * several cursors to iterate over the same state. Requires cs_main, which
+     * BatchWrite is called with, so that no write can be queued between
+     * waiting for the pending ones and taking the snapshot.
+     */
+    std::unique_ptr<CDBSnapshot> GetSnapshot() const;
+    /**
+     * Cursor over the coins of snapshot whose txid is in [hashBegin, hashEnd),
+     * in key order. A null hashEnd leaves the range unbounded. The snapshot
+     * must outlive the cursor.
+     */
+    CCoinsViewCursor *Cursor(const CDBSnapshot &snapshot,
+                             const uint256 &hashBegin,
+                             const uint256 &hashEnd) const;
+
+    //! Summary of the UTXO set stored by WriteUTXOSummary, if any.
+    bool ReadUTXOSummary(CUTXOSummary &summary) const;
+    bool WriteUTXOSummary(const CUTXOSummary &summary);
+
     //! Attempt to update from an older database format.
     //! Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+private:
+    //! Best block as stored in the database, ignoring any write in progress.
+    uint256 ReadBestBlock() const;
+
+    //! Write the dirty entries of mapCoins to the database, erasing the
+    //! entries as they are written if fErase is set.
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase);
+
+    friend class CCoinsWriteThread;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -95,10 +142,17 @@ public:
     void Next() override;
 
 private:
-    CCoinsViewDBCursor(CDBIterator *pcursorIn, const uint256 &hashBlockIn)
-        : CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+    CCoinsViewDBCursor(CDBIterator *pcursorIn, const uint256 &hashBlockIn,
+                       const uint256 &hashEndIn = uint256())
+        : CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn),
+          hashEnd(hashEndIn) {}
     std::unique_ptr<CDBIterator> pcursor;
     std::pair<char, COutPoint> keyTmp;
+    //! Txid the iteration stops at, if not null.
+    uint256 hashEnd;
+
+    //! Cache the key of the current record, if it is in range.
+    void ReadKey();
 
     friend class CCoinsViewDB;
 };
@@ -118,14 +172,51 @@ public:
         int nLastFile, const std::vector<const CBlockIndex *> &blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
+    /**
+     * Counter bumped by every write to the block index, and by
+     * InvalidateBlockIndexSnapshot.
+     */
+    uint64_t ReadBlockIndexGeneration();
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
-    bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>> &list);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    /**
+     * Load all the block index entries through insertBlockIndex. The entries
+     * are read, deserialized and checked by nThreads threads, each taking a
+     * share of the key range, then linked on the calling thread.
+     */
     bool LoadBlockIndexGuts(
+        std::function<CBlockIndex *(const uint256 &)> insertBlockIndex,
+        int nThreads = 1);
+    /**
+     * Write a flat snapshot of the given block index entries to path, for
+     * LoadBlockIndexSnapshot to map at the next startup. The snapshot is only
+     * valid for the current generation of this database and for
+     * hashBestChain, the best block of the coins database.
+     */
+    bool
+    WriteBlockIndexSnapshot(const fs::path &path,
+                            const std::vector<const CBlockIndex *> &vBlocks,
+                            const uint256 &hashBestChain);
+    /**
+     * Load all the block index entries through insertBlockIndex from a
+     * snapshot written by WriteBlockIndexSnapshot, without the deserialization
+     * and proof of work checks of LoadBlockIndexGuts: a checksum over the file
+     * tells it is the one this node wrote. Returns false, having loaded
+     * nothing, if the snapshot is missing, corrupt or stale. A snapshot is
+     * only used once: it is invalidated whatever the outcome.
+     *
+     * A version which does not know about snapshots does not bump the
+     * generation. Unless it connected blocks, which changes hashBestChain, a
+     * snapshot written before it ran only lacks what it added to the block
+     * index, which is then downloaded again.
+     */
+    bool LoadBlockIndexSnapshot(
+        const fs::path &path, const uint256 &hashBestChain,
         std::function<CBlockIndex *(const uint256 &)> insertBlockIndex);
+    /** Invalidate the snapshot at path, if any. */
+    void InvalidateBlockIndexSnapshot(const fs::path &path);
 };
 
 #endif // BITCOIN_TXDB_H
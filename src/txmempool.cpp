@@ -30,7 +30,7 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef &_tx, const Amount _nFee,
     : tx(_tx), nFee(_nFee), nTime(_nTime), entryPriority(_entryPriority),
       entryHeight(_entryHeight), inChainInputValue(_inChainInputValue),
       spendsCoinbase(_spendsCoinbase), sigOpCount(_sigOpsCount),
-      lockPoints(lp) {
+      lockPoints(lp), nEpoch(0) {
     nTxSize = tx->GetTotalSize();
     nModSize = tx->CalculateModifiedSize(GetTxSize());
     nUsageSize = RecursiveDynamicUsage(tx);
@@ -81,34 +81,41 @@ void CTxMemPoolEntry::UpdateLockPoints(const LockPoints &lp) {
 void CTxMemPool::UpdateForDescendants(txiter updateIt,
                                       cacheMap &cachedDescendants,
                                       const std::set<uint256> &setExclude) {
-    setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
+    AssertLockHeld(cs);
+    const EpochGuard epoch(*this);
+    std::vector<txiter> stageEntries, vAllDescendants;
+    for (const CTxMemPoolEntry *child : updateIt->children) {
+        Visited(*child);
+        stageEntries.push_back(mapTx.iterator_to(*child));
+    }
 
     while (!stageEntries.empty()) {
-        const txiter cit = *stageEntries.begin();
-        setAllDescendants.insert(cit);
-        stageEntries.erase(cit);
-        const setEntries &setChildren = GetMemPoolChildren(cit);
-        for (const txiter childEntry : setChildren) {
+        const txiter cit = stageEntries.back();
+        stageEntries.pop_back();
+        vAllDescendants.push_back(cit);
+        for (const CTxMemPoolEntry *child : cit->children) {
+            const txiter childEntry = mapTx.iterator_to(*child);
             cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
             if (cacheIt != cachedDescendants.end()) {
                 // We've already calculated this one, just add the entries for
                 // this set but don't traverse again.
                 for (const txiter cacheEntry : cacheIt->second) {
-                    setAllDescendants.insert(cacheEntry);
+                    if (!Visited(*cacheEntry)) {
+                        vAllDescendants.push_back(cacheEntry);
+                    }
                 }
-            } else if (!setAllDescendants.count(childEntry)) {
+            } else if (!Visited(*child)) {
                 // Schedule for later processing
-                stageEntries.insert(childEntry);
+                stageEntries.push_back(childEntry);
             }
         }
     }
-    // setAllDescendants now contains all in-mempool descendants of updateIt.
+    // vAllDescendants now contains all in-mempool descendants of updateIt.
     // Update and add to cached descendant map
     int64_t modifySize = 0;
     Amount modifyFee(0);
     int64_t modifyCount = 0;
-    for (txiter cit : setAllDescendants) {
+    for (txiter cit : vAllDescendants) {
         if (!setExclude.count(cit->GetTx().GetId())) {
             modifySize += cit->GetTxSize();
             modifyFee += cit->GetModifiedFee();
@@ -183,8 +190,10 @@ bool CTxMemPool::CalculateMemPoolAncestors(
     std::string &errString, bool fSearchForParents /* = true */) const {
     LOCK(cs);
 
-    setEntries parentHashes;
+    // Ancestors found but not walked yet.
+    std::vector<txiter> parentHashes;
     const CTransaction &tx = entry.GetTx();
+    const EpochGuard epoch(*this);
 
     if (fSearchForParents) {
         // Get parents of this transaction that are in the mempool
@@ -192,10 +201,10 @@ bool CTxMemPool::CalculateMemPoolAncestors(
         // iterate mapTx to find parents.
         for (const CTxIn &in : tx.vin) {
             txiter piter = mapTx.find(in.prevout.hash);
-            if (piter == mapTx.end()) {
+            if (piter == mapTx.end() || Visited(*piter)) {
                 continue;
             }
-            parentHashes.insert(piter);
+            parentHashes.push_back(piter);
             if (parentHashes.size() + 1 > limitAncestorCount) {
                 errString =
                     strprintf("too many unconfirmed parents [limit: %u]",
@@ -206,17 +215,19 @@ bool CTxMemPool::CalculateMemPoolAncestors(
     } else {
         // If we're not searching for parents, we require this to be an entry in
         // the mempool already.
-        txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        for (const CTxMemPoolEntry *parent : entry.parents) {
+            Visited(*parent);
+            parentHashes.push_back(mapTx.iterator_to(*parent));
+        }
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
 
     while (!parentHashes.empty()) {
-        txiter stageit = *parentHashes.begin();
+        txiter stageit = parentHashes.back();
 
         setAncestors.insert(stageit);
-        parentHashes.erase(stageit);
+        parentHashes.pop_back();
         totalSizeWithAncestors += stageit->GetTxSize();
 
         if (stageit->GetSizeWithDescendants() + entry.GetTxSize() >
@@ -240,11 +251,10 @@ bool CTxMemPool::CalculateMemPoolAncestors(
             return false;
         }
 
-        const setEntries &setMemPoolParents = GetMemPoolParents(stageit);
-        for (const txiter &phash : setMemPoolParents) {
+        for (const CTxMemPoolEntry *parent : stageit->parents) {
             // If this is a new ancestor, add it.
-            if (setAncestors.count(phash) == 0) {
-                parentHashes.insert(phash);
+            if (!Visited(*parent)) {
+                parentHashes.push_back(mapTx.iterator_to(*parent));
             }
             if (parentHashes.size() + setAncestors.size() + 1 >
                 limitAncestorCount) {
@@ -261,10 +271,9 @@ bool CTxMemPool::CalculateMemPoolAncestors(
 
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it,
                                    setEntries &setAncestors) {
-    setEntries parentIters = GetMemPoolParents(it);
     // add or remove this tx as a child of each parent
-    for (txiter piter : parentIters) {
-        UpdateChild(piter, it, add);
+    for (const CTxMemPoolEntry *parent : it->parents) {
+        UpdateChild(mapTx.iterator_to(*parent), it, add);
     }
     const int64_t updateCount = (add ? 1 : -1);
     const int64_t updateSize = updateCount * it->GetTxSize();
@@ -291,9 +300,8 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it,
 }
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it) {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
-    for (txiter updateIt : setMemPoolChildren) {
-        UpdateParent(updateIt, it, false);
+    for (const CTxMemPoolEntry *child : it->children) {
+        UpdateParent(mapTx.iterator_to(*child), it, false);
     }
 }
 
@@ -305,9 +313,9 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove,
     if (updateDescendants) {
         // updateDescendants should be true whenever we're not recursively
         // removing a tx and all its descendants, eg when a transaction is
-        // confirmed in a block. Here we only update statistics and not data in
-        // mapLinks (which we need to preserve until we're finished with all
-        // operations that need to traverse the mempool).
+        // confirmed in a block. Here we only update statistics and not the
+        // links between entries (which we need to preserve until we're
+        // finished with all operations that need to traverse the mempool).
         for (txiter removeIt : entriesToRemove) {
             setEntries setDescendants;
             CalculateDescendants(removeIt, setDescendants);
@@ -332,16 +340,16 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove,
         // should be a bit faster.
         // However, if we happen to be in the middle of processing a reorg, then
         // the mempool can be in an inconsistent state. In this case, the set of
-        // ancestors reachable via mapLinks will be the same as the set of
+        // ancestors reachable via the links will be the same as the set of
         // ancestors whose packages include this transaction, because when we
         // add a new transaction to the mempool in addUnchecked(), we assume it
         // has no children, and in the case of a reorg where that assumption is
         // false, the in-mempool children aren't linked to the in-block tx's
         // until UpdateTransactionsFromBlock() is called. So if we're being
         // called during a reorg, ie before UpdateTransactionsFromBlock() has
-        // been called, then mapLinks[] will differ from the set of mempool
+        // been called, then the links will differ from the set of mempool
         // parents we'd calculate by searching, and it's important that we use
-        // the mapLinks[] notion of ancestor transactions as the set of things
+        // the links' notion of ancestor transactions as the set of things
         // to update for removal.
         CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit,
                                   nNoLimit, nNoLimit, dummy, false);
@@ -380,7 +388,7 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, Amount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate &_minReasonableRelayFee)
-    : nTransactionsUpdated(0) {
+    : nTransactionsUpdated(0), nEpoch(0), fInEpoch(false) {
     // lock free clear
     _clear();
 
@@ -418,7 +426,6 @@ bool CTxMemPool::addUnchecked(const uint256 &hash, const CTxMemPoolEntry &entry,
     // Used by AcceptToMemoryPool(), which DOES do all the appropriate checks.
     LOCK(cs);
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
-    mapLinks.insert(make_pair(newit, TxLinks()));
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting into
@@ -490,9 +497,8 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason) {
 
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) +
-                        memusage::DynamicUsage(mapLinks[it].children);
-    mapLinks.erase(it);
+    cachedInnerUsage -= memusage::DynamicUsage(it->parents) +
+                        memusage::DynamicUsage(it->children);
     mapTx.erase(it);
     nTransactionsUpdated++;
     minerPolicyEstimator->removeTx(txid);
@@ -506,22 +512,26 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason) {
 // iterating over those entries.
 void CTxMemPool::CalculateDescendants(txiter entryit,
                                       setEntries &setDescendants) {
-    setEntries stage;
-    if (setDescendants.count(entryit) == 0) {
-        stage.insert(entryit);
+    AssertLockHeld(cs);
+    std::vector<txiter> stage;
+    if (setDescendants.insert(entryit).second) {
+        stage.push_back(entryit);
     }
     // Traverse down the children of entry, only adding children that are not
     // accounted for in setDescendants already (because those children have
     // either already been walked, or will be walked in this iteration).
+    const EpochGuard epoch(*this);
     while (!stage.empty()) {
-        txiter it = *stage.begin();
-        setDescendants.insert(it);
-        stage.erase(it);
-
-        const setEntries &setChildren = GetMemPoolChildren(it);
-        for (const txiter &childiter : setChildren) {
-            if (!setDescendants.count(childiter)) {
-                stage.insert(childiter);
+        txiter it = stage.back();
+        stage.pop_back();
+
+        for (const CTxMemPoolEntry *child : it->children) {
+            if (Visited(*child)) {
+                continue;
+            }
+            const txiter childiter = mapTx.iterator_to(*child);
+            if (setDescendants.insert(childiter).second) {
+                stage.push_back(childiter);
             }
         }
     }
@@ -665,7 +675,6 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef> &vtx,
 }
 
 void CTxMemPool::_clear() {
-    mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
     vTxHashes.clear();
@@ -682,6 +691,19 @@ void CTxMemPool::clear() {
     _clear();
 }
 
+//! The entries of mapTx the links point to.
+static CTxMemPool::setEntries
+GetLinkedEntries(const CTxMemPool::indexed_transaction_set &mapTx,
+                 const CTxMemPoolEntry::Links &links) {
+    CTxMemPool::setEntries setEntries;
+    for (const CTxMemPoolEntry *linked : links) {
+        setEntries.insert(mapTx.iterator_to(*linked));
+    }
+    // Links are unique.
+    assert(setEntries.size() == links.size());
+    return setEntries;
+}
+
 void CTxMemPool::check(const CCoinsViewCache *pcoins) const {
     if (nCheckFrequency == 0) {
         return;
@@ -709,11 +731,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const {
         checkTotal += it->GetTxSize();
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction &tx = it->GetTx();
-        txlinksMap::const_iterator linksiter = mapLinks.find(it);
-        assert(linksiter != mapLinks.end());
-        const TxLinks &links = linksiter->second;
-        innerUsage += memusage::DynamicUsage(links.parents) +
-                      memusage::DynamicUsage(links.children);
+        innerUsage += memusage::DynamicUsage(it->parents) +
+                      memusage::DynamicUsage(it->children);
         bool fDependsWait = false;
         setEntries setParentCheck;
         int64_t parentSizes = 0;
@@ -742,7 +761,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const {
             assert(it3->second == &tx);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
+        assert(setParentCheck == GetLinkedEntries(mapTx, it->parents));
         // Verify ancestor state is correct.
         setEntries setAncestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -779,7 +798,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const {
                 childSizes += childit->GetTxSize();
             }
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        assert(setChildrenCheck == GetLinkedEntries(mapTx, it->children));
         // Also check to make sure size is greater than sum with immediate
         // children. Just a sanity check, not definitive that this calc is
         // correct...
@@ -1088,7 +1107,6 @@ size_t CTxMemPool::DynamicMemoryUsage() const {
                mapTx.size() +
            memusage::DynamicUsage(mapNextTx) +
            memusage::DynamicUsage(mapDeltas) +
-           memusage::DynamicUsage(mapLinks) +
            memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
 }
 
@@ -1131,38 +1149,62 @@ bool CTxMemPool::addUnchecked(const uint256 &hash, const CTxMemPoolEntry &entry,
     return addUnchecked(hash, entry, setAncestors, validFeeEstimate);
 }
 
-void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add) {
-    setEntries s;
-    if (add && mapLinks[entry].children.insert(child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].children.erase(child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+/**
+ * Add or remove a link, keeping track of the memory used by the links. Their
+ * order does not matter.
+ */
+static size_t UpdateLinks(CTxMemPoolEntry::Links &links,
+                          const CTxMemPoolEntry *linked, bool add) {
+    CTxMemPoolEntry::Links::iterator it =
+        std::find(links.begin(), links.end(), linked);
+    if (add && it == links.end()) {
+        links.push_back(linked);
+    } else if (!add && it != links.end()) {
+        *it = links.back();
+        links.pop_back();
     }
+    return memusage::DynamicUsage(links);
+}
+
+void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add) {
+    cachedInnerUsage -= memusage::DynamicUsage(entry->children);
+    cachedInnerUsage += UpdateLinks(entry->children, &*child, add);
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add) {
-    setEntries s;
-    if (add && mapLinks[entry].parents.insert(parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
-    }
+    cachedInnerUsage -= memusage::DynamicUsage(entry->parents);
+    cachedInnerUsage += UpdateLinks(entry->parents, &*parent, add);
 }
 
-const CTxMemPool::setEntries &
+const CTxMemPoolEntry::Links &
 CTxMemPool::GetMemPoolParents(txiter entry) const {
     assert(entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.parents;
+    return entry->parents;
 }
 
-const CTxMemPool::setEntries &
+const CTxMemPoolEntry::Links &
 CTxMemPool::GetMemPoolChildren(txiter entry) const {
     assert(entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.children;
+    return entry->children;
+}
+
+CTxMemPool::EpochGuard::EpochGuard(const CTxMemPool &poolIn) : pool(poolIn) {
+    assert(!pool.fInEpoch);
+    pool.fInEpoch = true;
+    pool.nEpoch++;
+}
+
+CTxMemPool::EpochGuard::~EpochGuard() {
+    pool.fInEpoch = false;
+}
+
+bool CTxMemPool::Visited(const CTxMemPoolEntry &entry) const {
+    assert(fInEpoch);
+    if (entry.nEpoch == nEpoch) {
+        return true;
+    }
+    entry.nEpoch = nEpoch;
+    return false;
 }
 
 CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
@@ -9,6 +9,7 @@
 #include "amount.h"
 #include "coins.h"
 #include "indirectmap.h"
+#include "prevector.h"
 #include "primitives/transaction.h"
 #include "random.h"
 #include "sync.h"
@@ -80,7 +81,14 @@ class CTxMemPool;
  */
 
 class CTxMemPoolEntry {
+public:
+    //! In-mempool direct parents or children of an entry. Most transactions
+    //! have only a few, which are then stored inline.
+    typedef prevector<4, const CTxMemPoolEntry *> Links;
+
 private:
+    friend class CTxMemPool;
+
     CTransactionRef tx;
     //!< Cached to avoid expensive parent-transaction lookups
     Amount nFee;
@@ -177,6 +185,14 @@ public:
 
     //!< Index in mempool's vTxHashes
     mutable size_t vTxHashesIdx;
+
+private:
+    // Links to the entries of the in-mempool parents and children, maintained
+    // by CTxMemPool. Entries of mapTx are never moved, nor copied, once added.
+    mutable Links parents;
+    mutable Links children;
+    //!< Last traversal of the mempool graph which visited this entry
+    mutable uint64_t nEpoch;
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -418,8 +434,12 @@ public:
  *
  * In order for the feerate sort to remain correct, we must update transactions
  * in the mempool when new descendants arrive. To facilitate this, we track the
- * set of in-mempool direct parents and direct children in mapLinks. Within each
- * CTxMemPoolEntry, we track the size and fees of all descendants.
+ * in-mempool direct parents and direct children of each CTxMemPoolEntry, as
+ * links to their entries. Within each CTxMemPoolEntry, we also track the size
+ * and fees of all descendants.
+ *
+ * Walks of the graph mark the entries they visit with the epoch of the walk,
+ * instead of keeping the set of entries visited so far: see EpochGuard.
  *
  * Usually when a new transaction is added to the mempool, it has no in-mempool
  * children (because any such children would be an orphan). So in
@@ -451,7 +471,7 @@ public:
  * state, to account for in-mempool, out-of-block descendants for all the
  * in-block transactions by calling UpdateTransactionsFromBlock(). Note that
  * until this is called, the mempool state is not consistent, and in particular
- * mapLinks may not be correct (and therefore functions like
+ * the links between entries may not be correct (and therefore functions like
  * CalculateMemPoolAncestors() and CalculateDescendants() that rely on them to
  * walk the mempool are not generally safe to use).
  *
@@ -483,6 +503,10 @@ private:
     //! themselves)
     uint64_t cachedInnerUsage;
 
+    //!< Current traversal of the mempool graph, see CTxMemPoolEntry::nEpoch
+    mutable uint64_t nEpoch;
+    mutable bool fInEpoch;
+
     mutable int64_t lastRollingFeeUpdate;
     mutable bool blockSinceLastRollingFeeBump;
     //!< minimum fee to get into the pool, decreases exponentially
@@ -535,19 +559,28 @@ public:
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
 
-    const setEntries &GetMemPoolParents(txiter entry) const;
-    const setEntries &GetMemPoolChildren(txiter entry) const;
+    const CTxMemPoolEntry::Links &GetMemPoolParents(txiter entry) const;
+    const CTxMemPoolEntry::Links &GetMemPoolChildren(txiter entry) const;
 
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
-    struct TxLinks {
-        setEntries parents;
-        setEntries children;
+    /**
+     * Starts a new walk of the mempool graph, for the lifetime of the guard.
+     * Walks do not nest.
+     */
+    class EpochGuard {
+    public:
+        explicit EpochGuard(const CTxMemPool &poolIn);
+        ~EpochGuard();
+
+    private:
+        const CTxMemPool &pool;
     };
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
-    txlinksMap mapLinks;
+    //! Mark the entry as visited by the current walk. Returns whether it was
+    //! already.
+    bool Visited(const CTxMemPoolEntry &entry) const;
 
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
@@ -545,6 +545,57 @@ void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length) {
 #endif
 }
 
+/**
+ * Read length bytes at offset of file into data, without using or moving the
+ * position of the stream, so several threads can read the same file at once.
+ */
+bool FileReadAt(FILE *file, void *data, size_t length, uint64_t offset) {
+#ifdef WIN32
+    HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(file));
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD nRead;
+    return ReadFile(hFile, data, length, &nRead, &overlapped) &&
+           nRead == length;
+#else
+    uint8_t *p = (uint8_t *)data;
+    while (length > 0) {
+        ssize_t nRead = pread(fileno(file), p, length, offset);
+        if (nRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (nRead <= 0) {
+            return false;
+        }
+        p += nRead;
+        offset += nRead;
+        length -= nRead;
+    }
+    return true;
+#endif
+}
+
+/**
+ * Hint that a file will mostly be read sequentially, so the OS reads further
+ * ahead. It is advisory.
+ */
+void FileAdviseSequential(FILE *file) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+/**
+ * Hint that length bytes from offset of a file will be read soon, so the OS
+ * can start reading them in the background. It is advisory.
+ */
+void FileReadAhead(FILE *file, uint64_t offset, uint64_t length) {
+#if defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(fileno(file), offset, length, POSIX_FADV_WILLNEED);
+#endif
+}
+
 #ifdef WIN32
 fs::path GetSpecialFolderPath(int nFolder, bool fCreate) {
     char pszPath[MAX_PATH] = "";
@@ -642,3 +693,18 @@ std::string CopyrightHolders(const std::string &strPrefix) {
 int64_t GetStartupTime() {
     return nStartupTime;
 }
+
+static CCriticalSection cs_startupPhases;
+static std::vector<std::pair<std::string, int64_t>>
+    vStartupPhases GUARDED_BY(cs_startupPhases);
+
+void RecordStartupPhase(const std::string &strPhase, int64_t nTimeMicros) {
+    LogPrintf("Startup phase %s: %.2fms\n", strPhase, nTimeMicros * 0.001);
+    LOCK(cs_startupPhases);
+    vStartupPhases.emplace_back(strPhase, nTimeMicros);
+}
+
+std::vector<std::pair<std::string, int64_t>> GetStartupPhases() {
+    LOCK(cs_startupPhases);
+    return vStartupPhases;
+}
@@ -26,6 +26,7 @@
 #include <exception>
 #include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <boost/signals2/signal.hpp>
@@ -34,6 +35,14 @@
 // Application startup time (used for uptime calculation)
 int64_t GetStartupTime();
 
+/** Record how long a phase of the node startup took, and log it. */
+void RecordStartupPhase(const std::string &strPhase, int64_t nTimeMicros);
+/**
+ * The startup phases recorded so far, in the order they completed, with their
+ * duration in microseconds.
+ */
+std::vector<std::pair<std::string, int64_t>> GetStartupPhases();
+
 /** Signals for translation. */
 class CTranslationInterface {
 public:
@@ -69,6 +78,9 @@ void FileCommit(FILE *file);
 bool TruncateFile(FILE *file, unsigned int length);
 int RaiseFileDescriptorLimit(int nMinFD);
 void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length);
+bool FileReadAt(FILE *file, void *data, size_t length, uint64_t offset);
+void FileAdviseSequential(FILE *file);
+void FileReadAhead(FILE *file, uint64_t offset, uint64_t length);
 bool RenameOver(fs::path src, fs::path dest);
 bool TryCreateDirectories(const fs::path &p);
 fs::path GetDefaultDataDir();
@@ -7,15 +7,19 @@
 #include "validation.h"
 
 #include "arith_uint256.h"
+#include "blockcache.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinstats.h"
 #include "config.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
 #include "fs.h"
 #include "hash.h"
+#include "index/txindex.h"
 #include "init.h"
 #include "policy/fees.h"
 #include "policy/policy.h"
@@ -41,10 +45,13 @@
 #include "warnings.h"
 
 #include <atomic>
+#include <iterator>
 #include <sstream>
+#include <unordered_set>
 
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/math/distributions/poisson.hpp>
 #include <boost/range/adaptor/reversed.hpp>
@@ -67,7 +74,6 @@ CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
 bool fReindex = false;
-bool fTxIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
@@ -175,9 +181,13 @@ CBlockIndex *FindForkInGlobalIndex(const CChain &chain,
     return chain.Genesis();
 }
 
+CCoinsViewDB *pcoinsdbview = nullptr;
 CCoinsViewCache *pcoinsTip = nullptr;
 CBlockTreeDB *pblocktree = nullptr;
 
+/** Statistics of the UTXO set at the tip, if maintained (-utxosummary). */
+static std::unique_ptr<CUTXOSummary> pUTXOSummary;
+
 enum FlushStateMode {
     FLUSH_STATE_NONE,
     FLUSH_STATE_IF_NEEDED,
@@ -734,14 +744,71 @@ CheckInputsFromMempoolAndCache(const CTransaction &tx, CValidationState &state,
                        txdata);
 }
 
-static bool AcceptToMemoryPoolWorker(
-    const Config &config, CTxMemPool &pool, CValidationState &state,
-    const CTransactionRef &ptx, bool fLimitFree, bool *pfMissingInputs,
-    int64_t nAcceptTime, bool fOverrideMempoolLimit, const Amount nAbsurdFee,
-    std::vector<COutPoint> &coins_to_uncache) {
+namespace {
+
+/**
+ * A transaction on its way into the mempool. The pre-checks fill it in while
+ * holding cs_main, so that its scripts can then be checked without any lock
+ * and, for a batch, on the mempool check threads.
+ */
+struct MempoolAcceptWorkspace {
+    explicit MempoolAcceptWorkspace(const CTransactionRef &ptxIn)
+        : ptx(ptxIn), view(&dummy), txdata(*ptxIn) {}
+
+    const CTransactionRef ptx;
+    //! Holds the inputs once the backend is switched back to the dummy.
+    CCoinsView dummy;
+    CCoinsViewCache view;
+    std::unique_ptr<CTxMemPoolEntry> entry;
+    CTxMemPool::setEntries setAncestors;
+    //! The tip the pre-checks ran against.
+    const CBlockIndex *pindexTip = nullptr;
+    uint32_t extraFlags = SCRIPT_VERIFY_NONE;
+    uint32_t scriptVerifyFlags = SCRIPT_VERIFY_NONE;
+    uint32_t currentBlockScriptVerifyFlags = SCRIPT_VERIFY_NONE;
+    PrecomputedTransactionData txdata;
+    std::vector<COutPoint> coins_to_uncache;
+    //! Set once the script checks passed.
+    bool fScriptsOk = false;
+};
+
+} // namespace
+
+static bool CalculateMemPoolAncestorsWithLimits(const CTxMemPool &pool,
+                                                MempoolAcceptWorkspace &ws,
+                                                CValidationState &state) {
+    // Calculate in-mempool ancestors, up to a limit.
+    size_t nLimitAncestors =
+        gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    size_t nLimitAncestorSize =
+        gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+    size_t nLimitDescendants =
+        gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    size_t nLimitDescendantSize =
+        gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) *
+        1000;
+    std::string errString;
+    ws.setAncestors.clear();
+    if (!pool.CalculateMemPoolAncestors(
+            *ws.entry, ws.setAncestors, nLimitAncestors, nLimitAncestorSize,
+            nLimitDescendants, nLimitDescendantSize, errString)) {
+        return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain",
+                         false, errString);
+    }
+    return true;
+}
+
+/**
+ * Everything but the script checks and the insertion: policy, inputs, fees and
+ * ancestor limits.
+ */
+static bool PreChecks(const Config &config, CTxMemPool &pool,
+                      MempoolAcceptWorkspace &ws, CValidationState &state,
+                      bool fLimitFree, bool *pfMissingInputs,
+                      int64_t nAcceptTime, const Amount nAbsurdFee) {
     AssertLockHeld(cs_main);
 
-    const CTransaction &tx = *ptx;
+    const CTransaction &tx = *ws.ptx;
     const uint256 txid = tx.GetId();
     if (pfMissingInputs) {
         *pfMissingInputs = false;
@@ -795,298 +862,352 @@ static bool AcceptToMemoryPoolWorker(
         }
     }
 
+    CCoinsViewCache &view = ws.view;
+    std::vector<COutPoint> &coins_to_uncache = ws.coins_to_uncache;
+
+    Amount nValueIn(0);
+    LockPoints lp;
     {
-        CCoinsView dummy;
-        CCoinsViewCache view(&dummy);
+        LOCK(pool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+        view.SetBackend(viewMemPool);
+
+        // Do we already have it?
+        for (size_t out = 0; out < tx.vout.size(); out++) {
+            COutPoint outpoint(txid, out);
+            bool had_coin_in_cache = pcoinsTip->HaveCoinInCache(outpoint);
+            if (view.HaveCoin(outpoint)) {
+                if (!had_coin_in_cache) {
+                    coins_to_uncache.push_back(outpoint);
+                }
 
-        Amount nValueIn(0);
-        LockPoints lp;
-        {
-            LOCK(pool.cs);
-            CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
-            view.SetBackend(viewMemPool);
-
-            // Do we already have it?
-            for (size_t out = 0; out < tx.vout.size(); out++) {
-                COutPoint outpoint(txid, out);
-                bool had_coin_in_cache = pcoinsTip->HaveCoinInCache(outpoint);
-                if (view.HaveCoin(outpoint)) {
-                    if (!had_coin_in_cache) {
-                        coins_to_uncache.push_back(outpoint);
-                    }
+                return state.Invalid(false, REJECT_ALREADY_KNOWN,
+                                     "txn-already-known");
+            }
+        }
 
-                    return state.Invalid(false, REJECT_ALREADY_KNOWN,
-                                         "txn-already-known");
-                }
+        // Do all inputs exist?
+        for (const CTxIn txin : tx.vin) {
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                coins_to_uncache.push_back(txin.prevout);
             }
 
-            // Do all inputs exist?
-            for (const CTxIn txin : tx.vin) {
-                if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
-                    coins_to_uncache.push_back(txin.prevout);
+            if (!view.HaveCoin(txin.prevout)) {
+                if (pfMissingInputs) {
+                    *pfMissingInputs = true;
                 }
 
-                if (!view.HaveCoin(txin.prevout)) {
-                    if (pfMissingInputs) {
-                        *pfMissingInputs = true;
-                    }
-
-                    // fMissingInputs and !state.IsInvalid() is used to detect
-                    // this condition, don't set state.Invalid()
-                    return false;
-                }
+                // fMissingInputs and !state.IsInvalid() is used to detect
+                // this condition, don't set state.Invalid()
+                return false;
             }
+        }
 
-            // Are the actual inputs available?
-            if (!view.HaveInputs(tx)) {
-                return state.Invalid(false, REJECT_DUPLICATE,
-                                     "bad-txns-inputs-spent");
-            }
+        // Are the actual inputs available?
+        if (!view.HaveInputs(tx)) {
+            return state.Invalid(false, REJECT_DUPLICATE,
+                                 "bad-txns-inputs-spent");
+        }
 
-            // Bring the best block into scope.
-            view.GetBestBlock();
+        // Bring the best block into scope.
+        view.GetBestBlock();
 
-            nValueIn = view.GetValueIn(tx);
+        nValueIn = view.GetValueIn(tx);
 
-            // We have all inputs cached now, so switch back to dummy, so we
-            // don't need to keep lock on mempool.
-            view.SetBackend(dummy);
+        // We have all inputs cached now, so switch back to dummy, so we
+        // don't need to keep lock on mempool.
+        view.SetBackend(ws.dummy);
 
-            // Only accept BIP68 sequence locked transactions that can be mined
-            // in the next block; we don't want our mempool filled up with
-            // transactions that can't be mined yet. Must keep pool.cs for this
-            // unless we change CheckSequenceLocks to take a CoinsViewCache
-            // instead of create its own.
-            if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp)) {
-                return state.DoS(0, false, REJECT_NONSTANDARD,
-                                 "non-BIP68-final");
-            }
+        // Only accept BIP68 sequence locked transactions that can be mined
+        // in the next block; we don't want our mempool filled up with
+        // transactions that can't be mined yet. Must keep pool.cs for this
+        // unless we change CheckSequenceLocks to take a CoinsViewCache
+        // instead of create its own.
+        if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp)) {
+            return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
         }
+    }
 
-        // Check for non-standard pay-to-script-hash in inputs
-        if (fRequireStandard && !AreInputsStandard(tx, view)) {
-            return state.Invalid(false, REJECT_NONSTANDARD,
-                                 "bad-txns-nonstandard-inputs");
-        }
+    // Check for non-standard pay-to-script-hash in inputs
+    if (fRequireStandard && !AreInputsStandard(tx, view)) {
+        return state.Invalid(false, REJECT_NONSTANDARD,
+                             "bad-txns-nonstandard-inputs");
+    }
 
-        int64_t nSigOpsCount =
-            GetTransactionSigOpCount(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+    int64_t nSigOpsCount =
+        GetTransactionSigOpCount(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
 
-        Amount nValueOut = tx.GetValueOut();
-        Amount nFees = nValueIn - nValueOut;
-        // nModifiedFees includes any fee deltas from PrioritiseTransaction
-        Amount nModifiedFees = nFees;
-        double nPriorityDummy = 0;
-        pool.ApplyDeltas(txid, nPriorityDummy, nModifiedFees);
+    Amount nValueOut = tx.GetValueOut();
+    Amount nFees = nValueIn - nValueOut;
+    // nModifiedFees includes any fee deltas from PrioritiseTransaction
+    Amount nModifiedFees = nFees;
+    double nPriorityDummy = 0;
+    pool.ApplyDeltas(txid, nPriorityDummy, nModifiedFees);
 
-        Amount inChainInputValue;
-        double dPriority =
-            view.GetPriority(tx, chainActive.Height(), inChainInputValue);
+    Amount inChainInputValue;
+    double dPriority =
+        view.GetPriority(tx, chainActive.Height(), inChainInputValue);
 
-        // Keep track of transactions that spend a coinbase, which we re-scan
-        // during reorgs to ensure COINBASE_MATURITY is still met.
-        bool fSpendsCoinbase = false;
-        for (const CTxIn &txin : tx.vin) {
-            const Coin &coin = view.AccessCoin(txin.prevout);
-            if (coin.IsCoinBase()) {
-                fSpendsCoinbase = true;
-                break;
-            }
+    // Keep track of transactions that spend a coinbase, which we re-scan
+    // during reorgs to ensure COINBASE_MATURITY is still met.
+    bool fSpendsCoinbase = false;
+    for (const CTxIn &txin : tx.vin) {
+        const Coin &coin = view.AccessCoin(txin.prevout);
+        if (coin.IsCoinBase()) {
+            fSpendsCoinbase = true;
+            break;
         }
+    }
 
-        CTxMemPoolEntry entry(ptx, nFees, nAcceptTime, dPriority,
-                              chainActive.Height(), inChainInputValue,
-                              fSpendsCoinbase, nSigOpsCount, lp);
-        unsigned int nSize = entry.GetTxSize();
-
-        // Check that the transaction doesn't have an excessive number of
-        // sigops, making it impossible to mine. Since the coinbase transaction
-        // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
-        // MAX_BLOCK_SIGOPS_PER_MB; we still consider this an invalid rather
-        // than merely non-standard transaction.
-        if (nSigOpsCount > MAX_STANDARD_TX_SIGOPS) {
-            return state.DoS(0, false, REJECT_NONSTANDARD,
-                             "bad-txns-too-many-sigops", false,
-                             strprintf("%d", nSigOpsCount));
-        }
-
-        Amount mempoolRejectFee =
-            pool.GetMinFee(
-                    gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) *
-                    1000000)
-                .GetFee(nSize);
-        if (mempoolRejectFee > Amount(0) && nModifiedFees < mempoolRejectFee) {
+    ws.entry.reset(new CTxMemPoolEntry(
+        ws.ptx, nFees, nAcceptTime, dPriority, chainActive.Height(),
+        inChainInputValue, fSpendsCoinbase, nSigOpsCount, lp));
+    const CTxMemPoolEntry &entry = *ws.entry;
+    unsigned int nSize = entry.GetTxSize();
+
+    // Check that the transaction doesn't have an excessive number of
+    // sigops, making it impossible to mine. Since the coinbase transaction
+    // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
+    // MAX_BLOCK_SIGOPS_PER_MB; we still consider this an invalid rather
+    // than merely non-standard transaction.
+    if (nSigOpsCount > MAX_STANDARD_TX_SIGOPS) {
+        return state.DoS(0, false, REJECT_NONSTANDARD,
+                         "bad-txns-too-many-sigops", false,
+                         strprintf("%d", nSigOpsCount));
+    }
+
+    Amount mempoolRejectFee =
+        pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) *
+                       1000000)
+            .GetFee(nSize);
+    if (mempoolRejectFee > Amount(0) && nModifiedFees < mempoolRejectFee) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE,
+                         "mempool min fee not met", false,
+                         strprintf("%d < %d", nFees, mempoolRejectFee));
+    }
+
+    if (gArgs.GetBoolArg("-relaypriority", DEFAULT_RELAYPRIORITY) &&
+        nModifiedFees < ::minRelayTxFee.GetFee(nSize) &&
+        !AllowFree(entry.GetPriority(chainActive.Height() + 1))) {
+        // Require that free transactions have sufficient priority to be
+        // mined in the next block.
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE,
+                         "insufficient priority");
+    }
+
+    // Continuously rate-limit free (really, very-low-fee) transactions.
+    // This mitigates 'penny-flooding' -- sending thousands of free
+    // transactions just to be annoying or make others' transactions take
+    // longer to confirm.
+    if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
+        static CCriticalSection csFreeLimiter;
+        static double dFreeCount;
+        static int64_t nLastTime;
+        int64_t nNow = GetTime();
+
+        LOCK(csFreeLimiter);
+
+        // Use an exponentially decaying ~10-minute window:
+        dFreeCount *= pow(1.0 - 1.0 / 600.0, double(nNow - nLastTime));
+        nLastTime = nNow;
+        // -limitfreerelay unit is thousand-bytes-per-minute
+        // At default rate it would take over a month to fill 1GB
+        if (dFreeCount + nSize >=
+            gArgs.GetArg("-limitfreerelay", DEFAULT_LIMITFREERELAY) * 10 *
+                1000) {
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE,
-                             "mempool min fee not met", false,
-                             strprintf("%d < %d", nFees, mempoolRejectFee));
+                             "rate limited free transaction");
         }
 
-        if (gArgs.GetBoolArg("-relaypriority", DEFAULT_RELAYPRIORITY) &&
-            nModifiedFees < ::minRelayTxFee.GetFee(nSize) &&
-            !AllowFree(entry.GetPriority(chainActive.Height() + 1))) {
-            // Require that free transactions have sufficient priority to be
-            // mined in the next block.
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE,
-                             "insufficient priority");
-        }
-
-        // Continuously rate-limit free (really, very-low-fee) transactions.
-        // This mitigates 'penny-flooding' -- sending thousands of free
-        // transactions just to be annoying or make others' transactions take
-        // longer to confirm.
-        if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
-            static CCriticalSection csFreeLimiter;
-            static double dFreeCount;
-            static int64_t nLastTime;
-            int64_t nNow = GetTime();
-
-            LOCK(csFreeLimiter);
-
-            // Use an exponentially decaying ~10-minute window:
-            dFreeCount *= pow(1.0 - 1.0 / 600.0, double(nNow - nLastTime));
-            nLastTime = nNow;
-            // -limitfreerelay unit is thousand-bytes-per-minute
-            // At default rate it would take over a month to fill 1GB
-            if (dFreeCount + nSize >=
-                gArgs.GetArg("-limitfreerelay", DEFAULT_LIMITFREERELAY) * 10 *
-                    1000) {
-                return state.DoS(0, false, REJECT_INSUFFICIENTFEE,
-                                 "rate limited free transaction");
-            }
+        LogPrint(BCLog::MEMPOOL, "Rate limit dFreeCount: %g => %g\n",
+                 dFreeCount, dFreeCount + nSize);
+        dFreeCount += nSize;
+    }
 
-            LogPrint(BCLog::MEMPOOL, "Rate limit dFreeCount: %g => %g\n",
-                     dFreeCount, dFreeCount + nSize);
-            dFreeCount += nSize;
-        }
+    if (nAbsurdFee != Amount(0) && nFees > nAbsurdFee) {
+        return state.Invalid(false, REJECT_HIGHFEE, "absurdly-high-fee",
+                             strprintf("%d > %d", nFees, nAbsurdFee));
+    }
 
-        if (nAbsurdFee != Amount(0) && nFees > nAbsurdFee) {
-            return state.Invalid(false, REJECT_HIGHFEE, "absurdly-high-fee",
-                                 strprintf("%d > %d", nFees, nAbsurdFee));
-        }
+    if (!CalculateMemPoolAncestorsWithLimits(pool, ws, state)) {
+        return false;
+    }
 
-        // Calculate in-mempool ancestors, up to a limit.
-        CTxMemPool::setEntries setAncestors;
-        size_t nLimitAncestors =
-            gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
-        size_t nLimitAncestorSize =
-            gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) *
-            1000;
-        size_t nLimitDescendants =
-            gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
-        size_t nLimitDescendantSize =
-            gArgs.GetArg("-limitdescendantsize",
-                         DEFAULT_DESCENDANT_SIZE_LIMIT) *
-            1000;
-        std::string errString;
-        if (!pool.CalculateMemPoolAncestors(
-                entry, setAncestors, nLimitAncestors, nLimitAncestorSize,
-                nLimitDescendants, nLimitDescendantSize, errString)) {
-            return state.DoS(0, false, REJECT_NONSTANDARD,
-                             "too-long-mempool-chain", false, errString);
-        }
+    // Set extraFlags as a set of flags that needs to be activated.
+    ws.extraFlags = SCRIPT_VERIFY_NONE;
+    if (hasMonolith) {
+        ws.extraFlags |= SCRIPT_ENABLE_MONOLITH_OPCODES;
+    }
+
+    if (IsReplayProtectionEnabledForCurrentBlock(config)) {
+        ws.extraFlags |= SCRIPT_ENABLE_REPLAY_PROTECTION;
+    }
+
+    // Check inputs based on the set of flags we activate.
+    ws.scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!config.GetChainParams().RequireStandard()) {
+        ws.scriptVerifyFlags =
+            SCRIPT_ENABLE_SIGHASH_FORKID |
+            gArgs.GetArg("-promiscuousmempoolflags", ws.scriptVerifyFlags);
+    }
+
+    // Make sure whatever we need to activate is actually activated.
+    ws.scriptVerifyFlags |= ws.extraFlags;
+
+    ws.currentBlockScriptVerifyFlags =
+        GetBlockScriptFlags(config, chainActive.Tip());
+    ws.pindexTip = chainActive.Tip();
+    return true;
+}
+
+/**
+ * Check the scripts against the standard flags. This only reads the workspace
+ * and the signature and script caches, which have their own locks, so it does
+ * not need cs_main.
+ */
+static bool ScriptChecks(MempoolAcceptWorkspace &ws, CValidationState &state) {
+    const CTransaction &tx = *ws.ptx;
+
+    // Check against previous transactions. This is done last to help
+    // prevent CPU exhaustion denial-of-service attacks.
+    if (!CheckInputs(tx, state, ws.view, true, ws.scriptVerifyFlags, true,
+                     false, ws.txdata)) {
+        // State filled in by CheckInputs.
+        return false;
+    }
 
-        // Set extraFlags as a set of flags that needs to be activated.
-        uint32_t extraFlags = SCRIPT_VERIFY_NONE;
-        if (hasMonolith) {
-            extraFlags |= SCRIPT_ENABLE_MONOLITH_OPCODES;
+    // Run the scripts against the current block flags too, so that the check
+    // done under the lock in FinalizeAccept is a script cache hit. A failure
+    // here is dealt with there.
+    CValidationState stateDummy;
+    CheckInputs(tx, stateDummy, ws.view, true,
+                ws.currentBlockScriptVerifyFlags, true, true, ws.txdata);
+    return true;
+}
+
+/**
+ * Add a transaction which passed the pre-checks and the script checks to the
+ * mempool. If fRevalidate is set, the mempool may have changed since the
+ * pre-checks, so conflicts, inputs and ancestors are checked again.
+ */
+static bool FinalizeAccept(CTxMemPool &pool, MempoolAcceptWorkspace &ws,
+                           CValidationState &state, bool fOverrideMempoolLimit,
+                           bool fRevalidate) {
+    AssertLockHeld(cs_main);
+
+    const CTransaction &tx = *ws.ptx;
+    const uint256 txid = tx.GetId();
+
+    if (fRevalidate) {
+        assert(ws.pindexTip == chainActive.Tip());
+        if (pool.exists(txid)) {
+            return state.Invalid(false, REJECT_ALREADY_KNOWN,
+                                 "txn-already-in-mempool");
         }
 
-        if (IsReplayProtectionEnabledForCurrentBlock(config)) {
-            extraFlags |= SCRIPT_ENABLE_REPLAY_PROTECTION;
+        LOCK(pool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+        for (const CTxIn &txin : tx.vin) {
+            if (pool.mapNextTx.count(txin.prevout)) {
+                return state.Invalid(false, REJECT_CONFLICT,
+                                     "txn-mempool-conflict");
+            }
+            // A parent may have left the mempool in the meantime.
+            if (!viewMemPool.HaveCoin(txin.prevout)) {
+                return state.Invalid(false, REJECT_DUPLICATE,
+                                     "bad-txns-inputs-spent");
+            }
         }
 
-        // Check inputs based on the set of flags we activate.
-        uint32_t scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
-        if (!config.GetChainParams().RequireStandard()) {
-            scriptVerifyFlags =
-                SCRIPT_ENABLE_SIGHASH_FORKID |
-                gArgs.GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+        if (!CalculateMemPoolAncestorsWithLimits(pool, ws, state)) {
+            return false;
         }
+    }
 
-        // Make sure whatever we need to activate is actually activated.
-        scriptVerifyFlags |= extraFlags;
+    // Check again against the current block tip's script verification flags
+    // to cache our script execution flags. This is, of course, useless if
+    // the next block has different script flags from the previous one, but
+    // because the cache tracks script flags for us it will auto-invalidate
+    // and we'll just have a few blocks of extra misses on soft-fork
+    // activation.
+    //
+    // This is also useful in case of bugs in the standard flags that cause
+    // transactions to pass as valid when they're actually invalid. For
+    // instance the STRICTENC flag was incorrectly allowing certain CHECKSIG
+    // NOT scripts to pass, even though they were invalid.
+    //
+    // There is a similar check in CreateNewBlock() to prevent creating
+    // invalid blocks (using TestBlockValidity), however allowing such
+    // transactions into the mempool can be exploited as a DoS attack.
+    if (!CheckInputsFromMempoolAndCache(tx, state, ws.view, pool,
+                                        ws.currentBlockScriptVerifyFlags, true,
+                                        ws.txdata)) {
+        // If we're using promiscuousmempoolflags, we may hit this normally.
+        // Check if current block has some flags that scriptVerifyFlags does
+        // not before printing an ominous warning.
+        if (!(~ws.scriptVerifyFlags & ws.currentBlockScriptVerifyFlags)) {
+            return error(
+                "%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against "
+                "MANDATORY but not STANDARD flags %s, %s",
+                __func__, txid.ToString(), FormatStateMessage(state));
+        }
 
-        // Check against previous transactions. This is done last to help
-        // prevent CPU exhaustion denial-of-service attacks.
-        PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false,
-                         txdata)) {
-            // State filled in by CheckInputs.
-            return false;
+        if (!CheckInputs(tx, state, ws.view, true,
+                         MANDATORY_SCRIPT_VERIFY_FLAGS | ws.extraFlags, true,
+                         false, ws.txdata)) {
+            return error(
+                "%s: ConnectInputs failed against MANDATORY but not "
+                "STANDARD flags due to promiscuous mempool %s, %s",
+                __func__, txid.ToString(), FormatStateMessage(state));
         }
 
-        // Check again against the current block tip's script verification flags
-        // to cache our script execution flags. This is, of course, useless if
-        // the next block has different script flags from the previous one, but
-        // because the cache tracks script flags for us it will auto-invalidate
-        // and we'll just have a few blocks of extra misses on soft-fork
-        // activation.
-        //
-        // This is also useful in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain CHECKSIG
-        // NOT scripts to pass, even though they were invalid.
-        //
-        // There is a similar check in CreateNewBlock() to prevent creating
-        // invalid blocks (using TestBlockValidity), however allowing such
-        // transactions into the mempool can be exploited as a DoS attack.
-        uint32_t currentBlockScriptVerifyFlags =
-            GetBlockScriptFlags(config, chainActive.Tip());
-
-        if (!CheckInputsFromMempoolAndCache(tx, state, view, pool,
-                                            currentBlockScriptVerifyFlags, true,
-                                            txdata)) {
-            // If we're using promiscuousmempoolflags, we may hit this normally.
-            // Check if current block has some flags that scriptVerifyFlags does
-            // not before printing an ominous warning.
-            if (!(~scriptVerifyFlags & currentBlockScriptVerifyFlags)) {
-                return error(
-                    "%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against "
-                    "MANDATORY but not STANDARD flags %s, %s",
-                    __func__, txid.ToString(), FormatStateMessage(state));
-            }
+        LogPrintf("Warning: -promiscuousmempool flags set to not include "
+                  "currently enforced soft forks, this may break mining or "
+                  "otherwise cause instability!\n");
+    }
 
-            if (!CheckInputs(tx, state, view, true,
-                             MANDATORY_SCRIPT_VERIFY_FLAGS | extraFlags, true,
-                             false, txdata)) {
-                return error(
-                    "%s: ConnectInputs failed against MANDATORY but not "
-                    "STANDARD flags due to promiscuous mempool %s, %s",
-                    __func__, txid.ToString(), FormatStateMessage(state));
-            }
+    // This transaction should only count for fee estimation if
+    // the node is not behind and it is not dependent on any other
+    // transactions in the mempool.
+    bool validForFeeEstimation =
+        IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
 
-            LogPrintf("Warning: -promiscuousmempool flags set to not include "
-                      "currently enforced soft forks, this may break mining or "
-                      "otherwise cause instability!\n");
-        }
-
-        // This transaction should only count for fee estimation if
-        // the node is not behind and it is not dependent on any other
-        // transactions in the mempool.
-        bool validForFeeEstimation =
-            IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
-
-        // Store transaction in memory.
-        pool.addUnchecked(txid, entry, setAncestors, validForFeeEstimation);
-
-        // Trim mempool and check if tx was trimmed.
-        if (!fOverrideMempoolLimit) {
-            LimitMempoolSize(
-                pool,
-                gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000,
-                gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 *
-                    60);
-            if (!pool.exists(txid)) {
-                return state.DoS(0, false, REJECT_INSUFFICIENTFEE,
-                                 "mempool full");
-            }
+    // Store transaction in memory.
+    pool.addUnchecked(txid, *ws.entry, ws.setAncestors, validForFeeEstimation);
+
+    // Trim mempool and check if tx was trimmed.
+    if (!fOverrideMempoolLimit) {
+        LimitMempoolSize(
+            pool,
+            gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000,
+            gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(txid)) {
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
         }
     }
 
-    GetMainSignals().TransactionAddedToMempool(ptx);
+    GetMainSignals().TransactionAddedToMempool(ws.ptx);
     return true;
 }
 
+static bool AcceptToMemoryPoolWorker(
+    const Config &config, CTxMemPool &pool, CValidationState &state,
+    const CTransactionRef &ptx, bool fLimitFree, bool *pfMissingInputs,
+    int64_t nAcceptTime, bool fOverrideMempoolLimit, const Amount nAbsurdFee,
+    std::vector<COutPoint> &coins_to_uncache) {
+    AssertLockHeld(cs_main);
+
+    MempoolAcceptWorkspace ws(ptx);
+    bool res = PreChecks(config, pool, ws, state, fLimitFree, pfMissingInputs,
+                         nAcceptTime, nAbsurdFee) &&
+               ScriptChecks(ws, state) &&
+               FinalizeAccept(pool, ws, state, fOverrideMempoolLimit, false);
+    coins_to_uncache.insert(coins_to_uncache.end(),
+                            ws.coins_to_uncache.begin(),
+                            ws.coins_to_uncache.end());
+    return res;
+}
+
 /**
  * (try to) add transaction to memory pool with a specified acceptance time.
  */
@@ -1123,6 +1244,147 @@ bool AcceptToMemoryPool(const Config &config, CTxMemPool &pool,
                                       fOverrideMempoolLimit, nAbsurdFee);
 }
 
+namespace {
+
+/** Runs the script checks of one transaction of a batch. */
+class CMempoolAcceptCheck {
+private:
+    MempoolAcceptWorkspace *pws;
+    CValidationState *pstate;
+
+public:
+    CMempoolAcceptCheck() : pws(nullptr), pstate(nullptr) {}
+    CMempoolAcceptCheck(MempoolAcceptWorkspace *pwsIn,
+                        CValidationState *pstateIn)
+        : pws(pwsIn), pstate(pstateIn) {}
+
+    //! The result is recorded in the workspace, so that one invalid
+    //! transaction does not cut the checks of the others short.
+    bool operator()() {
+        pws->fScriptsOk = ScriptChecks(*pws, *pstate);
+        return true;
+    }
+
+    void swap(CMempoolAcceptCheck &check) {
+        std::swap(pws, check.pws);
+        std::swap(pstate, check.pstate);
+    }
+};
+
+} // namespace
+
+/**
+ * Every check is a whole transaction, so hand them out one at a time. The
+ * queue only has one master at a time, which cs_mempoolcheckqueue enforces.
+ */
+static const unsigned int MEMPOOL_CHECK_BATCH_SIZE = 1;
+
+static CCriticalSection cs_mempoolcheckqueue;
+static std::unique_ptr<CCheckQueueBase<CMempoolAcceptCheck>>
+    mempoolcheckqueue = MakeCheckQueue<CMempoolAcceptCheck>(
+        CheckQueueEngine::WORKSTEALING, MEMPOOL_CHECK_BATCH_SIZE);
+
+void ThreadMempoolCheck() {
+    RenameThread("bitcoin-mempoolch");
+    mempoolcheckqueue->Thread();
+}
+
+std::vector<MempoolAcceptResult>
+AcceptToMemoryPoolBatch(const Config &config, CTxMemPool &pool,
+                        const std::vector<CTransactionRef> &vtx,
+                        bool fLimitFree) {
+    std::vector<MempoolAcceptResult> results(vtx.size());
+    std::vector<std::unique_ptr<MempoolAcceptWorkspace>> workspaces(
+        vtx.size());
+    const int64_t nAcceptTime = GetTime();
+
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < vtx.size(); i++) {
+            std::unique_ptr<MempoolAcceptWorkspace> ws(
+                new MempoolAcceptWorkspace(vtx[i]));
+            if (PreChecks(config, pool, *ws, results[i].state, fLimitFree,
+                          &results[i].fMissingInputs, nAcceptTime,
+                          Amount(0))) {
+                workspaces[i] = std::move(ws);
+                continue;
+            }
+            for (const COutPoint &outpoint : ws->coins_to_uncache) {
+                pcoinsTip->Uncache(outpoint);
+            }
+        }
+    }
+
+    // The expensive part, without holding cs_main.
+    std::vector<CMempoolAcceptCheck> vChecks;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (workspaces[i]) {
+            vChecks.emplace_back(workspaces[i].get(), &results[i].state);
+        }
+    }
+    if (nScriptCheckThreads && vChecks.size() > 1) {
+        LOCK(cs_mempoolcheckqueue);
+        CCheckQueueControl<CMempoolAcceptCheck> control(
+            mempoolcheckqueue.get());
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (CMempoolAcceptCheck &check : vChecks) {
+            check();
+        }
+    }
+
+    LOCK(cs_main);
+    std::set<uint256> setAccepted;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        MempoolAcceptResult &result = results[i];
+        MempoolAcceptWorkspace *ws = workspaces[i].get();
+        std::vector<COutPoint> coins_to_uncache;
+        if (ws && !ws->fScriptsOk) {
+            coins_to_uncache = ws->coins_to_uncache;
+        } else if (ws && ws->pindexTip == chainActive.Tip()) {
+            result.fAccepted = FinalizeAccept(pool, *ws, result.state, false,
+                                              true);
+            coins_to_uncache = ws->coins_to_uncache;
+        } else if (ws || (result.fMissingInputs &&
+                          std::any_of(vtx[i]->vin.begin(), vtx[i]->vin.end(),
+                                      [&](const CTxIn &txin) {
+                                          return setAccepted.count(
+                                              txin.prevout.hash);
+                                      }))) {
+            // Either the tip moved since the pre-checks, or this transaction
+            // spends an earlier one of the batch: start over. The scripts
+            // which were already checked are cache hits, and a transaction
+            // which passed the pre-checks is already counted by the free
+            // transaction rate limiter. The coins the pre-checks brought into
+            // the cache are cached already for the retry, which does not list
+            // them again.
+            if (ws) {
+                coins_to_uncache = ws->coins_to_uncache;
+            }
+            result.state = CValidationState();
+            result.fAccepted = AcceptToMemoryPoolWorker(
+                config, pool, result.state, vtx[i], fLimitFree && !ws,
+                &result.fMissingInputs, nAcceptTime, false, Amount(0),
+                coins_to_uncache);
+        }
+
+        if (result.fAccepted) {
+            setAccepted.insert(vtx[i]->GetId());
+            continue;
+        }
+        for (const COutPoint &outpoint : coins_to_uncache) {
+            pcoinsTip->Uncache(outpoint);
+        }
+    }
+
+    // After we've (potentially) uncached entries, ensure our coins cache is
+    // still within its size limits
+    CValidationState stateDummy;
+    FlushStateToDisk(config.GetChainParams(), stateDummy, FLUSH_STATE_PERIODIC);
+    return results;
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is
  * placed in hashBlock */
 bool GetTransaction(const Config &config, const uint256 &txid,
@@ -1130,6 +1392,12 @@ bool GetTransaction(const Config &config, const uint256 &txid,
                     bool fAllowSlow) {
     CBlockIndex *pindexSlow = nullptr;
 
+    // The index is updated in the background: let it catch up with the blocks
+    // connected so far.
+    if (g_txindex) {
+        g_txindex->BlockUntilSyncedToCurrentChain();
+    }
+
     LOCK(cs_main);
 
     CTransactionRef ptx = mempool.get(txid);
@@ -1138,27 +1406,8 @@ bool GetTransaction(const Config &config, const uint256 &txid,
         return true;
     }
 
-    if (fTxIndex) {
-        CDiskTxPos postx;
-        if (pblocktree->ReadTxIndex(txid, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK,
-                           CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
-            CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception &e) {
-                return error("%s: Deserialize or I/O error - %s", __func__,
-                             e.what());
-            }
-            hashBlock = header.GetHash();
-            if (txOut->GetId() != txid)
-                return error("%s: txid mismatch", __func__);
-            return true;
-        }
+    if (g_txindex && g_txindex->FindTx(txid, hashBlock, txOut)) {
+        return true;
     }
 
     // use coin database to locate block that contains transaction, and scan it
@@ -1214,20 +1463,25 @@ static bool WriteBlockToDisk(const CBlock &block, CDiskBlockPos &pos,
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock &block, const CDiskBlockPos &pos,
-                       const Config &config) {
-    block.SetNull();
-
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s",
-                     pos.ToString());
+/**
+ * Read length bytes at pos of the block files, through the pool of open files
+ * if there is one.
+ */
+static bool ReadBlockFileAt(const CDiskBlockPos &pos, void *data,
+                            size_t length) {
+    if (g_blockfilepool) {
+        return g_blockfilepool->Read(pos, data, length);
     }
 
-    // Read block
+    CAutoFile file(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    return !file.IsNull() && FileReadAt(file.Get(), data, length, pos.nPos);
+}
+
+/** Deserialize a block read from disk and check its header. */
+static bool DeserializeBlock(CBlock &block, const std::vector<uint8_t> &raw,
+                             const CDiskBlockPos &pos, const Config &config) {
     try {
-        filein >> block;
+        VectorReader(SER_DISK, CLIENT_VERSION, raw, 0) >> block;
     } catch (const std::exception &e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__,
                      e.what(), pos.ToString());
@@ -1242,16 +1496,93 @@ bool ReadBlockFromDisk(CBlock &block, const CDiskBlockPos &pos,
     return true;
 }
 
+RawBlockRef ReadRawBlock(const uint256 &hash, const CDiskBlockPos &pos,
+                         const Config &config) {
+    if (g_rawblockcache) {
+        RawBlockRef cached = g_rawblockcache->Get(hash);
+        if (cached) {
+            return cached;
+        }
+    }
+
+    std::vector<uint8_t> block;
+    if (!ReadRawBlockFromDisk(block, pos, config)) {
+        return nullptr;
+    }
+
+    // The header comes first, so checking its hash is enough to know the
+    // block is the one we expect.
+    if (Hash(block.begin(), block.begin() + 80) != hash) {
+        error("ReadRawBlock: hash doesn't match index for %s at %s",
+              hash.ToString(), pos.ToString());
+        return nullptr;
+    }
+
+    auto raw = std::make_shared<const std::vector<uint8_t>>(std::move(block));
+    if (g_rawblockcache) {
+        g_rawblockcache->Add(hash, raw);
+    }
+    return raw;
+}
+
+RawBlockRef ReadRawBlock(const CBlockIndex *pindex, const Config &config) {
+    return ReadRawBlock(pindex->GetBlockHash(), pindex->GetBlockPos(), config);
+}
+
+bool ReadBlockFromDisk(CBlock &block, const CDiskBlockPos &pos,
+                       const Config &config) {
+    block.SetNull();
+
+    std::vector<uint8_t> raw;
+    return ReadRawBlockFromDisk(raw, pos, config) &&
+           DeserializeBlock(block, raw, pos, config);
+}
+
+bool ReadBlockFromDisk(CBlock &block, const uint256 &hash,
+                       const CDiskBlockPos &pos, const Config &config) {
+    block.SetNull();
+
+    RawBlockRef raw = ReadRawBlock(hash, pos, config);
+    return raw && DeserializeBlock(block, *raw, pos, config);
+}
+
 bool ReadBlockFromDisk(CBlock &block, const CBlockIndex *pindex,
                        const Config &config) {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), config)) {
-        return false;
+    return ReadBlockFromDisk(block, pindex->GetBlockHash(),
+                             pindex->GetBlockPos(), config);
+}
+
+bool ReadRawBlockFromDisk(std::vector<uint8_t> &block, const CDiskBlockPos &pos,
+                          const Config &config) {
+    block.clear();
+
+    // Read the index header of the block, then the block as it was serialized
+    uint8_t header[CMessageHeader::MESSAGE_START_SIZE + 4];
+    if (pos.nPos < sizeof(header) ||
+        !ReadBlockFileAt(CDiskBlockPos(pos.nFile, pos.nPos - sizeof(header)),
+                         header, sizeof(header))) {
+        return error("ReadRawBlockFromDisk: failed to read index header for "
+                     "%s",
+                     pos.ToString());
+    }
+    if (memcmp(header, config.GetChainParams().DiskMagic().data(),
+               CMessageHeader::MESSAGE_START_SIZE) != 0) {
+        return error("ReadRawBlockFromDisk: Block magic mismatch at %s",
+                     pos.ToString());
+    }
+    // Blocks accepted under a larger -excessiveblocksize than the current one
+    // are still on disk, so only the serialization limit applies. Reading
+    // past the end of the file fails below.
+    uint32_t nSize = ReadLE32(header + CMessageHeader::MESSAGE_START_SIZE);
+    if (nSize < 80 || nSize > MAX_SIZE) {
+        return error("ReadRawBlockFromDisk: Bad block size %u at %s", nSize,
+                     pos.ToString());
     }
 
-    if (block.GetHash() != pindex->GetBlockHash()) {
-        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() "
-                     "doesn't match index for %s at %s",
-                     pindex->ToString(), pindex->GetBlockPos().ToString());
+    block.resize(nSize);
+    if (!ReadBlockFileAt(pos, block.data(), nSize)) {
+        return error("ReadRawBlockFromDisk: failed to read %u bytes at %s",
+                     nSize, pos.ToString());
     }
 
     return true;
@@ -1691,6 +2022,15 @@ bool AbortNode(CValidationState &state, const std::string &strMessage,
 
 } // namespace
 
+bool ReadBlockUndoFromDisk(CBlockUndo &blockundo, const CBlockIndex *pindex) {
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull()) {
+        return error("%s: no undo data available for block %s", __func__,
+                     pindex->GetBlockHash().ToString());
+    }
+    return UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash());
+}
+
 /** Restore the UTXO in a Coin at a given COutPoint. */
 DisconnectResult UndoCoinSpend(const Coin &undo, CCoinsViewCache &view,
                                const COutPoint &out) {
@@ -1728,13 +2068,36 @@ DisconnectResult UndoCoinSpend(const Coin &undo, CCoinsViewCache &view,
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
+/**
+ * Apply the connection or disconnection of a block to the UTXO set summary, if
+ * it is maintained. A summary that does not match the block is dropped.
+ */
+static void UpdateUTXOSummary(
+    const CBlock &block, const CBlockUndo &blockundo, const CBlockIndex *pindex,
+    bool fConnect,
+    const std::vector<std::pair<COutPoint, Coin>> &vOverwritten = {}) {
+    if (!pUTXOSummary) {
+        return;
+    }
+    if (fConnect ? !pUTXOSummary->ConnectBlock(block, blockundo,
+                                               pindex->nHeight, vOverwritten)
+                 : !pUTXOSummary->DisconnectBlock(block, blockundo)) {
+        LogPrintf("UTXO set summary out of sync at block %s, dropping it\n",
+                  pindex->GetBlockHash().ToString());
+        pUTXOSummary.reset();
+    }
+}
+
 /**
  * Undo the effects of this block (with given index) on the UTXO set represented
  * by coins. When FAILED is returned, view is left in an indeterminate state.
+ * If fUpdateUTXOSummary is set, view is the chain tip and the UTXO set summary
+ * is updated as well.
  */
 static DisconnectResult DisconnectBlock(const CBlock &block,
                                         const CBlockIndex *pindex,
-                                        CCoinsViewCache &view) {
+                                        CCoinsViewCache &view,
+                                        bool fUpdateUTXOSummary = false) {
     CBlockUndo blockUndo;
     CDiskBlockPos pos = pindex->GetUndoPos();
     if (pos.IsNull()) {
@@ -1747,7 +2110,11 @@ static DisconnectResult DisconnectBlock(const CBlock &block,
         return DISCONNECT_FAILED;
     }
 
-    return ApplyBlockUndo(blockUndo, block, pindex, view);
+    DisconnectResult res = ApplyBlockUndo(blockUndo, block, pindex, view);
+    if (res == DISCONNECT_OK && fUpdateUTXOSummary) {
+        UpdateUTXOSummary(block, blockUndo, pindex, false);
+    }
+    return res;
 }
 
 DisconnectResult ApplyBlockUndo(const CBlockUndo &blockUndo,
@@ -1836,11 +2203,35 @@ static void FlushBlockFile(bool fFinalize = false) {
 static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
                         unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static const unsigned int SCRIPT_CHECK_BATCH_SIZE = 128;
+
+static std::unique_ptr<CCheckQueueBase<CScriptCheck>> scriptcheckqueue =
+    MakeCheckQueue<CScriptCheck>(CheckQueueEngine::WORKSTEALING,
+                                 SCRIPT_CHECK_BATCH_SIZE);
+
+bool InitScriptCheckQueue(const std::string &strEngine) {
+    CheckQueueEngine engine;
+    if (strEngine == "legacy") {
+        engine = CheckQueueEngine::LEGACY;
+    } else if (strEngine == "workstealing") {
+        engine = CheckQueueEngine::WORKSTEALING;
+    } else {
+        return false;
+    }
+
+    // Must be called before any script checking thread is started.
+    assert(scriptcheckqueue->IsIdle());
+    scriptcheckqueue =
+        MakeCheckQueue<CScriptCheck>(engine, SCRIPT_CHECK_BATCH_SIZE);
+    assert(mempoolcheckqueue->IsIdle());
+    mempoolcheckqueue =
+        MakeCheckQueue<CMempoolAcceptCheck>(engine, MEMPOOL_CHECK_BATCH_SIZE);
+    return true;
+}
 
 void ThreadScriptCheck() {
     RenameThread("bitcoin-scriptch");
-    scriptcheckqueue.Thread();
+    scriptcheckqueue->Thread();
 }
 
 // Protected by cs_main
@@ -1959,12 +2350,81 @@ static uint32_t GetBlockScriptFlags(const Config &config,
 
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+/**
+ * Load all the coins spent by a block into the view, except the ones created by
+ * the block itself, so that the backing database can resolve the cache misses
+ * in a single parallel batch. Transactions that are not known yet may be null.
+ */
+static std::vector<COutPoint>
+GetBlockInputs(const std::vector<CTransactionRef> &vtx) {
+    std::unordered_set<uint256, SaltedTxidHasher> setBlockTxIds;
+    setBlockTxIds.reserve(vtx.size());
+    for (const auto &tx : vtx) {
+        if (tx) {
+            setBlockTxIds.insert(tx->GetId());
+        }
+    }
+
+    std::vector<COutPoint> vOutpoints;
+    for (const auto &tx : vtx) {
+        if (!tx || tx->IsCoinBase()) {
+            continue;
+        }
+        for (const CTxIn &in : tx->vin) {
+            if (!setBlockTxIds.count(in.prevout.hash)) {
+                vOutpoints.push_back(in.prevout);
+            }
+        }
+    }
+    return vOutpoints;
+}
+
+static void PrefetchBlockInputs(const std::vector<CTransactionRef> &vtx,
+                                const CCoinsViewCache &view) {
+    view.PrefetchCoins(GetBlockInputs(vtx));
+}
+
+void PrefetchBlockInputs(const std::vector<CTransactionRef> &vtx) {
+    std::vector<COutPoint> vOutpoints;
+    uint256 hashBestBlock;
+    {
+        LOCK(cs_main);
+        for (const COutPoint &outpoint : GetBlockInputs(vtx)) {
+            if (!pcoinsTip->HaveCoinInCache(outpoint)) {
+                vOutpoints.push_back(outpoint);
+            }
+        }
+        hashBestBlock = pcoinsTip->GetBestBlock();
+    }
+    if (vOutpoints.empty()) {
+        return;
+    }
+
+    // The database is read without cs_main. Nothing but connecting or
+    // disconnecting a block changes the coins that were not cached, so the
+    // result still applies as long as the tip has not moved.
+    std::vector<Coin> vCoins;
+    try {
+        pcoinsdbview->GetCoins(vOutpoints, vCoins);
+    } catch (const std::runtime_error &e) {
+        // Only a prefetch, the coins will be read again when they are needed.
+        LogPrintf("%s: %s\n", __func__, e.what());
+        return;
+    }
+
+    LOCK(cs_main);
+    if (pcoinsTip->GetBestBlock() == hashBestBlock) {
+        pcoinsTip->AddFetchedCoins(vOutpoints, vCoins);
+    }
+}
+
 /**
  * Apply the effects of this block (with given index) on the UTXO set
  * represented by coins. Validity checks that depend on the UTXO set are also
@@ -1973,7 +2433,8 @@ static int64_t nTimeTotal = 0;
  */
 static bool ConnectBlock(const Config &config, const CBlock &block,
                          CValidationState &state, CBlockIndex *pindex,
-                         CCoinsViewCache &view, bool fJustCheck = false) {
+                         CCoinsViewCache &view, bool fJustCheck = false,
+                         bool fUpdateUTXOSummary = false) {
     AssertLockHeld(cs_main);
 
     int64_t nTimeStart = GetTimeMicros();
@@ -1998,6 +2459,10 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
     if (block.GetHash() == consensusParams.hashGenesisBlock) {
         if (!fJustCheck) {
             view.SetBestBlock(pindex->GetBlockHash());
+            if (fUpdateUTXOSummary && pUTXOSummary &&
+                pUTXOSummary->hashBlock.IsNull()) {
+                pUTXOSummary->hashBlock = pindex->GetBlockHash();
+            }
         }
 
         return true;
@@ -2114,10 +2579,21 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
     LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs]\n",
              0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
+    // The block is connected as a pipeline: all the spent coins are fetched
+    // first, then the transactions are walked in order to run the contextual
+    // checks and apply the coin updates, while their script checks are
+    // verified concurrently by the script check threads.
+    PrefetchBlockInputs(block.vtx, view);
+
+    int64_t nTime2b = GetTimeMicros();
+    nTimePrefetch += nTime2b - nTime2;
+    LogPrint(BCLog::BENCH, "    - Prefetch inputs: %.2fms [%.2fs]\n",
+             0.001 * (nTime2b - nTime2), nTimePrefetch * 0.000001);
+
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks ? &scriptcheckqueue
-                                                           : nullptr);
+    CCheckQueueControl<CScriptCheck> control(
+        fScriptChecks ? scriptcheckqueue.get() : nullptr);
 
     std::vector<int> prevheights;
     Amount nFees(0);
@@ -2129,12 +2605,22 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
         ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
     const uint64_t nMaxSigOpsCount = GetMaxBlockSigOpsCount(currentBlockSize);
 
-    CDiskTxPos pos(pindex->GetBlockPos(),
-                   GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos>> vPos;
-    vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
 
+    // Without BIP30, a coinbase may overwrite unspent outputs, which the UTXO
+    // set summary must forget about.
+    std::vector<std::pair<COutPoint, Coin>> vOverwritten;
+    if (fUpdateUTXOSummary && pUTXOSummary && !fEnforceBIP30) {
+        const CTransaction &coinbase = *block.vtx[0];
+        for (size_t o = 0; o < coinbase.vout.size(); o++) {
+            COutPoint out(coinbase.GetId(), o);
+            Coin coin;
+            if (view.GetCoin(out, coin)) {
+                vOverwritten.emplace_back(out, std::move(coin));
+            }
+        }
+    }
+
     for (size_t i = 0; i < block.vtx.size(); i++) {
         const CTransaction &tx = *(block.vtx[i]);
 
@@ -2193,6 +2679,8 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
                              tx.GetId().ToString(), FormatStateMessage(state));
             }
 
+            // Hand the script checks over right away, so that verification
+            // runs while the rest of the block is walked.
             control.Add(vChecks);
         }
 
@@ -2202,19 +2690,16 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
         }
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(),
                     pindex->nHeight);
-
-        vPos.push_back(std::make_pair(tx.GetId(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
 
     int64_t nTime3 = GetTimeMicros();
-    nTimeConnect += nTime3 - nTime2;
+    nTimeConnect += nTime3 - nTime2b;
     LogPrint(BCLog::BENCH,
              "      - Connect %u transactions: %.2fms (%.3fms/tx, "
              "%.3fms/txin) [%.2fs]\n",
-             (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2),
-             0.001 * (nTime3 - nTime2) / block.vtx.size(),
-             nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs - 1),
+             (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2b),
+             0.001 * (nTime3 - nTime2b) / block.vtx.size(),
+             nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2b) / (nInputs - 1),
              nTimeConnect * 0.000001);
 
     Amount blockReward =
@@ -2268,13 +2753,13 @@ static bool ConnectBlock(const Config &config, const CBlock &block,
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex && !pblocktree->WriteTxIndex(vPos)) {
-        return AbortNode(state, "Failed to write transaction index");
-    }
-
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
+    if (fUpdateUTXOSummary) {
+        UpdateUTXOSummary(block, blockundo, pindex, true, vOverwritten);
+    }
+
     int64_t nTime5 = GetTimeMicros();
     nTimeIndex += nTime5 - nTime4;
     LogPrint(BCLog::BENCH, "    - Index writing: %.2fms [%.2fs]\n",
@@ -2407,8 +2892,15 @@ static bool FlushStateToDisk(const CChainParams &chainparams,
                             state, "Failed to write to block index database");
                     }
                 }
-                // Finally remove any pruned files
-                if (fFlushForPrune) UnlinkPrunedFiles(setFilesToPrune);
+                // Finally remove any pruned files, once the chainstate no
+                // longer depends on them being replayed.
+                if (fFlushForPrune) {
+                    if (!pcoinsTip->WaitForWrites()) {
+                        return AbortNode(state,
+                                         "Failed to write to coin database");
+                    }
+                    UnlinkPrunedFiles(setFilesToPrune);
+                }
                 nLastWrite = nNow;
             }
             // Flush best chain related state. This can only be done if the
@@ -2428,6 +2920,23 @@ static bool FlushStateToDisk(const CChainParams &chainparams,
                 if (!pcoinsTip->Flush()) {
                     return AbortNode(state, "Failed to write to coin database");
                 }
+                // With -asyncflush, the chainstate may still be being written
+                // in the background. A crash in the meantime is recovered from
+                // by replaying the blocks on startup, but explicit and pruning
+                // flushes must be durable when we return.
+                if ((mode == FLUSH_STATE_ALWAYS || fFlushForPrune) &&
+                    !pcoinsTip->WaitForWrites()) {
+                    return AbortNode(state, "Failed to write to coin database");
+                }
+                // The summary is only used if it matches the best block of the
+                // coin database, so it does not need to be written atomically
+                // with it.
+                if (pUTXOSummary &&
+                    pUTXOSummary->hashBlock == pcoinsTip->GetBestBlock() &&
+                    !pcoinsdbview->WriteUTXOSummary(*pUTXOSummary)) {
+                    return AbortNode(state,
+                                     "Failed to write the UTXO set summary");
+                }
                 nLastFlush = nNow;
             }
         }
@@ -2574,7 +3083,8 @@ static bool DisconnectTip(const Config &config, CValidationState &state,
     {
         CCoinsViewCache view(pcoinsTip);
         assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK) {
+        if (DisconnectBlock(block, pindexDelete, view, true) !=
+            DISCONNECT_OK) {
             return error("DisconnectTip(): DisconnectBlock %s failed",
                          pindexDelete->GetBlockHash().ToString());
         }
@@ -2750,7 +3260,8 @@ static bool ConnectTip(const Config &config, CValidationState &state,
              (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(config, blockConnecting, state, pindexNew, view);
+        bool rv = ConnectBlock(config, blockConnecting, state, pindexNew, view,
+                               false, true);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid()) {
@@ -2995,6 +3506,15 @@ static void NotifyHeaderTip() {
     }
 }
 
+/**
+ * Serializes ActivateBestChain. Its tip notifications are sent after cs_main
+ * is released, so concurrent calls from several message handler threads could
+ * otherwise deliver them out of order and leave listeners on a stale tip. It
+ * is taken before cs_main, so ActivateBestChain must not be called with
+ * cs_main held.
+ */
+static CCriticalSection cs_activatebestchain;
+
 bool ActivateBestChain(const Config &config, CValidationState &state,
                        std::shared_ptr<const CBlock> pblock) {
     // Note that while we're often called here from ProcessNewBlock, this is
@@ -3002,6 +3522,8 @@ bool ActivateBestChain(const Config &config, CValidationState &state,
     // us in the middle of ProcessNewBlock - do not assume pblock is set
     // sanely for performance or correctness!
 
+    LOCK(cs_activatebestchain);
+
     CBlockIndex *pindexMostWork = nullptr;
     CBlockIndex *pindexNewTip = nullptr;
     do {
@@ -4083,6 +4605,9 @@ void UnlinkPrunedFiles(const std::set<int> &setFilesToPrune) {
     for (std::set<int>::iterator it = setFilesToPrune.begin();
          it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        if (g_blockfilepool) {
+            g_blockfilepool->Close(*it);
+        }
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4272,12 +4797,31 @@ CBlockIndex *InsertBlockIndex(uint256 hash) {
     return pindexNew;
 }
 
-static bool LoadBlockIndexDB(const CChainParams &chainparams) {
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex)) return false;
+static fs::path GetBlockIndexSnapshotPath() {
+    return GetDataDir() / "blocks" / "index.snapshot";
+}
+
+static bool LoadBlockIndexDB(const CChainParams &chainparams,
+                             const uint256 &hashBestChain) {
+    const fs::path pathSnapshot = GetBlockIndexSnapshotPath();
+    bool fFromSnapshot = false;
+    if (gArgs.GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCK_INDEX_SNAPSHOT)) {
+        fFromSnapshot = pblocktree->LoadBlockIndexSnapshot(
+            pathSnapshot, hashBestChain, InsertBlockIndex);
+    } else {
+        // Don't let a snapshot from an earlier run be used once the database
+        // has changed.
+        pblocktree->InvalidateBlockIndexSnapshot(pathSnapshot);
+    }
+    if (!fFromSnapshot &&
+        !pblocktree->LoadBlockIndexGuts(InsertBlockIndex, GetNumCores())) {
+        return false;
+    }
 
     boost::this_thread::interruption_point();
 
     // Calculate nChainWork
+    int64_t nStart = GetTimeMicros();
     std::vector<std::pair<int, CBlockIndex *>> vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     for (const std::pair<uint256, CBlockIndex *> &item : mapBlockIndex) {
@@ -4325,8 +4869,10 @@ static bool LoadBlockIndexDB(const CChainParams &chainparams) {
             pindexBestHeader = pindex;
         }
     }
+    RecordStartupPhase("loadblockindex.chainwork", GetTimeMicros() - nStart);
 
     // Load block file info
+    nStart = GetTimeMicros();
     pblocktree->ReadLastBlockFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
     LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
@@ -4361,6 +4907,7 @@ static bool LoadBlockIndexDB(const CChainParams &chainparams) {
             return false;
         }
     }
+    RecordStartupPhase("loadblockindex.files", GetTimeMicros() - nStart);
 
     // Check whether we have ever pruned block & undo files
     pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
@@ -4374,11 +4921,6 @@ static bool LoadBlockIndexDB(const CChainParams &chainparams) {
     pblocktree->ReadReindexing(fReindexing);
     fReindex |= fReindexing;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("%s: transaction index %s\n", __func__,
-              fTxIndex ? "enabled" : "disabled");
-
     return true;
 }
 
@@ -4765,16 +5307,74 @@ void UnloadBlockIndex() {
     }
     mapBlockIndex.clear();
     fHavePruned = false;
+    pUTXOSummary.reset();
 }
 
-bool LoadBlockIndex(const CChainParams &chainparams) {
+bool LoadBlockIndex(const CChainParams &chainparams,
+                    const uint256 &hashBestChain) {
     // Load block index from databases
-    if (!fReindex && !LoadBlockIndexDB(chainparams)) {
+    if (!fReindex && !LoadBlockIndexDB(chainparams, hashBestChain)) {
         return false;
     }
     return true;
 }
 
+bool LoadUTXOSummary() {
+    LOCK(cs_main);
+    std::unique_ptr<CUTXOSummary> summary(new CUTXOSummary());
+    const uint256 hashBestChain = pcoinsTip->GetBestBlock();
+    // The summary is computed from the database, which must be up to date.
+    if (!hashBestChain.IsNull()) {
+        FlushStateToDisk();
+    }
+    if (pcoinsdbview->ReadUTXOSummary(*summary) &&
+        summary->hashBlock == hashBestChain) {
+        LogPrintf("Loaded UTXO set summary at height %d\n", summary->nHeight);
+    } else if (hashBestChain.IsNull()) {
+        *summary = CUTXOSummary();
+    } else {
+        LogPrintf("Computing UTXO set summary, this may take a while\n");
+        int64_t nStart = GetTimeMillis();
+        CCoinsStats stats;
+        if (!GetUTXOStats(pcoinsdbview, stats, GetNumCores(), true) ||
+            stats.hashBlock != hashBestChain) {
+            return error("%s: unable to read UTXO set", __func__);
+        }
+        *summary = CUTXOSummary(stats);
+        if (!pcoinsdbview->WriteUTXOSummary(*summary)) {
+            return error("%s: failed to write UTXO set summary", __func__);
+        }
+        LogPrintf("Computed UTXO set summary in %dms\n",
+                  GetTimeMillis() - nStart);
+    }
+    pUTXOSummary = std::move(summary);
+    return true;
+}
+
+bool GetUTXOSummary(CUTXOSummary &summary) {
+    LOCK(cs_main);
+    if (!pUTXOSummary || chainActive.Tip() == nullptr ||
+        pUTXOSummary->hashBlock != chainActive.Tip()->GetBlockHash()) {
+        return false;
+    }
+    summary = *pUTXOSummary;
+    return true;
+}
+
+void DumpBlockIndexSnapshot() {
+    LOCK(cs_main);
+    if (!pblocktree || !pcoinsTip) {
+        return;
+    }
+    std::vector<const CBlockIndex *> vBlocks;
+    vBlocks.reserve(mapBlockIndex.size());
+    for (const auto &item : mapBlockIndex) {
+        vBlocks.push_back(item.second);
+    }
+    pblocktree->WriteBlockIndexSnapshot(GetBlockIndexSnapshotPath(), vBlocks,
+                                        pcoinsTip->GetBestBlock());
+}
+
 bool InitBlockIndex(const Config &config) {
     LOCK(cs_main);
 
@@ -4783,9 +5383,6 @@ bool InitBlockIndex(const Config &config) {
         return true;
     }
 
-    // Use the provided setting for -txindex in the new database
-    fTxIndex = gArgs.GetBoolArg("-txindex", DEFAULT_TXINDEX);
-    pblocktree->WriteFlag("txindex", fTxIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the
@@ -5430,6 +6027,94 @@ void DumpMempool(void) {
     }
 }
 
+static const uint64_t SCRIPT_CACHES_DUMP_VERSION = 1;
+
+bool LoadScriptCaches() {
+    FILE *filestr = fsbridge::fopen(GetDataDir() / "sigcache.dat", "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open script caches file from disk. Continuing "
+                  "anyway.\n");
+        return false;
+    }
+
+    uint256 sigNonce, scriptNonce;
+    std::vector<uint256> sigEntries, scriptEntries;
+    int nClientVersion;
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != SCRIPT_CACHES_DUMP_VERSION) {
+            return false;
+        }
+        file >> nClientVersion;
+        file >> sigNonce;
+        file >> sigEntries;
+        file >> scriptNonce;
+        file >> scriptEntries;
+    } catch (const std::exception &e) {
+        LogPrintf("Failed to deserialize script caches data on disk: %s. "
+                  "Continuing anyway.\n",
+                  e.what());
+        return false;
+    }
+
+    // A signature is valid whatever the version which checked it, but the
+    // result of a script may change with the rules of the client which ran
+    // it, so only keep the script execution cache of the same version.
+    LoadSignatureCache(sigNonce, sigEntries);
+    if (nClientVersion == CLIENT_VERSION) {
+        LoadScriptExecutionCache(scriptNonce, scriptEntries);
+    } else {
+        scriptEntries.clear();
+    }
+
+    LogPrintf("Imported script caches from disk: %u signature cache entries, "
+              "%u script execution cache entries\n",
+              sigEntries.size(), scriptEntries.size());
+    return true;
+}
+
+void DumpScriptCaches() {
+    int64_t start = GetTimeMicros();
+
+    uint256 sigNonce, scriptNonce;
+    std::vector<uint256> sigEntries, scriptEntries;
+    DumpSignatureCache(sigNonce, sigEntries);
+    DumpScriptExecutionCache(scriptNonce, scriptEntries);
+
+    int64_t mid = GetTimeMicros();
+
+    try {
+        FILE *filestr =
+            fsbridge::fopen(GetDataDir() / "sigcache.dat.new", "wb");
+        if (!filestr) {
+            return;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = SCRIPT_CACHES_DUMP_VERSION;
+        file << version;
+        file << int(CLIENT_VERSION);
+        file << sigNonce;
+        file << sigEntries;
+        file << scriptNonce;
+        file << scriptEntries;
+
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "sigcache.dat.new",
+                   GetDataDir() / "sigcache.dat");
+        int64_t last = GetTimeMicros();
+        LogPrintf("Dumped script caches: %gs to copy, %gs to dump\n",
+                  (mid - start) * 0.000001, (last - mid) * 0.000001);
+    } catch (const std::exception &e) {
+        LogPrintf("Failed to dump script caches: %s. Continuing anyway.\n",
+                  e.what());
+    }
+}
+
 //! Guess how far we are in the verification process at the given block index
 double GuessVerificationProgress(const ChainTxData &data, CBlockIndex *pindex) {
     if (pindex == nullptr) {
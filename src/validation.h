@@ -15,6 +15,7 @@
 #include "chain.h"
 #include "coins.h"
 #include "consensus/consensus.h"
+#include "consensus/validation.h"
 #include "fs.h"
 #include "protocol.h" // For CMessageHeader::MessageMagic
 #include "script/script_error.h"
@@ -26,6 +27,7 @@
 #include <cstdint>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <utility>
@@ -33,16 +35,18 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
 class CChainParams;
+class CCoinsViewDB;
 class CConnman;
 class CInv;
 class Config;
 class CScriptCheck;
 class CTxMemPool;
 class CTxUndo;
+class CUTXOSummary;
 class CValidationInterface;
-class CValidationState;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
@@ -93,6 +97,8 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** -parengine default (script verification queue implementation) */
+static const char *const DEFAULT_SCRIPTCHECK_ENGINE = "workstealing";
 /** Number of blocks that can be requested at any given time from a single peer.
  */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
@@ -175,6 +181,8 @@ static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -persistsigcache */
+static const bool DEFAULT_PERSIST_SIGCACHE = true;
 /** Default for using fee filter */
 static const bool DEFAULT_FEEFILTER = true;
 
@@ -203,7 +211,6 @@ extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
-extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
@@ -341,14 +348,36 @@ bool LoadExternalBlockFile(const Config &config, FILE *fileIn,
                            CDiskBlockPos *dbp = nullptr);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const Config &config);
-/** Load the block tree and coins database from disk */
-bool LoadBlockIndex(const CChainParams &chainparams);
+/**
+ * Load the block tree and coins database from disk. hashBestChain is the best
+ * block of the coins database, which a block index snapshot must match to be
+ * used.
+ */
+bool LoadBlockIndex(const CChainParams &chainparams,
+                    const uint256 &hashBestChain);
+/** Write a block index snapshot for the next startup (-blockindexsnapshot) */
+void DumpBlockIndexSnapshot();
+/**
+ * Start maintaining the UTXO set summary (-utxosummary), from the coins
+ * database if it has an up to date one, or else by walking the UTXO set.
+ */
+bool LoadUTXOSummary();
+/** Get the UTXO set summary, if it is maintained and up to date with the tip */
+bool GetUTXOSummary(CUTXOSummary &summary);
 /** Update the chain tip based on database information. */
 void LoadChainTip(const CChainParams &chainparams);
 /** Unload database information */
 void UnloadBlockIndex();
+/**
+ * Select the script verification queue implementation ("legacy" or
+ * "workstealing"). Must be called before the script checking threads are
+ * started. Returns false if the engine is unknown.
+ */
+bool InitScriptCheckQueue(const std::string &strEngine);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the mempool script checking thread */
+void ThreadMempoolCheck();
 /** Check whether we are doing an initial block download (synchronizing from
  * disk or network) */
 bool IsInitialBlockDownload();
@@ -374,7 +403,8 @@ bool GetTransaction(const Config &config, const uint256 &hash,
  * pblock is either nullptr or a pointer to a block that is already loaded
  * in memory (to avoid loading it from disk again).
  *
- * Returns true if a new chain tip was set.
+ * Returns true if a new chain tip was set. Must not be called with cs_main
+ * held.
  */
 bool ActivateBestChain(
     const Config &config, CValidationState &state,
@@ -422,6 +452,25 @@ bool AcceptToMemoryPool(const Config &config, CTxMemPool &pool,
                         bool fOverrideMempoolLimit = false,
                         const Amount nAbsurdFee = Amount(0));
 
+/** The outcome of one transaction of AcceptToMemoryPoolBatch. */
+struct MempoolAcceptResult {
+    bool fAccepted = false;
+    bool fMissingInputs = false;
+    CValidationState state;
+};
+
+/**
+ * (try to) add a batch of transactions to memory pool. Their scripts are
+ * checked in parallel on the mempool check threads without holding cs_main,
+ * which the caller must not hold; only the final conflict checks and the
+ * insertions are serialized, in order. A transaction spending an earlier one
+ * of the batch is retried once that one is accepted.
+ */
+std::vector<MempoolAcceptResult>
+AcceptToMemoryPoolBatch(const Config &config, CTxMemPool &pool,
+                        const std::vector<CTransactionRef> &vtx,
+                        bool fLimitFree);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -582,11 +631,43 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Load the coins spent by the transactions of a block, except the ones created
+ * by the block itself, into the UTXO cache. The missing ones are read from the
+ * database in parallel, without holding cs_main. Transactions that are not
+ * known yet may be null.
+ */
+void PrefetchBlockInputs(const std::vector<CTransactionRef> &vtx);
+
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock &block, const CDiskBlockPos &pos,
                        const Config &config);
 bool ReadBlockFromDisk(CBlock &block, const CBlockIndex *pindex,
                        const Config &config);
+/**
+ * Read the block with this hash stored at pos, like the CBlockIndex version,
+ * for callers which looked them up under cs_main but read without it.
+ */
+bool ReadBlockFromDisk(CBlock &block, const uint256 &hash,
+                       const CDiskBlockPos &pos, const Config &config);
+/**
+ * Read the serialized block at pos as it is stored on disk, which is also how
+ * it is sent over the network, without deserializing it.
+ */
+bool ReadRawBlockFromDisk(std::vector<uint8_t> &block, const CDiskBlockPos &pos,
+                          const Config &config);
+/**
+ * Get the serialized block of pindex from the raw block cache, or read it from
+ * disk, check its header hash and add it to the cache. The buffer is shared
+ * with the cache rather than copied.
+ */
+std::shared_ptr<const std::vector<uint8_t>>
+ReadRawBlock(const CBlockIndex *pindex, const Config &config);
+std::shared_ptr<const std::vector<uint8_t>>
+ReadRawBlock(const uint256 &hash, const CDiskBlockPos &pos,
+             const Config &config);
+/** Read the undo data of a block other than the genesis block. */
+bool ReadBlockUndoFromDisk(CBlockUndo &blockundo, const CBlockIndex *pindex);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -676,6 +757,13 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/**
+ * Global variable that points to the coins database (protected by cs_main).
+ * GetCoins, which reads from a database snapshot and the pending writes under
+ * their own lock, may be called without it.
+ */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main)
  */
 extern CCoinsViewCache *pcoinsTip;
@@ -722,4 +810,13 @@ void DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool(const Config &config);
 
+/** Dump the signature and script execution caches to disk. */
+void DumpScriptCaches();
+
+/**
+ * Load the signature and script execution caches from disk. Must be called
+ * after they are initialized and before they are used.
+ */
+bool LoadScriptCaches();
+
 #endif // BITCOIN_VALIDATION_H
@@ -5,62 +5,195 @@
 
 #include "validationinterface.h"
 
+#include "primitives/block.h"
+#include "scheduler.h"
+#include "uint256.h"
+
+#include <boost/bind.hpp>
+#include <boost/signals2/signal.hpp>
+
+#include <future>
+
+struct MainSignalsInstance {
+    boost::signals2::signal<void(const CBlockIndex *, const CBlockIndex *,
+                                 bool fInitialDownload)>
+        UpdatedBlockTip;
+    boost::signals2::signal<void(const CTransactionRef &)>
+        TransactionAddedToMempool;
+    boost::signals2::signal<void(const std::shared_ptr<const CBlock> &,
+                                 const CBlockIndex *pindex,
+                                 const std::vector<CTransactionRef> &)>
+        BlockConnected;
+    boost::signals2::signal<void(const std::shared_ptr<const CBlock> &)>
+        BlockDisconnected;
+    boost::signals2::signal<void(const CBlockLocator &)> SetBestChain;
+    boost::signals2::signal<void(const uint256 &)> Inventory;
+    boost::signals2::signal<void(int64_t nBestBlockTime, CConnman *connman)>
+        Broadcast;
+    boost::signals2::signal<void(const CBlock &, const CValidationState &)>
+        BlockChecked;
+    boost::signals2::signal<void(const CBlockIndex *,
+                                 const std::shared_ptr<const CBlock> &)>
+        NewPoWValidBlock;
+
+    //! Queue of the notifications, if dispatched in the background.
+    std::unique_ptr<SingleThreadedSchedulerClient> schedulerClient;
+};
+
 static CMainSignals g_signals;
 
+CMainSignals::CMainSignals() : m_internals(new MainSignalsInstance()) {}
+
+CMainSignals::~CMainSignals() {}
+
+void CMainSignals::RegisterBackgroundSignalScheduler(CScheduler &scheduler) {
+    assert(!m_internals->schedulerClient);
+    m_internals->schedulerClient.reset(
+        new SingleThreadedSchedulerClient(&scheduler));
+}
+
+void CMainSignals::UnregisterBackgroundSignalScheduler() {
+    if (m_internals->schedulerClient) {
+        assert(m_internals->schedulerClient->CallbacksPending() == 0);
+    }
+    m_internals->schedulerClient.reset();
+}
+
+void CMainSignals::FlushBackgroundCallbacks() {
+    if (m_internals->schedulerClient) {
+        m_internals->schedulerClient->EmptyQueue();
+    }
+}
+
+size_t CMainSignals::CallbacksPending() {
+    if (!m_internals->schedulerClient) {
+        return 0;
+    }
+    return m_internals->schedulerClient->CallbacksPending();
+}
+
+void CMainSignals::Enqueue(std::function<void()> func) {
+    if (m_internals->schedulerClient) {
+        m_internals->schedulerClient->AddToProcessQueue(std::move(func));
+    } else {
+        func();
+    }
+}
+
 CMainSignals &GetMainSignals() {
     return g_signals;
 }
 
 void RegisterValidationInterface(CValidationInterface *pwalletIn) {
-    g_signals.UpdatedBlockTip.connect(boost::bind(
+    MainSignalsInstance &signals = *g_signals.m_internals;
+    signals.UpdatedBlockTip.connect(boost::bind(
         &CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
-    g_signals.TransactionAddedToMempool.connect(boost::bind(
+    signals.TransactionAddedToMempool.connect(boost::bind(
         &CValidationInterface::TransactionAddedToMempool, pwalletIn, _1));
-    g_signals.BlockConnected.connect(boost::bind(
+    signals.BlockConnected.connect(boost::bind(
         &CValidationInterface::BlockConnected, pwalletIn, _1, _2, _3));
-    g_signals.BlockDisconnected.connect(
+    signals.BlockDisconnected.connect(
         boost::bind(&CValidationInterface::BlockDisconnected, pwalletIn, _1));
-    g_signals.SetBestChain.connect(
+    signals.SetBestChain.connect(
         boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.Inventory.connect(
+    signals.Inventory.connect(
         boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
-    g_signals.Broadcast.connect(boost::bind(
+    signals.Broadcast.connect(boost::bind(
         &CValidationInterface::ResendWalletTransactions, pwalletIn, _1, _2));
-    g_signals.BlockChecked.connect(
+    signals.BlockChecked.connect(
         boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
-    g_signals.NewPoWValidBlock.connect(boost::bind(
+    signals.NewPoWValidBlock.connect(boost::bind(
         &CValidationInterface::NewPoWValidBlock, pwalletIn, _1, _2));
 }
 
 void UnregisterValidationInterface(CValidationInterface *pwalletIn) {
-    g_signals.BlockChecked.disconnect(
+    MainSignalsInstance &signals = *g_signals.m_internals;
+    signals.BlockChecked.disconnect(
         boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
-    g_signals.Broadcast.disconnect(boost::bind(
+    signals.Broadcast.disconnect(boost::bind(
         &CValidationInterface::ResendWalletTransactions, pwalletIn, _1, _2));
-    g_signals.Inventory.disconnect(
+    signals.Inventory.disconnect(
         boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
-    g_signals.SetBestChain.disconnect(
+    signals.SetBestChain.disconnect(
         boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
-    g_signals.TransactionAddedToMempool.disconnect(boost::bind(
+    signals.TransactionAddedToMempool.disconnect(boost::bind(
         &CValidationInterface::TransactionAddedToMempool, pwalletIn, _1));
-    g_signals.BlockConnected.disconnect(boost::bind(
+    signals.BlockConnected.disconnect(boost::bind(
         &CValidationInterface::BlockConnected, pwalletIn, _1, _2, _3));
-    g_signals.BlockDisconnected.disconnect(
+    signals.BlockDisconnected.disconnect(
         boost::bind(&CValidationInterface::BlockDisconnected, pwalletIn, _1));
-    g_signals.UpdatedBlockTip.disconnect(boost::bind(
+    signals.UpdatedBlockTip.disconnect(boost::bind(
         &CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
-    g_signals.NewPoWValidBlock.disconnect(boost::bind(
+    signals.NewPoWValidBlock.disconnect(boost::bind(
         &CValidationInterface::NewPoWValidBlock, pwalletIn, _1, _2));
 }
 
 void UnregisterAllValidationInterfaces() {
-    g_signals.BlockChecked.disconnect_all_slots();
-    g_signals.Broadcast.disconnect_all_slots();
-    g_signals.Inventory.disconnect_all_slots();
-    g_signals.SetBestChain.disconnect_all_slots();
-    g_signals.TransactionAddedToMempool.disconnect_all_slots();
-    g_signals.BlockConnected.disconnect_all_slots();
-    g_signals.BlockDisconnected.disconnect_all_slots();
-    g_signals.UpdatedBlockTip.disconnect_all_slots();
-    g_signals.NewPoWValidBlock.disconnect_all_slots();
+    MainSignalsInstance &signals = *g_signals.m_internals;
+    signals.BlockChecked.disconnect_all_slots();
+    signals.Broadcast.disconnect_all_slots();
+    signals.Inventory.disconnect_all_slots();
+    signals.SetBestChain.disconnect_all_slots();
+    signals.TransactionAddedToMempool.disconnect_all_slots();
+    signals.BlockConnected.disconnect_all_slots();
+    signals.BlockDisconnected.disconnect_all_slots();
+    signals.UpdatedBlockTip.disconnect_all_slots();
+    signals.NewPoWValidBlock.disconnect_all_slots();
+}
+
+void CallFunctionInValidationInterfaceQueue(std::function<void()> func) {
+    g_signals.Enqueue(std::move(func));
+}
+
+void SyncWithValidationInterfaceQueue() {
+    std::promise<void> promise;
+    CallFunctionInValidationInterfaceQueue([&promise] { promise.set_value(); });
+    promise.get_future().wait();
+}
+
+void CMainSignals::UpdatedBlockTip(const CBlockIndex *pindexNew,
+                                   const CBlockIndex *pindexFork,
+                                   bool fInitialDownload) {
+    Enqueue([this, pindexNew, pindexFork, fInitialDownload] {
+        m_internals->UpdatedBlockTip(pindexNew, pindexFork, fInitialDownload);
+    });
+}
+
+void CMainSignals::TransactionAddedToMempool(const CTransactionRef &ptx) {
+    Enqueue([this, ptx] { m_internals->TransactionAddedToMempool(ptx); });
+}
+
+void CMainSignals::BlockConnected(
+    const std::shared_ptr<const CBlock> &pblock, const CBlockIndex *pindex,
+    const std::vector<CTransactionRef> &txnConflicted) {
+    Enqueue([this, pblock, pindex, txnConflicted] {
+        m_internals->BlockConnected(pblock, pindex, txnConflicted);
+    });
+}
+
+void CMainSignals::BlockDisconnected(
+    const std::shared_ptr<const CBlock> &pblock) {
+    Enqueue([this, pblock] { m_internals->BlockDisconnected(pblock); });
+}
+
+void CMainSignals::SetBestChain(const CBlockLocator &locator) {
+    Enqueue([this, locator] { m_internals->SetBestChain(locator); });
+}
+
+void CMainSignals::Inventory(const uint256 &hash) {
+    Enqueue([this, hash] { m_internals->Inventory(hash); });
+}
+
+void CMainSignals::Broadcast(int64_t nBestBlockTime, CConnman *connman) {
+    m_internals->Broadcast(nBestBlockTime, connman);
+}
+
+void CMainSignals::BlockChecked(const CBlock &block,
+                                const CValidationState &state) {
+    m_internals->BlockChecked(block, state);
+}
+
+void CMainSignals::NewPoWValidBlock(
+    const CBlockIndex *pindex, const std::shared_ptr<const CBlock> &pblock) {
+    m_internals->NewPoWValidBlock(pindex, pblock);
 }
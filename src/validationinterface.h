@@ -8,8 +8,7 @@
 
 #include "primitives/transaction.h" // CTransaction(Ref)
 
-#include <boost/signals2/signal.hpp>
-
+#include <functional>
 #include <memory>
 
 class CBlock;
@@ -18,6 +17,7 @@ struct CBlockLocator;
 class CBlockIndex;
 class CConnman;
 class CReserveScript;
+class CScheduler;
 class CValidationInterface;
 class CValidationState;
 class uint256;
@@ -30,6 +30,21 @@ void RegisterValidationInterface(CValidationInterface *pwalletIn);
 void UnregisterValidationInterface(CValidationInterface *pwalletIn);
 /** Unregister all wallets from core */
 void UnregisterAllValidationInterfaces();
+/**
+ * Run func after the notifications sent so far are dispatched, on the thread
+ * dispatching them. This is useful to know when a given notification reached
+ * the listeners.
+ */
+void CallFunctionInValidationInterfaceQueue(std::function<void()> func);
+/**
+ * Wait until the notifications sent so far are dispatched. As listeners may
+ * take cs_main, this must not be called with cs_main held, nor from a
+ * listener.
+ */
+void SyncWithValidationInterfaceQueue();
+
+//! -asyncnotifications default
+static const bool DEFAULT_ASYNC_NOTIFICATIONS = false;
 
 class CValidationInterface {
 protected:
@@ -55,43 +70,79 @@ protected:
     friend void ::UnregisterAllValidationInterfaces();
 };
 
-struct CMainSignals {
-    /** Notifies listeners of updated block chain tip */
-    boost::signals2::signal<void(const CBlockIndex *, const CBlockIndex *,
-                                 bool fInitialDownload)>
-        UpdatedBlockTip;
-    /** Notifies listeners of a transaction having been added to mempool. */
-    boost::signals2::signal<void(const CTransactionRef &)>
-        TransactionAddedToMempool;
+struct MainSignalsInstance;
+
+/**
+ * Dispatches the notifications of validation to the registered interfaces.
+ *
+ * By default, listeners are called synchronously, in the thread of the caller
+ * and usually with cs_main held. Once a background scheduler is registered,
+ * the notifications which validation does not depend on are queued instead,
+ * and dispatched in order by the scheduler thread, so that slow listeners do
+ * not hold up validation. Callers which need the listeners to have caught up
+ * use SyncWithValidationInterfaceQueue.
+ */
+class CMainSignals {
+private:
+    std::unique_ptr<MainSignalsInstance> m_internals;
+
+    friend void ::RegisterValidationInterface(CValidationInterface *);
+    friend void ::UnregisterValidationInterface(CValidationInterface *);
+    friend void ::UnregisterAllValidationInterfaces();
+    friend void ::CallFunctionInValidationInterfaceQueue(
+        std::function<void()> func);
+
+    //! Run func on the scheduler thread if registered, right away otherwise.
+    void Enqueue(std::function<void()> func);
+
+public:
+    CMainSignals();
+    ~CMainSignals();
+
+    /** Dispatch the queued notifications on the thread of scheduler. */
+    void RegisterBackgroundSignalScheduler(CScheduler &scheduler);
+    /** Go back to synchronous notifications. The queue must be empty. */
+    void UnregisterBackgroundSignalScheduler();
+    /**
+     * Dispatch the notifications still queued on the calling thread, once the
+     * scheduler thread stopped.
+     */
+    void FlushBackgroundCallbacks();
+    /** Number of notifications waiting to be dispatched. */
+    size_t CallbacksPending();
+
+    /** Notifies listeners of updated block chain tip. Queued. */
+    void UpdatedBlockTip(const CBlockIndex *pindexNew,
+                         const CBlockIndex *pindexFork, bool fInitialDownload);
+    /** Notifies listeners of a transaction having been added to mempool.
+     * Queued. */
+    void TransactionAddedToMempool(const CTransactionRef &ptx);
     /**
-     * Notifies listeners of a block being connected.
-     * Provides a vector of transactions evicted from the mempool as a result.
+     * Notifies listeners of a block being connected. Provides a vector of
+     * transactions evicted from the mempool as a result. Queued.
      */
-    boost::signals2::signal<void(const std::shared_ptr<const CBlock> &,
-                                 const CBlockIndex *pindex,
-                                 const std::vector<CTransactionRef> &)>
-        BlockConnected;
-    /** Notifies listeners of a block being disconnected */
-    boost::signals2::signal<void(const std::shared_ptr<const CBlock> &)>
-        BlockDisconnected;
-    /** Notifies listeners of a new active block chain. */
-    boost::signals2::signal<void(const CBlockLocator &)> SetBestChain;
-    /** Notifies listeners about an inventory item being seen on the network. */
-    boost::signals2::signal<void(const uint256 &)> Inventory;
-    /** Tells listeners to broadcast their data. */
-    boost::signals2::signal<void(int64_t nBestBlockTime, CConnman *connman)>
-        Broadcast;
-    /** Notifies listeners of a block validation result */
-    boost::signals2::signal<void(const CBlock &, const CValidationState &)>
-        BlockChecked;
+    void BlockConnected(const std::shared_ptr<const CBlock> &pblock,
+                        const CBlockIndex *pindex,
+                        const std::vector<CTransactionRef> &txnConflicted);
+    /** Notifies listeners of a block being disconnected. Queued. */
+    void BlockDisconnected(const std::shared_ptr<const CBlock> &pblock);
+    /** Notifies listeners of a new active block chain. Queued. */
+    void SetBestChain(const CBlockLocator &locator);
+    /** Notifies listeners about an inventory item being seen on the network.
+     * Queued. */
+    void Inventory(const uint256 &hash);
+    /** Tells listeners to broadcast their data. Synchronous. */
+    void Broadcast(int64_t nBestBlockTime, CConnman *connman);
+    /** Notifies listeners of a block validation result. Synchronous, as
+     * listeners look at the state. */
+    void BlockChecked(const CBlock &block, const CValidationState &state);
     /**
      * Notifies listeners that a block which builds directly on our current tip
      * has been received and connected to the headers tree, though not validated
-     * yet.
+     * yet. Synchronous, as it is used to relay the block early.
      */
-    boost::signals2::signal<void(const CBlockIndex *,
-                                 const std::shared_ptr<const CBlock> &)>
-        NewPoWValidBlock;
+    void NewPoWValidBlock(const CBlockIndex *pindex,
+                          const std::shared_ptr<const CBlock> &pblock);
 };
 
 CMainSignals &GetMainSignals();
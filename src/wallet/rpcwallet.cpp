@@ -21,6 +21,7 @@
 #include "util.h"
 #include "utilmoneystr.h"
 #include "validation.h"
+#include "validationinterface.h"
 #include "wallet.h"
 #include "walletdb.h"
 
@@ -43,6 +44,13 @@ static std::string urlDecode(const std::string &urlEncoded) {
 }
 
 CWallet *GetWalletForJSONRPCRequest(const JSONRPCRequest &request) {
+    // With -asyncnotifications, let the wallets catch up with the blocks and
+    // transactions notified so far, so that a call sees the effects of the
+    // calls made before it.
+    if (!request.fHelp) {
+        SyncWithValidationInterfaceQueue();
+    }
+
     if (request.URI.substr(0, WALLET_ENDPOINT_BASE.size()) ==
         WALLET_ENDPOINT_BASE) {
         // wallet endpoint was used
@@ -0,0 +1,260 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""
+Test cut-through relay of compact blocks and getblockrelayinfo.
+
+Each node gets a chain from a sender peer, then a compact block with a
+transaction it does not have, and has to ask the sender for it. A receiver peer
+in high-bandwidth mode checks when the block is relayed to it:
+
+- With -cutthroughrelay (node 0), it gets the compact block before the node
+  has the transaction, and its getblocktxn for that block is answered once the
+  node has it. If the block turns out invalid, or another one takes its place
+  at the tip, the node answers notfound instead.
+- Without (node 1), it only gets the compact block once the node has validated
+  it.
+"""
+
+import time
+
+from test_framework.blocktools import (create_block, create_coinbase,
+                                       create_transaction)
+from test_framework.mininode import *
+from test_framework.script import CScript, OP_TRUE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+# Peers older than this may ban us for relaying a block that turns out to be
+# invalid, so they are left out of cut-through relay.
+INVALID_CB_NO_BAN_VERSION = 70015
+
+
+class CutThroughRelayTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [["-cutthroughrelay"], []]
+
+    def setup_network(self):
+        # The nodes only talk to the test peers.
+        self.setup_nodes()
+
+    def connect_peer(self, node_index):
+        peer = NodeConnCB()
+        conn = NodeConn('127.0.0.1', p2p_port(node_index),
+                        self.nodes[node_index], peer, send_version=False)
+        version = msg_version()
+        version.nVersion = INVALID_CB_NO_BAN_VERSION
+        version.addrTo.ip = conn.dstaddr
+        version.addrTo.port = conn.dstport
+        version.addrFrom.ip = "0.0.0.0"
+        version.addrFrom.port = 0
+        conn.send_message(version, True)
+        peer.add_connection(conn)
+        return peer
+
+    def last_cmpctblock_hash(self, peer):
+        with mininode_lock:
+            message = peer.last_message.get("cmpctblock")
+            if message is None:
+                return None
+            message.header_and_shortids.header.calc_sha256()
+            return message.header_and_shortids.header.sha256
+
+    def build_chain(self, node, sender, receiver):
+        # Compact blocks are only taken from peers that support them, and
+        # relayed in high-bandwidth mode to those that ask for it.
+        sendcmpct = msg_sendcmpct()
+        sender.send_and_ping(sendcmpct)
+        sendcmpct.announce = True
+        receiver.send_and_ping(sendcmpct)
+
+        # Anyone can spend the coinbases, so that the last block can spend the
+        # first.
+        tip = int(node.getbestblockhash(), 16)
+        block_time = int(time.time()) - 200
+        blocks = []
+        for height in range(1, 102):
+            block = create_block(tip, create_coinbase(height), block_time)
+            block.solve()
+            sender.send_message(msg_block(block))
+            blocks.append(block)
+            tip = block.sha256
+            block_time += 1
+        sender.sync_with_ping()
+        assert_equal(node.getbestblockhash(), blocks[-1].hash)
+
+        # Let the node know the receiver has the tip, so that it relays the
+        # next block to it.
+        headers = msg_headers()
+        headers.headers = [CBlockHeader(blocks[-1])]
+        receiver.send_and_ping(headers)
+
+        spend = create_transaction(blocks[0].vtx[0], 0, b"",
+                                   blocks[0].vtx[0].vout[0].nValue - 1000,
+                                   CScript([OP_TRUE]))
+        block = create_block(tip, create_coinbase(102), block_time)
+        block.vtx.append(spend)
+        block.hashMerkleRoot = block.calc_merkle_root()
+        block.solve()
+        return block
+
+    def send_compact_block(self, node, sender, block):
+        # The node does not have the transaction of the block, and asks the
+        # sender for it.
+        with mininode_lock:
+            sender.last_message.pop("getblocktxn", None)
+        cmpct = HeaderAndShortIDs()
+        cmpct.initialize_from_block(block)
+        sender.send_message(msg_cmpctblock(cmpct.to_p2p()))
+
+        def test_function(): return "getblocktxn" in sender.last_message
+        wait_until(test_function, timeout=30, lock=mininode_lock)
+        with mininode_lock:
+            request = sender.last_message["getblocktxn"].block_txn_request
+            assert_equal(request.blockhash, block.sha256)
+            assert_equal(request.to_absolute(), [1])
+
+    def send_block_transactions(self, sender, block):
+        blocktxn = msg_blocktxn()
+        blocktxn.block_transactions = BlockTransactions(block.sha256,
+                                                        block.vtx[1:])
+        sender.send_message(blocktxn)
+
+    def test_cut_through(self, node, sender, receiver):
+        block = self.build_chain(node, sender, receiver)
+        validated = node.getblockrelayinfo()["validated"]["count"]
+
+        self.send_compact_block(node, sender, block)
+        # The receiver gets the block while the node is still waiting for its
+        # transaction.
+        wait_until(lambda: self.last_cmpctblock_hash(receiver) == block.sha256,
+                   timeout=30)
+        assert node.getbestblockhash() != block.hash
+
+        # The receiver asks for the transaction the node does not have yet.
+        # The request is kept until it does.
+        request = msg_getblocktxn()
+        request.block_txn_request = BlockTransactionsRequest(block.sha256)
+        request.block_txn_request.from_absolute([1])
+        receiver.send_and_ping(request)
+        with mininode_lock:
+            assert "blocktxn" not in receiver.last_message
+
+        self.send_block_transactions(sender, block)
+        wait_until(lambda: "blocktxn" in receiver.last_message, timeout=30,
+                   lock=mininode_lock)
+        with mininode_lock:
+            response = receiver.last_message["blocktxn"].block_transactions
+            assert_equal(response.blockhash, block.sha256)
+            assert_equal(len(response.transactions), 1)
+            response.transactions[0].calc_sha256()
+            assert_equal(response.transactions[0].sha256, block.vtx[1].sha256)
+        sender.sync_with_ping()
+        assert_equal(node.getbestblockhash(), block.hash)
+
+        info = node.getblockrelayinfo()
+        assert_equal(info["cutthroughrelay"], True)
+        assert_equal(info["cutthrough"]["count"], 1)
+        assert_greater_than_or_equal(info["cutthrough"]["totallatency"], 0)
+        assert_equal(info["cutthrough"]["maxlatency"],
+                     info["cutthrough"]["totallatency"])
+        # The block is not relayed, or counted, a second time once valid.
+        assert_equal(info["validated"]["count"], validated)
+
+    def request_held_transactions(self, node, sender, receiver, block):
+        # The block is relayed before the node has its transaction, and the
+        # receiver asks for it.
+        self.send_compact_block(node, sender, block)
+        wait_until(lambda: self.last_cmpctblock_hash(receiver) == block.sha256,
+                   timeout=30)
+        with mininode_lock:
+            receiver.last_message.pop("blocktxn", None)
+            receiver.last_message.pop("notfound", None)
+        request = msg_getblocktxn()
+        request.block_txn_request = BlockTransactionsRequest(block.sha256)
+        request.block_txn_request.from_absolute([1])
+        receiver.send_and_ping(request)
+        with mininode_lock:
+            assert "blocktxn" not in receiver.last_message
+            assert "notfound" not in receiver.last_message
+
+    def wait_for_notfound(self, receiver, block):
+        wait_until(lambda: "notfound" in receiver.last_message, timeout=30,
+                   lock=mininode_lock)
+        with mininode_lock:
+            assert_equal([(inv.type, inv.hash) for inv in
+                          receiver.last_message["notfound"].inv],
+                         [(2, block.sha256)])
+            assert "blocktxn" not in receiver.last_message
+
+    def test_abandoned(self, node, sender, receiver):
+        tip = int(node.getbestblockhash(), 16)
+        height = node.getblockcount() + 1
+        block_time = int(time.time())
+
+        # The transaction completes an invalid block, with two coinbases.
+        block = create_block(tip, create_coinbase(height), block_time)
+        block.vtx.append(create_coinbase(height + 1))
+        block.hashMerkleRoot = block.calc_merkle_root()
+        block.solve()
+        self.request_held_transactions(node, sender, receiver, block)
+        self.send_block_transactions(sender, block)
+        self.wait_for_notfound(receiver, block)
+        assert_equal(node.getbestblockhash(), "%064x" % tip)
+
+        # The transaction never comes, and another block takes the place of
+        # this one at the tip.
+        spend = create_transaction(block.vtx[0], 0, b"", 1000,
+                                   CScript([OP_TRUE]))
+        block = create_block(tip, create_coinbase(height), block_time + 1)
+        block.vtx.append(spend)
+        block.hashMerkleRoot = block.calc_merkle_root()
+        block.solve()
+        self.request_held_transactions(node, sender, receiver, block)
+        other = create_block(tip, create_coinbase(height), block_time + 2)
+        other.solve()
+        sender.send_and_ping(msg_block(other))
+        assert_equal(node.getbestblockhash(), other.hash)
+        self.wait_for_notfound(receiver, block)
+
+    def test_validated(self, node, sender, receiver):
+        block = self.build_chain(node, sender, receiver)
+        validated = node.getblockrelayinfo()["validated"]["count"]
+
+        self.send_compact_block(node, sender, block)
+        receiver.sync_with_ping()
+        assert self.last_cmpctblock_hash(receiver) != block.sha256
+
+        self.send_block_transactions(sender, block)
+        wait_until(lambda: self.last_cmpctblock_hash(receiver) == block.sha256,
+                   timeout=30)
+        assert_equal(node.getbestblockhash(), block.hash)
+
+        info = node.getblockrelayinfo()
+        assert_equal(info["cutthroughrelay"], False)
+        assert_equal(info["cutthrough"]["count"], 0)
+        assert_equal(info["validated"]["count"], validated + 1)
+        assert_greater_than_or_equal(info["validated"]["totallatency"],
+                                     info["validated"]["maxlatency"])
+
+    def run_test(self):
+        peers = [(self.connect_peer(i), self.connect_peer(i))
+                 for i in range(self.num_nodes)]
+        NetworkThread().start()
+        for sender, receiver in peers:
+            sender.wait_for_verack()
+            receiver.wait_for_verack()
+
+        self.log.info("Relay a compact block before having validated it")
+        self.test_cut_through(self.nodes[0], *peers[0])
+        self.log.info("Answer notfound when the block does not make it")
+        self.test_abandoned(self.nodes[0], *peers[0])
+        self.log.info("Relay a compact block once validated")
+        self.test_validated(self.nodes[1], *peers[1])
+
+
+if __name__ == '__main__':
+    CutThroughRelayTest().main()
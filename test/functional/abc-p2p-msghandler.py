@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""
+Exercise the socket event loop and the message handler threads.
+
+Node 0 waits on its sockets with select, node 1 with epoll, and both spread
+their peers over several message handler threads. Blocks mined on either node
+must reach the other one and a set of mininode peers, and the per peer queue
+and per message statistics must be reported through getpeerinfo and
+getmessageprocessinginfo.
+"""
+
+from test_framework.mininode import *
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+MSGHANDLER_THREADS = 3
+# More peers than threads, so that some threads serve several of them.
+NUM_MININODES = 4
+# The nodes are connected to each other in both directions.
+NUM_PEERS = NUM_MININODES + 2
+ADDRESS = "mipcBbFg9gMiCh81Kj8tqqdgoZub1ZJRfn"
+
+
+class TestNode(NodeConnCB):
+    def __init__(self):
+        super().__init__()
+        self.blocks = set()
+
+    def on_block(self, conn, message):
+        message.block.calc_sha256()
+        self.blocks.add(message.block.sha256)
+
+    def wait_for_blocks(self, hashes):
+        def test_function(): return self.blocks.issuperset(hashes)
+        wait_until(test_function, timeout=60, lock=mininode_lock)
+
+
+class MessageHandlerTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        threads = "-msghandlerthreads={}".format(MSGHANDLER_THREADS)
+        self.extra_args = [["-socketevents=select", threads],
+                           ["-socketevents=epoll", threads]]
+
+    def check_processing_info(self, node):
+        peers = node.getpeerinfo()
+        assert_equal(len(peers), NUM_PEERS)
+        for peer in peers:
+            assert_greater_than_or_equal(peer['processqueue'], 0)
+            assert_greater_than_or_equal(peer['processqueuebytes'], 0)
+
+        info = node.getmessageprocessinginfo()
+        assert_equal(info['threads'], MSGHANDLER_THREADS)
+        assert_greater_than_or_equal(info['queued'], 0)
+        assert_greater_than_or_equal(info['queuedbytes'], 0)
+        messages = info['messages']
+        for command in ['version', 'verack', 'ping', 'pong', 'getdata']:
+            assert command in messages, command
+        assert_greater_than_or_equal(messages['version']['count'], NUM_PEERS)
+        for stats in messages.values():
+            assert_greater_than(stats['count'], 0)
+            assert_greater_than_or_equal(stats['totaltime'],
+                                         stats['maxtime'])
+
+    def run_test(self):
+        # Connect a few mininodes to each node.
+        test_nodes = []
+        for i in range(self.num_nodes):
+            for _ in range(NUM_MININODES):
+                test_node = TestNode()
+                conn = NodeConn('127.0.0.1', p2p_port(i), self.nodes[i],
+                                test_node)
+                test_node.add_connection(conn)
+                test_nodes.append(test_node)
+        NetworkThread().start()
+        for test_node in test_nodes:
+            test_node.wait_for_verack()
+            test_node.sync_with_ping()
+
+        # Mine on both nodes, so blocks travel in both directions.
+        hashes = self.nodes[0].generatetoaddress(10, ADDRESS)
+        self.sync_all()
+        hashes += self.nodes[1].generatetoaddress(10, ADDRESS)
+        self.sync_all()
+        assert_equal(self.nodes[0].getbestblockhash(), hashes[-1])
+
+        # Every mininode fetches all the blocks from the node it is connected
+        # to, and keeps pinging while the requests are served.
+        invs = [CInv(2, int(h, 16)) for h in hashes]
+        for test_node in test_nodes:
+            test_node.send_message(msg_getdata(invs))
+        for test_node in test_nodes:
+            test_node.sync_with_ping()
+            test_node.wait_for_blocks([int(h, 16) for h in hashes])
+
+        for node in self.nodes:
+            self.check_processing_info(node)
+
+        # Peers stay connected and served after all this.
+        for test_node in test_nodes:
+            test_node.sync_with_ping()
+
+        # An unknown event mode is refused at startup.
+        self.stop_node(1)
+        self.assert_start_raises_init_error(
+            1, ["-socketevents=poll"], "Unknown -socketevents mode 'poll'")
+
+
+if __name__ == '__main__':
+    MessageHandlerTest().main()
@@ -976,6 +976,22 @@ class msg_getdata():
         return "msg_getdata(inv=%s)" % (repr(self.inv))
 
 
+class msg_notfound():
+    command = b"notfound"
+
+    def __init__(self, inv=None):
+        self.inv = inv if inv != None else []
+
+    def deserialize(self, f):
+        self.inv = deser_vector(f, CInv)
+
+    def serialize(self):
+        return ser_vector(self.inv)
+
+    def __repr__(self):
+        return "msg_notfound(inv=%s)" % (repr(self.inv))
+
+
 class msg_getblocks():
     command = b"getblocks"
 
@@ -1422,6 +1438,8 @@ class NodeConnCB():
 
     def on_mempool(self, conn): pass
 
+    def on_notfound(self, conn, message): pass
+
     def on_pong(self, conn, message): pass
 
     def on_reject(self, conn, message): pass
@@ -1530,6 +1548,7 @@ class NodeConn(asyncore.dispatcher):
         b"alert": msg_alert,
         b"inv": msg_inv,
         b"getdata": msg_getdata,
+        b"notfound": msg_notfound,
         b"getblocks": msg_getblocks,
         b"tx": msg_tx,
         b"block": msg_block,